@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+#
+# Creates chunk index of an update file, used by WinSparkle to download
+# only the parts of the update that changed since the previous version.
+#
+# Usage: make_chunk_index.py update_file [index_file]
+#
+# Upload the index next to the update and reference it with
+# sparkle:chunkIndex attribute of the enclosure.
+#
+# The chunking must match PrepareChunkSync() in src/chunksync.cpp.
+
+import hashlib
+import struct
+import sys
+
+MIN_SIZE = 16 * 1024
+MASK_BITS = 16          # average chunk size is about MIN_SIZE + 64 KB
+MAX_SIZE = 256 * 1024
+
+
+def gear_table():
+    values = []
+    x = 0
+    for _ in range(256):
+        x = (x + 0x9E3779B97F4A7C15) & 0xFFFFFFFFFFFFFFFF
+        z = x
+        z = ((z ^ (z >> 30)) * 0xBF58476D1CE4E5B9) & 0xFFFFFFFFFFFFFFFF
+        z = ((z ^ (z >> 27)) * 0x94D049BB133111EB) & 0xFFFFFFFFFFFFFFFF
+        z ^= z >> 31
+        values.append(z >> 32)
+    return values
+
+
+def chunks(data):
+    gear = gear_table()
+    mask = (0xFFFFFFFF << (32 - MASK_BITS)) & 0xFFFFFFFF
+    start = 0
+    h = 0
+    for i, b in enumerate(data):
+        h = ((h << 1) + gear[b]) & 0xFFFFFFFF
+        length = i - start + 1
+        if (length >= MIN_SIZE and (h & mask) == 0) or length >= MAX_SIZE:
+            yield data[start:i + 1]
+            start = i + 1
+            h = 0
+    if start < len(data):
+        yield data[start:]
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        sys.exit("Usage: %s update_file [index_file]" % sys.argv[0])
+
+    with open(sys.argv[1], "rb") as f:
+        data = f.read()
+
+    entries = [struct.pack("<I", len(c)) + hashlib.sha256(c).digest() for c in chunks(data)]
+    index = b"WSCI" + struct.pack("<IIIIQI", 1, MIN_SIZE, MASK_BITS, MAX_SIZE, len(data), len(entries))
+    index += b"".join(entries)
+
+    out = sys.argv[2] if len(sys.argv) == 3 else sys.argv[1] + ".chunks"
+    with open(out, "wb") as f:
+        f.write(index)
+
+
+if __name__ == "__main__":
+    main()
@@ -176,6 +176,37 @@ typedef const char*(__cdecl* win_sparkle_get_available_host_callback_t)();
 */
 WIN_SPARKLE_API void __cdecl win_sparkle_set_get_available_host_callback(win_sparkle_get_available_host_callback_t callback);
 
+/**
+    Registers a mirror of the update server.
+
+    If any mirrors are registered, they are used instead of the callback set
+    with win_sparkle_set_get_available_host_callback(). WinSparkle measures
+    latency and throughput of each mirror, probes them in parallel before
+    checking for updates and always uses the best one. If a mirror fails
+    during the download of an update, the download continues from another
+    one.
+
+    All mirrors must serve the same content at the same paths. Requests to
+    different mirrors aren't made conditional, so the update should be
+    signed, see win_sparkle_set_dsa_pub_pem().
+
+    @param host  Scheme and host name of the mirror, in the same form as
+                 returned by win_sparkle_get_available_host_callback_t,
+                 e.g. "https://eu.example.com".
+
+    @since 0.9
+
+    @see win_sparkle_clear_mirror_hosts()
+*/
+WIN_SPARKLE_API void __cdecl win_sparkle_add_mirror_host(const char *host);
+
+/**
+    Removes all mirrors registered with win_sparkle_add_mirror_host().
+
+    @since 0.9
+*/
+WIN_SPARKLE_API void __cdecl win_sparkle_clear_mirror_hosts();
+
 /**
     Sets DSA public key.
 
@@ -258,6 +289,137 @@ WIN_SPARKLE_API void __cdecl win_sparkle_set_http_header(const char *name, const
 */
 WIN_SPARKLE_API void __cdecl win_sparkle_clear_http_headers();
 
+/// Durability policies for win_sparkle_set_download_flush_policy()
+typedef enum
+{
+    /// Leave writing of the downloaded update to disk to the OS (default).
+    WIN_SPARKLE_FLUSH_NONE = 0,
+
+    /// Flush the update to disk once it is downloaded.
+    WIN_SPARKLE_FLUSH_ON_COMPLETE = 1,
+
+    /// Also flush it whenever progress of a resumable download is recorded.
+    WIN_SPARKLE_FLUSH_ON_PROGRESS = 2
+} win_sparkle_flush_policy_t;
+
+/**
+    Set how eagerly the downloaded update is flushed to disk.
+
+    Flushing makes sure that the file survives a system crash, at the cost
+    of slowing down the download.
+
+    @param policy  One of win_sparkle_flush_policy_t values.
+
+    @since 0.9
+*/
+WIN_SPARKLE_API void __cdecl win_sparkle_set_download_flush_policy(win_sparkle_flush_policy_t policy);
+
+/**
+    Limit the bandwidth used for downloading updates.
+
+    @param bytes_per_second  Maximum download rate, 0 for no limit (default).
+
+    @since 0.9
+
+    @see win_sparkle_set_download_priority()
+*/
+WIN_SPARKLE_API void __cdecl win_sparkle_set_download_rate_limit(unsigned bytes_per_second);
+
+/// Priorities for win_sparkle_set_download_priority()
+typedef enum
+{
+    /// Download updates as fast as the rate limit allows (default).
+    WIN_SPARKLE_DOWNLOAD_PRIORITY_FOREGROUND = 0,
+
+    /// Yield to other traffic and work of the application. The download
+    /// slows down whenever it increases network delay, and its threads run
+    /// with low CPU and I/O priority.
+    WIN_SPARKLE_DOWNLOAD_PRIORITY_BACKGROUND = 1
+} win_sparkle_download_priority_t;
+
+/**
+    Set priority of downloading updates.
+
+    Background priority is useful for silent updates on slow links, where
+    the download would otherwise degrade the application's own traffic.
+    The rate limit set with win_sparkle_set_download_rate_limit() still
+    applies as the upper bound.
+
+    @param priority  One of win_sparkle_download_priority_t values.
+
+    @since 0.9
+*/
+WIN_SPARKLE_API void __cdecl win_sparkle_set_download_priority(win_sparkle_download_priority_t priority);
+
+/**
+    Set maximum total size of cached update installers.
+
+    Downloaded installers are kept, so that an update that was postponed
+    doesn't have to be downloaded again. The least recently used ones are
+    deleted when they take more space than this. The installer of the
+    installed version is kept too, for delta updates, and doesn't count
+    towards the limit.
+
+    The cache is in the temporary directory (%TEMP%).
+
+    @param bytes  Maximum size of the cache (default: 1 GB). If 0,
+                  no installers are kept.
+
+    @since 0.9
+*/
+WIN_SPARKLE_API void __cdecl win_sparkle_set_installer_cache_limit(unsigned long long bytes);
+
+/**
+    Download updates before notifying the user about them.
+
+    If enabled, updates found by automatic checks are downloaded and
+    verified in the background, with the priority of
+    WIN_SPARKLE_DOWNLOAD_PRIORITY_BACKGROUND, and the user is told about
+    them only after that. The update is then ready to install as soon as
+    the user chooses to. Manual checks don't do this, because the user
+    is waiting for their result.
+
+    Only signed updates are downloaded in advance. The download is skipped
+    if there's not enough disk space or the connection is metered, see
+    win_sparkle_set_prestage_disk_space_callback() and
+    win_sparkle_set_prestage_metered_connection_callback(), and the user is
+    notified about the update as usual.
+
+    When the user chooses to install an update that was downloaded in
+    advance, the installer is verified again and launched right away,
+    without asking the user a second time once it's ready. The application
+    is still asked if it can be shut down, see
+    win_sparkle_set_can_shutdown_callback().
+
+    If the user starts downloading an update while one is being downloaded
+    in advance, the user's download takes over and continues it.
+
+    @param prestage  1 to enable, 0 to disable (default).
+
+    @since 0.9
+*/
+WIN_SPARKLE_API void __cdecl win_sparkle_set_prestage_updates(int prestage);
+
+/**
+    Extract updates distributed as ZIP archives while they are downloaded.
+
+    If enabled, updates that are ZIP archives are extracted into a staging
+    directory as their data arrive, instead of after the download, and
+    the directory is moved next to the archive once its signature is
+    verified. The callback set with
+    win_sparkle_set_user_run_installer_callback() then receives path to
+    this directory instead of the archive; it should be set, because
+    WinSparkle doesn't know how to install extracted files.
+
+    Only stored and deflated entries are supported. Updates that aren't
+    ZIP archives, or that fail to extract, are handled as usual.
+
+    @param extract  1 to enable, 0 to disable (default).
+
+    @since 0.9
+*/
+WIN_SPARKLE_API void __cdecl win_sparkle_set_extract_archives(int extract);
+
 /**
     Set the registry path where settings will be stored.
 
@@ -604,6 +766,52 @@ typedef void(__cdecl* win_sparkle_update_dismissed_callback_t)();
 */
 WIN_SPARKLE_API void __cdecl win_sparkle_set_update_dismissed_callback(win_sparkle_update_dismissed_callback_t callback);
 
+/// Callback type for win_sparkle_prestage_disk_space_callback()
+typedef int(__cdecl* win_sparkle_prestage_disk_space_callback_t)(unsigned long long, unsigned long long);
+
+/**
+    Set callback for deciding if there's enough disk space to download
+    an update in advance.
+
+    The callback is called with the size of the update in bytes (0 if not
+    known) and free space in the temporary directory, where the update is
+    downloaded to. It returns TRUE if the update may be downloaded or FALSE
+    if not.
+
+    If no callback is set, the update is downloaded only if at least 1 GB
+    of free space remains after the download.
+
+    @note The callback is called from a background thread.
+
+    @see win_sparkle_set_prestage_updates()
+
+    @since 0.9
+*/
+WIN_SPARKLE_API void __cdecl win_sparkle_set_prestage_disk_space_callback(win_sparkle_prestage_disk_space_callback_t callback);
+
+/// Callback type for win_sparkle_prestage_metered_connection_callback()
+typedef int(__cdecl* win_sparkle_prestage_metered_connection_callback_t)(int);
+
+/**
+    Set callback for deciding if an update may be downloaded in advance
+    with the current network connection.
+
+    The callback is called with TRUE if Windows reports the connection as
+    metered (it costs extra, is roaming or is over its data limit) and FALSE
+    otherwise, including on Windows versions that don't report it. It
+    returns TRUE if the update may be downloaded or FALSE if not.
+
+    If no callback is set, the update isn't downloaded in advance on metered
+    connections.
+
+    @note The callback is called from a background thread.
+
+    @see win_sparkle_set_prestage_updates()
+
+    @since 0.9
+*/
+WIN_SPARKLE_API void __cdecl win_sparkle_set_prestage_metered_connection_callback(win_sparkle_prestage_metered_connection_callback_t callback);
+
 
 /// Callback type for win_sparkle_user_run_installer_callback()
 typedef int(__cdecl* win_sparkle_user_run_installer_callback_t)(const wchar_t *, const char*);
@@ -30,8 +30,8 @@
 
 #include <expat.h>
 #include <algorithm>
-#include <iterator>
 #include <vector>
+#include <stdlib.h>
 #include <windows.h>
 
 namespace winsparkle
@@ -56,7 +56,7 @@ namespace
 
 // Misc helper functions:
 
-bool is_compatible_with_windows_version(Appcast item)
+bool is_compatible_with_windows_version(const Appcast& item)
 {
     auto& version = item.MinOSVersion;
 
@@ -121,40 +121,53 @@ inline bool is_compatible_with_os_arch(const Appcast::Enclosure& enclosure)
 }
 
 
-// Finds the best enclosure for the current OS and architecture.
-Appcast::Enclosure find_best_enclosure_for_os_arch(const std::vector<Appcast::Enclosure>& enclosures)
+// Finds the best enclosure for the current OS and architecture. Returns NULL
+// if none of the enclosures is compatible.
+Appcast::Enclosure *find_best_enclosure_for_os_arch(std::vector<Appcast::Enclosure>& enclosures)
 {
-	// filter out incompatible enclosures:
-	std::vector<Appcast::Enclosure> compatible;
-	std::copy_if(enclosures.begin(), enclosures.end(), std::back_inserter(compatible), is_compatible_with_os_arch);
-    if (compatible.empty())
-		return Appcast::Enclosure();
-
-	// is there arch-specific enclosure?
-	auto it = std::find_if(compatible.begin(), compatible.end(),
-                           [](const Appcast::Enclosure& e) { return e.OS == OS_MARKER_ARCH; });
-	if (it != compatible.end())
-		return *it;
-
-    // is there an enclosure explicitly marked as for windows?
-    it = std::find_if(compatible.begin(), compatible.end(),
-                      [](const Appcast::Enclosure& e) { return e.OS == OS_MARKER_GENERIC; });
-    if (it != compatible.end())
-        return *it;
-
-    // because all enclosures are compatible, any one will do, e.g. the first one:
-	return compatible.front();
+    Appcast::Enclosure *best = NULL;
+
+    for (auto& e : enclosures)
+    {
+        if (!is_compatible_with_os_arch(e))
+            continue;
+
+        // arch-specific enclosure is the best match possible:
+        if (e.OS == OS_MARKER_ARCH)
+            return &e;
+
+        // otherwise prefer an enclosure explicitly marked as for windows; if there
+        // isn't one, any compatible enclosure will do, e.g. the first one
+        if (!best || (e.OS == OS_MARKER_GENERIC && best->OS != OS_MARKER_GENERIC))
+            best = &e;
+    }
+
+    return best;
+}
+
+
+// Resolves URL of a file related to the item's update, e.g. a delta, against
+// the directory of the full update.
+std::string resolve_download_url(const Appcast& item, const std::string& url)
+{
+    if (url.find("://") != std::string::npos)
+        return url;
+
+    auto host = ApplicationController::GetAvailableHost();
+    return host + "/oeth-agent/downloads/" + item.Version + "/" + url;
 }
 
 
 void trim_whitespace(std::string& s)
 {
-    size_t startpos = s.find_first_not_of(" \t\r\n");
-    if (startpos != std::string::npos)
-        s = s.substr(startpos);
-    size_t endpos = s.find_last_not_of(" \t\r\n");
-    if (endpos != std::string::npos)
-        s = s.substr(0, endpos + 1);
+    const size_t endpos = s.find_last_not_of(" \t\r\n");
+    if (endpos == std::string::npos)
+    {
+        s.clear();
+        return;
+    }
+    s.erase(endpos + 1);
+    s.erase(0, s.find_first_not_of(" \t\r\n"));
 }
 
 
@@ -162,41 +175,161 @@ void trim_whitespace(std::string& s)
                                 XML parsing
  *--------------------------------------------------------------------------*/
 
-#define MVAL(x) x
-#define CONCAT3(a,b,c) MVAL(a)##MVAL(b)##MVAL(c)
-
 #define NS_SPARKLE      "http://www.andymatuschak.org/xml-namespaces/sparkle"
 #define NS_SEP          '#'
-#define NS_SPARKLE_NAME(name) NS_SPARKLE "#" name
-
-#define NODE_CHANNEL    "channel"
-#define NODE_ITEM       "item"
-#define NODE_RELNOTES   NS_SPARKLE_NAME("releaseNotesLink")
-#define NODE_TITLE "title"
-#define NODE_DESCRIPTION "description"
-#define NODE_LINK       "link"
-#define NODE_ENCLOSURE  "enclosure"
-#define NODE_MIN_OS_VERSION NS_SPARKLE_NAME("minimumSystemVersion")
-#define NODE_MIN_SERVER_VERSION NS_SPARKLE_NAME("minimumServerVersion")
-#define NODE_CRITICAL_UPDATE NS_SPARKLE_NAME("criticalUpdate")
-#define ATTR_URL        "url"
-#define ATTR_VERSION    NS_SPARKLE_NAME("version")
-#define ATTR_SHORTVERSION NS_SPARKLE_NAME("shortVersionString")
-#define ATTR_DSASIGNATURE NS_SPARKLE_NAME("dsaSignature")
-#define ATTR_OS         NS_SPARKLE_NAME("os")
-#define ATTR_ARGUMENTS  NS_SPARKLE_NAME("installerArguments")
-#define NODE_VERSION      ATTR_VERSION        // These can be nodes or
-#define NODE_SHORTVERSION ATTR_SHORTVERSION   // attributes.
-#define NODE_DSASIGNATURE ATTR_DSASIGNATURE
+#define NS_SPARKLE_PREFIX NS_SPARKLE "#"
+
+// Element and attribute names the parser is interested in.
+enum NameId
+{
+    Name_Unknown,
+
+    // RSS names:
+    Name_Channel,           // <channel>
+    Name_Item,              // <item>
+    Name_Title,             // <title>
+    Name_Description,       // <description>
+    Name_Link,              // <link>
+    Name_Enclosure,         // <enclosure>
+    Name_Url,               // url="..."
+    Name_Length,            // length="..."
+
+    // Sparkle namespace names:
+    Name_RelNotes,          // <sparkle:releaseNotesLink>
+    Name_Version,           // <sparkle:version> or sparkle:version="..."
+    Name_ShortVersion,      // <sparkle:shortVersionString> or sparkle:shortVersionString="..."
+    Name_DsaSignature,      // <sparkle:dsaSignature> or sparkle:dsaSignature="..."
+    Name_MinOSVersion,      // <sparkle:minimumSystemVersion>
+    Name_MinServerVersion,  // <sparkle:minimumServerVersion>
+    Name_CriticalUpdate,    // <sparkle:criticalUpdate>
+    Name_OS,                // sparkle:os="..."
+    Name_InstallerArguments,// sparkle:installerArguments="..."
+    Name_Deltas,            // <sparkle:deltas>
+    Name_DeltaFrom,         // sparkle:deltaFrom="..."
+    Name_ChunkIndex         // sparkle:chunkIndex="..."
+};
+
+// Checks if name, which is known to have the same length, is the literal.
+#define IS_NAME(literal)  (memcmp(name, literal, sizeof(literal) - 1) == 0)
+
+// Maps names without namespace (i.e. RSS ones) to NameId. Names are first told
+// apart by their length, so that each is compared with at most two candidates.
+NameId classify_rss_name(const char *name, size_t len)
+{
+    switch ( len )
+    {
+        case 3:
+            if ( IS_NAME("url") )
+                return Name_Url;
+            break;
+        case 4:
+            if ( name[0] == 'i' && IS_NAME("item") )
+                return Name_Item;
+            if ( name[0] == 'l' && IS_NAME("link") )
+                return Name_Link;
+            break;
+        case 5:
+            if ( IS_NAME("title") )
+                return Name_Title;
+            break;
+        case 6:
+            if ( IS_NAME("length") )
+                return Name_Length;
+            break;
+        case 7:
+            if ( IS_NAME("channel") )
+                return Name_Channel;
+            break;
+        case 9:
+            if ( IS_NAME("enclosure") )
+                return Name_Enclosure;
+            break;
+        case 11:
+            if ( IS_NAME("description") )
+                return Name_Description;
+            break;
+    }
+    return Name_Unknown;
+}
+
+// Same for names in the Sparkle namespace, without the namespace prefix.
+NameId classify_sparkle_name(const char *name, size_t len)
+{
+    switch ( len )
+    {
+        case 2:
+            if ( IS_NAME("os") )
+                return Name_OS;
+            break;
+        case 6:
+            if ( IS_NAME("deltas") )
+                return Name_Deltas;
+            break;
+        case 7:
+            if ( IS_NAME("version") )
+                return Name_Version;
+            break;
+        case 9:
+            if ( IS_NAME("deltaFrom") )
+                return Name_DeltaFrom;
+            break;
+        case 10:
+            if ( IS_NAME("chunkIndex") )
+                return Name_ChunkIndex;
+            break;
+        case 12:
+            if ( IS_NAME("dsaSignature") )
+                return Name_DsaSignature;
+            break;
+        case 14:
+            if ( IS_NAME("criticalUpdate") )
+                return Name_CriticalUpdate;
+            break;
+        case 16:
+            if ( IS_NAME("releaseNotesLink") )
+                return Name_RelNotes;
+            break;
+        case 18:
+            if ( name[0] == 's' && IS_NAME("shortVersionString") )
+                return Name_ShortVersion;
+            if ( name[0] == 'i' && IS_NAME("installerArguments") )
+                return Name_InstallerArguments;
+            break;
+        case 20:
+            // "minimumSystemVersion" and "minimumServerVersion" differ at [8]
+            if ( name[8] == 'y' && IS_NAME("minimumSystemVersion") )
+                return Name_MinOSVersion;
+            if ( name[8] == 'e' && IS_NAME("minimumServerVersion") )
+                return Name_MinServerVersion;
+            break;
+    }
+    return Name_Unknown;
+}
+
+#undef IS_NAME
+
+// Maps (namespaced) element or attribute name to its NameId. This is done
+// once per element, so that the handlers below can simply switch on it.
+NameId classify_name(const char *name)
+{
+    static const size_t prefix_len = sizeof(NS_SPARKLE_PREFIX) - 1;
+
+    const size_t len = strlen(name);
+
+    // only names longer than the namespace URI can be in it
+    if ( len > prefix_len && name[0] == 'h' && memcmp(name, NS_SPARKLE_PREFIX, prefix_len) == 0 )
+        return classify_sparkle_name(name + prefix_len, len - prefix_len);
+    else
+        return classify_rss_name(name, len);
+}
 
 
 // context data for the parser
 struct ContextData
 {
-    ContextData(XML_Parser& p)
-        : parser(p),
-        in_channel(0), in_item(0), in_relnotes(0), in_title(0), in_description(0), in_link(0),
-        in_version(0), in_shortversion(0), in_dsasignature(0), in_min_os_version(0), in_min_server_version(0)
+    ContextData(XML_Parser p, AppcastDownloadSink *s)
+        : parser(p), sink(s), done(false),
+        in_channel(0), in_item(0), in_deltas(0), in_node(Name_Unknown)
     {}
 
 	// call when entering <item> element
@@ -205,16 +338,31 @@ struct ContextData
 		current = Appcast();
         enclosures.clear();
 		legacy_dsa_signature.clear();
+        in_deltas = 0;
+        in_node = Name_Unknown;
     }
 
     // the parser we're using
-    XML_Parser& parser;
+    XML_Parser parser;
 
-    // is inside <channel>, <item> or <sparkle:releaseNotesLink>, <title>, <description>, or <link> respectively?
-    int in_channel, in_item, in_relnotes, in_title, in_description, in_link;
+    // the sink to pass parsed items to
+    AppcastDownloadSink *sink;
 
-    // is inside <sparkle:version> or <sparkle:shortVersionString> etc. node?
-    int in_version, in_shortversion, in_dsasignature, in_min_os_version, in_min_server_version;
+    // set once </channel> was reached and the parser was stopped
+    bool done;
+
+    // is inside <channel> or <item> respectively?
+    int in_channel, in_item;
+
+    // is inside <sparkle:deltas> of the current item?
+    int in_deltas;
+
+    // child element of <item> whose text is being read, if any
+    NameId in_node;
+
+    // text of in_node read so far; reused for all elements to avoid
+    // reallocations and only stored into the item in OnEndElement()
+    std::string text;
 
     // currently parsed item
     Appcast current;
@@ -225,97 +373,174 @@ struct ContextData
     // signature present as <sparkle:dsaSignature>, not enclosure attribute 
     std::string legacy_dsa_signature;
     
-    // parsed <item>s
+    // parsed <item>s, see AppcastDownloadSink::OnItem()
     std::vector<Appcast> all_items;
 };
 
 
+// Stores text of the just finished in_node element into the current item.
+void store_text(ContextData& ctxt)
+{
+    Appcast& item = ctxt.current;
+    const std::string& text = ctxt.text;
+
+    switch ( ctxt.in_node )
+    {
+        case Name_RelNotes:
+            item.ReleaseNotesURL.append(text);
+            trim_whitespace(item.ReleaseNotesURL);
+            break;
+        case Name_Title:
+            item.Title.append(text);
+            break;
+        case Name_Description:
+            item.Description.append(text);
+            break;
+        case Name_Link:
+            item.WebBrowserURL.append(text);
+            trim_whitespace(item.WebBrowserURL);
+            break;
+        case Name_Version:
+            item.Version.append(text);
+            break;
+        case Name_ShortVersion:
+            item.ShortVersionString.append(text);
+            break;
+        case Name_DsaSignature:
+            ctxt.legacy_dsa_signature = text;
+            break;
+        case Name_MinOSVersion:
+            item.MinOSVersion.append(text);
+            break;
+        case Name_MinServerVersion:
+            item.MinServerVersion.append(text);
+            break;
+        default:
+            break;
+    }
+}
+
+
 void XMLCALL OnStartElement(void *data, const char *name, const char **attrs)
 {
     ContextData& ctxt = *static_cast<ContextData*>(data);
 
-    if ( strcmp(name, NODE_CHANNEL) == 0 )
+    const NameId node = classify_name(name);
+
+    if ( node == Name_Channel )
     {
         ctxt.in_channel++;
+        return;
     }
-    else if ( ctxt.in_channel && strcmp(name, NODE_ITEM) == 0 )
-    {
-        ctxt.in_item++;
-        ctxt.reset_for_new_item();
-    }
-    else if ( ctxt.in_item )
+
+    if ( !ctxt.in_item )
     {
-        if ( strcmp(name, NODE_RELNOTES) == 0 )
-        {
-            ctxt.in_relnotes++;
-        }
-        else if ( strcmp(name, NODE_TITLE) == 0 )
-        {
-            ctxt.in_title++;
-        }
-        else if ( strcmp(name, NODE_DESCRIPTION) == 0 )
-        {
-            ctxt.in_description++;
-        }
-        else if ( strcmp(name, NODE_LINK) == 0 )
-        {
-            ctxt.in_link++;
-        }
-        else if ( strcmp(name, NODE_VERSION) == 0 )
-        {
-            ctxt.in_version++;
-        }
-        else if ( strcmp(name, NODE_SHORTVERSION) == 0 )
-        {
-            ctxt.in_shortversion++;
-        }
-        else if (strcmp(name, NODE_DSASIGNATURE) == 0)
-        {
-            ctxt.in_dsasignature++;
-        }
-        else if (strcmp(name, NODE_MIN_OS_VERSION) == 0)
+        if ( ctxt.in_channel && node == Name_Item )
         {
-            ctxt.in_min_os_version++;
+            ctxt.in_item++;
+            ctxt.reset_for_new_item();
         }
-        else if (strcmp(name, NODE_MIN_SERVER_VERSION) == 0)
-        {
-            ctxt.in_min_server_version++;
-        }
-        else if (strcmp(name, NODE_ENCLOSURE) == 0)
+        return;
+    }
+
+    switch ( node )
+    {
+        case Name_Item:
+            ctxt.in_item++;
+            ctxt.reset_for_new_item();
+            break;
+
+        case Name_RelNotes:
+        case Name_Title:
+        case Name_Description:
+        case Name_Link:
+        case Name_Version:
+        case Name_ShortVersion:
+        case Name_DsaSignature:
+        case Name_MinOSVersion:
+        case Name_MinServerVersion:
+            ctxt.in_node = node;
+            ctxt.text.clear();
+            break;
+
+        case Name_Enclosure:
         {
             Appcast& item = ctxt.current;
 			Appcast::Enclosure enclosure;
 
             for (int i = 0; attrs[i]; i += 2)
             {
-                const char* name = attrs[i];
                 const char* value = attrs[i + 1];
 
-                if (strcmp(name, ATTR_URL) == 0)
-                    enclosure.DownloadURL = value;
-                else if (strcmp(name, ATTR_DSASIGNATURE) == 0)
-                    enclosure.DsaSignature = value;
-                else if (strcmp(name, ATTR_OS) == 0)
-                    enclosure.OS = value;
-                else if (strcmp(name, ATTR_ARGUMENTS) == 0)
-                    enclosure.InstallerArguments = value;
-
-                // legacy syntax where version info was on enclosure, not item:
-                else if (strcmp(name, ATTR_VERSION) == 0)
-                    item.Version = value;
-                else if (strcmp(name, ATTR_SHORTVERSION) == 0)
-                    item.ShortVersionString = value;
+                switch ( classify_name(attrs[i]) )
+                {
+                    case Name_Url:
+                        enclosure.DownloadURL = value;
+                        break;
+                    case Name_Length:
+                        enclosure.Length = (size_t)strtoull(value, NULL, 10);
+                        break;
+                    case Name_DsaSignature:
+                        enclosure.DsaSignature = value;
+                        break;
+                    case Name_OS:
+                        enclosure.OS = value;
+                        break;
+                    case Name_InstallerArguments:
+                        enclosure.InstallerArguments = value;
+                        break;
+                    case Name_DeltaFrom:
+                        enclosure.DeltaFrom = value;
+                        break;
+                    case Name_ChunkIndex:
+                        enclosure.ChunkIndexURL = value;
+                        break;
+
+                    // legacy syntax where version info was on enclosure, not item
+                    // (deltas repeat the item's version, so it's ignored there):
+                    case Name_Version:
+                        if (!ctxt.in_deltas)
+                            item.Version = value;
+                        break;
+                    case Name_ShortVersion:
+                        if (!ctxt.in_deltas)
+                            item.ShortVersionString = value;
+                        break;
+
+                    default:
+                        break;
+                }
+            }
+
+            if (ctxt.in_deltas)
+            {
+                // deltas don't affect the choice of the full update, so
+                // incompatible or unusable ones can be dropped right away
+                if (!enclosure.DeltaFrom.empty() && !enclosure.DownloadURL.empty() &&
+                    is_compatible_with_os_arch(enclosure))
+                {
+                    item.Deltas.push_back(std::move(enclosure));
+                }
+                break;
             }
 
 			// note: we intentionally include incompatible enclosures in the list so that
 			// we can check for that case later in OnEndElement() and skip the entire <item>
 			if (enclosure.IsValid())
-				ctxt.enclosures.push_back(enclosure);
+				ctxt.enclosures.push_back(std::move(enclosure));
+            break;
         }
-        else if (strcmp(name, NODE_CRITICAL_UPDATE) == 0)
-        {
+
+        case Name_Deltas:
+            ctxt.in_deltas++;
+            break;
+
+        case Name_CriticalUpdate:
             ctxt.current.CriticalUpdate = true;
-        }
+            break;
+
+        default:
+            break;
     }
 }
 
@@ -324,45 +549,21 @@ void XMLCALL OnEndElement(void *data, const char *name)
 {
     ContextData& ctxt = *static_cast<ContextData*>(data);
 
+    const NameId node = classify_name(name);
+
     if (ctxt.in_item)
     {
-        if (strcmp(name, NODE_RELNOTES) == 0)
+        if (node == ctxt.in_node)
         {
-            ctxt.in_relnotes--;
+            store_text(ctxt);
+            ctxt.in_node = Name_Unknown;
         }
-        else if (strcmp(name, NODE_TITLE) == 0)
+        else if (node == Name_Deltas)
         {
-            ctxt.in_title--;
+            if (ctxt.in_deltas)
+                ctxt.in_deltas--;
         }
-        else if (strcmp(name, NODE_DESCRIPTION) == 0)
-        {
-            ctxt.in_description--;
-        }
-        else if (strcmp(name, NODE_MIN_OS_VERSION) == 0)
-        {
-            ctxt.in_min_os_version--;
-        }
-        else if (strcmp(name, NODE_MIN_SERVER_VERSION) == 0)
-        {
-            ctxt.in_min_server_version--;
-        }
-        else if (strcmp(name, NODE_LINK) == 0)
-        {
-            ctxt.in_link--;
-        }
-        else if (strcmp(name, NODE_VERSION) == 0)
-        {
-            ctxt.in_version--;
-        }
-        else if (strcmp(name, NODE_SHORTVERSION) == 0)
-        {
-            ctxt.in_shortversion--;
-        }
-        else if (strcmp(name, NODE_DSASIGNATURE) == 0)
-        {
-            ctxt.in_dsasignature--;
-        }
-        else if (strcmp(name, NODE_ITEM) == 0)
+        else if (node == Name_Item)
         {
             ctxt.in_item--;
 
@@ -373,28 +574,30 @@ void XMLCALL OnEndElement(void *data, const char *name)
 
 			if (!ctxt.enclosures.empty())
             {
-                item.enclosure = find_best_enclosure_for_os_arch(ctxt.enclosures);
-				if (!item.enclosure.IsValid())
+                Appcast::Enclosure *best = find_best_enclosure_for_os_arch(ctxt.enclosures);
+				if (!best)
 				{
 					// There are enclosures (e.g. weblink is not used), but all enclosures are
                     // incompatible. This means the <item> is not meant for this OS and should be
                     // skipped (as Sparkle does; there may be another <item> for us).
                     return;
 				}
+                item.enclosure = std::move(*best);
             }
 
             if (item.IsValid() && is_compatible_with_windows_version(item))
             {
-                ctxt.all_items.push_back(item);
+                ctxt.sink->OnItem(item);
             }
         }
     }
-    else if (strcmp(name, NODE_CHANNEL) == 0 )
+    else if (node == Name_Channel)
     {
         ctxt.in_channel--;
         // we've reached the end of <channel> element,
         // so we stop parsing
         XML_StopParser(ctxt.parser, XML_TRUE);
+        ctxt.done = true;
     }
 }
 
@@ -402,46 +605,9 @@ void XMLCALL OnEndElement(void *data, const char *name)
 void XMLCALL OnText(void *data, const char *s, int len)
 {
     ContextData& ctxt = *static_cast<ContextData*>(data);
-    Appcast& item = ctxt.current;
 
-    if (ctxt.in_relnotes)
-    {
-        item.ReleaseNotesURL.append(s, len);
-        trim_whitespace(item.ReleaseNotesURL);
-    }
-    else if (ctxt.in_title)
-    {
-        item.Title.append(s, len);
-    }
-    else if (ctxt.in_description)
-    {
-        item.Description.append(s, len);
-    }
-    else if (ctxt.in_link)
-    {
-        item.WebBrowserURL.append(s, len);
-        trim_whitespace(item.WebBrowserURL);
-    }
-    else if (ctxt.in_version)
-    {
-        item.Version.append(s, len);
-    }
-    else if (ctxt.in_shortversion)
-    {
-        item.ShortVersionString.append(s, len);
-    }
-    else if (ctxt.in_dsasignature)
-    {
-        ctxt.legacy_dsa_signature.assign(s, len);
-    }
-    else if (ctxt.in_min_os_version)
-    {
-        item.MinOSVersion.append(s, len);
-    }
-    else if (ctxt.in_min_server_version)
-    {
-        item.MinServerVersion.append(s, len);
-    }
+    if (ctxt.in_node != Name_Unknown)
+        ctxt.text.append(s, len);
 }
 
 } // anonymous namespace
@@ -458,39 +624,115 @@ bool Appcast::Enclosure::IsValid() const
 
 std::vector<Appcast> Appcast::Load(const std::string& xml)
 {
-    XML_Parser p = XML_ParserCreateNS(NULL, NS_SEP);
-    if ( !p )
+    AppcastDownloadSink sink;
+    sink.Add(xml.c_str(), xml.size());
+    return sink.Finish();
+}
+
+std::string Appcast::GetDownloadURL() const
+{
+    auto host = ApplicationController::GetAvailableHost();
+    auto url = host + "/oeth-agent/downloads/" + Version + "/" + enclosure.OS + ".exe";
+    return url;
+}
+
+const Appcast::Enclosure *Appcast::FindDelta(const std::string& fromVersion) const
+{
+    const Enclosure *best = NULL;
+
+    for (auto& d : Deltas)
+    {
+        if (d.DeltaFrom != fromVersion)
+            continue;
+
+        // the delta must produce the same installer as the full update, so
+        // prefer one marked for the same OS as the chosen full enclosure
+        if (d.OS == enclosure.OS)
+            return &d;
+        if (!best)
+            best = &d;
+    }
+
+    return best;
+}
+
+std::string Appcast::GetDeltaDownloadURL(const Enclosure& delta) const
+{
+    return resolve_download_url(*this, delta.DownloadURL);
+}
+
+std::string Appcast::GetChunkIndexURL() const
+{
+    if (enclosure.ChunkIndexURL.empty())
+        return std::string();
+    return resolve_download_url(*this, enclosure.ChunkIndexURL);
+}
+
+
+/*--------------------------------------------------------------------------*
+                          AppcastDownloadSink class
+ *--------------------------------------------------------------------------*/
+
+AppcastDownloadSink::AppcastDownloadSink()
+{
+    m_parser = XML_ParserCreateNS(NULL, NS_SEP);
+    if ( !m_parser )
         throw std::runtime_error("Update process failed. Please contact support. (1)");
 
-    ContextData ctxt(p);
+    XML_SetUserData(m_parser, new ContextData(m_parser, this));
+    XML_SetElementHandler(m_parser, OnStartElement, OnEndElement);
+    XML_SetCharacterDataHandler(m_parser, OnText);
+}
 
-    XML_SetUserData(p, &ctxt);
-    XML_SetElementHandler(p, OnStartElement, OnEndElement);
-    XML_SetCharacterDataHandler(p, OnText);
+AppcastDownloadSink::~AppcastDownloadSink()
+{
+    delete static_cast<ContextData*>(XML_GetUserData(m_parser));
+    XML_ParserFree(m_parser);
+}
 
-    XML_Status st = XML_Parse(p, xml.c_str(), (int)xml.size(), XML_TRUE);
+void AppcastDownloadSink::Add(const void *data, size_t len)
+{
+    // ignore anything that follows </channel>, the parser is stopped (note
+    // that derived classes may read the rest of the feed, see IsComplete())
+    if ( AppcastDownloadSink::IsComplete() )
+        return;
 
-    if ( st == XML_STATUS_ERROR )
-    {
-        XML_ParserFree(p);
+    void *buf = XML_GetBuffer(m_parser, (int)len);
+    if ( !buf )
+        throw std::runtime_error("Update process failed. Please contact support. (1)");
+    memcpy(buf, data, len);
+
+    if ( XML_ParseBuffer(m_parser, (int)len, XML_FALSE) == XML_STATUS_ERROR )
         throw std::runtime_error("Update process failed. Please contact support. (2)");
-    }
+}
 
-    XML_ParserFree(p);
+void AppcastDownloadSink::OnItem(Appcast& item)
+{
+    ContextData& ctxt = *static_cast<ContextData*>(XML_GetUserData(m_parser));
 
-    if (ctxt.all_items.empty())
-        return {}; // invalid
+    // the item is reset when the next <item> starts, so we can move it
+    ctxt.all_items.push_back(std::move(item));
+}
 
-	// the items were already filtered to only include those compatible with the current OS + arch
-	// and meeting minimum OS version requirements, so we can just return the first one
-	return std::move(ctxt.all_items);
+bool AppcastDownloadSink::IsComplete() const
+{
+    return static_cast<ContextData*>(XML_GetUserData(m_parser))->done;
 }
 
-std::string Appcast::GetDownloadURL() const
+std::vector<Appcast> AppcastDownloadSink::Finish()
 {
-    auto host = ApplicationController::GetAvailableHost();
-    auto url = host + "/oeth-agent/downloads/" + Version + "/" + enclosure.OS + ".exe";
-    return url;
+    ContextData& ctxt = *static_cast<ContextData*>(XML_GetUserData(m_parser));
+
+    if ( !ctxt.done )
+    {
+        // no more data; this fails if the feed was incomplete
+        if ( XML_ParseBuffer(m_parser, 0, XML_TRUE) == XML_STATUS_ERROR )
+            throw std::runtime_error("Update process failed. Please contact support. (2)");
+    }
+
+    // the items were already filtered to only include those compatible with the current OS + arch
+    // and meeting minimum OS version requirements, so we can just return them
+    return std::move(ctxt.all_items);
 }
 
 } // namespace winsparkle
@@ -26,9 +26,12 @@
 #ifndef _appcast_h_
 #define _appcast_h_
 
+#include "download.h"
+
 #include <string>
 #include <vector>
 
+struct XML_ParserStruct;
 
 namespace winsparkle
 {
@@ -77,11 +80,23 @@ struct Appcast
         // Arguments passed on the the updater executable
         std::string InstallerArguments;
 
+        /// Size of the update in bytes, if known (0 otherwise)
+        size_t Length = 0;
+
+        /// For delta updates, version the delta applies to (empty otherwise)
+        std::string DeltaFrom;
+
+        /// URL of the chunk index of the update, if any (see PrepareChunkSync())
+        std::string ChunkIndexURL;
+
         bool IsValid() const;
     };
 
 	Enclosure enclosure;
 
+    /// Delta updates from <sparkle:deltas>, compatible with this OS
+    std::vector<Enclosure> Deltas;
+
 
     /**
         Loads all updates from XML appcast feed.
@@ -107,6 +122,77 @@ struct Appcast
     bool HasDownload() const { return enclosure.IsValid(); }
 
     std::string GetDownloadURL() const;
+
+    /**
+        Finds the delta update that applies to given installed version.
+
+        Returns NULL if there's no such delta.
+     */
+    const Enclosure *FindDelta(const std::string& fromVersion) const;
+
+    /**
+        Returns URL of the delta update.
+
+        Relative URLs are resolved against the directory of the full update.
+     */
+    std::string GetDeltaDownloadURL(const Enclosure& delta) const;
+
+    /**
+        Returns URL of the update's chunk index, or empty string if it
+        has none.
+
+        Relative URLs are resolved as in GetDeltaDownloadURL().
+     */
+    std::string GetChunkIndexURL() const;
+};
+
+
+/**
+    IDownloadSink implementation that parses the appcast feed as it arrives.
+
+    Every downloaded chunk is fed directly to the XML parser, so that parsing
+    overlaps with the network transfer and the whole feed never has to be
+    kept in memory. The sink reports itself complete as soon as the end of
+    <channel> is reached, which lets DownloadFile() stop the transfer.
+ */
+class AppcastDownloadSink : public IDownloadSink
+{
+public:
+    AppcastDownloadSink();
+    virtual ~AppcastDownloadSink();
+
+    virtual void SetLength(size_t) {}
+    virtual void SetFilename(const std::wstring&) {}
+    virtual void Add(const void *data, size_t len);
+    virtual bool IsComplete() const;
+
+    /**
+        Called for every usable <item> as soon as it is parsed.
+
+        Items that are not appliable (e.g. for different OS) are not passed
+        to this method. The default implementation collects the items so
+        that they can be retrieved with Finish(); derived classes may
+        override it to process the items immediately instead.
+
+        @param item The parsed item; it may be modified or moved from.
+     */
+    virtual void OnItem(Appcast& item);
+
+    /**
+        Finishes parsing and returns all updates found in the feed.
+
+        The returned list has the same semantics as the one returned by
+        Appcast::Load(); it is empty if OnItem() was overridden.
+
+        Throws on error, including when the feed is truncated.
+     */
+    std::vector<Appcast> Finish();
+
+private:
+    AppcastDownloadSink(const AppcastDownloadSink&);
+    AppcastDownloadSink& operator=(const AppcastDownloadSink&);
+
+    XML_ParserStruct *m_parser;
 };
 
 } // namespace winsparkle
@@ -0,0 +1,532 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "appcastcache.h"
+#include "settings.h"
+#include "error.h"
+#include "utils.h"
+
+#include <openssl/sha.h>
+
+#include <stdio.h>
+#include <rpc.h>
+
+namespace winsparkle
+{
+
+/*--------------------------------------------------------------------------*
+                                  helpers
+ *--------------------------------------------------------------------------*/
+
+namespace
+{
+
+// Cache file layout:
+//
+//   magic             4 bytes, "WSAC"
+//   format version    uint32
+//   payload size      uint32
+//   payload checksum  SHA-256 of the payload
+//   payload           AppcastCheckResult fields, see WriteResult()
+//
+// All integers are little-endian, strings are stored as uint32 length
+// followed by the bytes.
+
+const char CACHE_MAGIC[4] = { 'W', 'S', 'A', 'C' };
+const DWORD CACHE_FORMAT_VERSION = 3;
+const size_t CACHE_HEADER_SIZE = 4 + 4 + 4 + SHA256_DIGEST_LENGTH;
+
+// Don't bother with files that are clearly not ours.
+const DWORD CACHE_MAX_PAYLOAD_SIZE = 1024 * 1024;
+
+
+class CacheWriter
+{
+public:
+    void PutUInt32(DWORD value)
+    {
+        for ( int i = 0; i < 4; i++ )
+            m_data += char((value >> (8 * i)) & 0xFF);
+    }
+
+    void PutUInt64(unsigned long long value)
+    {
+        PutUInt32(DWORD(value & 0xFFFFFFFF));
+        PutUInt32(DWORD(value >> 32));
+    }
+
+    void PutBytes(const void *data, size_t len)
+    {
+        m_data.append(static_cast<const char*>(data), len);
+    }
+
+    void PutBool(bool value)
+    {
+        m_data += char(value ? 1 : 0);
+    }
+
+    void PutString(const std::string& value)
+    {
+        PutUInt32(DWORD(value.length()));
+        m_data += value;
+    }
+
+    const std::string& GetData() const { return m_data; }
+
+private:
+    std::string m_data;
+};
+
+
+// Reads data written by CacheWriter. All methods return false if the data
+// are truncated.
+class CacheReader
+{
+public:
+    CacheReader(const unsigned char *data, size_t size)
+        : m_pos(data), m_end(data + size) {}
+
+    bool GetUInt32(DWORD& value)
+    {
+        if ( m_end - m_pos < 4 )
+            return false;
+        value = 0;
+        for ( int i = 0; i < 4; i++ )
+            value |= DWORD(m_pos[i]) << (8 * i);
+        m_pos += 4;
+        return true;
+    }
+
+    bool GetUInt64(unsigned long long& value)
+    {
+        DWORD low, high;
+        if ( !GetUInt32(low) || !GetUInt32(high) )
+            return false;
+        value = (static_cast<unsigned long long>(high) << 32) | low;
+        return true;
+    }
+
+    bool GetBytes(const unsigned char*& data, size_t len)
+    {
+        if ( size_t(m_end - m_pos) < len )
+            return false;
+        data = m_pos;
+        m_pos += len;
+        return true;
+    }
+
+    bool GetBool(bool& value)
+    {
+        if ( m_pos == m_end )
+            return false;
+        value = *m_pos++ != 0;
+        return true;
+    }
+
+    bool GetString(std::string& value)
+    {
+        DWORD len;
+        if ( !GetUInt32(len) || DWORD(m_end - m_pos) < len )
+            return false;
+        value.assign(reinterpret_cast<const char*>(m_pos), len);
+        m_pos += len;
+        return true;
+    }
+
+    bool IsAtEnd() const { return m_pos == m_end; }
+
+private:
+    const unsigned char *m_pos, *m_end;
+};
+
+
+void WriteEnclosure(CacheWriter& w, const Appcast::Enclosure& e)
+{
+    w.PutString(e.DownloadURL);
+    w.PutString(e.DsaSignature);
+    w.PutString(e.OS);
+    w.PutString(e.InstallerArguments);
+    w.PutUInt64(e.Length);
+    w.PutString(e.DeltaFrom);
+    w.PutString(e.ChunkIndexURL);
+}
+
+bool ReadEnclosure(CacheReader& r, Appcast::Enclosure& e)
+{
+    unsigned long long length;
+    if ( !r.GetString(e.DownloadURL) ||
+         !r.GetString(e.DsaSignature) ||
+         !r.GetString(e.OS) ||
+         !r.GetString(e.InstallerArguments) ||
+         !r.GetUInt64(length) ||
+         !r.GetString(e.DeltaFrom) ||
+         !r.GetString(e.ChunkIndexURL) )
+        return false;
+    e.Length = size_t(length);
+    return true;
+}
+
+void WriteResult(CacheWriter& w, const AppcastCheckResult& r)
+{
+    w.PutString(r.URL);
+    w.PutString(r.CurrentVersion);
+    w.PutString(r.ServerVersion);
+    w.PutString(r.ContentHash);
+    w.PutBool(r.HasApplicableItems);
+    w.PutBool(r.HasUpdate);
+
+    const Appcast& a = r.Update;
+    w.PutString(a.Version);
+    w.PutString(a.ShortVersionString);
+    w.PutString(a.ReleaseNotesURL);
+    w.PutString(a.WebBrowserURL);
+    w.PutString(a.Title);
+    w.PutString(a.Description);
+    w.PutString(a.MinOSVersion);
+    w.PutString(a.MinServerVersion);
+    w.PutBool(a.CriticalUpdate);
+    WriteEnclosure(w, a.enclosure);
+    w.PutUInt32(DWORD(a.Deltas.size()));
+    for ( size_t i = 0; i < a.Deltas.size(); i++ )
+        WriteEnclosure(w, a.Deltas[i]);
+}
+
+bool ReadDeltas(CacheReader& r, std::vector<Appcast::Enclosure>& deltas)
+{
+    DWORD count;
+    if ( !r.GetUInt32(count) )
+        return false;
+
+    deltas.clear();
+    for ( DWORD i = 0; i < count; i++ )
+    {
+        Appcast::Enclosure delta;
+        if ( !ReadEnclosure(r, delta) )
+            return false;
+        deltas.push_back(delta);
+    }
+    return true;
+}
+
+bool ReadResult(CacheReader& r, AppcastCheckResult& res)
+{
+    Appcast& a = res.Update;
+    return r.GetString(res.URL) &&
+           r.GetString(res.CurrentVersion) &&
+           r.GetString(res.ServerVersion) &&
+           r.GetString(res.ContentHash) &&
+           r.GetBool(res.HasApplicableItems) &&
+           r.GetBool(res.HasUpdate) &&
+           r.GetString(a.Version) &&
+           r.GetString(a.ShortVersionString) &&
+           r.GetString(a.ReleaseNotesURL) &&
+           r.GetString(a.WebBrowserURL) &&
+           r.GetString(a.Title) &&
+           r.GetString(a.Description) &&
+           r.GetString(a.MinOSVersion) &&
+           r.GetString(a.MinServerVersion) &&
+           r.GetBool(a.CriticalUpdate) &&
+           ReadEnclosure(r, a.enclosure) &&
+           ReadDeltas(r, a.Deltas) &&
+           r.IsAtEnd();
+}
+
+
+// Read-only memory mapping of a whole file.
+class MappedFile
+{
+public:
+    MappedFile(const std::wstring& path)
+        : m_file(INVALID_HANDLE_VALUE), m_mapping(NULL), m_data(NULL), m_size(0)
+    {
+        m_file = CreateFile(path.c_str(), GENERIC_READ,
+                             FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+                             OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if ( m_file == INVALID_HANDLE_VALUE )
+            return;
+
+        LARGE_INTEGER size;
+        if ( !GetFileSizeEx(m_file, &size) ||
+             size.QuadPart == 0 || size.QuadPart > CACHE_HEADER_SIZE + CACHE_MAX_PAYLOAD_SIZE )
+            return;
+
+        m_mapping = CreateFileMapping(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if ( !m_mapping )
+            return;
+
+        m_data = static_cast<const unsigned char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+        if ( m_data )
+            m_size = size_t(size.QuadPart);
+    }
+
+    ~MappedFile()
+    {
+        if ( m_data )
+            UnmapViewOfFile(m_data);
+        if ( m_mapping )
+            CloseHandle(m_mapping);
+        if ( m_file != INVALID_HANDLE_VALUE )
+            CloseHandle(m_file);
+    }
+
+    const unsigned char *GetData() const { return m_data; }
+    size_t GetSize() const { return m_size; }
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    HANDLE m_file;
+    HANDLE m_mapping;
+    const unsigned char *m_data;
+    size_t m_size;
+};
+
+
+std::wstring GetCacheFilePrefix()
+{
+    wchar_t tmpdir[MAX_PATH + 1];
+    if (GetTempPath(MAX_PATH + 1, tmpdir) == 0)
+        throw Win32Exception("Cannot determine temporary directory");
+
+    std::wstring path(tmpdir);
+    path += L"Appcast-";
+    return path;
+}
+
+// Returns path of the cache file, optionally choosing a new one.
+// Returns empty string if there's no (valid) file.
+std::wstring GetCacheFilePath(bool create)
+{
+    const std::wstring prefix = GetCacheFilePrefix();
+
+    // Check that the path really is ours, to prevent malicious users from
+    // making us overwrite arbitrary files:
+    std::wstring path;
+    if ( Settings::ReadConfigValue("AppcastCacheFile", path) &&
+         path.find(prefix) == 0 )
+    {
+        return path;
+    }
+
+    if ( !create )
+        return std::wstring();
+
+    UUID uuid;
+    UuidCreate(&uuid);
+    RPC_WSTR uuidStr;
+    UuidToString(&uuid, &uuidStr);
+    path = prefix + reinterpret_cast<wchar_t*>(uuidStr) + L".cache";
+    RpcStringFree(&uuidStr);
+
+    Settings::WriteConfigValue("AppcastCacheFile", path);
+    return path;
+}
+
+} // anonymous namespace
+
+
+/*--------------------------------------------------------------------------*
+                               AppcastCache
+ *--------------------------------------------------------------------------*/
+
+CriticalSection AppcastCache::ms_csVars;
+bool AppcastCache::ms_loaded = false;
+bool AppcastCache::ms_hasResult = false;
+AppcastCheckResult AppcastCache::ms_result;
+unsigned AppcastCache::ms_hits = 0;
+unsigned AppcastCache::ms_misses = 0;
+
+
+bool AppcastCache::Get(const std::string& url,
+                       const std::string& currentVersion,
+                       AppcastCheckResult& result)
+{
+    CriticalSectionLocker lock(ms_csVars);
+
+    if ( !ms_loaded )
+    {
+        ms_loaded = true;
+        ms_hasResult = LoadFromFile(ms_result);
+    }
+
+    if ( !ms_hasResult ||
+         ms_result.URL != url ||
+         ms_result.CurrentVersion != currentVersion )
+    {
+        return false;
+    }
+
+    result = ms_result;
+    return true;
+}
+
+
+void AppcastCache::Store(const AppcastCheckResult& result)
+{
+    CriticalSectionLocker lock(ms_csVars);
+
+    ms_result = result;
+    ms_hasResult = true;
+    ms_loaded = true;
+
+    try
+    {
+        SaveToFile(result);
+    }
+    catch ( const std::exception& e )
+    {
+        LogError(std::string("Failed to save appcast cache: ") + e.what());
+    }
+}
+
+
+void AppcastCache::Unload()
+{
+    CriticalSectionLocker lock(ms_csVars);
+
+    ms_result = AppcastCheckResult();
+    ms_hasResult = false;
+    ms_loaded = false;
+}
+
+
+void AppcastCache::RecordHit()
+{
+    CriticalSectionLocker lock(ms_csVars);
+    ms_hits++;
+}
+
+void AppcastCache::RecordMiss()
+{
+    CriticalSectionLocker lock(ms_csVars);
+    ms_misses++;
+}
+
+unsigned AppcastCache::GetHitCount()
+{
+    CriticalSectionLocker lock(ms_csVars);
+    return ms_hits;
+}
+
+unsigned AppcastCache::GetMissCount()
+{
+    CriticalSectionLocker lock(ms_csVars);
+    return ms_misses;
+}
+
+
+bool AppcastCache::LoadFromFile(AppcastCheckResult& result)
+{
+    std::wstring path;
+    try
+    {
+        path = GetCacheFilePath(false);
+    }
+    catch ( Win32Exception& ) // cannot determine temp directory
+    {
+        return false;
+    }
+    if ( path.empty() )
+        return false;
+
+    MappedFile file(path);
+    const unsigned char *data = file.GetData();
+    if ( !data || file.GetSize() < CACHE_HEADER_SIZE )
+        return false;
+
+    CacheReader header(data, CACHE_HEADER_SIZE);
+    const unsigned char *magic, *checksum;
+    DWORD version, payloadSize;
+    if ( !header.GetBytes(magic, sizeof(CACHE_MAGIC)) ||
+         memcmp(magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+         !header.GetUInt32(version) || version != CACHE_FORMAT_VERSION ||
+         !header.GetUInt32(payloadSize) ||
+         payloadSize != file.GetSize() - CACHE_HEADER_SIZE ||
+         !header.GetBytes(checksum, SHA256_DIGEST_LENGTH) )
+    {
+        return false;
+    }
+
+    const unsigned char *payload = data + CACHE_HEADER_SIZE;
+
+    unsigned char actual[SHA256_DIGEST_LENGTH];
+    SHA256(payload, payloadSize, actual);
+    if ( memcmp(actual, checksum, SHA256_DIGEST_LENGTH) != 0 )
+    {
+        LogError("Appcast cache file is corrupted, ignoring it.");
+        return false;
+    }
+
+    CacheReader reader(payload, payloadSize);
+    AppcastCheckResult loaded;
+    if ( !ReadResult(reader, loaded) )
+        return false;
+
+    result = loaded;
+    return true;
+}
+
+
+void AppcastCache::SaveToFile(const AppcastCheckResult& result)
+{
+    CacheWriter payload;
+    WriteResult(payload, result);
+    const std::string& data = payload.GetData();
+
+    unsigned char checksum[SHA256_DIGEST_LENGTH];
+    SHA256(reinterpret_cast<const unsigned char*>(data.data()), data.length(), checksum);
+
+    CacheWriter file;
+    file.PutBytes(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    file.PutUInt32(CACHE_FORMAT_VERSION);
+    file.PutUInt32(DWORD(data.length()));
+    file.PutBytes(checksum, sizeof(checksum));
+    file.PutBytes(data.data(), data.length());
+    const std::string& contents = file.GetData();
+
+    // Write to a temporary file first and then atomically replace the old
+    // file, so that a reader never sees partially written data.
+    const std::wstring path = GetCacheFilePath(true);
+    const std::wstring tmppath = path + L".tmp";
+
+    FILE *f = _wfopen(tmppath.c_str(), L"wb");
+    if ( !f )
+        throw std::runtime_error("Cannot create cache file");
+    const bool ok = fwrite(contents.data(), 1, contents.length(), f) == contents.length();
+    if ( fclose(f) != 0 || !ok )
+    {
+        DeleteFile(tmppath.c_str());
+        throw std::runtime_error("Cannot write cache file");
+    }
+
+    if ( !MoveFileEx(tmppath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) )
+    {
+        DeleteFile(tmppath.c_str());
+        throw Win32Exception("Cannot replace cache file");
+    }
+}
+
+} // namespace winsparkle
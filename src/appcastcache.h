@@ -0,0 +1,148 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _appcastcache_h_
+#define _appcastcache_h_
+
+#include "appcast.h"
+#include "threads.h"
+
+#include <string>
+
+namespace winsparkle
+{
+
+/**
+    Result of evaluating the appcast feed, as stored in AppcastCache.
+ */
+struct AppcastCheckResult
+{
+    AppcastCheckResult() : HasApplicableItems(false), HasUpdate(false) {}
+
+    /// URL of the feed
+    std::string URL;
+
+    /// Installed version the result was computed for
+    std::string CurrentVersion;
+
+    /// Server version the items' MinServerVersion was evaluated against
+    std::string ServerVersion;
+
+    /// SHA-256 hash of the feed's content (binary); empty if it wasn't
+    /// computed, because the feed was evaluated without a previous result
+    std::string ContentHash;
+
+    /// True if the feed had any items for this server version
+    bool HasApplicableItems;
+
+    /// True if Update is the update that should be offered
+    bool HasUpdate;
+
+    /// The chosen update: the critical update candidate if there was one,
+    /// the latest version otherwise
+    Appcast Update;
+};
+
+
+/**
+    Persistent cache of the last result of evaluating the appcast feed.
+
+    If the feed didn't change since the last check (either because the server
+    says so or because its content hash is the same), the cached result is
+    used instead of parsing the feed again.
+
+    The cache is kept in memory and also in a file, so that it survives
+    restarts of the application. The file's location is stored in
+    the configuration, see Settings::WriteConfigValue(). The file is
+    memory-mapped when loading and its content is verified with a checksum;
+    a corrupted file is ignored.
+ */
+class AppcastCache
+{
+public:
+    /**
+        Retrieves the cached result, if it was computed for the same feed
+        and installed version.
+
+        The caller must check that the result's ServerVersion matches the
+        current server version before using it.
+
+        @param url             URL of the feed.
+        @param currentVersion  Currently installed version.
+        @param result          Receives the cached result.
+
+        @return true if there is a matching cached result.
+     */
+    static bool Get(const std::string& url,
+                    const std::string& currentVersion,
+                    AppcastCheckResult& result);
+
+    /**
+        Stores a new result, replacing the previous one.
+
+        Failure to write the cache file is logged, but isn't an error.
+     */
+    static void Store(const AppcastCheckResult& result);
+
+    /**
+        Forgets the result kept in memory, so that the next Get() loads it
+        from the file again.
+
+        Used when the configuration, which stores the file's location,
+        changes.
+     */
+    static void Unload();
+
+    /// Records that the cached result was reused.
+    static void RecordHit();
+
+    /// Records that the feed had to be parsed.
+    static void RecordMiss();
+
+    /// Returns the number of times the cached result was reused.
+    static unsigned GetHitCount();
+
+    /// Returns the number of times the feed had to be parsed.
+    static unsigned GetMissCount();
+
+private:
+    AppcastCache(); // no instances
+
+    static bool LoadFromFile(AppcastCheckResult& result);
+    static void SaveToFile(const AppcastCheckResult& result);
+
+private:
+    // guards the variables below:
+    static CriticalSection ms_csVars;
+
+    static bool ms_loaded;
+    static bool ms_hasResult;
+    static AppcastCheckResult ms_result;
+    static unsigned ms_hits, ms_misses;
+};
+
+} // namespace winsparkle
+
+#endif // _appcastcache_h_
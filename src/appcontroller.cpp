@@ -24,6 +24,7 @@
  */
 
 #include "appcontroller.h"
+#include "mirrors.h"
 
 
 namespace winsparkle
@@ -46,6 +47,8 @@ win_sparkle_update_skipped_callback_t      ApplicationController::ms_cbUpdateSki
 win_sparkle_update_postponed_callback_t    ApplicationController::ms_cbUpdatePostponed = NULL;
 win_sparkle_update_dismissed_callback_t    ApplicationController::ms_cbUpdateDismissed = NULL;
 win_sparkle_user_run_installer_callback_t  ApplicationController::ms_cbUserRunInstaller = NULL;
+win_sparkle_prestage_disk_space_callback_t ApplicationController::ms_cbPrestageDiskSpace = NULL;
+win_sparkle_prestage_metered_connection_callback_t ApplicationController::ms_cbPrestageMeteredConnection = NULL;
 
 bool ApplicationController::IsReadyToShutdown()
 {
@@ -76,6 +79,35 @@ void ApplicationController::RequestShutdown()
     // nothing yet
 }
 
+bool ApplicationController::CanPrestageWithDiskSpace(unsigned long long required,
+                                                     unsigned long long available)
+{
+    {
+        CriticalSectionLocker lock(ms_csVars);
+        if ( ms_cbPrestageDiskSpace )
+            return (*ms_cbPrestageDiskSpace)(required, available) == 0 ? false : true;
+    }
+
+    // default implementations:
+
+    // don't fill the disk up with something the user didn't ask for yet
+    const unsigned long long reserve = 1024 * 1024 * 1024;
+    return available >= required && available - required >= reserve;
+}
+
+bool ApplicationController::CanPrestageOnConnection(bool metered)
+{
+    {
+        CriticalSectionLocker lock(ms_csVars);
+        if ( ms_cbPrestageMeteredConnection )
+            return (*ms_cbPrestageMeteredConnection)(metered ? 1 : 0) == 0 ? false : true;
+    }
+
+    // default implementations:
+
+    return !metered;
+}
+
 void ApplicationController::NotifyUpdateError(int error_code, const char* error_message)
 {
     {
@@ -219,6 +251,10 @@ int ApplicationController::UserRunInstallerCallback(const wchar_t* filePath, con
 
 std::string ApplicationController::GetAvailableHost()
 {
+    // registered mirrors take precedence over the callback
+    if (!Mirrors::IsEmpty())
+        return Mirrors::GetBestHost();
+
     {
         CriticalSectionLocker lock(ms_csVars);
         if (ms_cbGetAvailableHost)
@@ -226,6 +262,8 @@ std::string ApplicationController::GetAvailableHost()
             return (*ms_cbGetAvailableHost)();
         }
     }
+
+    return std::string();
 }
 
 } // namespace winsparkle
@@ -50,6 +50,12 @@ public:
     /// Tell the host to terminate.
     static void RequestShutdown();
 
+    /// Ask if the update can be downloaded in advance with this much free space.
+    static bool CanPrestageWithDiskSpace(unsigned long long required, unsigned long long available);
+
+    /// Ask if the update can be downloaded in advance over the current connection.
+    static bool CanPrestageOnConnection(bool metered);
+
     //@}
 
     /**
@@ -193,6 +199,20 @@ public:
         ms_cbUpdateDismissed = callback;
     }
 
+    /// Set the win_sparkle_prestage_disk_space_callback_t function
+    static void SetPrestageDiskSpaceCallback(win_sparkle_prestage_disk_space_callback_t callback)
+    {
+        CriticalSectionLocker lock(ms_csVars);
+        ms_cbPrestageDiskSpace = callback;
+    }
+
+    /// Set the win_sparkle_prestage_metered_connection_callback_t function
+    static void SetPrestageMeteredConnectionCallback(win_sparkle_prestage_metered_connection_callback_t callback)
+    {
+        CriticalSectionLocker lock(ms_csVars);
+        ms_cbPrestageMeteredConnection = callback;
+    }
+
     static void SetUserRunInstallerCallback(win_sparkle_user_run_installer_callback_t callback)
     {
         CriticalSectionLocker lock(ms_csVars);
@@ -222,6 +242,8 @@ private:
     static win_sparkle_update_postponed_callback_t    ms_cbUpdatePostponed;
     static win_sparkle_update_dismissed_callback_t    ms_cbUpdateDismissed;
     static win_sparkle_user_run_installer_callback_t  ms_cbUserRunInstaller;
+    static win_sparkle_prestage_disk_space_callback_t ms_cbPrestageDiskSpace;
+    static win_sparkle_prestage_metered_connection_callback_t ms_cbPrestageMeteredConnection;
     
 };
 
@@ -0,0 +1,524 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "archiveextract.h"
+#include "error.h"
+#include "utils.h"
+
+#include <windows.h>
+#include <algorithm>
+#include <cwctype>
+
+namespace winsparkle
+{
+
+/*--------------------------------------------------------------------------*
+                                  helpers
+ *--------------------------------------------------------------------------*/
+
+namespace
+{
+
+const unsigned long SIG_LOCAL_HEADER = 0x04034b50;
+const unsigned long SIG_DATA_DESCRIPTOR = 0x08074b50;
+const unsigned long SIG_CENTRAL_HEADER = 0x02014b50;
+const unsigned long SIG_END_OF_CENTRAL_DIR = 0x06054b50;
+
+const size_t LOCAL_HEADER_SIZE = 30;
+
+const unsigned FLAG_ENCRYPTED = 0x0001;
+const unsigned FLAG_DATA_DESCRIPTOR = 0x0008;
+const unsigned FLAG_UTF8 = 0x0800;
+
+const unsigned METHOD_STORED = 0;
+const unsigned METHOD_DEFLATED = 8;
+
+const unsigned long ZIP64_SIZE = 0xFFFFFFFF;
+
+// ZIP integers are little-endian:
+
+unsigned GetUInt16(const std::string& data, size_t pos)
+{
+    return (unsigned char)data[pos] | ((unsigned char)data[pos + 1] << 8);
+}
+
+unsigned long GetUInt32(const std::string& data, size_t pos)
+{
+    return GetUInt16(data, pos) | ((unsigned long)GetUInt16(data, pos + 2) << 16);
+}
+
+// Checks that a part of an entry's path names a file in its directory.
+bool IsValidPathPart(const std::wstring& part)
+{
+    if ( part.empty() || part == L"." || part == L".." )
+        return false;
+
+    // Windows strips trailing dots and spaces, e.g. ".. " would become
+    // "..", and some characters aren't allowed or have special meaning.
+    const wchar_t last = part[part.length() - 1];
+    if ( last == L'.' || last == L' ' )
+        return false;
+    for ( size_t i = 0; i < part.length(); i++ )
+    {
+        if ( part[i] < 32 || wcschr(L"<>:\"|?*", part[i]) )
+            return false;
+    }
+
+    // Names of devices refer to the devices in any directory and with any
+    // extension, e.g. "dir\\nul.txt".
+    std::wstring base = part.substr(0, part.find(L'.'));
+    base.erase(base.find_last_not_of(L' ') + 1);
+    std::transform(base.begin(), base.end(), base.begin(), towupper);
+
+    static const wchar_t *const devices[] = { L"CON", L"PRN", L"AUX", L"NUL", L"CONIN$", L"CONOUT$" };
+    for ( size_t i = 0; i < sizeof(devices) / sizeof(devices[0]); i++ )
+    {
+        if ( base == devices[i] )
+            return false;
+    }
+
+    // COM0 to COM9 and LPT0 to LPT9, including superscript digits
+    if ( base.length() == 4 &&
+         (base.compare(0, 3, L"COM") == 0 || base.compare(0, 3, L"LPT") == 0) &&
+         wcschr(L"0123456789\u00B9\u00B2\u00B3", base[3]) )
+    {
+        return false;
+    }
+
+    return true;
+}
+
+// Converts name of an entry to relative path. Names that could be written
+// outside of the directory the archive is extracted to, or that Windows
+// wouldn't create as files in it, are rejected.
+std::wstring GetEntryPath(const std::string& name, bool utf8)
+{
+    // names are in IBM PC code page unless flagged as UTF-8
+    const UINT codepage = utf8 ? CP_UTF8 : 437;
+
+    std::wstring path;
+    const int len = name.empty()
+                    ? 0
+                    : MultiByteToWideChar(codepage, 0, name.data(), (int)name.size(), NULL, 0);
+    if ( len > 0 )
+    {
+        path.resize(len);
+        MultiByteToWideChar(codepage, 0, name.data(), (int)name.size(), &path[0], len);
+    }
+
+    std::replace(path.begin(), path.end(), L'/', L'\\');
+
+    bool valid = !path.empty();
+    for ( size_t start = 0; valid && start < path.length(); )
+    {
+        size_t end = path.find(L'\\', start);
+        if ( end == std::wstring::npos )
+            end = path.length();
+
+        valid = IsValidPathPart(path.substr(start, end - start));
+        start = end + 1;
+    }
+
+    if ( !valid )
+        throw std::runtime_error("Archive contains invalid file name.");
+
+    return path;
+}
+
+// Creates directory @a path inside @a base, including its parents.
+void CreateDirectories(const std::wstring& base, const std::wstring& path)
+{
+    for ( size_t end = 0; end < path.length(); end++ )
+    {
+        end = path.find(L'\\', end);
+        if ( end == std::wstring::npos )
+            end = path.length();
+
+        const std::wstring dir = base + L"\\" + path.substr(0, end);
+        if ( !CreateDirectory(dir.c_str(), NULL) && GetLastError() != ERROR_ALREADY_EXISTS )
+            throw Win32Exception("Cannot create directory for extracted files");
+    }
+}
+
+} // anonymous namespace
+
+
+/*--------------------------------------------------------------------------*
+                              ArchiveExtractor
+ *--------------------------------------------------------------------------*/
+
+ArchiveExtractor::ArchiveExtractor(const std::wstring& stagingDir)
+    : m_dir(stagingDir),
+      m_state(State_Start),
+      m_flags(0), m_method(0),
+      m_expectedCRC(0), m_expectedCompressed(0), m_expectedSize(0),
+      m_crc(0), m_compressed(0), m_size(0),
+      m_file(NULL),
+      m_inflating(false)
+{
+}
+
+
+ArchiveExtractor::~ArchiveExtractor()
+{
+    CloseEntry();
+}
+
+
+void ArchiveExtractor::Add(const void *data, size_t len)
+{
+    const char *p = static_cast<const char*>(data);
+
+    try
+    {
+        while ( len > 0 )
+        {
+            switch ( m_state )
+            {
+                case State_Start:
+                case State_Header:
+                    ProcessHeader(p, len);
+                    break;
+
+                case State_Data:
+                    ProcessData(p, len);
+                    break;
+
+                case State_Descriptor:
+                    ProcessDescriptor(p, len);
+                    break;
+
+                case State_Done:
+                case State_NotArchive:
+                case State_Failed:
+                    return; // the rest isn't needed
+            }
+        }
+    }
+    catch (const std::exception& e)
+    {
+        CloseEntry();
+        m_error = e.what();
+        m_state = State_Failed;
+    }
+}
+
+
+bool ArchiveExtractor::Finish()
+{
+    switch ( m_state )
+    {
+        case State_Done:
+            return true;
+
+        case State_NotArchive:
+            return false;
+
+        case State_Failed:
+            throw std::runtime_error(m_error);
+
+        default:
+            throw std::runtime_error("Archive is incomplete.");
+    }
+}
+
+
+void ArchiveExtractor::Commit(const std::wstring& dir)
+{
+    if ( m_state != State_Done )
+        throw std::runtime_error("Archive is incomplete.");
+
+    if ( GetFileAttributes(dir.c_str()) != INVALID_FILE_ATTRIBUTES )
+        DeleteDirectory(dir);
+
+    if ( !MoveFile(m_dir.c_str(), dir.c_str()) )
+        throw Win32Exception("Cannot move extracted files");
+}
+
+
+bool ArchiveExtractor::ExtractFile(const std::wstring& path)
+{
+    FILE *file = _wfopen(path.c_str(), L"rb");
+    if ( !file )
+        throw std::runtime_error("Update failed. Local file not found.");
+
+    std::vector<char> buffer(64 * 1024);
+    while ( m_state != State_Done && m_state != State_NotArchive && m_state != State_Failed )
+    {
+        const size_t len = fread(&buffer[0], 1, buffer.size(), file);
+        if ( len == 0 )
+            break;
+        Add(&buffer[0], len);
+    }
+
+    fclose(file);
+    return Finish();
+}
+
+
+bool ArchiveExtractor::Fill(const char*& data, size_t& len, size_t count)
+{
+    if ( m_header.length() < count )
+    {
+        const size_t n = std::min(len, count - m_header.length());
+        m_header.append(data, n);
+        data += n;
+        len -= n;
+    }
+
+    return m_header.length() >= count;
+}
+
+
+void ArchiveExtractor::ProcessHeader(const char*& data, size_t& len)
+{
+    // the signature determines what follows
+    if ( !Fill(data, len, 4) )
+        return;
+
+    const unsigned long signature = GetUInt32(m_header, 0);
+    if ( signature != SIG_LOCAL_HEADER )
+    {
+        if ( m_state == State_Start )
+            m_state = State_NotArchive;
+        else if ( signature == SIG_CENTRAL_HEADER || signature == SIG_END_OF_CENTRAL_DIR )
+            m_state = State_Done; // only the directory of the entries follows
+        else
+            throw std::runtime_error("Archive is corrupted.");
+
+        m_header.clear();
+        return;
+    }
+
+    if ( !Fill(data, len, LOCAL_HEADER_SIZE) )
+        return;
+
+    const size_t nameLength = GetUInt16(m_header, 26);
+    const size_t extraLength = GetUInt16(m_header, 28);
+    if ( !Fill(data, len, LOCAL_HEADER_SIZE + nameLength + extraLength) )
+        return;
+
+    BeginEntry();
+}
+
+
+void ArchiveExtractor::BeginEntry()
+{
+    m_flags = GetUInt16(m_header, 6);
+    m_method = GetUInt16(m_header, 8);
+    m_expectedCRC = GetUInt32(m_header, 14);
+    m_expectedCompressed = GetUInt32(m_header, 18);
+    m_expectedSize = GetUInt32(m_header, 22);
+    const std::string name = m_header.substr(LOCAL_HEADER_SIZE, GetUInt16(m_header, 26));
+    m_header.clear();
+
+    if ( m_flags & FLAG_ENCRYPTED )
+        throw std::runtime_error("Encrypted archives are not supported.");
+    if ( m_method != METHOD_STORED && m_method != METHOD_DEFLATED )
+        throw std::runtime_error("Archive uses unsupported compression method.");
+    if ( m_expectedCompressed == ZIP64_SIZE || m_expectedSize == ZIP64_SIZE )
+        throw std::runtime_error("ZIP64 archives are not supported.");
+
+    // names of directories end with a slash, they don't have any data
+    const std::wstring path = GetEntryPath(name, (m_flags & FLAG_UTF8) != 0);
+    const size_t sep = path.rfind(L'\\');
+    const bool isDir = sep == path.length() - 1;
+
+    // without the size, there's no way to tell where stored data end
+    if ( (m_flags & FLAG_DATA_DESCRIPTOR) && m_method == METHOD_STORED && !isDir )
+        throw std::runtime_error("Archive uses unsupported format of entries.");
+
+    if ( m_state == State_Start )
+    {
+        // remove files left over from an earlier attempt
+        if ( GetFileAttributes(m_dir.c_str()) != INVALID_FILE_ATTRIBUTES )
+            DeleteDirectory(m_dir);
+        if ( !CreateDirectory(m_dir.c_str(), NULL) )
+            throw Win32Exception("Cannot create directory for extracted files");
+    }
+
+    if ( sep != std::wstring::npos )
+        CreateDirectories(m_dir, path.substr(0, sep));
+
+    if ( !isDir )
+    {
+        const std::wstring filename = m_dir + L"\\" + path;
+        m_file = _wfopen(filename.c_str(), L"wb");
+        if ( !m_file )
+            throw std::runtime_error("Failed to save the update file.  Please check disk space and permissions.");
+    }
+
+    m_crc = crc32(0L, Z_NULL, 0);
+    m_compressed = 0;
+    m_size = 0;
+    m_state = State_Data;
+
+    if ( m_method == METHOD_DEFLATED )
+    {
+        memset(&m_zstream, 0, sizeof(m_zstream));
+        if ( inflateInit2(&m_zstream, -MAX_WBITS) != Z_OK )
+            throw std::runtime_error("Failed to initialize decompression.");
+        m_inflating = true;
+
+        if ( m_buffer.empty() )
+            m_buffer.resize(64 * 1024);
+    }
+    else if ( m_expectedCompressed == 0 || isDir )
+    {
+        EndEntryData();
+    }
+}
+
+
+void ArchiveExtractor::ProcessData(const char*& data, size_t& len)
+{
+    size_t count = len;
+    if ( !(m_flags & FLAG_DATA_DESCRIPTOR) )
+        count = (size_t)std::min<unsigned long long>(count, m_expectedCompressed - m_compressed);
+
+    if ( m_method == METHOD_STORED )
+    {
+        WriteEntryData(data, count);
+        m_compressed += count;
+        data += count;
+        len -= count;
+
+        if ( m_compressed == m_expectedCompressed )
+            EndEntryData();
+        return;
+    }
+
+    m_zstream.next_in = (Bytef*)data;
+    m_zstream.avail_in = (uInt)count;
+
+    int ret;
+    do
+    {
+        m_zstream.next_out = &m_buffer[0];
+        m_zstream.avail_out = (uInt)m_buffer.size();
+
+        ret = inflate(&m_zstream, Z_NO_FLUSH);
+        if ( ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR )
+            throw std::runtime_error("Archive is corrupted.");
+
+        WriteEntryData(&m_buffer[0], m_buffer.size() - m_zstream.avail_out);
+    }
+    while ( ret != Z_STREAM_END && m_zstream.avail_out == 0 );
+
+    const size_t consumed = count - m_zstream.avail_in;
+    m_compressed += consumed;
+    data += consumed;
+    len -= consumed;
+
+    if ( ret == Z_STREAM_END )
+        EndEntryData();
+    else if ( !(m_flags & FLAG_DATA_DESCRIPTOR) && m_compressed == m_expectedCompressed )
+        throw std::runtime_error("Archive is corrupted.");
+}
+
+
+void ArchiveExtractor::ProcessDescriptor(const char*& data, size_t& len)
+{
+    // the descriptor's signature is optional
+    if ( !Fill(data, len, 4) )
+        return;
+
+    const size_t size = GetUInt32(m_header, 0) == SIG_DATA_DESCRIPTOR ? 16 : 12;
+    if ( !Fill(data, len, size) )
+        return;
+
+    const size_t pos = size - 12;
+    const unsigned long crc = GetUInt32(m_header, pos);
+    const unsigned long compressed = GetUInt32(m_header, pos + 4);
+    const unsigned long uncompressed = GetUInt32(m_header, pos + 8);
+    m_header.clear();
+
+    CheckEntry(crc, compressed, uncompressed);
+}
+
+
+void ArchiveExtractor::WriteEntryData(const void *data, size_t len)
+{
+    if ( len == 0 )
+        return;
+
+    if ( !m_file )
+        throw std::runtime_error("Archive is corrupted.");
+
+    if ( fwrite(data, 1, len, m_file) != len )
+        throw std::runtime_error("Failed to save the update file.  Please check disk space and permissions.");
+
+    m_crc = crc32(m_crc, (const Bytef*)data, (uInt)len);
+    m_size += len;
+}
+
+
+void ArchiveExtractor::EndEntryData()
+{
+    if ( m_inflating )
+    {
+        inflateEnd(&m_zstream);
+        m_inflating = false;
+    }
+
+    if ( m_flags & FLAG_DATA_DESCRIPTOR )
+        m_state = State_Descriptor;
+    else
+        CheckEntry(m_expectedCRC, m_expectedCompressed, m_expectedSize);
+}
+
+
+void ArchiveExtractor::CheckEntry(unsigned long crc,
+                                  unsigned long long compressed,
+                                  unsigned long long size)
+{
+    if ( crc != m_crc || compressed != m_compressed || size != m_size )
+        throw std::runtime_error("Archive is corrupted.");
+
+    if ( !CloseEntry() )
+        throw std::runtime_error("Failed to save the update file.  Please check disk space and permissions.");
+
+    m_state = State_Header;
+}
+
+
+bool ArchiveExtractor::CloseEntry()
+{
+    if ( m_inflating )
+    {
+        inflateEnd(&m_zstream);
+        m_inflating = false;
+    }
+
+    bool ok = true;
+    if ( m_file )
+    {
+        ok = fclose(m_file) == 0;
+        m_file = NULL;
+    }
+    return ok;
+}
+
+} // namespace winsparkle
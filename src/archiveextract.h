@@ -0,0 +1,143 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _archiveextract_h_
+#define _archiveextract_h_
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+namespace winsparkle
+{
+
+/**
+    Extracts ZIP archive from its data as they arrive.
+
+    The archive is fed in order with Add(), so that its files can be written
+    while it is still being downloaded, overlapping decompression with the
+    network transfer. The files are written into a staging directory, which
+    is moved to its final place by Commit() only after the whole archive was
+    verified.
+
+    Only the subset of the format used for distributing software is
+    supported: stored and deflated entries, without encryption and ZIP64
+    extensions. The central directory is not used, entries are extracted
+    as their local headers are encountered.
+
+    If the data don't start with a ZIP local header, they aren't considered
+    an archive and are ignored.
+ */
+class ArchiveExtractor
+{
+public:
+    /// Creates extractor writing files into @a stagingDir.
+    ArchiveExtractor(const std::wstring& stagingDir);
+    ~ArchiveExtractor();
+
+    /**
+        Processes next data of the archive.
+
+        Errors don't throw, so that a broken archive doesn't interrupt its
+        download; they are reported by Finish().
+     */
+    void Add(const void *data, size_t len);
+
+    /**
+        Checks that the whole archive was extracted.
+
+        Returns false if the data weren't an archive. Throws if extraction
+        failed or if the archive is incomplete.
+     */
+    bool Finish();
+
+    /**
+        Moves the extracted files into @a dir, replacing it if it exists.
+
+        Must be called after Finish() returned true. Throws on error.
+     */
+    void Commit(const std::wstring& dir);
+
+    /**
+        Extracts the archive file by feeding it to Add().
+
+        Returns false if the file isn't an archive. Throws on error.
+     */
+    bool ExtractFile(const std::wstring& path);
+
+private:
+    ArchiveExtractor(const ArchiveExtractor&);
+    ArchiveExtractor& operator=(const ArchiveExtractor&);
+
+    enum State
+    {
+        State_Start,        // nothing processed yet
+        State_Header,       // reading local header or end of entries
+        State_Data,         // reading entry's data
+        State_Descriptor,   // reading data descriptor following the data
+        State_Done,         // all entries were extracted
+        State_NotArchive,   // the data aren't an archive
+        State_Failed        // extraction failed, m_error describes why
+    };
+
+    // Moves up to @a count bytes in total into m_header, returns true once
+    // it has that many.
+    bool Fill(const char*& data, size_t& len, size_t count);
+
+    // Each of these processes the data of the current state, consuming
+    // them, and moves to the next state when it's done.
+    void ProcessHeader(const char*& data, size_t& len);
+    void ProcessData(const char*& data, size_t& len);
+    void ProcessDescriptor(const char*& data, size_t& len);
+
+    void BeginEntry();
+    void WriteEntryData(const void *data, size_t len);
+    void EndEntryData();
+    void CheckEntry(unsigned long crc, unsigned long long compressed, unsigned long long size);
+    // Closes file of the current entry, returns false if writing it failed.
+    bool CloseEntry();
+
+    std::wstring m_dir;
+    State m_state;
+    std::string m_error;
+    std::string m_header;   // partially received header
+
+    // current entry:
+    unsigned m_flags, m_method;
+    unsigned long m_expectedCRC;
+    unsigned long long m_expectedCompressed, m_expectedSize;
+    unsigned long m_crc;
+    unsigned long long m_compressed, m_size;
+    FILE *m_file;
+    z_stream m_zstream;
+    bool m_inflating;
+    std::vector<unsigned char> m_buffer;
+};
+
+} // namespace winsparkle
+
+#endif // _archiveextract_h_
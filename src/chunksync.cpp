@@ -0,0 +1,377 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "chunksync.h"
+#include "error.h"
+#include "threads.h"
+
+#include <openssl/sha.h>
+
+#include <windows.h>
+
+#include <map>
+#include <vector>
+#include <io.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace winsparkle
+{
+
+/*--------------------------------------------------------------------------*
+                                  helpers
+ *--------------------------------------------------------------------------*/
+
+namespace
+{
+
+const char INDEX_MAGIC[4] = { 'W', 'S', 'C', 'I' };
+const unsigned INDEX_FORMAT_VERSION = 1;
+
+// Limits of the chunking parameters; anything else isn't a sensible index.
+const unsigned INDEX_MIN_CHUNK_SIZE = 64;
+const unsigned INDEX_MAX_CHUNK_SIZE = 16 * 1024 * 1024;
+
+// Runs of reused chunks shorter than this are downloaded as well, so that
+// the missing chunks around them are fetched with a single Range request;
+// an extra request costs more than downloading a few more bytes.
+const size_t MIN_REUSED_RUN = 64 * 1024;
+
+const size_t READ_BUFFER_SIZE = 1024 * 1024;
+
+
+// Random values for the gear hash, generated with SplitMix64, so that
+// they don't have to be listed here (and in bin/make_chunk_index.py).
+struct GearTable
+{
+    GearTable()
+    {
+        unsigned long long x = 0;
+        for ( int i = 0; i < 256; i++ )
+        {
+            x += 0x9E3779B97F4A7C15ULL;
+            unsigned long long z = x;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            z ^= z >> 31;
+            values[i] = unsigned(z >> 32);
+        }
+    }
+
+    unsigned values[256];
+};
+
+const GearTable gs_gear;
+
+
+struct IndexChunk
+{
+    size_t Offset;
+    size_t Length;
+    std::string Hash;   // SHA-256, binary
+};
+
+struct ChunkIndex
+{
+    unsigned MinSize, MaskBits, MaxSize;
+    size_t Length;
+    std::vector<IndexChunk> Chunks;
+};
+
+
+// Reads little-endian data of the index. All methods return false if
+// the data are truncated.
+class IndexReader
+{
+public:
+    IndexReader(const std::string& data)
+        : m_pos(reinterpret_cast<const unsigned char*>(data.data())),
+          m_end(m_pos + data.size()) {}
+
+    bool GetUInt32(unsigned& value)
+    {
+        if ( m_end - m_pos < 4 )
+            return false;
+        value = 0;
+        for ( int i = 0; i < 4; i++ )
+            value |= unsigned(m_pos[i]) << (8 * i);
+        m_pos += 4;
+        return true;
+    }
+
+    bool GetUInt64(unsigned long long& value)
+    {
+        unsigned low, high;
+        if ( !GetUInt32(low) || !GetUInt32(high) )
+            return false;
+        value = (static_cast<unsigned long long>(high) << 32) | low;
+        return true;
+    }
+
+    bool GetBytes(std::string& value, size_t len)
+    {
+        if ( size_t(m_end - m_pos) < len )
+            return false;
+        value.assign(reinterpret_cast<const char*>(m_pos), len);
+        m_pos += len;
+        return true;
+    }
+
+    bool IsAtEnd() const { return m_pos == m_end; }
+
+private:
+    const unsigned char *m_pos, *m_end;
+};
+
+
+ChunkIndex ParseIndex(const std::string& data)
+{
+    IndexReader r(data);
+    ChunkIndex index;
+    std::string magic;
+    unsigned version, count;
+    unsigned long long length;
+
+    if ( !r.GetBytes(magic, sizeof(INDEX_MAGIC)) ||
+         memcmp(magic.data(), INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 ||
+         !r.GetUInt32(version) || version != INDEX_FORMAT_VERSION ||
+         !r.GetUInt32(index.MinSize) ||
+         !r.GetUInt32(index.MaskBits) ||
+         !r.GetUInt32(index.MaxSize) ||
+         !r.GetUInt64(length) ||
+         !r.GetUInt32(count) )
+    {
+        throw std::runtime_error("Invalid chunk index.");
+    }
+
+    if ( index.MinSize < INDEX_MIN_CHUNK_SIZE ||
+         index.MaxSize > INDEX_MAX_CHUNK_SIZE ||
+         index.MinSize > index.MaxSize ||
+         index.MaskBits < 1 || index.MaskBits > 31 ||
+         length > size_t(-1) )
+    {
+        throw std::runtime_error("Invalid chunk index.");
+    }
+    index.Length = size_t(length);
+
+    size_t offset = 0;
+    for ( unsigned i = 0; i < count; i++ )
+    {
+        IndexChunk c;
+        unsigned len;
+        if ( !r.GetUInt32(len) || len == 0 || len > index.MaxSize ||
+             !r.GetBytes(c.Hash, SHA256_DIGEST_LENGTH) ||
+             index.Length - offset < len )
+        {
+            throw std::runtime_error("Invalid chunk index.");
+        }
+        c.Offset = offset;
+        c.Length = len;
+        offset += len;
+        index.Chunks.push_back(c);
+    }
+
+    if ( offset != index.Length || !r.IsAtEnd() )
+        throw std::runtime_error("Invalid chunk index.");
+
+    return index;
+}
+
+
+// Copies chunks of the local file that the new file contains into it.
+class ChunkAssembler
+{
+public:
+    ChunkAssembler(const ChunkIndex& index, FILE *target)
+        : m_index(index), m_target(target), m_reused(index.Chunks.size(), false)
+    {
+        for ( size_t i = 0; i < index.Chunks.size(); i++ )
+            m_byHash[index.Chunks[i].Hash].push_back(i);
+    }
+
+    // Processes a chunk of the local file.
+    void Add(const std::string& data)
+    {
+        unsigned char hash[SHA256_DIGEST_LENGTH];
+        SHA256(reinterpret_cast<const unsigned char*>(data.data()), data.size(), hash);
+
+        std::map<std::string, std::vector<size_t> >::iterator i =
+            m_byHash.find(std::string(reinterpret_cast<const char*>(hash), sizeof(hash)));
+        if ( i == m_byHash.end() )
+            return;
+
+        // the same content may occur in the new file more than once
+        for ( size_t n = 0; n < i->second.size(); n++ )
+        {
+            const IndexChunk& c = m_index.Chunks[i->second[n]];
+            if ( c.Length != data.size() )
+                continue;
+            if ( _fseeki64(m_target, c.Offset, SEEK_SET) != 0 ||
+                 fwrite(data.data(), data.size(), 1, m_target) != 1 )
+                throw std::runtime_error("Failed to save the update file.  Please check disk space and permissions.");
+            m_reused[i->second[n]] = true;
+        }
+
+        // the chunks are written now, repeated occurrences can be skipped
+        m_byHash.erase(i);
+    }
+
+    // Fills the completed ranges and statistics of the reused data.
+    void GetResult(PartialDownload& state, ChunkSyncStats& stats) const
+    {
+        state.Length = m_index.Length;
+        state.Completed.clear();
+
+        stats.Length = m_index.Length;
+
+        for ( size_t i = 0; i < m_index.Chunks.size(); )
+        {
+            if ( !m_reused[i] )
+            {
+                i++;
+                continue;
+            }
+
+            PartialDownload::Range r = { m_index.Chunks[i].Offset, 0 };
+            for ( ; i < m_index.Chunks.size() && m_reused[i]; i++ )
+                r.To = m_index.Chunks[i].Offset + m_index.Chunks[i].Length;
+
+            if ( r.To - r.From >= MIN_REUSED_RUN || (r.From == 0 && r.To == m_index.Length) )
+            {
+                state.Completed.push_back(r);
+                stats.Reused += r.To - r.From;
+            }
+        }
+    }
+
+private:
+    const ChunkIndex& m_index;
+    FILE *m_target;
+    std::map<std::string, std::vector<size_t> > m_byHash;
+    std::vector<bool> m_reused;
+};
+
+
+// Splits the file into chunks the same way the index was created and
+// passes them to the assembler.
+void ChunkFile(FILE *file, const ChunkIndex& index, ChunkAssembler& assembler, Thread *onThread)
+{
+    const unsigned mask = 0xFFFFFFFFU << (32 - index.MaskBits);
+
+    std::vector<unsigned char> buffer(READ_BUFFER_SIZE);
+    std::string chunk;
+    unsigned hash = 0;
+
+    size_t len;
+    while ( (len = fread(&buffer[0], 1, buffer.size(), file)) > 0 )
+    {
+        if ( onThread )
+            onThread->CheckShouldTerminate();
+
+        size_t start = 0;
+        for ( size_t i = 0; i < len; i++ )
+        {
+            hash = (hash << 1) + gs_gear.values[buffer[i]];
+
+            const size_t chunkLen = chunk.size() + (i - start) + 1;
+            if ( (chunkLen >= index.MinSize && (hash & mask) == 0) ||
+                 chunkLen >= index.MaxSize )
+            {
+                chunk.append(reinterpret_cast<const char*>(&buffer[start]), i - start + 1);
+                assembler.Add(chunk);
+                chunk.clear();
+                hash = 0;
+                start = i + 1;
+            }
+        }
+
+        chunk.append(reinterpret_cast<const char*>(&buffer[start]), len - start);
+    }
+
+    if ( ferror(file) )
+        throw std::runtime_error("Failed to read the previous update file.");
+
+    if ( !chunk.empty() )
+        assembler.Add(chunk);
+}
+
+} // anonymous namespace
+
+
+/*--------------------------------------------------------------------------*
+                               public functions
+ *--------------------------------------------------------------------------*/
+
+ChunkSyncStats PrepareChunkSync(const std::string& indexData,
+                                const std::wstring& source,
+                                const std::wstring& target,
+                                PartialDownload& state,
+                                Thread *onThread)
+{
+    const ChunkIndex index = ParseIndex(indexData);
+
+    FILE *src = _wfopen(source.c_str(), L"rb");
+    if ( !src )
+        throw std::runtime_error("Failed to read the previous update file.");
+
+    FILE *dst = _wfopen(target.c_str(), L"wb");
+    if ( !dst )
+    {
+        fclose(src);
+        throw std::runtime_error("Failed to save the update file.  Please check disk space and permissions.");
+    }
+
+    ChunkSyncStats stats;
+    try
+    {
+        // the download is resumed into a file of the full size
+        if ( _chsize_s(_fileno(dst), index.Length) != 0 )
+            throw std::runtime_error("Failed to save the update file.  Please check disk space and permissions.");
+
+        ChunkAssembler assembler(index, dst);
+        ChunkFile(src, index, assembler, onThread);
+        assembler.GetResult(state, stats);
+
+        if ( fclose(dst) != 0 )
+        {
+            dst = NULL;
+            throw std::runtime_error("Failed to save the update file.  Please check disk space and permissions.");
+        }
+        dst = NULL;
+        fclose(src);
+    }
+    catch ( ... )
+    {
+        if ( dst )
+            fclose(dst);
+        fclose(src);
+        DeleteFile(target.c_str());
+        throw;
+    }
+
+    return stats;
+}
+
+} // namespace winsparkle
@@ -0,0 +1,103 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _chunksync_h_
+#define _chunksync_h_
+
+#include "download.h"
+
+#include <string>
+
+namespace winsparkle
+{
+
+class Thread;
+
+/**
+    Statistics of a chunk sync, see PrepareChunkSync().
+ */
+struct ChunkSyncStats
+{
+    ChunkSyncStats() : Length(0), Reused(0) {}
+
+    /// Length of the new file.
+    size_t Length;
+
+    /// Number of bytes reused from the local file, i.e. not to be downloaded.
+    size_t Reused;
+};
+
+/**
+    Prepares download of a file by reusing content of a similar local file,
+    like zsync or casync do.
+
+    The new file is described by a chunk index: its content is split into
+    chunks at boundaries determined by a rolling hash of the content, so
+    that chunks unaffected by a change are the same in both versions, even
+    if they moved. The local file is split in the same way and chunks with
+    matching SHA-256 hashes are copied into @a target, which is created
+    with the full length of the new file.
+
+    The copied parts are recorded as completed in @a state, so that the
+    download can be finished by passing it to DownloadFileSegmented(), which
+    fetches only the missing ranges. Runs of copied chunks that are too short
+    to be worth a separate Range request are left to be downloaded too.
+    The caller must set @a state's URL and verify the complete file, e.g.
+    with a signature.
+
+    Index format (integers are little-endian):
+
+    @code
+    magic       4 bytes, "WSCI"
+    version     uint32, 1
+    min_size    uint32, minimum chunk size
+    mask_bits   uint32, number of hash bits that must be zero at a boundary
+    max_size    uint32, maximum chunk size
+    length      uint64, length of the file
+    count       uint32, number of chunks
+    chunks      count times uint32 length followed by 32 bytes SHA-256
+    @endcode
+
+    See bin/make_chunk_index.py for the chunking algorithm.
+
+    Throws on error, including invalid index.
+
+    @param index     Content of the chunk index of the new file.
+    @param source    The local file, e.g. the previous installer.
+    @param target    Where to assemble the new file.
+    @param state     Receives the length and completed ranges.
+    @param onThread  Thread this runs on, checked for termination.
+
+    @return Statistics of the reused data.
+ */
+ChunkSyncStats PrepareChunkSync(const std::string& index,
+                                const std::wstring& source,
+                                const std::wstring& target,
+                                PartialDownload& state,
+                                Thread *onThread);
+
+} // namespace winsparkle
+
+#endif // _chunksync_h_
@@ -0,0 +1,108 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "deltapatch.h"
+#include "error.h"
+#include "threads.h"
+
+#include <windows.h>
+
+namespace winsparkle
+{
+
+/*--------------------------------------------------------------------------*
+                                  helpers
+ *--------------------------------------------------------------------------*/
+
+namespace
+{
+
+// from msdelta.h, which isn't available with all compilers:
+typedef long long DELTA_FLAG_TYPE;
+typedef BOOL (WINAPI *ApplyDeltaW_t)(DELTA_FLAG_TYPE, LPCWSTR, LPCWSTR, LPCWSTR);
+
+const DELTA_FLAG_TYPE DELTA_FLAG_NONE = 0;
+
+// guards the variables below:
+CriticalSection gs_csMSDelta;
+bool gs_msdeltaLoaded = false;
+ApplyDeltaW_t gs_applyDelta = NULL;
+
+// Loads msdelta.dll, which isn't loaded into processes by default. It is
+// loaded from the system directory only, to avoid DLL planting attacks,
+// and kept loaded for the rest of the process' lifetime.
+ApplyDeltaW_t GetApplyDeltaFunc()
+{
+    CriticalSectionLocker lock(gs_csMSDelta);
+
+    if ( !gs_msdeltaLoaded )
+    {
+        gs_msdeltaLoaded = true;
+
+        wchar_t sysdir[MAX_PATH + 1];
+        const UINT len = GetSystemDirectory(sysdir, MAX_PATH + 1);
+        if ( len == 0 || len > MAX_PATH )
+            return NULL;
+
+        const std::wstring path = std::wstring(sysdir) + L"\\msdelta.dll";
+        HMODULE dll = LoadLibrary(path.c_str());
+        if ( dll )
+            gs_applyDelta = (ApplyDeltaW_t)GetProcAddress(dll, "ApplyDeltaW");
+    }
+
+    return gs_applyDelta;
+}
+
+} // anonymous namespace
+
+
+/*--------------------------------------------------------------------------*
+                               public functions
+ *--------------------------------------------------------------------------*/
+
+bool IsDeltaPatchSupported()
+{
+    return GetApplyDeltaFunc() != NULL;
+}
+
+
+void ApplyDeltaPatch(const std::wstring& source,
+                     const std::wstring& delta,
+                     const std::wstring& target)
+{
+    ApplyDeltaW_t applyDelta = GetApplyDeltaFunc();
+    if ( !applyDelta )
+        throw std::runtime_error("Delta updates are not supported on this system.");
+
+    if ( !applyDelta(DELTA_FLAG_NONE, source.c_str(), delta.c_str(), target.c_str()) )
+    {
+        // don't leave a partially written file behind
+        Win32Exception err("Failed to apply delta update");
+        DeleteFile(target.c_str());
+        throw err;
+    }
+}
+
+} // namespace winsparkle
@@ -0,0 +1,62 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _deltapatch_h_
+#define _deltapatch_h_
+
+#include <string>
+
+namespace winsparkle
+{
+
+/**
+    Returns true if delta updates can be applied on this system.
+
+    Deltas are applied with the system's MSDelta library, which is available
+    on Windows Vista and newer.
+ */
+bool IsDeltaPatchSupported();
+
+/**
+    Applies delta update to a file.
+
+    The delta is in MSDelta format, as created by CreateDelta() (or the
+    mspatch tools). The patched file is written to @a target, replacing it
+    if it exists.
+
+    Throws on error, including when @a source isn't the file the delta was
+    created for.
+
+    @param source  File the delta applies to, i.e. the previous installer.
+    @param delta   The delta file.
+    @param target  Where to write the result.
+ */
+void ApplyDeltaPatch(const std::wstring& source,
+                     const std::wstring& delta,
+                     const std::wstring& target);
+
+} // namespace winsparkle
+
+#endif // _deltapatch_h_
@@ -25,7 +25,10 @@
 
 #include "winsparkle.h"
 
+#include "appcastcache.h"
 #include "appcontroller.h"
+#include "download.h"
+#include "mirrors.h"
 #include "settings.h"
 #include "error.h"
 #include "ui.h"
@@ -37,6 +40,14 @@
 
 using namespace winsparkle;
 
+namespace
+{
+
+// How long win_sparkle_cleanup() waits for update checks to stop, in ms
+const unsigned CHECKERS_SHUTDOWN_TIMEOUT = 5000;
+
+} // anonymous namespace
+
 extern "C"
 {
 
@@ -105,9 +116,16 @@ WIN_SPARKLE_API void __cdecl win_sparkle_cleanup()
 {
     try
     {
+        // Stop update checks first, they would use the UI and start new
+        // requests otherwise.
+        UpdateChecker::TerminateAll(CHECKERS_SHUTDOWN_TIMEOUT);
+
         UI::ShutDown();
 
-        // FIXME: shut down any worker UpdateChecker and UpdateDownloader threads too
+        // WinINet handles must not be closed from DllMain, do it now; any
+        // requests of threads that didn't stop in time keep the session
+        // open until they finish
+        CloseDownloadSession();
     }
     CATCH_ALL_EXCEPTIONS
 }
@@ -158,6 +176,24 @@ WIN_SPARKLE_API void __cdecl win_sparkle_set_get_available_host_callback(win_spa
     CATCH_ALL_EXCEPTIONS
 }
 
+WIN_SPARKLE_API void __cdecl win_sparkle_add_mirror_host(const char *host)
+{
+    try
+    {
+        Mirrors::Add(host);
+    }
+    CATCH_ALL_EXCEPTIONS
+}
+
+WIN_SPARKLE_API void __cdecl win_sparkle_clear_mirror_hosts()
+{
+    try
+    {
+        Mirrors::Clear();
+    }
+    CATCH_ALL_EXCEPTIONS
+}
+
 WIN_SPARKLE_API int __cdecl win_sparkle_set_dsa_pub_pem(const char *dsa_pub_pem)
 {
     try
@@ -200,6 +236,60 @@ WIN_SPARKLE_API void __cdecl win_sparkle_clear_http_headers()
     CATCH_ALL_EXCEPTIONS
 }
 
+WIN_SPARKLE_API void __cdecl win_sparkle_set_download_flush_policy(win_sparkle_flush_policy_t policy)
+{
+    try
+    {
+        Settings::SetDownloadFlushPolicy(policy);
+    }
+    CATCH_ALL_EXCEPTIONS
+}
+
+WIN_SPARKLE_API void __cdecl win_sparkle_set_download_rate_limit(unsigned bytes_per_second)
+{
+    try
+    {
+        Settings::SetDownloadRateLimit(bytes_per_second);
+    }
+    CATCH_ALL_EXCEPTIONS
+}
+
+WIN_SPARKLE_API void __cdecl win_sparkle_set_download_priority(win_sparkle_download_priority_t priority)
+{
+    try
+    {
+        Settings::SetDownloadPriority(priority);
+    }
+    CATCH_ALL_EXCEPTIONS
+}
+
+WIN_SPARKLE_API void __cdecl win_sparkle_set_installer_cache_limit(unsigned long long bytes)
+{
+    try
+    {
+        Settings::SetInstallerCacheLimit(bytes);
+    }
+    CATCH_ALL_EXCEPTIONS
+}
+
+WIN_SPARKLE_API void __cdecl win_sparkle_set_prestage_updates(int prestage)
+{
+    try
+    {
+        Settings::SetPrestageUpdates(prestage != 0);
+    }
+    CATCH_ALL_EXCEPTIONS
+}
+
+WIN_SPARKLE_API void __cdecl win_sparkle_set_extract_archives(int extract)
+{
+    try
+    {
+        Settings::SetExtractArchives(extract != 0);
+    }
+    CATCH_ALL_EXCEPTIONS
+}
+
 WIN_SPARKLE_API void __cdecl win_sparkle_set_app_build_version(const wchar_t *build)
 {
     try
@@ -223,6 +313,8 @@ WIN_SPARKLE_API void __cdecl win_sparkle_set_config_methods(win_sparkle_config_m
     try
     {
         Settings::SetConfigMethods(config_methods);
+        // the cached appcast is located through the configuration
+        AppcastCache::Unload();
     }
     CATCH_ALL_EXCEPTIONS
 }
@@ -468,6 +560,24 @@ WIN_SPARKLE_API void __cdecl win_sparkle_set_update_dismissed_callback(win_spark
     CATCH_ALL_EXCEPTIONS
 }
 
+WIN_SPARKLE_API void __cdecl win_sparkle_set_prestage_disk_space_callback(win_sparkle_prestage_disk_space_callback_t callback)
+{
+    try
+    {
+        ApplicationController::SetPrestageDiskSpaceCallback(callback);
+    }
+    CATCH_ALL_EXCEPTIONS
+}
+
+WIN_SPARKLE_API void __cdecl win_sparkle_set_prestage_metered_connection_callback(win_sparkle_prestage_metered_connection_callback_t callback)
+{
+    try
+    {
+        ApplicationController::SetPrestageMeteredConnectionCallback(callback);
+    }
+    CATCH_ALL_EXCEPTIONS
+}
+
 /*--------------------------------------------------------------------------*
                               Manual usage
  *--------------------------------------------------------------------------*/
@@ -24,25 +24,20 @@
  */
 
 #include "download.h"
+#include "downloadpipeline.h"
+#include "httptransport.h"
+#include "throttle.h"
 
 #include "error.h"
-#include "settings.h"
+#include "threads.h"
 #include "utils.h"
-#include "winsparkle-version.h"
 
 #include <string>
-#include <windows.h>
-#include <wininet.h>
-
-#ifndef INTERNET_OPTION_ENABLE_HTTP_PROTOCOL
-    #define INTERNET_OPTION_ENABLE_HTTP_PROTOCOL 148
-#endif
-#ifndef HTTP_PROTOCOL_FLAG_HTTP2
-    #define HTTP_PROTOCOL_FLAG_HTTP2 0x2
-#endif
-#ifndef INTERNET_OPTION_HTTP_DECODING
-	#define INTERNET_OPTION_HTTP_DECODING 65
-#endif
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <stdlib.h>
 
 
 namespace winsparkle
@@ -55,310 +50,1161 @@ namespace winsparkle
 namespace
 {
 
-struct InetHandle
+// Range of sizes of reads of downloaded data
+const size_t READ_SIZE_MIN = 16 * 1024;
+const size_t READ_SIZE_MAX = 1024 * 1024;
+
+// Segmented downloads are only used for resources at least this large
+const size_t SEGMENTED_MIN_LENGTH = 4 * 1024 * 1024;
+
+// Segments are never split into parts smaller than this
+const size_t SEGMENT_MIN_SIZE = 1024 * 1024;
+
+// Deletes the response, closing its connection, when it goes out of scope.
+class ResponseRef
 {
-    InetHandle(HINTERNET handle = 0) : m_handle(handle), m_callback(NULL) {}
+public:
+    ResponseRef(IHttpResponse *response) : m_response(response) {}
+    ~ResponseRef() { Close(); }
 
-    ~InetHandle()
+    IHttpResponse *operator->() const { return m_response; }
+    IHttpResponse& operator*() const { return *m_response; }
+
+    // Releases ownership of the response.
+    IHttpResponse *Detach()
     {
-        Close();
+        IHttpResponse *response = m_response;
+        m_response = NULL;
+        return response;
     }
 
-    InetHandle& operator=(HINTERNET handle)
+    // Closes the connection, possibly before reading all of the response.
+    void Close()
     {
-        Close();
-        m_handle = handle;
-        return *this;
+        delete m_response;
+        m_response = NULL;
     }
 
-    void SetStatusCallback(INTERNET_STATUS_CALLBACK callback)
+private:
+    ResponseRef(const ResponseRef&);
+    ResponseRef& operator=(const ResponseRef&);
+
+    IHttpResponse *m_response;
+};
+
+
+HttpRequestParams MakeRequest(const std::string& url, const std::string& headers, int flags)
+{
+    HttpRequestParams request;
+    request.URL = url;
+    request.Headers = headers;
+    request.BypassProxies = (flags & Download_BypassProxies) != 0;
+    return request;
+}
+
+
+std::wstring GetURLFileName(const std::string& url)
+{
+    std::string fn(url);
+    if (fn.find_first_of('?') != std::string::npos)
+        fn = fn.substr(0, fn.find_first_of('?'));
+    const size_t lastSlash = fn.find_last_of('/');
+    if (lastSlash != std::string::npos)
+        fn = fn.substr(lastSlash + 1);
+    return AnsiToWide(fn);
+}
+
+
+// Checks the response's status code and gets its validators.
+DownloadInfo GetResponseInfo(const IHttpResponse& response, int flags = 0)
+{
+    DownloadInfo info;
+
+    // Check returned status code - we need to detect 404 instead of
+    // downloading the human-readable 404 page:
+    const unsigned statusCode = response.GetStatusCode();
+    if ( statusCode != 0 )
     {
-        m_callback = callback;
-        InternetSetStatusCallback(m_handle, m_callback);
+        if ( statusCode >= 400 && !(flags & Download_AcceptErrors) )
+            throw std::runtime_error("Update failed, please check your network connection. If the issue persists, contact support.");
+        info.StatusCode = statusCode;
     }
 
-    void Close()
+    response.GetHeader("ETag", info.ETag);
+    response.GetHeader("Last-Modified", info.LastModified);
+
+    return info;
+}
+
+
+bool GetContentLength(const IHttpResponse& response, size_t& length)
+{
+    std::string value;
+    if ( !response.GetHeader("Content-Length", value) || value.empty() )
+        return false;
+
+    char *end;
+    const unsigned long long len = strtoull(value.c_str(), &end, 10);
+    if ( *end != '\0' && *end != ' ' )
+        return false;
+
+    length = (size_t)len;
+    return true;
+}
+
+
+void SetSinkFilename(const IHttpResponse& response, const std::string& url, IDownloadSink *sink)
+{
+    // Get filename fron Content-Disposition, if available
+    std::string contentDisposition;
+    if ( response.GetHeader("Content-Disposition", contentDisposition) )
     {
-        if (m_handle)
+        size_t pos = contentDisposition.find("filename=");
+        if ( pos != std::string::npos )
         {
-            if (m_callback)
-                InternetSetStatusCallback(m_handle, NULL);
-            InternetCloseHandle(m_handle);
-            m_handle = NULL;
+            pos += 9;
+            while ( pos < contentDisposition.length() && contentDisposition[pos] == ' ' )
+                pos++;
+
+            bool quoted = false;
+            if ( pos < contentDisposition.length() &&
+                 (contentDisposition[pos] == '"' || contentDisposition[pos] == '\'') )
+            {
+                quoted = true;
+                pos++;
+            }
+
+            std::string filename = contentDisposition.substr(pos, contentDisposition.find(';', pos) - pos);
+            if ( quoted && !filename.empty() )
+                filename.erase(filename.length() - 1);
+
+            sink->SetFilename(AnsiToWide(filename));
+            return;
         }
     }
 
-    operator HINTERNET() const { return m_handle; }
+    // Use the URL after redirects, if the transport knows it
+    std::string effectiveURL = response.GetURL();
+    if ( effectiveURL.empty() )
+        effectiveURL = url;
+    sink->SetFilename(GetURLFileName(effectiveURL));
+}
+
+
+// Holds a reference to a pooled buffer.
+class BufferRef
+{
+public:
+    BufferRef(DownloadBuffer *buffer) : m_buffer(buffer) {}
+    ~BufferRef() { m_buffer->Release(); }
+
+    DownloadBuffer *operator->() const { return m_buffer; }
+    operator DownloadBuffer*() const { return m_buffer; }
 
-    HINTERNET m_handle;
-    INTERNET_STATUS_CALLBACK m_callback;
+private:
+    BufferRef(const BufferRef&);
+    BufferRef& operator=(const BufferRef&);
+
+    DownloadBuffer *m_buffer;
 };
 
-std::wstring MakeUserAgent()
+
+CriticalSection gs_csReadStats;
+DownloadReadStats gs_readStats;
+
+// Reads response data into pooled buffers. The size of reads adapts to the
+// connection: when a read fills the whole buffer, more data are probably
+// ready, so the next read is larger; if reads repeatedly return only a small
+// part of the buffer, it's too large to be useful.
+//
+// If the download is throttled, reads are kept small enough not to exceed
+// the throttle's bursts and the reader waits for the throttle after each.
+class AdaptiveReader
 {
-    std::wstring userAgent =
-        Settings::GetAppName() + L"/" + Settings::GetAppVersion() +
-        L" WinSparkle/" + AnsiToWide(WIN_SPARKLE_VERSION_STRING);
+public:
+    AdaptiveReader(IHttpResponse& response, DownloadThrottle *throttle = NULL, Thread *onThread = NULL)
+        : m_response(response), m_throttle(throttle), m_thread(onThread),
+          m_size(READ_SIZE_MIN), m_underfilled(0)
+    {}
 
-#ifdef _WIN64
-    userAgent += L" (Win64)";
-#else
-    // If we're running a 32bit process, check if we're on 64bit Windows OS:
-    auto f_IsWow64Process = LOAD_DYNAMIC_FUNC(IsWow64Process, kernel32);
-    if( f_IsWow64Process )
+    // Returns buffer for the next read. Use a fresh buffer for every read,
+    // the sink may still hold the previous one.
+    DownloadBuffer *NewBuffer()
     {
-        BOOL wow64 = FALSE;
-        f_IsWow64Process(GetCurrentProcess(), &wow64);
-        if ( wow64 )
-            userAgent += L" (WOW64)";
+        return BufferPool::GetShared(m_size).Get();
     }
 
-#endif
+    // Reads next chunk of data into the buffer; returns 0 at the end.
+    size_t Read(DownloadBuffer *buffer)
+    {
+        const size_t size = buffer->GetCapacity();
+
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        const size_t len = m_response.Read(buffer->GetData(), size);
+        const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
 
-    return userAgent;
+        RecordRead(size, len, std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
+
+        size_t maxSize = READ_SIZE_MAX;
+        if ( m_throttle )
+        {
+            m_throttle->Consume(len, m_thread);
+
+            const size_t maxRead = m_throttle->GetMaxRead();
+            if ( maxRead != 0 )
+                maxSize = std::max(std::min(maxSize, maxRead), READ_SIZE_MIN);
+            while ( m_size > maxSize )
+                m_size = std::max(m_size / 4, READ_SIZE_MIN);
+        }
+
+        if ( len == size )
+        {
+            m_underfilled = 0;
+            if ( m_size * 4 <= maxSize )
+                m_size *= 4;
+        }
+        else if ( len != 0 && len < size / 4 )
+        {
+            if ( ++m_underfilled >= 4 && m_size > READ_SIZE_MIN )
+            {
+                m_size = std::max(m_size / 4, READ_SIZE_MIN);
+                m_underfilled = 0;
+            }
+        }
+        else
+        {
+            m_underfilled = 0;
+        }
+
+        return len;
+    }
+
+private:
+    static void RecordRead(size_t size, size_t len, unsigned long long latency)
+    {
+        CriticalSectionLocker lock(gs_csReadStats);
+        gs_readStats.Reads++;
+        gs_readStats.Bytes += len;
+        gs_readStats.ReadSizes[size]++;
+        gs_readStats.TotalLatency += latency;
+        gs_readStats.MaxLatency = std::max(gs_readStats.MaxLatency, latency);
+    }
+
+    IHttpResponse& m_response;
+    DownloadThrottle *m_throttle;
+    Thread *m_thread;
+    size_t m_size;          // size of the next read
+    unsigned m_underfilled; // number of consecutive reads much smaller than m_size
+};
+
+
+// Reads the rest of the response into the sink. Returns the number of bytes
+// read.
+size_t ReadToSink(IHttpResponse& response, IDownloadSink *sink,
+                  DownloadThrottle *throttle = NULL, Thread *onThread = NULL)
+{
+    AdaptiveReader reader(response, throttle, onThread);
+    size_t total = 0;
+    for ( ;; )
+    {
+        BufferRef buffer(reader.NewBuffer());
+        const size_t len = reader.Read(buffer);
+        if ( len == 0 )
+            break; // all of the file was downloaded
+
+        total += len;
+        sink->AddBuffer(buffer, len);
+
+        if (sink->IsComplete())
+            break; // the sink has all it needs, don't bother with the rest
+    }
+
+    return total;
 }
 
 
-bool GetHttpHeader(HINTERNET handle, DWORD whatToGet, DWORD& output)
+/*--------------------------------------------------------------------------*
+                            segmented downloads
+ *--------------------------------------------------------------------------*/
+
+// Interval between saving progress of a segmented download, in ms
+const unsigned SAVE_PROGRESS_INTERVAL = 1000;
+
+// Interval between measurements of delay for background downloads, in ms
+const unsigned DELAY_PROBE_INTERVAL = 1000;
+
+
+bool RangeLess(const PartialDownload::Range& a, const PartialDownload::Range& b)
 {
-    DWORD outputSize = sizeof(output);
-    DWORD headerIndex = 0;
-    return HttpQueryInfoA
-           (
-               handle,
-               whatToGet | HTTP_QUERY_FLAG_NUMBER,
-               &output,
-               &outputSize,
-               &headerIndex
-           ) == TRUE;
+    return a.From < b.From;
 }
 
+// Sorts the ranges and merges overlapping or adjacent ones.
+void NormalizeRanges(std::vector<PartialDownload::Range>& ranges)
+{
+    std::sort(ranges.begin(), ranges.end(), RangeLess);
 
-std::wstring GetURLFileName(const char *url)
+    std::vector<PartialDownload::Range> merged;
+    for ( size_t i = 0; i < ranges.size(); i++ )
+    {
+        const PartialDownload::Range& r = ranges[i];
+        if ( r.From >= r.To )
+            continue;
+        if ( !merged.empty() && r.From <= merged.back().To )
+        {
+            if ( r.To > merged.back().To )
+                merged.back().To = r.To;
+        }
+        else
+        {
+            merged.push_back(r);
+        }
+    }
+
+    ranges.swap(merged);
+}
+
+// Returns ranges of the resource that weren't downloaded yet.
+std::vector<PartialDownload::Range> GetMissingRanges(const PartialDownload& state)
 {
-    const char *lastSlash = strrchr(url, '/');
-    std::string fn(lastSlash ? lastSlash + 1 : url);
-    if (fn.find_first_of('?') != std::string::npos)
-        fn = fn.substr(0, fn.find_first_of('?'));
-    return AnsiToWide(fn);
+    std::vector<PartialDownload::Range> completed(state.Completed);
+    NormalizeRanges(completed);
+
+    std::vector<PartialDownload::Range> missing;
+    size_t pos = 0;
+    for ( size_t i = 0; i < completed.size() && pos < state.Length; i++ )
+    {
+        if ( completed[i].From > pos )
+        {
+            PartialDownload::Range r = { pos, std::min(completed[i].From, state.Length) };
+            missing.push_back(r);
+        }
+        pos = std::max(pos, completed[i].To);
+    }
+    if ( pos < state.Length )
+    {
+        PartialDownload::Range r = { pos, state.Length };
+        missing.push_back(r);
+    }
+
+    return missing;
 }
 
-struct DownloadCallbackContext
+
+// Shared state of a segmented download.
+//
+// The resource is split into segments, each of which is downloaded over its
+// own connection. Initially, there's one segment for every missing range,
+// the first of them served by the initial request. Whenever a connection is
+// idle, it takes over a segment nobody works on or steals the second half of
+// the largest remaining one, so that the work is distributed evenly and slow
+// connections don't hold the download back.
+//
+// All calls to the sink are serialized here.
+class SegmentScheduler
 {
-    DownloadCallbackContext(InetHandle *conn_) : conn(conn_), lastError(ERROR_SUCCESS) {}
-    InetHandle *conn;
-    DWORD lastError;
-    Event eventRequestComplete;
+public:
+    SegmentScheduler(IRandomAccessDownloadSink *sink, const PartialDownload& state)
+        : m_sink(sink), m_state(state), m_lastSave(GetMonotonicTime()), m_sinkFailed(false)
+    {
+        NormalizeRanges(m_state.Completed);
+
+        const std::vector<PartialDownload::Range> missing = GetMissingRanges(m_state);
+        for ( size_t i = 0; i < missing.size(); i++ )
+        {
+            Segment s = { missing[i].From, missing[i].From, missing[i].To, i == 0 };
+            m_segments.push_back(s);
+        }
+    }
+
+    // Assigns a segment to a connection. Returns false if there's no more
+    // work to do.
+    bool Acquire(size_t& index, size_t& from, size_t& to)
+    {
+        CriticalSectionLocker lock(m_cs);
+
+        // Segments nobody works on (not started yet or orphaned by failed
+        // connections) are taken over as a whole
+        for ( size_t i = 0; i < m_segments.size(); i++ )
+        {
+            Segment& s = m_segments[i];
+            if ( !s.owned && s.pos < s.end )
+            {
+                s.owned = true;
+                index = i;
+                from = s.pos;
+                to = s.end;
+                return true;
+            }
+        }
+
+        // Otherwise, help with the largest remaining segment
+        size_t largest = 0;
+        size_t largestSize = 0;
+        for ( size_t i = 0; i < m_segments.size(); i++ )
+        {
+            const Segment& s = m_segments[i];
+            if ( s.pos < s.end && s.end - s.pos > largestSize )
+            {
+                largest = i;
+                largestSize = s.end - s.pos;
+            }
+        }
+
+        if ( largestSize < 2 * SEGMENT_MIN_SIZE )
+            return false;
+
+        Segment& victim = m_segments[largest];
+        const size_t mid = victim.pos + largestSize / 2;
+        Segment stolen = { mid, mid, victim.end, true };
+        victim.end = mid;
+        m_segments.push_back(stolen);
+
+        index = m_segments.size() - 1;
+        from = stolen.pos;
+        to = stolen.end;
+        return true;
+    }
+
+    // Stores data downloaded for given segment. Returns false once the
+    // segment is complete and the connection should move on.
+    bool Commit(size_t index, DownloadBuffer *buffer, size_t len)
+    {
+        CriticalSectionLocker lock(m_cs);
+
+        Segment& s = m_segments[index];
+        // the end may have been moved by another connection in the meantime
+        if ( len > s.end - s.pos )
+            len = s.end - s.pos;
+
+        try
+        {
+            m_sink->AddBufferAt(s.pos, buffer, len);
+            s.pos += len;
+
+            if ( GetMonotonicTime() - m_lastSave >= SAVE_PROGRESS_INTERVAL )
+                DoSaveProgress();
+        }
+        catch ( ... )
+        {
+            m_sinkFailed = true;
+            throw;
+        }
+
+        if ( s.pos < s.end )
+            return true;
+
+        m_changed.Signal();
+        return false;
+    }
+
+    // Gives up the segment after its connection failed.
+    void Release(size_t index)
+    {
+        CriticalSectionLocker lock(m_cs);
+        m_segments[index].owned = false;
+        m_changed.Signal();
+    }
+
+    // Returns true if storing the data failed. Such errors aren't the
+    // server's fault and downloading from a mirror wouldn't help.
+    bool SinkFailed()
+    {
+        CriticalSectionLocker lock(m_cs);
+        return m_sinkFailed;
+    }
+
+    // Returns true if all data were downloaded.
+    bool IsDone()
+    {
+        CriticalSectionLocker lock(m_cs);
+        for ( size_t i = 0; i < m_segments.size(); i++ )
+        {
+            if ( m_segments[i].pos < m_segments[i].end )
+                return false;
+        }
+        return true;
+    }
+
+    // Waits until some segment is completed or released.
+    void WaitForChange(unsigned timeoutMilliseconds)
+    {
+        m_changed.WaitUntilSignaled(timeoutMilliseconds);
+    }
+
+    // Reports progress to the sink immediately.
+    void SaveProgress()
+    {
+        CriticalSectionLocker lock(m_cs);
+        DoSaveProgress();
+    }
+
+private:
+    void DoSaveProgress()
+    {
+        PartialDownload state(m_state);
+        for ( size_t i = 0; i < m_segments.size(); i++ )
+        {
+            PartialDownload::Range r = { m_segments[i].start, m_segments[i].pos };
+            state.Completed.push_back(r);
+        }
+        NormalizeRanges(state.Completed);
+
+        m_sink->SaveProgress(state);
+        m_lastSave = GetMonotonicTime();
+    }
+
+    struct Segment
+    {
+        size_t start;   // where the segment started, [start,pos) is done
+        size_t pos;     // next byte to download
+        size_t end;     // end of the segment (exclusive)
+        bool owned;     // is some connection working on it?
+    };
+
+    CriticalSection m_cs;
+    Event m_changed;
+    IRandomAccessDownloadSink *m_sink;
+    PartialDownload m_state;  // with ranges completed before this attempt
+    unsigned long long m_lastSave;
+    bool m_sinkFailed;
+    std::vector<Segment> m_segments;
 };
 
-void CALLBACK DownloadInternetStatusCallback(_In_ HINTERNET hInternet,
-                                             _In_ DWORD_PTR dwContext,
-                                             _In_ DWORD     dwInternetStatus,
-                                             _In_ LPVOID    lpvStatusInformation,
-                                             _In_ DWORD     dwStatusInformationLength)
+
+// Checks that the response to a range request starts at @a from and that
+// the resource has the expected length.
+bool CheckContentRange(const IHttpResponse& response, size_t from, size_t length)
 {
-    DownloadCallbackContext *context = (DownloadCallbackContext*)dwContext;
-    INTERNET_ASYNC_RESULT *res = (INTERNET_ASYNC_RESULT*)lpvStatusInformation;
+    std::string contentRange;
+    if ( !response.GetHeader("Content-Range", contentRange) )
+        return false;
+
+    // unsigned long is only 32bit on Windows, even in 64bit builds
+    unsigned long long rangeFrom, rangeTo, total;
+    if ( sscanf(contentRange.c_str(), "bytes %llu-%llu/%llu", &rangeFrom, &rangeTo, &total) != 3 )
+        return false;
 
-    switch (dwInternetStatus)
+    return rangeFrom == (unsigned long long)from && total == (unsigned long long)length;
+}
+
+
+// Downloads data of a segment that starts at the current position of
+// an already open request. Returns the number of bytes downloaded.
+size_t ReadSegment(IHttpResponse& response, SegmentScheduler& scheduler, size_t index,
+                   DownloadThrottle *throttle, Thread *onThread)
+{
+    AdaptiveReader reader(response, throttle, onThread);
+    size_t total = 0;
+    for ( ;; )
     {
-        case INTERNET_STATUS_HANDLE_CREATED:
-            context->conn->m_handle = (HINTERNET)(res->dwResult);
-            break;
+        BufferRef buffer(reader.NewBuffer());
+        const size_t len = reader.Read(buffer);
+        if ( len == 0 )
+            throw DownloadException("Incomplete download");
 
-        case INTERNET_STATUS_REQUEST_COMPLETE:
-            context->lastError = res->dwError;
-            context->eventRequestComplete.Signal();
-            break;
+        total += len;
+        if ( !scheduler.Commit(index, buffer, len) )
+            return total;
     }
 }
 
-void WaitUntilSignaledWithTerminationCheck(Event& event, Thread *thread)
+
+HttpRequestParams MakeRangeRequest(const HttpRequestParams& request, size_t from, size_t to)
+{
+    HttpRequestParams range(request);
+    range.HasRange = true;
+    range.RangeFrom = from;
+    range.RangeTo = to;
+    return range;
+}
+
+
+// Where range requests of a segmented download are sent. All connections
+// use the same URL; when a request to it fails, they move on to a mirror,
+// if there's any.
+class RangeSource
 {
-    for (;;)
+public:
+    RangeSource(IHttpTransport& transport, const HttpRequestParams& request,
+                IDownloadMirrors *mirrors, DownloadThrottle *throttle)
+        : m_transport(transport), m_request(request), m_mirrors(mirrors),
+          m_throttle(throttle), m_length(0)
+    {}
+
+    // Makes requests to the URL conditional: only ranges of the resource
+    // with given validator and length are accepted. Without a validator,
+    // only the length is checked, as with mirrors.
+    void SetValidator(const std::string& validator, size_t length)
     {
-        if (thread)
-            thread->CheckShouldTerminate();
-        if (event.WaitUntilSignaled(100))
-            return;
+        m_validatedURL = m_request.URL;
+        m_validator = validator;
+        m_length = length;
     }
-}
 
-} // anonymous namespace
+    IHttpTransport& GetTransport() { return m_transport; }
 
+    DownloadThrottle *GetThrottle() { return m_throttle; }
 
-/*--------------------------------------------------------------------------*
-                                public functions
- *--------------------------------------------------------------------------*/
+    std::string GetURL()
+    {
+        CriticalSectionLocker lock(m_cs);
+        return m_request.URL;
+    }
 
-void DownloadFile(const std::string& url, IDownloadSink* sink, Thread* onThread, const std::string& headers_, int flags)
-{
-    std::string headers = headers_;
-    char url_path[2048];
-    URL_COMPONENTSA urlc;
-    memset(&urlc, 0, sizeof(urlc));
-    urlc.dwStructSize = sizeof(urlc);
-    urlc.lpszUrlPath = url_path;
-    urlc.dwUrlPathLength = sizeof(url_path);
-
-    if ( !InternetCrackUrlA(url.c_str(), 0, ICU_DECODE, &urlc) )
-        throw DownloadException();
-
-    InetHandle inet = InternetOpen
-                      (
-                          MakeUserAgent().c_str(),
-                          INTERNET_OPEN_TYPE_PRECONFIG,
-                          NULL, // lpszProxyName
-                          NULL, // lpszProxyBypass
-                          INTERNET_FLAG_ASYNC // dwFlags
-                      );
-    if ( !inet )
-        throw DownloadException();
-
-    DWORD dwOption = HTTP_PROTOCOL_FLAG_HTTP2;
-    InternetSetOptionW(inet, INTERNET_OPTION_ENABLE_HTTP_PROTOCOL, &dwOption, sizeof(dwOption));
-
-    if (IsWindowsVistaOrGreater())
-    {
-        DWORD dwEnableHttpDecoding = TRUE;
-        InternetSetOptionW(inet, INTERNET_OPTION_HTTP_DECODING, &dwEnableHttpDecoding, sizeof(dwEnableHttpDecoding));
-        headers += "Accept-Encoding: gzip, deflate\r\n";
-    }
-
-    // Never allow local caching, always contact the server for both
-    // appcast feeds and downloads. This is useful in case of
-    // misconfigured servers.
-    DWORD dwFlags = INTERNET_FLAG_NO_CACHE_WRITE | INTERNET_FLAG_RELOAD;
-    // For some requests (appcast feeds), don't even allow proxies to cache,
-    // as we need the most up-to-date information.
-    if ( flags & Download_BypassProxies )
-        dwFlags |= INTERNET_FLAG_PRAGMA_NOCACHE;
-    if ( urlc.nScheme == INTERNET_SCHEME_HTTPS )
-        dwFlags |= INTERNET_FLAG_SECURE;
-
-    InetHandle conn;
-
-    DownloadCallbackContext context(&conn);
-    inet.SetStatusCallback(&DownloadInternetStatusCallback);
-
-    HINTERNET conn_raw = InternetOpenUrlA
-                         (
-                             inet,
-                             url.c_str(),
-                             headers.c_str(),
-                             (DWORD)headers.length(),
-                             dwFlags,
-                             (DWORD_PTR)&context  // dwContext
-                         );
-    // InternetOpenUrl() may return NULL handle and then fill it in asynchronously from 
-    // DownloadInternetStatusCallback. We must make sure we don't overwrite the handle
-    // in that case, or throw an error.
-    if (conn_raw)
-    {
-        conn = conn_raw;
+    // Returns request for the range at the current URL.
+    HttpRequestParams MakeRequest(size_t from, size_t to)
+    {
+        CriticalSectionLocker lock(m_cs);
+        HttpRequestParams request = MakeRangeRequest(m_request, from, to);
+        // validators of different mirrors don't match, so only the length
+        // can be checked there
+        if ( request.URL == m_validatedURL && !m_validator.empty() )
+            request.Headers += "If-Range: " + m_validator + "\r\n";
+        return request;
     }
-    else
+
+    // Checks the response to a request made by MakeRequest().
+    void CheckResponse(const IHttpResponse& response, size_t from)
     {
-        if (GetLastError() != ERROR_IO_PENDING)
-            throw DownloadException();
+        // The server must send just the range; anything else means that
+        // ranges don't work after all or that the resource changed.
+        if ( response.GetStatusCode() != 206 ||
+             !CheckContentRange(response, from, m_length) )
+        {
+            throw DownloadException("Range request failed");
+        }
     }
 
-    WaitUntilSignaledWithTerminationCheck(context.eventRequestComplete, onThread);
+    // Moves on to a mirror after a request to @a failedURL failed. Returns
+    // false if there's none left.
+    bool Failover(const std::string& failedURL)
+    {
+        CriticalSectionLocker lock(m_cs);
 
-    // Check returned status code - we need to detect 404 instead of
-    // downloading the human-readable 404 page:
-    DWORD statusCode;
-    if ( GetHttpHeader(conn, HTTP_QUERY_STATUS_CODE, statusCode) && statusCode >= 400 )
+        // another connection already moved on
+        if ( failedURL != m_request.URL )
+            return true;
+
+        if ( !m_mirrors )
+            return false;
+        const std::string url = m_mirrors->GetFailoverURL(failedURL);
+        if ( url.empty() )
+            return false;
+
+        m_request.URL = url;
+        return true;
+    }
+
+    void ReportTransfer(const std::string& url, unsigned timeToHeaders, size_t bytes, unsigned duration)
     {
-        throw std::runtime_error("Update failed, please check your network connection. If the issue persists, contact support.");
+        CriticalSectionLocker lock(m_cs);
+        if ( m_mirrors )
+            m_mirrors->ReportTransfer(url, timeToHeaders, bytes, duration);
     }
 
-    // Get content length if possible:
-    DWORD contentLength;
-    if ( GetHttpHeader(conn, HTTP_QUERY_CONTENT_LENGTH, contentLength) )
-        sink->SetLength(contentLength);
+private:
+    CriticalSection m_cs;
+    IHttpTransport& m_transport;
+    HttpRequestParams m_request;    // common for all, with the current URL
+    IDownloadMirrors *m_mirrors;
+    DownloadThrottle *m_throttle;
+    std::string m_validatedURL;
+    std::string m_validator;
+    size_t m_length;
+};
 
-    // Get filename fron Content-Disposition, if available
-    char contentDisposition[512];
-    DWORD cdSize = 512;
-    bool filename_set = false;
-    if ( HttpQueryInfoA(conn, HTTP_QUERY_CONTENT_DISPOSITION, contentDisposition, &cdSize, NULL) )
+
+// Acquires and downloads segments until there's nothing left to do.
+void DownloadSegments(RangeSource& source, SegmentScheduler& scheduler, Thread *onThread)
+{
+    size_t index, from, to;
+    while ( scheduler.Acquire(index, from, to) )
     {
-        char *ptr = strstr(contentDisposition, "filename=");
-        if ( ptr )
+        const HttpRequestParams request = source.MakeRequest(from, to);
+        try
         {
-            char c_filename[512];
-            ptr += 9;
-            while ( *ptr == ' ' )
-                ptr++;
+            const unsigned long long start = GetMonotonicTime();
 
-            bool quoted = false;
-            if ( *ptr == '"' || *ptr == '\'')
+            ResponseRef response(source.GetTransport().Send(request, onThread));
+            source.CheckResponse(*response, from);
+
+            const size_t bytes = ReadSegment(*response, scheduler, index, source.GetThrottle(), onThread);
+
+            source.ReportTransfer(request.URL, response->GetTimeToHeaders(), bytes,
+                                  unsigned(GetMonotonicTime() - start));
+        }
+        catch ( const std::runtime_error& )
+        {
+            // Transport errors, error responses and broken connections all
+            // mean the same: continue on a mirror, if possible.
+            scheduler.Release(index);
+            if ( scheduler.SinkFailed() || !source.Failover(request.URL) )
+                throw;
+        }
+        catch ( ... )
+        {
+            scheduler.Release(index);
+            throw;
+        }
+    }
+}
+
+
+// Additional connection of a segmented download.
+class SegmentDownloadThread : public Thread
+{
+public:
+    SegmentDownloadThread(RangeSource& source, SegmentScheduler& scheduler)
+        : Thread("WinSparkle download segment"),
+          m_source(source), m_scheduler(scheduler)
+    {}
+
+protected:
+    virtual void Run()
+    {
+        SignalReady();
+
+        DownloadThrottle *throttle = m_source.GetThrottle();
+        BackgroundModeScope mode(throttle && throttle->IsBackground());
+
+        // Failures of additional connections aren't fatal: their segments
+        // are taken over by the remaining connections.
+        try
+        {
+            DownloadSegments(m_source, m_scheduler, this);
+        }
+        catch ( const std::exception& e )
+        {
+            LogError(e.what());
+        }
+    }
+
+    virtual bool IsJoinable() const { return true; }
+
+private:
+    RangeSource& m_source;
+    SegmentScheduler& m_scheduler;
+};
+
+
+// Owns additional connections' threads and stops them when done.
+class SegmentDownloadThreads
+{
+public:
+    SegmentDownloadThreads() {}
+
+    ~SegmentDownloadThreads()
+    {
+        for ( size_t i = 0; i < m_threads.size(); i++ )
+        {
+            m_threads[i]->TerminateAndJoin();
+            delete m_threads[i];
+        }
+    }
+
+    void Start(RangeSource& source, SegmentScheduler& scheduler)
+    {
+        SegmentDownloadThread *thread = new SegmentDownloadThread(source, scheduler);
+        m_threads.push_back(thread);
+        thread->Start();
+    }
+
+private:
+    SegmentDownloadThreads(const SegmentDownloadThreads&);
+    SegmentDownloadThreads& operator=(const SegmentDownloadThreads&);
+
+    std::vector<SegmentDownloadThread*> m_threads;
+};
+
+
+// Downloads all segments, starting with the first one served by the already
+// open initial request to the source's current URL.
+void DownloadAllSegments(ResponseRef& response,
+                         RangeSource& source,
+                         SegmentScheduler& scheduler,
+                         unsigned maxConnections,
+                         Thread *onThread)
+{
+    try
+    {
+        const std::string initialURL = source.GetURL();
+
+        SegmentDownloadThreads threads;
+        for ( unsigned i = 1; i < maxConnections; i++ )
+            threads.Start(source, scheduler);
+
+        // The initial request serves the first segment, then this thread
+        // helps with the rest like the others.
+        try
+        {
+            ReadSegment(*response, scheduler, 0, source.GetThrottle(), onThread);
+        }
+        catch ( const std::runtime_error& )
+        {
+            scheduler.Release(0);
+            if ( scheduler.SinkFailed() )
+                throw;
+            source.Failover(initialURL);
+        }
+        response.Close();
+
+        for ( ;; )
+        {
+            DownloadSegments(source, scheduler, onThread);
+
+            if ( scheduler.IsDone() )
+                break;
+
+            // Some segments are still being downloaded by other connections
+            // and can't be split any further; wait for them to finish or fail.
+            if ( onThread )
+                onThread->CheckShouldTerminate();
+            scheduler.WaitForChange(100);
+        }
+    }
+    catch ( ... )
+    {
+        // remember what we have, so that the download can be resumed later
+        scheduler.SaveProgress();
+        throw;
+    }
+}
+
+
+// Measures network delay for a background download's throttle, by sending
+// small range requests to the server periodically.
+class DelayProbeThread : public Thread
+{
+public:
+    DelayProbeThread(const std::string& url, DownloadThrottle& throttle)
+        : Thread("WinSparkle download delay probe"),
+          m_url(url), m_throttle(throttle)
+    {}
+
+protected:
+    virtual void Run()
+    {
+        SignalReady();
+
+        HttpRequestParams request;
+        request.URL = m_url;
+        request.HasRange = true;
+        request.RangeFrom = 0;
+        request.RangeTo = 1;
+
+        for ( ;; )
+        {
+            try
             {
-                quoted = true;
-                ptr++;
+                ResponseRef response(GetHttpTransport().Send(request, this));
+                if ( response->GetStatusCode() == 206 )
+                    m_throttle.AddDelaySample(response->GetTimeToHeaders());
+            }
+            catch ( const std::exception& )
+            {
+                // failures are the download's business
             }
 
-            char *ptr2 = c_filename;
-            while ( *ptr != ';' && *ptr != 0)
-                *ptr2++ = *ptr++;
+            if ( m_terminateEvent.WaitUntilSignaled(DELAY_PROBE_INTERVAL) )
+                return;
+        }
+    }
+
+    virtual bool IsJoinable() const { return true; }
 
-            if ( quoted )
-                *(ptr2 - 1) = 0;
-            else
-                *ptr2 = 0;
+private:
+    std::string m_url;
+    DownloadThrottle& m_throttle;
+};
+
+
+// Runs DelayProbeThread while in scope, if the throttle needs it.
+class DelayProbe
+{
+public:
+    DelayProbe() : m_thread(NULL) {}
 
-            sink->SetFilename(AnsiToWide(c_filename));
-            filename_set = true;
+    ~DelayProbe()
+    {
+        if ( m_thread )
+        {
+            m_thread->TerminateAndJoin();
+            delete m_thread;
         }
     }
 
-    if ( !filename_set )
+    // Starts probing @a url; it must support range requests, so that
+    // the probes don't download all of it.
+    void Start(const std::string& url, DownloadThrottle *throttle)
     {
-        DWORD ousize = 0;
-        InternetQueryOptionA(conn, INTERNET_OPTION_URL, NULL, &ousize);
-        if (GetLastError() == ERROR_INSUFFICIENT_BUFFER)
+        if ( m_thread || !throttle || !throttle->IsBackground() )
+            return;
+
+        m_thread = new DelayProbeThread(url, *throttle);
+        m_thread->Start();
+    }
+
+private:
+    DelayProbe(const DelayProbe&);
+    DelayProbe& operator=(const DelayProbe&);
+
+    DelayProbeThread *m_thread;
+};
+
+
+// Sends the initial request of a download and checks its response. If that
+// fails, the request is repeated on mirrors, if there are any, and its URL
+// is updated.
+IHttpResponse *SendWithFailover(IHttpTransport& transport,
+                                HttpRequestParams& request,
+                                IDownloadMirrors *mirrors,
+                                Thread *onThread,
+                                DownloadInfo& info)
+{
+    for ( ;; )
+    {
+        try
         {
-            DataBuffer<char> optionurl(ousize);
-            if ( InternetQueryOptionA(conn, INTERNET_OPTION_URL, optionurl, &ousize) )
-                sink->SetFilename(GetURLFileName(optionurl));
-            else
-                sink->SetFilename(GetURLFileName(urlc.lpszUrlPath));
+            ResponseRef response(transport.Send(request, onThread));
+            info = GetResponseInfo(*response);
+            return response.Detach();
         }
-        else
+        catch ( const std::runtime_error& )
         {
-            sink->SetFilename(GetURLFileName(urlc.lpszUrlPath));
+            const std::string url = mirrors ? mirrors->GetFailoverURL(request.URL) : std::string();
+            if ( url.empty() )
+                throw;
+            request.URL = url;
         }
     }
+}
 
-    // Download the data:
-    char buffer[10240];
-    for ( ;; )
+} // anonymous namespace
+
+
+/*--------------------------------------------------------------------------*
+                                public functions
+ *--------------------------------------------------------------------------*/
+
+void CloseDownloadSession()
+{
+    GetHttpTransport().Close();
+}
+
+
+std::wstring FormatPartialDownload(const PartialDownload& state)
+{
+    // lines with the URL, validator, length and completed ranges
+    std::wostringstream text;
+    text << AnsiToWide(state.URL) << L'\n'
+         << AnsiToWide(state.Validator) << L'\n'
+         << state.Length << L'\n';
+    for ( size_t i = 0; i < state.Completed.size(); i++ )
+        text << state.Completed[i].From << L'-' << state.Completed[i].To << L' ';
+    return text.str();
+}
+
+
+bool ParsePartialDownload(const std::wstring& text, PartialDownload& state)
+{
+    std::wistringstream lines(text);
+    std::wstring url, validator, length, ranges;
+    if ( !std::getline(lines, url) ||
+         !std::getline(lines, validator) ||
+         !std::getline(lines, length) )
+        return false;
+    std::getline(lines, ranges);
+
+    if ( url.empty() )
+        return false;
+
+    state.URL = WideToAnsi(url);
+    state.Validator = WideToAnsi(validator);
+
+    std::wistringstream lengthStream(length);
+    if ( !(lengthStream >> state.Length) || !(lengthStream >> std::ws).eof() )
+        return false;
+
+    state.Completed.clear();
+    std::wistringstream rangesStream(ranges);
+    std::wstring token;
+    while ( rangesStream >> token )
     {
-        INTERNET_BUFFERS ibuf = { 0 };
-        ibuf.dwStructSize = sizeof(ibuf);
-        ibuf.lpvBuffer = buffer;
-        ibuf.dwBufferLength = sizeof(buffer);
+        // every range must be complete, otherwise the text is damaged
+        std::wistringstream rangeStream(token);
+        PartialDownload::Range r;
+        wchar_t dash;
+        if ( !(rangeStream >> r.From >> dash >> r.To) || !rangeStream.eof() ||
+             dash != L'-' || r.From >= r.To || r.To > state.Length )
+            return false;
+        state.Completed.push_back(r);
+    }
+
+    return true;
+}
+
+
+DownloadReadStats GetDownloadReadStats()
+{
+    CriticalSectionLocker lock(gs_csReadStats);
+    return gs_readStats;
+}
+
 
-        if (!InternetReadFileEx(conn, &ibuf, IRF_ASYNC | IRF_NO_WAIT, NULL))
+void IDownloadSink::AddBuffer(DownloadBuffer *buffer, size_t len)
+{
+    Add(buffer->GetData(), len);
+}
+
+
+void IRandomAccessDownloadSink::AddBufferAt(size_t offset, DownloadBuffer *buffer, size_t len)
+{
+    AddAt(offset, buffer->GetData(), len);
+}
+
+
+DownloadInfo DownloadFile(const std::string& url, IDownloadSink* sink, Thread* onThread, const std::string& headers, int flags)
+{
+    HttpRequestParams request = MakeRequest(url, headers, flags);
+    request.AcceptEncoding = true;
+
+    ResponseRef response(GetHttpTransport().Send(request, onThread));
+
+    const DownloadInfo info = GetResponseInfo(*response, flags);
+
+    // Conditional request and the resource didn't change, there's no data
+    if ( info.IsNotModified() )
+        return info;
+
+    // Get content length if possible:
+    size_t contentLength;
+    if ( GetContentLength(*response, contentLength) )
+        sink->SetLength(contentLength);
+
+    SetSinkFilename(*response, url, sink);
+
+    // Download the data:
+    ReadToSink(*response, sink);
+
+    return info;
+}
+
+
+DownloadInfo DownloadFileSegmented(const std::string& url, IRandomAccessDownloadSink *sink, Thread *onThread, unsigned maxConnections, const PartialDownload *resumeFrom, IDownloadMirrors *mirrors, DownloadThrottle *throttle)
+{
+    BackgroundModeScope mode(throttle && throttle->IsBackground());
+    DelayProbe delayProbe;
+
+    // Compressed responses can't be downloaded in ranges, as the ranges
+    // would refer to the compressed data. Installers don't compress well
+    // anyway, so AcceptEncoding is left off.
+    HttpRequestParams request = MakeRequest(url, "", 0);
+    IHttpTransport& transport = GetHttpTransport();
+
+    if ( resumeFrom && resumeFrom->URL == url )
+    {
+        const std::vector<PartialDownload::Range> missing = GetMissingRanges(*resumeFrom);
+        if ( missing.empty() )
+        {
+            // nothing to download, e.g. all of it was available locally
+            if ( sink->ResumePartial(*resumeFrom) )
+                return DownloadInfo();
+        }
+        else
         {
-            if (GetLastError() != ERROR_IO_PENDING)
-                throw DownloadException();
+            RangeSource source(transport, request, mirrors, throttle);
+            source.SetValidator(resumeFrom->Validator, resumeFrom->Length);
 
-            WaitUntilSignaledWithTerminationCheck(context.eventRequestComplete, onThread);
-            continue;
+            // If the resource changed, the server sends all of it instead
+            // of the range, or 416 if it's shorter now, and we have to start
+            // over. So do we if the request fails: the full request below
+            // fails over to mirrors.
+            IHttpResponse *resumed = NULL;
+            try
+            {
+                resumed = transport.Send(source.MakeRequest(missing[0].From, missing[0].To), onThread);
+            }
+            catch ( const std::runtime_error& e )
+            {
+                LogError(e.what());
+            }
+
+            ResponseRef response(resumed);
+            if ( resumed )
+            {
+                const DownloadInfo info = GetResponseInfo(*response, Download_AcceptErrors);
+                if ( info.StatusCode == 206 &&
+                     CheckContentRange(*response, missing[0].From, resumeFrom->Length) &&
+                     sink->ResumePartial(*resumeFrom) )
+                {
+                    delayProbe.Start(url, throttle);
+
+                    SegmentScheduler scheduler(sink, *resumeFrom);
+                    DownloadAllSegments(response, source, scheduler, maxConnections, onThread);
+                    return info;
+                }
+            }
         }
+    }
+
+    // The initial request is for the whole resource: if the server doesn't
+    // support ranges, it is used to download it in a single stream.
+    const unsigned long long start = GetMonotonicTime();
+    DownloadInfo info;
+    ResponseRef response(SendWithFailover(transport, request, mirrors, onThread, info));
+
+    size_t contentLength = 0;
+    const bool hasLength = GetContentLength(*response, contentLength);
+    if ( hasLength )
+        sink->SetLength(contentLength);
 
-        if (ibuf.dwBufferLength == 0)
+    SetSinkFilename(*response, request.URL, sink);
+
+    // Range requests must be made conditional with a strong validator, so
+    // that parts of different versions of the file are never mixed.
+    std::string validator;
+    if ( !info.ETag.empty() && info.ETag.compare(0, 2, "W/") != 0 )
+        validator = info.ETag;
+    else
+        validator = info.LastModified;
+
+    std::string acceptRanges;
+    response->GetHeader("Accept-Ranges", acceptRanges);
+
+    if ( maxConnections < 2 ||
+         info.StatusCode != 200 ||
+         acceptRanges != "bytes" ||
+         validator.empty() ||
+         !hasLength || contentLength < SEGMENTED_MIN_LENGTH )
+    {
+        // Without range requests, the server can't be probed for delay and
+        // only the fixed rate limit applies.
+        const size_t bytes = ReadToSink(*response, sink, throttle, onThread);
+        if ( mirrors )
         {
-            if (context.lastError != ERROR_SUCCESS)
-                throw DownloadException();
-            else
-                break; // all of the file was downloaded
+            mirrors->ReportTransfer(request.URL, response->GetTimeToHeaders(), bytes,
+                                    unsigned(GetMonotonicTime() - start));
         }
-
-        sink->Add(ibuf.lpvBuffer, ibuf.dwBufferLength);
+        return info;
     }
+
+    sink->Preallocate(contentLength);
+
+    RangeSource source(transport, request, mirrors, throttle);
+    source.SetValidator(validator, contentLength);
+
+    delayProbe.Start(request.URL, throttle);
+
+    PartialDownload state;
+    state.URL = url;
+    state.Validator = validator;
+    state.Length = contentLength;
+
+    SegmentScheduler scheduler(sink, state);
+    DownloadAllSegments(response, source, scheduler, maxConnections, onThread);
+
+    return info;
 }
 
 } // namespace winsparkle
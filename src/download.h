@@ -27,11 +27,15 @@
 #define _download_h_
 
 #include <string>
+#include <vector>
+#include <map>
 
 namespace winsparkle
 {
 
 class Thread;
+class DownloadBuffer;
+class DownloadThrottle;
 
 /**
     Abstraction for storing downloaded data.
@@ -52,6 +56,117 @@ struct IDownloadSink
 
     /// Add chunk of downloaded data
     virtual void Add(const void *data, size_t len) = 0;
+
+    /**
+        Add chunk of downloaded data stored in the first @a len bytes of
+        a pooled buffer.
+
+        The sink may keep a reference to the buffer instead of copying the
+        data, see DownloadBuffer::AddRef(). The default implementation just
+        calls Add().
+     */
+    virtual void AddBuffer(DownloadBuffer *buffer, size_t len);
+
+    /**
+        Returns true if the sink doesn't need any more data.
+
+        DownloadFile() checks this after every chunk and stops the transfer
+        early if it returns true.
+     */
+    virtual bool IsComplete() const { return false; }
+};
+
+/**
+    Progress of a segmented download, used to resume it later.
+
+    See DownloadFileSegmented().
+ */
+struct PartialDownload
+{
+    PartialDownload() : Length(0) {}
+
+    /// Range of bytes from From (inclusive) to To (exclusive).
+    struct Range
+    {
+        size_t From, To;
+    };
+
+    /// URL of the resource.
+    std::string URL;
+
+    /// Strong validator (ETag or Last-Modified value) of the resource.
+    std::string Validator;
+
+    /// Total length of the resource.
+    size_t Length;
+
+    /// Already downloaded ranges, sorted and non-overlapping.
+    std::vector<Range> Completed;
+};
+
+/**
+    Returns text form of @a state, e.g. to store it in the configuration.
+
+    See ParsePartialDownload().
+ */
+std::wstring FormatPartialDownload(const PartialDownload& state);
+
+/**
+    Parses text form of PartialDownload created by FormatPartialDownload().
+
+    Returns false if @a text is malformed or inconsistent, e.g. because it
+    was damaged in storage.
+ */
+bool ParsePartialDownload(const std::wstring& text, PartialDownload& state);
+
+/**
+    Abstraction for storing data that may be downloaded out of order.
+
+    See DownloadFileSegmented().
+ */
+struct IRandomAccessDownloadSink : public IDownloadSink
+{
+    /**
+        Prepares the sink for receiving @a len bytes in random order.
+
+        This is called after SetFilename() if the download is segmented. If
+        it isn't called, the data are passed to Add() sequentially as usual.
+     */
+    virtual void Preallocate(size_t len) = 0;
+
+    /**
+        Stores chunk of downloaded data at given offset.
+
+        Calls are serialized, but they may come from different threads.
+     */
+    virtual void AddAt(size_t offset, const void *data, size_t len) = 0;
+
+    /**
+        Stores chunk of downloaded data from a pooled buffer at given offset.
+
+        See IDownloadSink::AddBuffer(). The default implementation just
+        calls AddAt().
+     */
+    virtual void AddBufferAt(size_t offset, DownloadBuffer *buffer, size_t len);
+
+    /**
+        Reopens previously downloaded data in order to resume the download.
+
+        This is called instead of SetFilename() and Preallocate() if
+        the download described by @a state can be resumed. If the data are
+        no longer available, the sink should return false and the download
+        starts over.
+     */
+    virtual bool ResumePartial(const PartialDownload& state) { return false; }
+
+    /**
+        Records progress of the download, so that it can be resumed later.
+
+        This is called periodically and when the download fails. All ranges
+        listed in @a state were already passed to AddAt(); the sink should
+        make sure they are stored before recording them.
+     */
+    virtual void SaveProgress(const PartialDownload& state) {}
 };
 
 /**
@@ -73,11 +188,75 @@ struct StringDownloadSink : public IDownloadSink
 };
 
 
+/**
+    Information about a completed HTTP request, as returned by DownloadFile().
+ */
+struct DownloadInfo
+{
+    DownloadInfo() : StatusCode(0) {}
+
+    /// HTTP status code of the response.
+    unsigned StatusCode;
+
+    /// Value of the ETag header, if the server sent it.
+    std::string ETag;
+
+    /// Value of the Last-Modified header, if the server sent it.
+    std::string LastModified;
+
+    /**
+        Returns true if the server responded with "304 Not Modified" to
+        a conditional request. No data were passed to the sink in that case.
+     */
+    bool IsNotModified() const { return StatusCode == 304; }
+};
+
+
+/**
+    Statistics of reads of downloaded data, for diagnostics.
+
+    See GetDownloadReadStats().
+ */
+struct DownloadReadStats
+{
+    DownloadReadStats() : Reads(0), Bytes(0), TotalLatency(0), MaxLatency(0) {}
+
+    /// Number of reads done.
+    unsigned long long Reads;
+
+    /// Number of bytes read.
+    unsigned long long Bytes;
+
+    /// Number of reads done with each read size.
+    std::map<size_t, unsigned long long> ReadSizes;
+
+    /// Total time spent waiting for data, in microseconds.
+    unsigned long long TotalLatency;
+
+    /// Longest time spent waiting for a single chunk, in microseconds.
+    unsigned long long MaxLatency;
+};
+
+/**
+    Returns statistics of all reads done by DownloadFile() and
+    DownloadFileSegmented() so far.
+
+    The size of reads adapts to the connection: it grows while the
+    connection has more data ready than fits into a read, and shrinks
+    when reads return much less than requested.
+ */
+DownloadReadStats GetDownloadReadStats();
+
+
 /// Flags for DownloadFile().
 enum DownloadFlag
 {
     /// Instruct proxies to pass the request upstream
-    Download_BypassProxies = 1
+    Download_BypassProxies = 1,
+
+    /// Pass the body of error responses (4xx and 5xx) to the sink instead
+    /// of throwing
+    Download_AcceptErrors = 2
 };
 
 /**
@@ -88,11 +267,92 @@ enum DownloadFlag
     @param url       URL of the resource to download.
     @param sink      Where to put downloaded data.
     @param onThread  Thread the request runs on.
+    @param headers   Additional request headers, each terminated with CRLF.
+                     If conditional headers such as If-None-Match are
+                     included, the caller must check for
+                     DownloadInfo::IsNotModified().
     @param flags     Or-combination of DownloadFlag values.
 
+    @return Information about the response.
+
     @see CheckConnection()
  */
-void DownloadFile(const std::string& url, IDownloadSink *sink, Thread *onThread, const std::string &headers = "", int flags = 0);
+DownloadInfo DownloadFile(const std::string& url, IDownloadSink *sink, Thread *onThread, const std::string &headers = "", int flags = 0);
+
+/**
+    Closes the HTTP session shared by all downloads.
+
+    Requests that are still running keep using it until they finish. A new
+    session is opened by the next download.
+ */
+void CloseDownloadSession();
+
+/**
+    Other locations of a resource, used by DownloadFileSegmented() to
+    continue the download after a failure.
+ */
+struct IDownloadMirrors
+{
+    /**
+        Returns URL of the same resource on another server, to be used
+        after a request to @a failedURL failed. Returns empty string if
+        there's none left.
+
+        Calls are serialized, but they may come from different threads.
+     */
+    virtual std::string GetFailoverURL(const std::string& failedURL) = 0;
+
+    /**
+        Reports a successful transfer from @a url.
+
+        @param url            URL of the request.
+        @param timeToHeaders  Time until the response's headers arrived, in ms.
+        @param bytes          Number of bytes downloaded.
+        @param duration       Time spent downloading them, in ms.
+     */
+    virtual void ReportTransfer(const std::string& url, unsigned timeToHeaders,
+                                size_t bytes, unsigned duration) {}
+};
+
+/**
+    Downloads a HTTP resource over several concurrent connections.
+
+    If the server supports byte ranges and the resource is large enough,
+    the sink is preallocated and the resource is downloaded in segments
+    using HTTP Range requests. Idle connections take over half of the
+    largest remaining segment, so that slow connections don't hold the
+    download back. Otherwise, the resource is downloaded in a single
+    stream, as with DownloadFile().
+
+    Progress of segmented downloads is reported to the sink's
+    SaveProgress(). If @a resumeFrom is given, only the missing ranges are
+    downloaded, provided that the resource didn't change since then
+    (this is checked with If-Range); otherwise, the download starts over.
+    If @a resumeFrom has no validator, e.g. because its data didn't come
+    from the server, only the length of the resource is checked and the
+    caller must verify the downloaded data.
+
+    If @a mirrors are given, failed requests are repeated on another mirror
+    and a segmented download continues from there with Range requests.
+    Mirrors may have different validators, so requests to them aren't
+    conditional; only the length is checked and the caller must verify
+    the downloaded data, e.g. with a signature.
+
+    Throws on error.
+
+    @param url             URL of the resource to download.
+    @param sink            Where to put downloaded data.
+    @param onThread        Thread the request runs on.
+    @param maxConnections  Maximum number of concurrent connections.
+    @param resumeFrom      Progress of an earlier attempt, or NULL.
+    @param mirrors         Other locations of the resource, or NULL.
+    @param throttle        Limits the rate of the download, or NULL. In its
+                           background mode, the download's threads run with
+                           background priority as well.
+
+    @return Information about the response.
+ */
+DownloadInfo DownloadFileSegmented(const std::string& url, IRandomAccessDownloadSink *sink, Thread *onThread, unsigned maxConnections = 4, const PartialDownload *resumeFrom = NULL, IDownloadMirrors *mirrors = NULL, DownloadThrottle *throttle = NULL);
 
 } // namespace winsparkle
 
@@ -0,0 +1,496 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "downloadpipeline.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+
+namespace winsparkle
+{
+
+/*--------------------------------------------------------------------------*
+                              BufferPool
+ *--------------------------------------------------------------------------*/
+
+DownloadBuffer::DownloadBuffer(BufferPool& pool, size_t capacity)
+    : m_pool(pool), m_capacity(capacity), m_refCount(1)
+{
+    m_data = new char[capacity];
+}
+
+
+DownloadBuffer::~DownloadBuffer()
+{
+    delete[] m_data;
+}
+
+
+void DownloadBuffer::Release()
+{
+    if ( --m_refCount == 0 )
+        m_pool.Recycle(this);
+}
+
+
+BufferPool::BufferPool(size_t bufferSize, size_t maxFree)
+    : m_bufferSize(bufferSize), m_maxFree(maxFree)
+{
+}
+
+
+BufferPool::~BufferPool()
+{
+    for ( size_t i = 0; i < m_free.size(); i++ )
+        delete m_free[i];
+}
+
+
+DownloadBuffer *BufferPool::Get()
+{
+    {
+        CriticalSectionLocker lock(m_cs);
+        if ( !m_free.empty() )
+        {
+            DownloadBuffer *buffer = m_free.back();
+            m_free.pop_back();
+            buffer->m_refCount = 1;
+            return buffer;
+        }
+    }
+
+    return new DownloadBuffer(*this, m_bufferSize);
+}
+
+
+void BufferPool::Recycle(DownloadBuffer *buffer)
+{
+    {
+        CriticalSectionLocker lock(m_cs);
+        if ( m_free.size() < m_maxFree )
+        {
+            m_free.push_back(buffer);
+            return;
+        }
+    }
+
+    delete buffer;
+}
+
+
+/*static*/
+BufferPool& BufferPool::GetShared(size_t size)
+{
+    // keep at most a few MBs of unused buffers around
+    static BufferPool pool16k(16 * 1024, 16);
+    static BufferPool pool64k(64 * 1024, 16);
+    static BufferPool pool256k(256 * 1024, 8);
+    static BufferPool pool1m(1024 * 1024, 4);
+
+    if ( size <= pool16k.GetBufferSize() )
+        return pool16k;
+    else if ( size <= pool64k.GetBufferSize() )
+        return pool64k;
+    else if ( size <= pool256k.GetBufferSize() )
+        return pool256k;
+    else
+        return pool1m;
+}
+
+
+/*--------------------------------------------------------------------------*
+                            AsyncWriteStage
+ *--------------------------------------------------------------------------*/
+
+class AsyncWriteStage::WriterThread : public Thread
+{
+public:
+    WriterThread(AsyncWriteStage& stage)
+        : Thread("WinSparkle download writer"), m_stage(stage)
+    {}
+
+protected:
+    virtual void Run()
+    {
+        SignalReady();
+
+        BackgroundModeScope mode(m_stage.m_background);
+        m_stage.WriteQueued();
+    }
+
+    virtual bool IsJoinable() const { return true; }
+
+private:
+    AsyncWriteStage& m_stage;
+};
+
+
+AsyncWriteStage::AsyncWriteStage(size_t bufferSize, size_t maxQueued, bool background)
+    : m_pool(bufferSize, maxQueued + 1),
+      m_maxQueued(maxQueued),
+      m_background(background),
+      m_current(NULL), m_currentOffset(0), m_currentLength(0),
+      m_busy(false), m_stop(false), m_failed(false),
+      m_thread(NULL)
+{
+    m_thread = new WriterThread(*this);
+    try
+    {
+        m_thread->Start();
+    }
+    catch ( ... )
+    {
+        delete m_thread;
+        throw;
+    }
+}
+
+
+AsyncWriteStage::~AsyncWriteStage()
+{
+    {
+        CriticalSectionLocker lock(m_cs);
+        m_stop = true;
+    }
+    m_queued.Signal();
+    m_thread->Join();
+    delete m_thread;
+
+    // data that weren't processed yet are discarded
+    for ( size_t i = 0; i < m_queue.size(); i++ )
+        m_queue[i].Buffer->Release();
+    if ( m_current )
+        m_current->Release();
+}
+
+
+void AsyncWriteStage::SetLength(size_t len)
+{
+    Drain();
+    CheckError();
+    DownloadStage::SetLength(len);
+}
+
+
+void AsyncWriteStage::SetFilename(const std::wstring& filename)
+{
+    Drain();
+    CheckError();
+    DownloadStage::SetFilename(filename);
+}
+
+
+void AsyncWriteStage::Preallocate(size_t len)
+{
+    Drain();
+    CheckError();
+    DownloadStage::Preallocate(len);
+}
+
+
+bool AsyncWriteStage::ResumePartial(const PartialDownload& state)
+{
+    return Drain() && DownloadStage::ResumePartial(state);
+}
+
+
+void AsyncWriteStage::SaveProgress(const PartialDownload& state)
+{
+    // don't record data that were lost as done
+    if ( Drain() )
+        DownloadStage::SaveProgress(state);
+}
+
+
+void AsyncWriteStage::Process(const DownloadChunk& chunk)
+{
+    CheckError();
+
+    size_t offset = chunk.Offset;
+    const char *data = chunk.Data;
+    size_t len = chunk.Length;
+
+    while ( len > 0 )
+    {
+        // only contiguous data can be gathered into the same buffer
+        if ( m_currentLength && m_currentOffset + m_currentLength != offset )
+        {
+            Submit();
+            CheckError();
+        }
+
+        if ( !m_current )
+            m_current = m_pool.Get();
+        if ( m_currentLength == 0 )
+            m_currentOffset = offset;
+
+        const size_t n = std::min(len, m_current->GetCapacity() - m_currentLength);
+        memcpy(m_current->GetData() + m_currentLength, data, n);
+        m_currentLength += n;
+        offset += n;
+        data += n;
+        len -= n;
+
+        if ( m_currentLength == m_current->GetCapacity() )
+        {
+            Submit();
+            CheckError();
+        }
+    }
+}
+
+
+void AsyncWriteStage::Finish()
+{
+    Drain();
+    CheckError();
+    DownloadStage::Finish();
+}
+
+
+void AsyncWriteStage::Submit()
+{
+    if ( m_currentLength == 0 )
+        return;
+
+    DownloadChunk chunk;
+    chunk.Offset = m_currentOffset;
+    chunk.Data = m_current->GetData();
+    chunk.Length = m_currentLength;
+    chunk.Buffer = m_current;
+
+    m_current = NULL;
+    m_currentLength = 0;
+
+    for ( ;; )
+    {
+        {
+            CriticalSectionLocker lock(m_cs);
+            if ( m_failed )
+            {
+                chunk.Buffer->Release();
+                return;
+            }
+            if ( m_queue.size() < m_maxQueued )
+            {
+                m_queue.push_back(chunk);
+                break;
+            }
+        }
+
+        // the queue is full, wait until the I/O thread catches up
+        m_written.WaitUntilSignaled();
+    }
+
+    m_queued.Signal();
+}
+
+
+bool AsyncWriteStage::Drain()
+{
+    Submit();
+
+    for ( ;; )
+    {
+        {
+            CriticalSectionLocker lock(m_cs);
+            if ( m_failed )
+                return false;
+            if ( m_queue.empty() && !m_busy )
+                return true;
+        }
+
+        m_written.WaitUntilSignaled();
+    }
+}
+
+
+void AsyncWriteStage::CheckError()
+{
+    CriticalSectionLocker lock(m_cs);
+    if ( m_failed )
+        throw std::runtime_error(m_error);
+}
+
+
+void AsyncWriteStage::WriteQueued()
+{
+    for ( ;; )
+    {
+        DownloadChunk chunk;
+        bool hasChunk = false;
+        {
+            CriticalSectionLocker lock(m_cs);
+            if ( m_stop )
+                return;
+            if ( !m_queue.empty() )
+            {
+                chunk = m_queue.front();
+                m_queue.pop_front();
+                m_busy = true;
+                hasChunk = true;
+            }
+        }
+
+        if ( !hasChunk )
+        {
+            m_queued.WaitUntilSignaled();
+            continue;
+        }
+
+        // there's room in the queue for another chunk now
+        m_written.Signal();
+
+        std::string error;
+        try
+        {
+            DownloadStage::Process(chunk);
+        }
+        catch ( const std::exception& e )
+        {
+            error = e.what();
+            if ( error.empty() )
+                error = "Failed to process downloaded data.";
+        }
+        catch ( ... )
+        {
+            error = "Failed to process downloaded data.";
+        }
+        chunk.Buffer->Release();
+
+        {
+            CriticalSectionLocker lock(m_cs);
+            m_busy = false;
+            if ( !error.empty() && !m_failed )
+            {
+                // the rest of the data can't be processed anymore
+                m_failed = true;
+                m_error = error;
+                for ( size_t i = 0; i < m_queue.size(); i++ )
+                    m_queue[i].Buffer->Release();
+                m_queue.clear();
+            }
+        }
+        m_written.Signal();
+    }
+}
+
+
+/*--------------------------------------------------------------------------*
+                            DownloadPipeline
+ *--------------------------------------------------------------------------*/
+
+void DownloadPipeline::Append(DownloadStage *stage)
+{
+    if ( m_last )
+        m_last->m_next = stage;
+    else
+        m_first = stage;
+    m_last = stage;
+}
+
+
+void DownloadPipeline::Finish()
+{
+    if ( m_first )
+        m_first->Finish();
+}
+
+
+void DownloadPipeline::SetLength(size_t len)
+{
+    if ( m_first )
+        m_first->SetLength(len);
+}
+
+
+void DownloadPipeline::SetFilename(const std::wstring& filename)
+{
+    if ( m_first )
+        m_first->SetFilename(filename);
+}
+
+
+void DownloadPipeline::Add(const void *data, size_t len)
+{
+    Process(m_position, data, len, NULL);
+    m_position += len;
+}
+
+
+void DownloadPipeline::AddBuffer(DownloadBuffer *buffer, size_t len)
+{
+    Process(m_position, buffer->GetData(), len, buffer);
+    m_position += len;
+}
+
+
+void DownloadPipeline::Preallocate(size_t len)
+{
+    if ( m_first )
+        m_first->Preallocate(len);
+}
+
+
+void DownloadPipeline::AddAt(size_t offset, const void *data, size_t len)
+{
+    Process(offset, data, len, NULL);
+}
+
+
+void DownloadPipeline::AddBufferAt(size_t offset, DownloadBuffer *buffer, size_t len)
+{
+    Process(offset, buffer->GetData(), len, buffer);
+}
+
+
+bool DownloadPipeline::ResumePartial(const PartialDownload& state)
+{
+    return m_first && m_first->ResumePartial(state);
+}
+
+
+void DownloadPipeline::SaveProgress(const PartialDownload& state)
+{
+    if ( m_first )
+        m_first->SaveProgress(state);
+}
+
+
+void DownloadPipeline::Process(size_t offset, const void *data, size_t len, DownloadBuffer *buffer)
+{
+    if ( !m_first )
+        return;
+
+    DownloadChunk chunk;
+    chunk.Offset = offset;
+    chunk.Data = static_cast<const char*>(data);
+    chunk.Length = len;
+    chunk.Buffer = buffer;
+    m_first->Process(chunk);
+}
+
+} // namespace winsparkle
@@ -0,0 +1,325 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _downloadpipeline_h_
+#define _downloadpipeline_h_
+
+#include "download.h"
+#include "threads.h"
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <deque>
+
+namespace winsparkle
+{
+
+class BufferPool;
+
+/**
+    Reference-counted buffer for downloaded data, owned by a BufferPool.
+
+    Buffers are passed between download stages by reference, so that the
+    data don't have to be copied. When the last reference is released, the
+    buffer is returned to its pool for reuse.
+ */
+class DownloadBuffer
+{
+public:
+    /// Returns the buffer's memory.
+    char *GetData() { return m_data; }
+
+    /// Returns the size of the buffer's memory.
+    size_t GetCapacity() const { return m_capacity; }
+
+    /// Adds a reference to the buffer.
+    void AddRef() { ++m_refCount; }
+
+    /// Releases a reference; the buffer is recycled when there are none left.
+    void Release();
+
+private:
+    DownloadBuffer(BufferPool& pool, size_t capacity);
+    ~DownloadBuffer();
+
+    DownloadBuffer(const DownloadBuffer&);
+    DownloadBuffer& operator=(const DownloadBuffer&);
+
+    BufferPool& m_pool;
+    char *m_data;
+    size_t m_capacity;
+    std::atomic<long> m_refCount;
+
+    friend class BufferPool;
+};
+
+
+/**
+    Pool of reusable buffers of the same size.
+
+    The pool is thread-safe. It must outlive all buffers obtained from it.
+ */
+class BufferPool
+{
+public:
+    /**
+        Creates the pool.
+
+        @param bufferSize  Size of the buffers.
+        @param maxFree     Maximum number of unused buffers kept for reuse.
+     */
+    BufferPool(size_t bufferSize, size_t maxFree = 16);
+    ~BufferPool();
+
+    /// Returns a buffer with one reference; call Release() when done.
+    DownloadBuffer *Get();
+
+    /// Returns the size of the pool's buffers.
+    size_t GetBufferSize() const { return m_bufferSize; }
+
+    /**
+        Returns pool of buffers of at least @a size bytes shared by all
+        downloads.
+
+        Sizes are rounded up to one of 16 KB, 64 KB, 256 KB and 1 MB, larger
+        sizes are capped at 1 MB.
+     */
+    static BufferPool& GetShared(size_t size);
+
+private:
+    BufferPool(const BufferPool&);
+    BufferPool& operator=(const BufferPool&);
+
+    void Recycle(DownloadBuffer *buffer);
+
+    CriticalSection m_cs;
+    std::vector<DownloadBuffer*> m_free;
+    size_t m_bufferSize;
+    size_t m_maxFree;
+
+    friend class DownloadBuffer;
+};
+
+
+/**
+    Chunk of downloaded data passed through DownloadPipeline.
+ */
+struct DownloadChunk
+{
+    /// Offset of the data in the downloaded resource.
+    size_t Offset;
+
+    /// The data.
+    const char *Data;
+
+    /// Length of the data.
+    size_t Length;
+
+    /**
+        Pooled buffer the data are stored in, or NULL if they aren't.
+
+        Stages that need the data after DownloadStage::Process() returns
+        must AddRef() the buffer, or copy the data if there's no buffer.
+     */
+    DownloadBuffer *Buffer;
+};
+
+
+/**
+    A single processing stage of DownloadPipeline.
+
+    The default implementations of all methods just pass the calls on to
+    the next stage. Derived classes override the methods they are interested
+    in and are responsible for calling the base class version to continue
+    down the pipeline.
+ */
+class DownloadStage
+{
+public:
+    DownloadStage() : m_next(NULL) {}
+    virtual ~DownloadStage() {}
+
+    /// See IDownloadSink::SetLength().
+    virtual void SetLength(size_t len)
+        { if ( m_next ) m_next->SetLength(len); }
+
+    /// See IDownloadSink::SetFilename().
+    virtual void SetFilename(const std::wstring& filename)
+        { if ( m_next ) m_next->SetFilename(filename); }
+
+    /// See IRandomAccessDownloadSink::Preallocate().
+    virtual void Preallocate(size_t len)
+        { if ( m_next ) m_next->Preallocate(len); }
+
+    /**
+        See IRandomAccessDownloadSink::ResumePartial().
+
+        The download is resumed only if all stages agree; the last stage
+        agrees by default.
+     */
+    virtual bool ResumePartial(const PartialDownload& state)
+        { return !m_next || m_next->ResumePartial(state); }
+
+    /// See IRandomAccessDownloadSink::SaveProgress().
+    virtual void SaveProgress(const PartialDownload& state)
+        { if ( m_next ) m_next->SaveProgress(state); }
+
+    /// Processes a chunk of downloaded data.
+    virtual void Process(const DownloadChunk& chunk)
+        { if ( m_next ) m_next->Process(chunk); }
+
+    /// Called after all data were processed.
+    virtual void Finish()
+        { if ( m_next ) m_next->Finish(); }
+
+private:
+    DownloadStage(const DownloadStage&);
+    DownloadStage& operator=(const DownloadStage&);
+
+    DownloadStage *m_next;
+
+    friend class DownloadPipeline;
+};
+
+
+/**
+    Stage that passes data to the following stages on a separate thread.
+
+    Downloaded data are gathered into large buffers, which are processed
+    by the following stages (typically file writing) on a dedicated I/O
+    thread, so that slow disks don't stall the network transfer. At most
+    @a maxQueued buffers wait for processing; when the queue is full,
+    Process() blocks until there's room again.
+
+    Calls other than Process() wait for all queued data to be processed
+    first and are forwarded on the calling thread. Errors that occur on
+    the I/O thread are rethrown by the next call to Process() or Finish().
+ */
+class AsyncWriteStage : public DownloadStage
+{
+public:
+    /**
+        Creates the stage and starts its I/O thread.
+
+        @param bufferSize  Size of the buffers data are gathered into.
+        @param maxQueued   Maximum number of buffers waiting for processing.
+        @param background  Run the I/O thread with background priority,
+                           see BackgroundModeScope.
+     */
+    AsyncWriteStage(size_t bufferSize = 1024 * 1024, size_t maxQueued = 4, bool background = false);
+    virtual ~AsyncWriteStage();
+
+    virtual void SetLength(size_t len);
+    virtual void SetFilename(const std::wstring& filename);
+    virtual void Preallocate(size_t len);
+    virtual bool ResumePartial(const PartialDownload& state);
+    virtual void SaveProgress(const PartialDownload& state);
+    virtual void Process(const DownloadChunk& chunk);
+    virtual void Finish();
+
+private:
+    class WriterThread;
+
+    // Queues the buffer being filled, waiting for room if necessary.
+    void Submit();
+
+    // Waits until all queued data are processed; returns false on error.
+    bool Drain();
+
+    // Throws if processing on the I/O thread failed.
+    void CheckError();
+
+    // Processes queued buffers on the I/O thread.
+    void WriteQueued();
+
+    BufferPool m_pool;
+    size_t m_maxQueued;
+    bool m_background;
+
+    // buffer being filled by Process() and offset of its data
+    DownloadBuffer *m_current;
+    size_t m_currentOffset, m_currentLength;
+
+    CriticalSection m_cs;
+    std::deque<DownloadChunk> m_queue;
+    bool m_busy;            // I/O thread is processing a chunk
+    bool m_stop;            // I/O thread should exit
+    bool m_failed;          // processing failed, m_error describes why
+    std::string m_error;
+    Event m_queued;         // signaled when a chunk is added to m_queue
+    Event m_written;        // signaled when a chunk was dequeued or processed
+
+    WriterThread *m_thread;
+};
+
+
+/**
+    IDownloadSink implementation composed of a chain of DownloadStage objects.
+
+    Downloaded data flow through the stages in the order in which they were
+    added, e.g. accounting, hashing and writing to a file. Sequentially
+    downloaded data are given offsets, so that stages handle sequential
+    and segmented downloads in the same way.
+
+    The pipeline doesn't own the stages.
+ */
+class DownloadPipeline : public IRandomAccessDownloadSink
+{
+public:
+    DownloadPipeline() : m_first(NULL), m_last(NULL), m_position(0) {}
+
+    /// Appends a stage at the end of the pipeline.
+    void Append(DownloadStage *stage);
+
+    /// Finishes processing; call after the download completed.
+    void Finish();
+
+    // IDownloadSink methods:
+    virtual void SetLength(size_t len);
+    virtual void SetFilename(const std::wstring& filename);
+    virtual void Add(const void *data, size_t len);
+    virtual void AddBuffer(DownloadBuffer *buffer, size_t len);
+
+    // IRandomAccessDownloadSink methods:
+    virtual void Preallocate(size_t len);
+    virtual void AddAt(size_t offset, const void *data, size_t len);
+    virtual void AddBufferAt(size_t offset, DownloadBuffer *buffer, size_t len);
+    virtual bool ResumePartial(const PartialDownload& state);
+    virtual void SaveProgress(const PartialDownload& state);
+
+private:
+    DownloadPipeline(const DownloadPipeline&);
+    DownloadPipeline& operator=(const DownloadPipeline&);
+
+    void Process(size_t offset, const void *data, size_t len, DownloadBuffer *buffer);
+
+    DownloadStage *m_first, *m_last;
+    size_t m_position;  // offset of the next sequentially added data
+};
+
+} // namespace winsparkle
+
+#endif // _downloadpipeline_h_
@@ -26,7 +26,14 @@
 #include "error.h"
 
 #include <string>
-#include <windows.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <errno.h>
+    #include <stdio.h>
+    #include <string.h>
+#endif
 
 namespace winsparkle
 {
@@ -38,8 +45,12 @@ namespace winsparkle
 namespace
 {
 
-std::string GetWin32ErrorMessage(const char *extraMsg, DWORD err)
+#ifdef _WIN32
+
+std::string GetLastErrorMessage(const char *extraMsg)
 {
+    const DWORD err = GetLastError();
+
     std::string msg;
 
     if ( extraMsg )
@@ -69,6 +80,28 @@ std::string GetWin32ErrorMessage(const char *extraMsg, DWORD err)
     return msg;
 }
 
+#else // !_WIN32
+
+std::string GetLastErrorMessage(const char *extraMsg)
+{
+    const int err = errno;
+    std::string msg;
+
+    if ( extraMsg )
+        msg = extraMsg;
+
+    if ( err != 0 )
+    {
+        if ( extraMsg )
+            msg += ": ";
+        msg += strerror(err);
+    }
+
+    return msg;
+}
+
+#endif // _WIN32
+
 } // anonymous namespace
 
 
@@ -77,12 +110,12 @@ std::string GetWin32ErrorMessage(const char *extraMsg, DWORD err)
  *--------------------------------------------------------------------------*/
 
 Win32Exception::Win32Exception(const char *extraMsg)
-    : std::runtime_error(GetWin32ErrorMessage(extraMsg, GetLastError()))
+    : std::runtime_error(GetLastErrorMessage(extraMsg))
 {
 }
 
 DownloadException::DownloadException(const char* extraMsg)
-    : std::runtime_error(GetWin32ErrorMessage(extraMsg, GetLastError()))
+    : std::runtime_error(GetLastErrorMessage(extraMsg))
 {
 }
 
@@ -97,7 +130,11 @@ void LogError(const char *msg)
     err.append(msg);
     err.append("\n");
 
+#ifdef _WIN32
     OutputDebugStringA(err.c_str());
+#else
+    fputs(err.c_str(), stderr);
+#endif
 }
 
 } // namespace winsparkle
@@ -36,7 +36,7 @@ namespace winsparkle
     Exception thrown if a Platform SDK error happens.
 
     This exception automatically sets the error message to the appropriate
-    error message for GetLastError()'s error code.
+    error message for GetLastError()'s error code (errno's outside of Windows).
  */
 class Win32Exception : public std::runtime_error
 {
@@ -61,7 +61,7 @@ public:
 };
 
 /**
-    Logs error to, currently, debug output.
+    Logs error to, currently, debug output (or stderr outside of Windows).
  */
 void LogError(const char *msg);
 
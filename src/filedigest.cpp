@@ -0,0 +1,161 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2012-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "filedigest.h"
+
+#include <algorithm>
+
+namespace winsparkle
+{
+
+namespace
+{
+
+// Most data read back from the file in one call of FileDigest::Written(),
+// so that the catching up is spread over the download
+const size_t CATCH_UP_MAX_BYTES = 1024 * 1024;
+
+} // anonymous namespace
+
+
+FileDigest::FileDigest(IDigestedDataSink *sink)
+    : m_sink(sink), m_hashed(0), m_failed(false)
+{
+    SHA1_Init(&m_ctx);
+}
+
+
+bool FileDigest::Written(FILE *file, size_t offset, const void *data, size_t len)
+{
+    if ( m_failed )
+        return false;
+
+    if ( offset == m_hashed )
+    {
+        Hash(data, len);
+    }
+    else
+    {
+        AddPending(offset, offset + len);
+    }
+
+    // Catch up gradually, so that most of the work is done while
+    // the download is still running.
+    return CatchUp(file, CATCH_UP_MAX_BYTES);
+}
+
+
+void FileDigest::Existing(size_t from, size_t to)
+{
+    AddPending(from, to);
+}
+
+
+bool FileDigest::Finish(FILE *file, std::string& digest)
+{
+    if ( m_failed )
+        return false;
+
+    CatchUp(file, size_t(-1));
+
+    if ( m_failed || !m_pending.empty() ||
+         _fseeki64(file, 0, SEEK_END) != 0 ||
+         _ftelli64(file) != (long long)m_hashed )
+    {
+        return false;
+    }
+
+    unsigned char sha1[SHA_DIGEST_LENGTH];
+    SHA1_Final(sha1, &m_ctx);
+    m_failed = true; // the context can't be used anymore
+    digest.assign(reinterpret_cast<const char*>(sha1), sizeof(sha1));
+    return true;
+}
+
+
+void FileDigest::AddPending(size_t from, size_t to)
+{
+    std::map<size_t, size_t>::iterator next = m_pending.lower_bound(from);
+    if ( next != m_pending.begin() )
+    {
+        std::map<size_t, size_t>::iterator prev = next;
+        --prev;
+        if ( prev->second >= from )
+        {
+            from = prev->first;
+            to = std::max(to, prev->second);
+            m_pending.erase(prev);
+        }
+    }
+    while ( next != m_pending.end() && next->first <= to )
+    {
+        to = std::max(to, next->second);
+        m_pending.erase(next++);
+    }
+    m_pending[from] = to;
+}
+
+
+void FileDigest::Hash(const void *data, size_t len)
+{
+    SHA1_Update(&m_ctx, data, len);
+    if ( m_sink )
+        m_sink->Add(data, len);
+    m_hashed += len;
+}
+
+
+bool FileDigest::CatchUp(FILE *file, size_t maxBytes)
+{
+    bool didRead = false;
+    while ( !m_pending.empty() && m_pending.begin()->first <= m_hashed && maxBytes > 0 )
+    {
+        const size_t end = m_pending.begin()->second;
+        if ( end <= m_hashed )
+        {
+            m_pending.erase(m_pending.begin());
+            continue;
+        }
+
+        if ( m_buffer.empty() )
+            m_buffer.resize(64 * 1024);
+
+        const size_t len = std::min(std::min(end - m_hashed, m_buffer.size()), maxBytes);
+        didRead = true;
+        if ( _fseeki64(file, m_hashed, SEEK_SET) != 0 ||
+             fread(&m_buffer[0], 1, len, file) != len )
+        {
+            // fall back to hashing the whole file when verifying it
+            m_failed = true;
+            return didRead;
+        }
+
+        Hash(&m_buffer[0], len);
+        maxBytes -= len;
+    }
+    return didRead;
+}
+
+} // namespace winsparkle
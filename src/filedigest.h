@@ -0,0 +1,105 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2012-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _filedigest_h_
+#define _filedigest_h_
+
+#include <openssl/sha.h>
+
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace winsparkle
+{
+
+/**
+    Receives data hashed by FileDigest, in file order.
+ */
+struct IDigestedDataSink
+{
+    /// Add next chunk of the file's data
+    virtual void Add(const void *data, size_t len) = 0;
+};
+
+
+/**
+    Computes SHA-1 digest of a file while it is being downloaded, so that
+    the file doesn't have to be read again to verify its signature.
+
+    Data are hashed in file order. Data written ahead of the hashed part (by
+    segmented or resumed downloads) are remembered and hashed once everything
+    before them is, reading them back from the file, which is typically
+    still in the OS cache at that point.
+ */
+class FileDigest
+{
+public:
+    /**
+        Creates the digest.
+
+        @param sink  If not NULL, receives the hashed data, e.g. to extract
+                     an archive that needs them in the same order.
+     */
+    FileDigest(IDigestedDataSink *sink = NULL);
+
+    /**
+        Processes data just written to @a file at given offset.
+
+        Returns true if the file had to be read, i.e. its position changed.
+     */
+    bool Written(FILE *file, size_t offset, const void *data, size_t len);
+
+    /// Registers data that are already present in the file.
+    void Existing(size_t from, size_t to);
+
+    /**
+        Finishes computation of the digest of @a file.
+
+        Returns false if it couldn't be computed for the whole file, e.g.
+        because it couldn't be read back; the file must then be hashed again.
+     */
+    bool Finish(FILE *file, std::string& digest);
+
+private:
+    void AddPending(size_t from, size_t to);
+    void Hash(const void *data, size_t len);
+    bool CatchUp(FILE *file, size_t maxBytes);
+
+    SHA_CTX m_ctx;
+    IDigestedDataSink *m_sink;
+    size_t m_hashed;                       // all data before this are hashed
+    std::map<size_t, size_t> m_pending;    // written, but not hashed yet
+    std::vector<unsigned char> m_buffer;
+    bool m_failed;
+
+    FileDigest(const FileDigest&);
+    FileDigest& operator=(const FileDigest&);
+};
+
+} // namespace winsparkle
+
+#endif // _filedigest_h_
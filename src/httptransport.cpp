@@ -0,0 +1,122 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "httptransport.h"
+
+#include "threads.h"
+#include "utils.h"
+#include "winsparkle-version.h"
+
+#ifdef _WIN32
+    #include "settings.h"
+#endif
+
+#include <stdio.h>
+
+namespace winsparkle
+{
+
+namespace
+{
+
+// guards the variables below:
+CriticalSection gs_csTransport;
+
+IHttpTransport *gs_transport = NULL;         // set by SetHttpTransport()
+IHttpTransport *gs_defaultTransport = NULL;  // created on demand
+
+} // anonymous namespace
+
+
+IHttpTransport& GetHttpTransport()
+{
+    CriticalSectionLocker lock(gs_csTransport);
+
+    if ( gs_transport )
+        return *gs_transport;
+
+    // Note that the default transport is never destroyed, because WinINet
+    // handles must not be closed from DllMain. Call Close() instead.
+    if ( !gs_defaultTransport )
+    {
+#ifdef _WIN32
+        gs_defaultTransport = CreateWinINetTransport();
+#else
+        gs_defaultTransport = CreateSocketTransport();
+#endif
+    }
+    return *gs_defaultTransport;
+}
+
+
+void SetHttpTransport(IHttpTransport *transport)
+{
+    CriticalSectionLocker lock(gs_csTransport);
+    gs_transport = transport;
+}
+
+
+std::wstring GetHttpUserAgent()
+{
+#ifndef _WIN32
+    // the application's name and version come from its Windows resources
+    return L"WinSparkle/" + AnsiToWide(WIN_SPARKLE_VERSION_STRING);
+#else
+    std::wstring userAgent =
+        Settings::GetAppName() + L"/" + Settings::GetAppVersion() +
+        L" WinSparkle/" + AnsiToWide(WIN_SPARKLE_VERSION_STRING);
+
+#ifdef _WIN64
+    userAgent += L" (Win64)";
+#else
+    // If we're running a 32bit process, check if we're on 64bit Windows OS:
+    auto f_IsWow64Process = LOAD_DYNAMIC_FUNC(IsWow64Process, kernel32);
+    if( f_IsWow64Process )
+    {
+        BOOL wow64 = FALSE;
+        f_IsWow64Process(GetCurrentProcess(), &wow64);
+        if ( wow64 )
+            userAgent += L" (WOW64)";
+    }
+
+#endif
+
+    return userAgent;
+#endif // _WIN32
+}
+
+
+std::string GetHttpRangeHeader(const HttpRequestParams& request)
+{
+    if ( !request.HasRange )
+        return std::string();
+
+    char header[100];
+    sprintf(header, "Range: bytes=%llu-%llu\r\n",
+            (unsigned long long)request.RangeFrom, (unsigned long long)request.RangeTo - 1);
+    return header;
+}
+
+} // namespace winsparkle
@@ -0,0 +1,176 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _httptransport_h_
+#define _httptransport_h_
+
+#include <string>
+
+namespace winsparkle
+{
+
+class Thread;
+
+/**
+    Parameters of a HTTP GET request, see IHttpTransport::Send().
+ */
+struct HttpRequestParams
+{
+    HttpRequestParams()
+        : BypassProxies(false), AcceptEncoding(false),
+          HasRange(false), RangeFrom(0), RangeTo(0)
+    {}
+
+    /// URL of the resource.
+    std::string URL;
+
+    /// Additional request headers, each terminated with CRLF.
+    std::string Headers;
+
+    /// Instruct proxies to pass the request upstream.
+    bool BypassProxies;
+
+    /// Accept compressed response; it is decoded transparently, if the
+    /// transport supports it.
+    bool AcceptEncoding;
+
+    /// Request only bytes from RangeFrom (inclusive) to RangeTo (exclusive).
+    bool HasRange;
+    size_t RangeFrom, RangeTo;
+};
+
+
+/**
+    Response to a HTTP request, as returned by IHttpTransport::Send().
+
+    Deleting the response closes its connection, possibly before all of
+    the body was read.
+ */
+class IHttpResponse
+{
+public:
+    virtual ~IHttpResponse() {}
+
+    /// Returns the HTTP status code.
+    virtual unsigned GetStatusCode() const = 0;
+
+    /// Gets value of the header @a name; returns false if there's none.
+    virtual bool GetHeader(const char *name, std::string& value) const = 0;
+
+    /// Returns URL of the response, which differs from the requested one
+    /// if the request was redirected.
+    virtual std::string GetURL() const = 0;
+
+    /// Returns time from sending the request until the response's headers
+    /// arrived, in milliseconds.
+    virtual unsigned GetTimeToHeaders() const = 0;
+
+    /**
+        Reads next chunk of the response's body, at most @a size bytes.
+
+        Returns as soon as some data are available, so the chunk may be
+        smaller. Returns 0 at the end of the body.
+
+        Throws on error or if the thread the request runs on is terminated.
+     */
+    virtual size_t Read(void *buffer, size_t size) = 0;
+};
+
+
+/**
+    Abstraction of the HTTP client used for all downloads.
+
+    Implementations must be thread-safe, requests may be sent from several
+    threads at the same time.
+ */
+class IHttpTransport
+{
+public:
+    virtual ~IHttpTransport() {}
+
+    /**
+        Sends GET request and waits for the response's headers.
+
+        Redirects are followed. Throws on error.
+
+        @param request   The request.
+        @param onThread  Thread the request runs on; waiting is cancelled
+                         if it is terminated. May be NULL.
+
+        @return The response; the caller must delete it.
+     */
+    virtual IHttpResponse *Send(const HttpRequestParams& request, Thread *onThread) = 0;
+
+    /**
+        Closes idle connections and other resources.
+
+        Requests that are still running aren't affected, their resources
+        are released when they finish. The transport can still be used
+        afterwards.
+     */
+    virtual void Close() {}
+};
+
+
+/**
+    Returns the transport used for downloads.
+
+    This is the WinINet transport (the socket one outside of Windows),
+    unless SetHttpTransport() was called.
+ */
+IHttpTransport& GetHttpTransport();
+
+/**
+    Sets the transport used for downloads, e.g. for testing.
+
+    Must not be called while any download is running. The caller keeps
+    ownership of @a transport; pass NULL to restore the default.
+ */
+void SetHttpTransport(IHttpTransport *transport);
+
+/// Creates transport using WinINet.
+IHttpTransport *CreateWinINetTransport();
+
+/**
+    Creates portable transport using plain sockets.
+
+    It only supports unencrypted HTTP/1.1 without proxies, which makes it
+    suitable for running against local test servers, also on platforms
+    without WinINet.
+ */
+IHttpTransport *CreateSocketTransport();
+
+
+// Helpers for implementations:
+
+/// Returns User-Agent string to use for requests.
+std::wstring GetHttpUserAgent();
+
+/// Returns Range header for the request, if it has a range.
+std::string GetHttpRangeHeader(const HttpRequestParams& request);
+
+} // namespace winsparkle
+
+#endif // _httptransport_h_
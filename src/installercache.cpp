@@ -0,0 +1,516 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "installercache.h"
+#include "settings.h"
+#include "error.h"
+#include "utils.h"
+
+#include <openssl/sha.h>
+
+#include <algorithm>
+#include <sstream>
+#include <rpc.h>
+#include <time.h>
+
+namespace winsparkle
+{
+
+/*--------------------------------------------------------------------------*
+                                  helpers
+ *--------------------------------------------------------------------------*/
+
+namespace
+{
+
+std::wstring GetUniqueTempDirectoryPrefix()
+{
+    wchar_t tmpdir[MAX_PATH + 1];
+    if (GetTempPath(MAX_PATH + 1, tmpdir) == 0)
+        throw Win32Exception("Cannot create temporary directory");
+
+    std::wstring dir(tmpdir);
+    dir += L"Update-";
+    return dir;
+}
+
+std::wstring CreateUniqueDirectory(const std::wstring& prefix)
+{
+    // This code creates a new randomized directory name and tries to create it;
+    // this process is repeated if the directory already exists.
+    for ( ;; )
+    {
+        std::wstring dir(prefix);
+        UUID uuid;
+        UuidCreate(&uuid);
+        RPC_WSTR uuidStr;
+        RPC_STATUS status = UuidToString(&uuid, &uuidStr);
+        dir += reinterpret_cast<wchar_t*>(uuidStr);
+        RpcStringFree(&uuidStr);
+
+        if ( CreateDirectory(dir.c_str(), NULL) )
+            return dir;
+        else if ( GetLastError() != ERROR_ALREADY_EXISTS )
+            throw Win32Exception("Cannot create temporary directory");
+    }
+}
+
+bool GetFileLength(const std::wstring& path, unsigned long long& size)
+{
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if ( !GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &data) ||
+         (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) )
+        return false;
+    size = (static_cast<unsigned long long>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+    return true;
+}
+
+// Config values can't be longer than 255 characters, so the entries are
+// stored in values of their own, InstallerCache0, InstallerCache1 and so on.
+const size_t MAX_ENTRY_LENGTH = 255;
+
+std::string GetEntryConfigName(size_t index)
+{
+    std::ostringstream name;
+    name << "InstallerCache" << index;
+    return name.str();
+}
+
+// Checks that the name doesn't refer to other directories.
+bool IsPlainName(const std::wstring& name)
+{
+    return !name.empty() && name != L"." && name != L".." &&
+           name.find_first_of(L"\\/:") == std::wstring::npos;
+}
+
+} // anonymous namespace
+
+
+/*--------------------------------------------------------------------------*
+                              cache entries
+ *--------------------------------------------------------------------------*/
+
+struct InstallerCache::Entry
+{
+    std::string Key;
+    std::wstring Dir;               // directory in the cache directory
+    std::wstring Filename;          // the installer in Dir
+    std::string Version;
+    unsigned long long Size;
+    unsigned long long LastUsed;    // time_t
+
+    bool operator<(const Entry& other) const { return LastUsed < other.LastUsed; }
+};
+
+CriticalSection InstallerCache::ms_csVars;
+InstallerCacheStats InstallerCache::ms_stats;
+
+
+// The cache directory is a temporary directory like those used for downloads
+// by older versions, so that it is accepted by IsDownloadDirectory() too.
+std::wstring InstallerCache::GetCacheDirectory(bool create)
+{
+    std::wstring dir;
+    if ( Settings::ReadConfigValue("InstallerCacheDir", dir) &&
+         IsDownloadDirectory(dir) &&
+         GetFileAttributes(dir.c_str()) != INVALID_FILE_ATTRIBUTES )
+    {
+        return dir;
+    }
+
+    if ( !create )
+        return std::wstring();
+
+    // entries of the old directory, if any, are gone
+    SaveEntries(std::vector<Entry>());
+
+    dir = CreateUniqueDirectory(GetUniqueTempDirectoryPrefix());
+    Settings::WriteConfigValue("InstallerCacheDir", dir);
+    return dir;
+}
+
+
+// Each entry is stored as a line with tab-separated key, directory, file
+// name, version, size and time of last use; they are in the order of use.
+
+std::wstring InstallerCache::FormatEntry(const Entry& e)
+{
+    std::wostringstream line;
+    line << AnsiToWide(e.Key) << L'\t'
+         << e.Dir << L'\t'
+         << e.Filename << L'\t'
+         << AnsiToWide(e.Version) << L'\t'
+         << e.Size << L'\t'
+         << e.LastUsed;
+    return line.str();
+}
+
+std::vector<InstallerCache::Entry> InstallerCache::LoadEntries()
+{
+    std::vector<Entry> entries;
+
+    std::wstring line;
+    for ( size_t index = 0; Settings::ReadConfigValue(GetEntryConfigName(index).c_str(), line); index++ )
+    {
+        std::wistringstream fields(line);
+        std::wstring key, version, size, lastUsed;
+        Entry e;
+        if ( !std::getline(fields, key, L'\t') ||
+             !std::getline(fields, e.Dir, L'\t') ||
+             !std::getline(fields, e.Filename, L'\t') ||
+             !std::getline(fields, version, L'\t') ||
+             !std::getline(fields, size, L'\t') ||
+             !std::getline(fields, lastUsed) ||
+             !(std::wistringstream(size) >> e.Size) ||
+             !(std::wistringstream(lastUsed) >> e.LastUsed) )
+        {
+            continue;
+        }
+
+        // don't let malicious users point us to arbitrary files
+        if ( key.empty() || !IsPlainName(e.Dir) || !IsPlainName(e.Filename) )
+            continue;
+
+        e.Key = WideToAnsi(key);
+        e.Version = WideToAnsi(version);
+        entries.push_back(e);
+    }
+
+    return entries;
+}
+
+void InstallerCache::SaveEntries(const std::vector<Entry>& entries)
+{
+    for ( size_t i = 0; i < entries.size(); i++ )
+        Settings::WriteConfigValue(GetEntryConfigName(i).c_str(), FormatEntry(entries[i]));
+
+    // delete values of entries that are gone
+    std::wstring line;
+    for ( size_t i = entries.size(); Settings::ReadConfigValue(GetEntryConfigName(i).c_str(), line); i++ )
+        Settings::DeleteConfigValue(GetEntryConfigName(i).c_str());
+}
+
+
+/*--------------------------------------------------------------------------*
+                             InstallerCache
+ *--------------------------------------------------------------------------*/
+
+std::string InstallerCache::GetKey(const Appcast::Enclosure& enclosure)
+{
+    if ( enclosure.DsaSignature.empty() || !Settings::HasDSAPubKeyPem() )
+        return std::string();
+
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    SHA256(reinterpret_cast<const unsigned char*>(enclosure.DsaSignature.data()),
+           enclosure.DsaSignature.size(), hash);
+
+    static const char hex[] = "0123456789abcdef";
+    std::string key;
+    for ( size_t i = 0; i < sizeof(hash); i++ )
+    {
+        key += hex[hash[i] >> 4];
+        key += hex[hash[i] & 0xF];
+    }
+    return key;
+}
+
+
+std::wstring InstallerCache::CreateDownloadDirectory()
+{
+    CriticalSectionLocker lock(ms_csVars);
+
+    // We need to put downloaded updates into a directory of their own, because
+    // if we put it in $TMP, some DLLs could be there and interfere with the
+    // installer.
+    return CreateUniqueDirectory(GetCacheDirectory(true) + L"\\");
+}
+
+
+bool InstallerCache::IsDownloadDirectory(const std::wstring& dir)
+{
+    try
+    {
+        return dir.find(GetUniqueTempDirectoryPrefix()) == 0 &&
+               dir.find(L"..") == std::wstring::npos;
+    }
+    catch (Win32Exception&) // cannot determine temp directory
+    {
+        return false;
+    }
+}
+
+
+bool InstallerCache::DeleteDownloadDirectory(const std::wstring& dir)
+{
+    if ( !IsDownloadDirectory(dir) )
+        return false;
+
+    CriticalSectionLocker lock(ms_csVars);
+
+    const std::wstring root = GetCacheDirectory(false);
+    if ( dir == root )
+        return false;
+
+    const std::vector<Entry> entries = LoadEntries();
+    for ( size_t i = 0; i < entries.size(); i++ )
+    {
+        // entries are only removed by Trim()
+        if ( dir == root + L"\\" + entries[i].Dir )
+            return true;
+    }
+
+    return DeleteDirectory(dir);
+}
+
+
+bool InstallerCache::Find(const std::string& key, std::wstring& path)
+{
+    CriticalSectionLocker lock(ms_csVars);
+
+    const std::wstring root = GetCacheDirectory(false);
+    if ( root.empty() )
+        return false;
+
+    const std::vector<Entry> entries = LoadEntries();
+    for ( size_t i = 0; i < entries.size(); i++ )
+    {
+        if ( entries[i].Key != key )
+            continue;
+        path = root + L"\\" + entries[i].Dir + L"\\" + entries[i].Filename;
+        return GetFileAttributes(path.c_str()) != INVALID_FILE_ATTRIBUTES;
+    }
+
+    return false;
+}
+
+
+bool InstallerCache::FindVersion(const std::string& version, std::wstring& path)
+{
+    CriticalSectionLocker lock(ms_csVars);
+
+    const std::wstring root = GetCacheDirectory(false);
+    if ( root.empty() )
+        return false;
+
+    // there may be several installers of the same version, e.g. if it
+    // was re-released; prefer the one used last
+    const std::vector<Entry> entries = LoadEntries();
+    const Entry *best = NULL;
+    for ( size_t i = 0; i < entries.size(); i++ )
+    {
+        const Entry& e = entries[i];
+        if ( e.Version != version || (best && best->LastUsed >= e.LastUsed) )
+            continue;
+        const std::wstring p = root + L"\\" + e.Dir + L"\\" + e.Filename;
+        if ( GetFileAttributes(p.c_str()) == INVALID_FILE_ATTRIBUTES )
+            continue;
+        best = &e;
+        path = p;
+    }
+
+    return best != NULL;
+}
+
+
+void InstallerCache::Add(const std::string& key, const std::string& version, const std::wstring& path)
+{
+    CriticalSectionLocker lock(ms_csVars);
+
+    const std::wstring root = GetCacheDirectory(false);
+    const size_t sep = path.find_last_of(L'\\');
+    if ( root.empty() || sep == std::wstring::npos ||
+         path.compare(0, root.length() + 1, root + L"\\") != 0 )
+    {
+        throw std::runtime_error("Update file is not in the cache directory.");
+    }
+
+    Entry e;
+    e.Key = key;
+    e.Dir = path.substr(root.length() + 1, sep - root.length() - 1);
+    e.Filename = path.substr(sep + 1);
+    e.Version = version;
+    e.LastUsed = time(NULL);
+    if ( !IsPlainName(e.Dir) || !IsPlainName(e.Filename) || !GetFileLength(path, e.Size) )
+        throw std::runtime_error("Update file is not in the cache directory.");
+    if ( FormatEntry(e).length() > MAX_ENTRY_LENGTH )
+        throw std::runtime_error("Update file name is too long to be cached.");
+
+    // replace older download of the same installer
+    std::vector<Entry> entries = LoadEntries();
+    for ( size_t i = 0; i < entries.size(); )
+    {
+        if ( entries[i].Key == key || entries[i].Dir == e.Dir )
+        {
+            if ( entries[i].Dir != e.Dir )
+                DeleteDirectory(root + L"\\" + entries[i].Dir);
+            entries.erase(entries.begin() + i);
+        }
+        else
+        {
+            i++;
+        }
+    }
+
+    entries.push_back(e);
+    SaveEntries(entries);
+}
+
+
+void InstallerCache::Remove(const std::string& key)
+{
+    CriticalSectionLocker lock(ms_csVars);
+
+    const std::wstring root = GetCacheDirectory(false);
+    std::vector<Entry> entries = LoadEntries();
+    for ( size_t i = 0; i < entries.size(); i++ )
+    {
+        if ( entries[i].Key != key )
+            continue;
+        if ( !root.empty() )
+            DeleteDirectory(root + L"\\" + entries[i].Dir);
+        entries.erase(entries.begin() + i);
+        SaveEntries(entries);
+        return;
+    }
+}
+
+
+void InstallerCache::Trim(const std::string& keepVersion, const std::wstring& keepDir)
+{
+    CriticalSectionLocker lock(ms_csVars);
+
+    const std::wstring root = GetCacheDirectory(false);
+    if ( root.empty() )
+        return;
+
+    // forget entries deleted by someone else
+    std::vector<Entry> entries = LoadEntries();
+    for ( size_t i = 0; i < entries.size(); )
+    {
+        const std::wstring path = root + L"\\" + entries[i].Dir + L"\\" + entries[i].Filename;
+        if ( GetFileAttributes(path.c_str()) == INVALID_FILE_ATTRIBUTES )
+            entries.erase(entries.begin() + i);
+        else
+            i++;
+    }
+
+    // delete leftovers of failed or abandoned downloads
+    WIN32_FIND_DATA data;
+    HANDLE find = FindFirstFile((root + L"\\*").c_str(), &data);
+    if ( find != INVALID_HANDLE_VALUE )
+    {
+        do
+        {
+            const std::wstring name(data.cFileName);
+            if ( !IsPlainName(name) || root + L"\\" + name == keepDir )
+                continue;
+
+            bool known = false;
+            for ( size_t i = 0; i < entries.size() && !known; i++ )
+                known = entries[i].Dir == name;
+            if ( !known )
+                DeleteDirectory(root + L"\\" + name);
+        } while ( FindNextFile(find, &data) );
+        FindClose(find);
+    }
+
+    // Evict least recently used entries over the limit. The installed
+    // version's installer is kept for delta updates and doesn't count
+    // towards the limit, unless caching is disabled; if there are several,
+    // e.g. of a re-released version, only the one used last is. Entries
+    // used in the same second stay in the order of use.
+    std::stable_sort(entries.begin(), entries.end());
+
+    const unsigned long long limit = Settings::GetInstallerCacheLimit();
+    std::string keepKey;
+    for ( size_t i = 0; i < entries.size() && limit > 0 && !keepVersion.empty(); i++ )
+    {
+        if ( entries[i].Version == keepVersion )
+            keepKey = entries[i].Key;
+    }
+
+    unsigned long long total = 0;
+    for ( size_t i = 0; i < entries.size(); i++ )
+    {
+        if ( entries[i].Key != keepKey )
+            total += entries[i].Size;
+    }
+
+    for ( size_t i = 0; i < entries.size() && total > limit; )
+    {
+        const Entry& e = entries[i];
+        // the installer may be still running, try another time
+        if ( e.Key == keepKey || !DeleteDirectory(root + L"\\" + e.Dir) )
+        {
+            i++;
+            continue;
+        }
+
+        ms_stats.Evictions++;
+        ms_stats.BytesEvicted += e.Size;
+        total -= e.Size;
+        entries.erase(entries.begin() + i);
+    }
+
+    SaveEntries(entries);
+}
+
+
+void InstallerCache::RecordHit(const std::string& key)
+{
+    CriticalSectionLocker lock(ms_csVars);
+
+    std::vector<Entry> entries = LoadEntries();
+    for ( size_t i = 0; i < entries.size(); i++ )
+    {
+        if ( entries[i].Key != key )
+            continue;
+        ms_stats.Hits++;
+        ms_stats.BytesSaved += entries[i].Size;
+
+        Entry e = entries[i];
+        e.LastUsed = time(NULL);
+        entries.erase(entries.begin() + i);
+        entries.push_back(e);
+        SaveEntries(entries);
+        return;
+    }
+}
+
+
+void InstallerCache::RecordMiss()
+{
+    CriticalSectionLocker lock(ms_csVars);
+    ms_stats.Misses++;
+}
+
+
+InstallerCacheStats InstallerCache::GetStats()
+{
+    CriticalSectionLocker lock(ms_csVars);
+    return ms_stats;
+}
+
+} // namespace winsparkle
@@ -0,0 +1,188 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _installercache_h_
+#define _installercache_h_
+
+#include "appcast.h"
+#include "threads.h"
+
+#include <string>
+#include <vector>
+
+namespace winsparkle
+{
+
+/**
+    Statistics of InstallerCache, for diagnostics.
+ */
+struct InstallerCacheStats
+{
+    InstallerCacheStats()
+        : Hits(0), Misses(0), BytesSaved(0), Evictions(0), BytesEvicted(0)
+    {}
+
+    /// Number of updates whose installer was found in the cache.
+    unsigned Hits;
+
+    /// Number of updates whose installer had to be downloaded.
+    unsigned Misses;
+
+    /// Total size of installers that didn't have to be downloaded.
+    unsigned long long BytesSaved;
+
+    /// Number of installers evicted from the cache.
+    unsigned Evictions;
+
+    /// Total size of evicted installers.
+    unsigned long long BytesEvicted;
+};
+
+
+/**
+    Cache of downloaded installers.
+
+    Updates are downloaded into directories inside the cache directory,
+    which is a temporary directory of its own for every application. Once
+    an installer is downloaded and verified, its directory becomes an entry
+    of the cache, keyed by the update's signature, and it is reused if
+    the same update is installed later, e.g. after the user postponed it.
+
+    Entries are evicted, least recently used first, when their total size
+    exceeds the limit set with Settings::SetInstallerCacheLimit(). The
+    installer of the installed version is kept outside of the limit, so
+    that delta updates can be applied to it, unless the limit is 0.
+
+    The entries are kept in the configuration.
+ */
+class InstallerCache
+{
+public:
+    /**
+        Returns the key of the update's installer, or empty string if it
+        can't be cached.
+
+        Only signed updates are cached, because cached installers must be
+        verified before they are used again.
+     */
+    static std::string GetKey(const Appcast::Enclosure& enclosure);
+
+    /**
+        Creates a new directory for downloading an update.
+
+        Throws on error.
+     */
+    static std::wstring CreateDownloadDirectory();
+
+    /**
+        Returns true if @a dir is a directory for downloading updates.
+
+        This is used to check directory names read from the configuration,
+        to prevent malicious users from forcing us into writing to (or
+        deleting) arbitrary directories. Directories of older WinSparkle
+        versions, which weren't in the cache directory, are accepted too.
+     */
+    static bool IsDownloadDirectory(const std::wstring& dir);
+
+    /**
+        Deletes the download directory @a dir with all its content, unless
+        it is an entry of the cache.
+
+        Returns false if it couldn't be deleted.
+     */
+    static bool DeleteDownloadDirectory(const std::wstring& dir);
+
+    /**
+        Finds cached installer.
+
+        The caller must verify the installer before using it and Remove()
+        it if that fails. RecordHit() or RecordMiss() should be called
+        after that.
+
+        @param key   Key as returned by GetKey().
+        @param path  Receives path to the installer.
+     */
+    static bool Find(const std::string& key, std::wstring& path);
+
+    /**
+        Finds cached installer of given version, e.g. to apply a delta
+        update to it.
+     */
+    static bool FindVersion(const std::string& version, std::wstring& path);
+
+    /**
+        Adds downloaded and verified installer to the cache.
+
+        The installer must be directly in a directory created by
+        CreateDownloadDirectory(), which becomes an entry of the cache.
+        Any other files in it are deleted together with the entry.
+
+        @param key      Key as returned by GetKey().
+        @param version  Version of the update.
+        @param path     Path to the installer.
+     */
+    static void Add(const std::string& key, const std::string& version, const std::wstring& path);
+
+    /// Removes the entry, e.g. if its installer doesn't verify anymore.
+    static void Remove(const std::string& key);
+
+    /**
+        Evicts least recently used entries while the cache is over
+        the limit and deletes directories that aren't its entries.
+
+        @param keepVersion  Installed version, whose installer is kept.
+        @param keepDir      Download directory that is in use, or empty.
+     */
+    static void Trim(const std::string& keepVersion, const std::wstring& keepDir);
+
+    /// Records that the cached installer of @a key was used.
+    static void RecordHit(const std::string& key);
+
+    /// Records that the installer had to be downloaded.
+    static void RecordMiss();
+
+    /// Returns statistics of the cache.
+    static InstallerCacheStats GetStats();
+
+private:
+    InstallerCache(); // no instances
+
+    struct Entry;
+
+    static std::wstring GetCacheDirectory(bool create);
+    static std::wstring FormatEntry(const Entry& e);
+    static std::vector<Entry> LoadEntries();
+    static void SaveEntries(const std::vector<Entry>& entries);
+
+private:
+    // guards the variables below and the entries in the configuration:
+    static CriticalSection ms_csVars;
+
+    static InstallerCacheStats ms_stats;
+};
+
+} // namespace winsparkle
+
+#endif // _installercache_h_
@@ -0,0 +1,487 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "mirrors.h"
+#include "httptransport.h"
+#include "error.h"
+
+#include <algorithm>
+
+namespace winsparkle
+{
+
+/*--------------------------------------------------------------------------*
+                                  helpers
+ *--------------------------------------------------------------------------*/
+
+namespace
+{
+
+// Mirrors aren't probed again sooner than this, in ms
+const unsigned long long PROBE_INTERVAL = 10 * 60 * 1000;
+
+// Delay before probing the next mirror if the previous one didn't respond
+// yet, in ms
+const unsigned long long PROBE_STAGGER = 250;
+
+// Probing is given up after this time, in ms
+const unsigned long long PROBE_TIMEOUT = 10 * 1000;
+
+// Mirrors are avoided for this long after a failure, in ms; the time
+// doubles with every consecutive failure, up to PROBE_INTERVAL
+const unsigned long long FAILURE_BACKOFF = 30 * 1000;
+
+// Weights of new samples in the smoothed values, as with TCP's SRTT
+const double RTT_GAIN = 1.0 / 8;
+const double THROUGHPUT_GAIN = 1.0 / 4;
+
+// Transfers smaller than this say more about latency than throughput
+const size_t THROUGHPUT_MIN_BYTES = 64 * 1024;
+
+// Mirrors are ranked by the estimated time to download this much
+const double RANKING_SIZE = 1024 * 1024;
+
+
+// Sends a probe request to a mirror.
+class ProbeThread : public Thread
+{
+public:
+    ProbeThread(const std::string& host, const std::string& path, Event& finished)
+        : Thread("WinSparkle mirror probe"),
+          m_host(host), m_path(path), m_finished(finished),
+          m_done(false), m_succeeded(false)
+    {}
+
+    bool IsDone() const
+    {
+        CriticalSectionLocker lock(m_cs);
+        return m_done;
+    }
+
+    bool Succeeded() const
+    {
+        CriticalSectionLocker lock(m_cs);
+        return m_succeeded;
+    }
+
+protected:
+    virtual void Run()
+    {
+        SignalReady();
+
+        bool succeeded = false;
+        try
+        {
+            // Just the headers are needed; ask for a single byte in case
+            // the response isn't closed early.
+            HttpRequestParams request;
+            request.URL = m_host + m_path;
+            request.BypassProxies = true;
+            request.HasRange = true;
+            request.RangeFrom = 0;
+            request.RangeTo = 1;
+
+            IHttpResponse *response = GetHttpTransport().Send(request, this);
+            const unsigned status = response->GetStatusCode();
+            const unsigned rtt = response->GetTimeToHeaders();
+            delete response;
+
+            succeeded = status != 0 && status < 400;
+            if ( succeeded )
+                Mirrors::ReportSuccess(m_host, rtt);
+            else
+                Mirrors::ReportFailure(m_host);
+        }
+        catch ( const std::exception& )
+        {
+            Mirrors::ReportFailure(m_host);
+        }
+        catch ( TerminateThreadException& )
+        {
+            // the race is over, this isn't the mirror's fault
+        }
+
+        {
+            CriticalSectionLocker lock(m_cs);
+            m_done = true;
+            m_succeeded = succeeded;
+        }
+        m_finished.Signal();
+    }
+
+    virtual bool IsJoinable() const { return true; }
+
+private:
+    std::string m_host, m_path;
+    Event& m_finished;
+    mutable CriticalSection m_cs;
+    bool m_done, m_succeeded;
+};
+
+
+// Probes of a single race; stops the remaining ones when done.
+class ProbeThreads
+{
+public:
+    ProbeThreads() {}
+
+    ~ProbeThreads()
+    {
+        for ( size_t i = 0; i < m_threads.size(); i++ )
+        {
+            m_threads[i]->TerminateAndJoin();
+            delete m_threads[i];
+        }
+    }
+
+    void Start(const std::string& host, const std::string& path)
+    {
+        ProbeThread *thread = new ProbeThread(host, path, m_finished);
+        m_threads.push_back(thread);
+        thread->Start();
+    }
+
+    bool HasWinner() const
+    {
+        for ( size_t i = 0; i < m_threads.size(); i++ )
+        {
+            if ( m_threads[i]->Succeeded() )
+                return true;
+        }
+        return false;
+    }
+
+    bool AllDone() const
+    {
+        for ( size_t i = 0; i < m_threads.size(); i++ )
+        {
+            if ( !m_threads[i]->IsDone() )
+                return false;
+        }
+        return true;
+    }
+
+    void WaitForChange(unsigned timeoutMilliseconds)
+    {
+        m_finished.WaitUntilSignaled(timeoutMilliseconds);
+    }
+
+private:
+    ProbeThreads(const ProbeThreads&);
+    ProbeThreads& operator=(const ProbeThreads&);
+
+    Event m_finished;
+    std::vector<ProbeThread*> m_threads;
+};
+
+
+double Smooth(double value, double sample, double gain)
+{
+    return value == 0 ? sample : value + gain * (sample - value);
+}
+
+} // anonymous namespace
+
+
+/*--------------------------------------------------------------------------*
+                               Mirrors class
+ *--------------------------------------------------------------------------*/
+
+CriticalSection Mirrors::ms_csVars;
+std::vector<Mirrors::Mirror> Mirrors::ms_mirrors;
+unsigned long long Mirrors::ms_lastProbe = 0;
+
+
+void Mirrors::Add(const std::string& host)
+{
+    std::string h(host);
+    while ( !h.empty() && h[h.length() - 1] == '/' )
+        h.erase(h.length() - 1);
+    if ( h.empty() )
+        return;
+
+    CriticalSectionLocker lock(ms_csVars);
+
+    if ( DoFind(h) )
+        return;
+
+    Mirror m = { h, 0, 0, 0, 0, 0, 0 };
+    ms_mirrors.push_back(m);
+    ms_lastProbe = 0;
+}
+
+
+void Mirrors::Clear()
+{
+    CriticalSectionLocker lock(ms_csVars);
+    ms_mirrors.clear();
+    ms_lastProbe = 0;
+}
+
+
+bool Mirrors::IsEmpty()
+{
+    CriticalSectionLocker lock(ms_csVars);
+    return ms_mirrors.empty();
+}
+
+
+std::string Mirrors::GetBestHost()
+{
+    CriticalSectionLocker lock(ms_csVars);
+    const std::vector<std::string> ranked = DoGetRanked();
+    return ranked.empty() ? std::string() : ranked[0];
+}
+
+
+void Mirrors::Probe(const std::string& path, Thread *onThread)
+{
+    std::vector<std::string> hosts;
+    {
+        CriticalSectionLocker lock(ms_csVars);
+        // there's nothing to choose from
+        if ( ms_mirrors.size() < 2 )
+            return;
+        if ( ms_lastProbe != 0 && GetMonotonicTime() - ms_lastProbe < PROBE_INTERVAL )
+            return;
+        ms_lastProbe = GetMonotonicTime();
+        hosts = DoGetRanked();
+    }
+
+    ProbeThreads probes;
+    size_t started = 0;
+    const unsigned long long start = GetMonotonicTime();
+    unsigned long long nextStart = start;
+
+    for ( ;; )
+    {
+        if ( onThread )
+            onThread->CheckShouldTerminate();
+
+        const unsigned long long now = GetMonotonicTime();
+
+        // don't wait for the next mirror's turn if all the probes failed
+        if ( started < hosts.size() && (now >= nextStart || probes.AllDone()) )
+        {
+            probes.Start(hosts[started++], path);
+            nextStart = now + PROBE_STAGGER;
+            continue;
+        }
+
+        if ( probes.HasWinner() )
+            break;
+        if ( started == hosts.size() && probes.AllDone() )
+            break;
+        if ( now - start >= PROBE_TIMEOUT )
+            break;
+
+        probes.WaitForChange(50);
+    }
+}
+
+
+void Mirrors::ReportSuccess(const std::string& host, unsigned timeToHeaders,
+                            size_t bytes, unsigned duration)
+{
+    CriticalSectionLocker lock(ms_csVars);
+
+    Mirror *m = DoFind(host);
+    if ( !m )
+        return;
+
+    m->transfers++;
+    m->recentFailures = 0;
+    m->srtt = Smooth(m->srtt, std::max(timeToHeaders, 1u), RTT_GAIN);
+    if ( bytes >= THROUGHPUT_MIN_BYTES && duration > 0 )
+        m->throughput = Smooth(m->throughput, bytes * 1000.0 / duration, THROUGHPUT_GAIN);
+}
+
+
+void Mirrors::ReportFailure(const std::string& host)
+{
+    CriticalSectionLocker lock(ms_csVars);
+
+    Mirror *m = DoFind(host);
+    if ( !m )
+        return;
+
+    m->failures++;
+    m->recentFailures++;
+    m->lastFailure = GetMonotonicTime();
+}
+
+
+std::string Mirrors::FindHost(const std::string& url, std::string *path)
+{
+    CriticalSectionLocker lock(ms_csVars);
+
+    for ( size_t i = 0; i < ms_mirrors.size(); i++ )
+    {
+        const std::string& host = ms_mirrors[i].host;
+        if ( url.compare(0, host.length(), host) == 0 &&
+             (url.length() == host.length() || url[host.length()] == '/') )
+        {
+            if ( path )
+                *path = url.substr(host.length());
+            return host;
+        }
+    }
+
+    return std::string();
+}
+
+
+std::vector<MirrorStats> Mirrors::GetStats()
+{
+    CriticalSectionLocker lock(ms_csVars);
+
+    std::vector<MirrorStats> stats;
+    const std::vector<std::string> ranked = DoGetRanked();
+    for ( size_t i = 0; i < ranked.size(); i++ )
+    {
+        const Mirror *m = DoFind(ranked[i]);
+        MirrorStats s;
+        s.Host = m->host;
+        s.SmoothedRTT = m->srtt;
+        s.Throughput = m->throughput;
+        s.Transfers = m->transfers;
+        s.Failures = m->failures;
+        stats.push_back(s);
+    }
+    return stats;
+}
+
+
+Mirrors::Mirror *Mirrors::DoFind(const std::string& host)
+{
+    for ( size_t i = 0; i < ms_mirrors.size(); i++ )
+    {
+        if ( ms_mirrors[i].host == host )
+            return &ms_mirrors[i];
+    }
+    return NULL;
+}
+
+
+std::vector<std::string> Mirrors::DoGetRanked()
+{
+    const unsigned long long now = GetMonotonicTime();
+
+    // Mirrors whose throughput wasn't measured yet are assumed to be as fast
+    // as the best one, so that they get a chance.
+    double bestThroughput = 0;
+    for ( size_t i = 0; i < ms_mirrors.size(); i++ )
+        bestThroughput = std::max(bestThroughput, ms_mirrors[i].throughput);
+
+    struct Ranked
+    {
+        int tier;       // 0 = measured, 1 = not measured yet, 2 = failed recently
+        double cost;    // estimated time to download RANKING_SIZE, in ms
+        size_t index;   // order of registration
+
+        bool operator<(const Ranked& other) const
+        {
+            if ( tier != other.tier )
+                return tier < other.tier;
+            if ( cost != other.cost )
+                return cost < other.cost;
+            return index < other.index;
+        }
+    };
+
+    std::vector<Ranked> ranked;
+    for ( size_t i = 0; i < ms_mirrors.size(); i++ )
+    {
+        const Mirror& m = ms_mirrors[i];
+        Ranked r = { 0, 0, i };
+
+        if ( m.recentFailures > 0 )
+        {
+            const unsigned shift = std::min(m.recentFailures - 1, 10u);
+            const unsigned long long backoff = std::min(FAILURE_BACKOFF << shift, PROBE_INTERVAL);
+            if ( now - m.lastFailure < backoff )
+                r.tier = 2;
+        }
+
+        if ( r.tier == 0 && m.srtt == 0 )
+            r.tier = 1;
+
+        r.cost = m.srtt;
+        const double throughput = m.throughput != 0 ? m.throughput : bestThroughput;
+        if ( throughput != 0 )
+            r.cost += RANKING_SIZE * 1000 / throughput;
+
+        ranked.push_back(r);
+    }
+
+    std::sort(ranked.begin(), ranked.end());
+
+    std::vector<std::string> hosts;
+    for ( size_t i = 0; i < ranked.size(); i++ )
+        hosts.push_back(ms_mirrors[ranked[i].index].host);
+    return hosts;
+}
+
+
+/*--------------------------------------------------------------------------*
+                            MirrorFailover class
+ *--------------------------------------------------------------------------*/
+
+std::string MirrorFailover::GetFailoverURL(const std::string& failedURL)
+{
+    CriticalSectionLocker lock(m_cs);
+
+    std::string path;
+    const std::string failedHost = Mirrors::FindHost(failedURL, &path);
+    if ( failedHost.empty() )
+        return std::string();
+
+    Mirrors::ReportFailure(failedHost);
+    if ( std::find(m_failed.begin(), m_failed.end(), failedHost) == m_failed.end() )
+        m_failed.push_back(failedHost);
+
+    const std::vector<MirrorStats> stats = Mirrors::GetStats();
+    for ( size_t i = 0; i < stats.size(); i++ )
+    {
+        if ( std::find(m_failed.begin(), m_failed.end(), stats[i].Host) == m_failed.end() )
+        {
+            LogError("Download failed, continuing from mirror " + stats[i].Host);
+            return stats[i].Host + path;
+        }
+    }
+
+    return std::string();
+}
+
+
+void MirrorFailover::ReportTransfer(const std::string& url, unsigned timeToHeaders,
+                                    size_t bytes, unsigned duration)
+{
+    const std::string host = Mirrors::FindHost(url);
+    if ( !host.empty() )
+        Mirrors::ReportSuccess(host, timeToHeaders, bytes, duration);
+}
+
+} // namespace winsparkle
@@ -0,0 +1,177 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _mirrors_h_
+#define _mirrors_h_
+
+#include "download.h"
+#include "threads.h"
+
+#include <string>
+#include <vector>
+
+namespace winsparkle
+{
+
+/**
+    Statistics of a mirror, for diagnostics.
+
+    See Mirrors::GetStats().
+ */
+struct MirrorStats
+{
+    MirrorStats() : SmoothedRTT(0), Throughput(0), Transfers(0), Failures(0) {}
+
+    /// The host, as registered with Mirrors::Add().
+    std::string Host;
+
+    /// Smoothed time until response headers arrive, in ms; 0 if unknown.
+    double SmoothedRTT;
+
+    /// Smoothed throughput of downloads, in bytes per second; 0 if unknown.
+    double Throughput;
+
+    /// Number of successful requests.
+    unsigned Transfers;
+
+    /// Number of failed requests.
+    unsigned Failures;
+};
+
+
+/**
+    Mirrors of the update server.
+
+    If any mirrors are registered, ApplicationController::GetAvailableHost()
+    returns the best of them instead of calling the application's callback.
+    Hosts are ranked by smoothed latency and download throughput, measured
+    both by probes (see Probe()) and by regular downloads; hosts that failed
+    recently are avoided for a while.
+ */
+class Mirrors
+{
+public:
+    /// Registers a mirror, e.g. "https://eu.example.com".
+    static void Add(const std::string& host);
+
+    /// Removes all mirrors.
+    static void Clear();
+
+    /// Returns true if no mirrors are registered.
+    static bool IsEmpty();
+
+    /// Returns the best mirror, or empty string if none is registered.
+    static std::string GetBestHost();
+
+    /**
+        Probes the mirrors, unless they were probed recently.
+
+        Mirrors are raced "happy eyeballs" style: a probe is sent to the best
+        ranked one and if it doesn't respond within a short time, to the next
+        one too, and so on, without cancelling the earlier probes. This stops
+        as soon as any mirror responds.
+
+        @param path      Path of the resource requested from the mirrors,
+                         i.e. the appcast's.
+        @param onThread  Thread the probes are run from; they are cancelled
+                         if it is terminated. May be NULL.
+     */
+    static void Probe(const std::string& path, Thread *onThread);
+
+    /**
+        Records successful request to @a host.
+
+        @param host           The mirror.
+        @param timeToHeaders  Time until response headers arrived, in ms.
+        @param bytes          Size of the downloaded data, 0 if not known.
+        @param duration       Time spent downloading the data, in ms.
+     */
+    static void ReportSuccess(const std::string& host, unsigned timeToHeaders,
+                              size_t bytes = 0, unsigned duration = 0);
+
+    /// Records failed request to @a host.
+    static void ReportFailure(const std::string& host);
+
+    /**
+        Returns mirror whose URL @a url is, or empty string if it isn't on any.
+
+        If @a path is given, it receives the rest of the URL after the host.
+     */
+    static std::string FindHost(const std::string& url, std::string *path = NULL);
+
+    /// Returns statistics of all mirrors, best ranked first.
+    static std::vector<MirrorStats> GetStats();
+
+private:
+    Mirrors(); // no instances
+
+    struct Mirror
+    {
+        std::string host;
+        double srtt;                    // smoothed RTT, ms
+        double throughput;              // smoothed throughput, bytes/s
+        unsigned transfers;
+        unsigned failures;
+        unsigned recentFailures;        // consecutive failures
+        unsigned long long lastFailure; // GetMonotonicTime() of the last one
+    };
+
+    static std::vector<std::string> DoGetRanked();
+    static Mirror *DoFind(const std::string& host);
+
+private:
+    // guards the variables below:
+    static CriticalSection ms_csVars;
+
+    static std::vector<Mirror> ms_mirrors;
+    static unsigned long long ms_lastProbe;
+};
+
+
+/**
+    Moves a download to other mirrors when it fails, see
+    DownloadFileSegmented().
+
+    Each mirror is tried at most once per download, in the order of ranking.
+    Transfers are reported to Mirrors, so that their statistics are kept up
+    to date.
+ */
+class MirrorFailover : public IDownloadMirrors
+{
+public:
+    MirrorFailover() {}
+
+    virtual std::string GetFailoverURL(const std::string& failedURL);
+    virtual void ReportTransfer(const std::string& url, unsigned timeToHeaders,
+                                size_t bytes, unsigned duration);
+
+private:
+    CriticalSection m_cs;
+    std::vector<std::string> m_failed;
+};
+
+} // namespace winsparkle
+
+#endif // _mirrors_h_
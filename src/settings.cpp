@@ -44,6 +44,12 @@ std::wstring Settings::ms_appVersion;
 std::wstring Settings::ms_appBuildVersion;
 std::string  Settings::ms_DSAPubKey;
 std::map<std::string, std::string> Settings::ms_httpHeaders;
+win_sparkle_flush_policy_t Settings::ms_downloadFlushPolicy = WIN_SPARKLE_FLUSH_NONE;
+unsigned Settings::ms_downloadRateLimit = 0;
+win_sparkle_download_priority_t Settings::ms_downloadPriority = WIN_SPARKLE_DOWNLOAD_PRIORITY_FOREGROUND;
+unsigned long long Settings::ms_installerCacheLimit = 1024 * 1024 * 1024;
+bool Settings::ms_prestageUpdates = false;
+bool Settings::ms_extractArchives = false;
 
 win_sparkle_config_methods_t Settings::ms_configMethods = GetDefaultConfigMethods();
 
@@ -236,7 +242,8 @@ void __cdecl Settings::RegistryDelete(const char *name, void *)
 
     RegCloseKey(key);
 
-    if (result != ERROR_SUCCESS)
+    // deleting a value that isn't set is not an error
+    if (result != ERROR_SUCCESS && result != ERROR_FILE_NOT_FOUND)
         throw Win32Exception("Cannot delete settings from registry");
 }
 
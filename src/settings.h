@@ -65,6 +65,13 @@ public:
         return host + ms_appcastPath;
     }
 
+    /// Get path of the appcast on the update server
+    static std::string GetAppcastPath()
+    {
+        CriticalSectionLocker lock(ms_csVars);
+        return ms_appcastPath;
+    }
+
     /// Return application name
     static std::wstring GetAppName()
     {
@@ -222,6 +229,90 @@ public:
         ms_httpHeaders.clear();
     }
 
+    /// Set durability policy for downloaded updates
+    static void SetDownloadFlushPolicy(win_sparkle_flush_policy_t policy)
+    {
+        CriticalSectionLocker lock(ms_csVars);
+        ms_downloadFlushPolicy = policy;
+    }
+
+    /// Get durability policy for downloaded updates
+    static win_sparkle_flush_policy_t GetDownloadFlushPolicy()
+    {
+        CriticalSectionLocker lock(ms_csVars);
+        return ms_downloadFlushPolicy;
+    }
+
+    /// Set maximum rate of downloading updates, 0 for no limit
+    static void SetDownloadRateLimit(unsigned bytesPerSecond)
+    {
+        CriticalSectionLocker lock(ms_csVars);
+        ms_downloadRateLimit = bytesPerSecond;
+    }
+
+    /// Get maximum rate of downloading updates, 0 if there's no limit
+    static unsigned GetDownloadRateLimit()
+    {
+        CriticalSectionLocker lock(ms_csVars);
+        return ms_downloadRateLimit;
+    }
+
+    /// Set priority of downloading updates
+    static void SetDownloadPriority(win_sparkle_download_priority_t priority)
+    {
+        CriticalSectionLocker lock(ms_csVars);
+        ms_downloadPriority = priority;
+    }
+
+    /// Get priority of downloading updates
+    static win_sparkle_download_priority_t GetDownloadPriority()
+    {
+        CriticalSectionLocker lock(ms_csVars);
+        return ms_downloadPriority;
+    }
+
+    /// Set maximum total size of cached installers, see InstallerCache
+    static void SetInstallerCacheLimit(unsigned long long bytes)
+    {
+        CriticalSectionLocker lock(ms_csVars);
+        ms_installerCacheLimit = bytes;
+    }
+
+    /// Get maximum total size of cached installers
+    static unsigned long long GetInstallerCacheLimit()
+    {
+        CriticalSectionLocker lock(ms_csVars);
+        return ms_installerCacheLimit;
+    }
+
+    /// Set whether updates are downloaded before the user is notified
+    static void SetPrestageUpdates(bool prestage)
+    {
+        CriticalSectionLocker lock(ms_csVars);
+        ms_prestageUpdates = prestage;
+    }
+
+    /// Get whether updates are downloaded before the user is notified
+    static bool GetPrestageUpdates()
+    {
+        CriticalSectionLocker lock(ms_csVars);
+        return ms_prestageUpdates;
+    }
+
+    /// Set whether archive updates are extracted while they are downloaded
+    static void SetExtractArchives(bool extract)
+    {
+        CriticalSectionLocker lock(ms_csVars);
+        ms_extractArchives = extract;
+    }
+
+    /// Get whether archive updates are extracted while they are downloaded
+    static bool GetExtractArchives()
+    {
+        CriticalSectionLocker lock(ms_csVars);
+        return ms_extractArchives;
+    }
+
     /// Set application's build version number
     static void SetAppBuildVersion(const wchar_t *version)
     {
@@ -331,7 +422,7 @@ public:
         return rv;
     }
 
-    // Deletes value from registry.
+    // Deletes value from registry, if it is set.
     static void DeleteConfigValue(const char *name);
 
     //@}
@@ -372,6 +463,12 @@ private:
     static std::wstring ms_appBuildVersion;
     static std::string  ms_DSAPubKey;
     static std::map<std::string, std::string> ms_httpHeaders;
+    static win_sparkle_flush_policy_t ms_downloadFlushPolicy;
+    static unsigned ms_downloadRateLimit;
+    static win_sparkle_download_priority_t ms_downloadPriority;
+    static unsigned long long ms_installerCacheLimit;
+    static bool ms_prestageUpdates;
+    static bool ms_extractArchives;
     static win_sparkle_config_methods_t ms_configMethods;
 };
 
@@ -173,20 +173,27 @@ public:
     {
         unsigned char sha1[SHA_DIGEST_LENGTH];
 
+        // SHA1 of file
         {
             WinCryptRSAContext ctx;
-            // SHA1 of file
-            {
-                WinCryptSHA1Hash hash(ctx);
-                hash.hashFile(filename);
-                hash.sha1Val(sha1);
-            }
-            // SHA1 of SHA1 of file
-            {
-                WinCryptSHA1Hash hash(ctx);
-                hash.hashData(sha1, ARRAYSIZE(sha1));
-                hash.sha1Val(sha1);
-            }
+            WinCryptSHA1Hash hash(ctx);
+            hash.hashFile(filename);
+            hash.sha1Val(sha1);
+        }
+
+        VerifyDSASHA1DigestSignature(sha1, signature);
+    }
+
+    void VerifyDSASHA1DigestSignature(const unsigned char(&fileSha1)[SHA_DIGEST_LENGTH], const std::string &signature)
+    {
+        unsigned char sha1[SHA_DIGEST_LENGTH];
+
+        // SHA1 of SHA1 of file
+        {
+            WinCryptRSAContext ctx;
+            WinCryptSHA1Hash hash(ctx);
+            hash.hashData(fileSha1, SHA_DIGEST_LENGTH);
+            hash.sha1Val(sha1);
         }
 
         DSAPub pubKey(Settings::GetDSAPubKeyPem());
@@ -315,4 +322,31 @@ void SignatureVerifier::VerifyDSASHA1SignatureValid(const std::wstring &filename
     }
 }
 
+void SignatureVerifier::VerifyDSASHA1DigestSignatureValid(const std::string &sha1, const std::string &signature_base64)
+{
+    try
+    {
+        if (signature_base64.size() == 0)
+            throw BadSignatureException("Missing DSA signature!");
+        if (sha1.size() != SHA_DIGEST_LENGTH)
+            throw BadSignatureException("Invalid SHA1 digest!");
+
+        unsigned char fileSha1[SHA_DIGEST_LENGTH];
+        memcpy(fileSha1, sha1.data(), SHA_DIGEST_LENGTH);
+        TinySSL::inst().VerifyDSASHA1DigestSignature(fileSha1, Base64ToBin(signature_base64));
+    }
+    catch (BadSignatureException&)
+    {
+        throw;
+    }
+    catch (const std::exception &e)
+    {
+        throw BadSignatureException(e.what());
+    }
+    catch (...)
+    {
+        throw BadSignatureException();
+    }
+}
+
 } // namespace winsparkle
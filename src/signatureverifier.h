@@ -49,6 +49,11 @@ public:
     // openssl dgst -sha1 -binary < filename | openssl dgst -sha1 -verify dsa_pub.pem -signature signature.bin
     // Throws BadSignatureException on failure.
     static void VerifyDSASHA1SignatureValid(const std::wstring &filename, const std::string &signature_base64);
+
+    // Same as VerifyDSASHA1SignatureValid(), but uses SHA1 hash of the file
+    // (in binary form) computed by the caller, e.g. while downloading it.
+    // Throws BadSignatureException on failure.
+    static void VerifyDSASHA1DigestSignatureValid(const std::string &sha1, const std::string &signature_base64);
 };
 
 } // namespace winsparkle
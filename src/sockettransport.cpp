@@ -0,0 +1,514 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// winsock2.h must be included before windows.h
+#ifdef _WIN32
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+#else
+    #include <sys/types.h>
+    #include <sys/socket.h>
+    #include <sys/select.h>
+    #include <netdb.h>
+    #include <unistd.h>
+#endif
+
+#include "httptransport.h"
+
+#include "error.h"
+#include "threads.h"
+#include "utils.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
+
+namespace winsparkle
+{
+
+/*--------------------------------------------------------------------------*
+                                helpers
+ *--------------------------------------------------------------------------*/
+
+namespace
+{
+
+#ifdef _WIN32
+typedef SOCKET SocketHandle;
+inline void CloseSocket(SocketHandle s) { closesocket(s); }
+#else
+typedef int SocketHandle;
+const SocketHandle INVALID_SOCKET = -1;
+inline void CloseSocket(SocketHandle s) { close(s); }
+#endif
+
+// Maximum number of redirects followed
+const int MAX_REDIRECTS = 5;
+
+// Interval of checks for thread termination while waiting, in ms
+const int POLL_INTERVAL = 100;
+
+
+// Components of a http:// URL
+struct HttpURL
+{
+    HttpURL(const std::string& url)
+    {
+        if ( url.compare(0, 7, "http://") != 0 )
+            throw DownloadException("Only http:// URLs are supported by the socket transport");
+
+        const size_t hostStart = 7;
+        size_t pathStart = url.find('/', hostStart);
+        if ( pathStart == std::string::npos )
+            pathStart = url.length();
+
+        host = url.substr(hostStart, pathStart - hostStart);
+        path = pathStart < url.length() ? url.substr(pathStart) : "/";
+        const size_t fragment = path.find('#');
+        if ( fragment != std::string::npos )
+            path.erase(fragment);
+
+        port = "80";
+        const size_t colon = host.rfind(':');
+        if ( colon != std::string::npos && host.find(']', colon) == std::string::npos )
+        {
+            port = host.substr(colon + 1);
+            host.erase(colon);
+        }
+        if ( host.length() > 2 && host[0] == '[' && host[host.length() - 1] == ']' )
+            host = host.substr(1, host.length() - 2);
+
+        if ( host.empty() )
+            throw DownloadException("Invalid URL");
+    }
+
+    std::string host, port, path;
+};
+
+
+// Resolves @a location relative to @a base.
+std::string ResolveURL(const std::string& base, const std::string& location)
+{
+    if ( location.find("://") != std::string::npos )
+        return location;
+
+    const size_t hostEnd = base.find('/', 7);
+    const std::string origin = base.substr(0, hostEnd);
+    if ( !location.empty() && location[0] == '/' )
+        return origin + location;
+
+    std::string path = hostEnd == std::string::npos ? "/" : base.substr(hostEnd);
+    path.erase(path.find_first_of("?#") == std::string::npos ? path.length() : path.find_first_of("?#"));
+    path.erase(path.rfind('/') + 1);
+    return origin + path + location;
+}
+
+
+bool EqualsNoCase(const std::string& a, const char *b)
+{
+    if ( a.length() != strlen(b) )
+        return false;
+    for ( size_t i = 0; i < a.length(); i++ )
+    {
+        if ( tolower((unsigned char)a[i]) != tolower((unsigned char)b[i]) )
+            return false;
+    }
+    return true;
+}
+
+
+// Connection to the server, with buffered reading.
+class SocketConnection
+{
+public:
+    SocketConnection(Thread *onThread)
+        : m_socket(INVALID_SOCKET), m_thread(onThread), m_bufPos(0), m_bufLen(0)
+    {}
+
+    ~SocketConnection()
+    {
+        if ( m_socket != INVALID_SOCKET )
+            CloseSocket(m_socket);
+    }
+
+    void Connect(const HttpURL& url)
+    {
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+
+        addrinfo *addresses = NULL;
+        if ( getaddrinfo(url.host.c_str(), url.port.c_str(), &hints, &addresses) != 0 )
+            throw DownloadException("Failed to resolve host name");
+
+        for ( addrinfo *a = addresses; a; a = a->ai_next )
+        {
+            SocketHandle s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if ( s == INVALID_SOCKET )
+                continue;
+            if ( connect(s, a->ai_addr, (int)a->ai_addrlen) == 0 )
+            {
+                m_socket = s;
+                break;
+            }
+            CloseSocket(s);
+        }
+        freeaddrinfo(addresses);
+
+        if ( m_socket == INVALID_SOCKET )
+            throw DownloadException("Failed to connect to the server");
+    }
+
+    void Send(const std::string& data)
+    {
+        size_t sent = 0;
+        while ( sent < data.length() )
+        {
+            const int n = send(m_socket, data.c_str() + sent, (int)(data.length() - sent), 0);
+            if ( n <= 0 )
+                throw DownloadException("Failed to send request");
+            sent += n;
+        }
+    }
+
+    // Reads a line terminated with CRLF, without the terminator. Returns
+    // false if the connection was closed first.
+    bool ReadLine(std::string& line)
+    {
+        line.clear();
+        for ( ;; )
+        {
+            if ( m_bufPos == m_bufLen && !Fill() )
+                return false;
+
+            const char *start = &m_buf[m_bufPos];
+            const char *nl = (const char*)memchr(start, '\n', m_bufLen - m_bufPos);
+            if ( nl )
+            {
+                line.append(start, nl - start);
+                m_bufPos += nl - start + 1;
+                if ( !line.empty() && line[line.length() - 1] == '\r' )
+                    line.erase(line.length() - 1);
+                return true;
+            }
+
+            line.append(start, m_bufLen - m_bufPos);
+            m_bufPos = m_bufLen;
+        }
+    }
+
+    // Reads at most @a size bytes; returns 0 when the connection is closed.
+    size_t Read(void *buffer, size_t size)
+    {
+        if ( m_bufPos < m_bufLen )
+        {
+            const size_t len = std::min(size, m_bufLen - m_bufPos);
+            memcpy(buffer, &m_buf[m_bufPos], len);
+            m_bufPos += len;
+            return len;
+        }
+
+        // read large chunks directly, without copying
+        return Receive(buffer, size);
+    }
+
+private:
+    bool Fill()
+    {
+        if ( m_buf.empty() )
+            m_buf.resize(16 * 1024);
+        m_bufPos = 0;
+        m_bufLen = Receive(&m_buf[0], m_buf.size());
+        return m_bufLen != 0;
+    }
+
+    size_t Receive(void *buffer, size_t size)
+    {
+        for ( ;; )
+        {
+            if ( m_thread )
+                m_thread->CheckShouldTerminate();
+
+            fd_set readable;
+            FD_ZERO(&readable);
+            FD_SET(m_socket, &readable);
+            timeval timeout = { 0, POLL_INTERVAL * 1000 };
+            const int ready = select((int)m_socket + 1, &readable, NULL, NULL, &timeout);
+            if ( ready < 0 )
+                throw DownloadException();
+            if ( ready == 0 )
+                continue;
+
+            const int n = recv(m_socket, (char*)buffer, (int)std::min(size, (size_t)0x7fffffff), 0);
+            if ( n < 0 )
+                throw DownloadException();
+            return n;
+        }
+    }
+
+    SocketConnection(const SocketConnection&);
+    SocketConnection& operator=(const SocketConnection&);
+
+    SocketHandle m_socket;
+    Thread *m_thread;
+    std::vector<char> m_buf;
+    size_t m_bufPos, m_bufLen;
+};
+
+
+// HTTP/1.1 response read from its own connection.
+class SocketResponse : public IHttpResponse
+{
+public:
+    SocketResponse(const std::string& url, Thread *onThread)
+        : m_url(url), m_conn(onThread), m_statusCode(0), m_timeToHeaders(0),
+          m_chunked(false), m_chunkStarted(false), m_hasLength(false), m_remaining(0), m_done(false)
+    {}
+
+    // Sends the request and reads the response's headers.
+    void Open(const HttpRequestParams& request)
+    {
+        const HttpURL url(m_url);
+
+        const auto start = std::chrono::steady_clock::now();
+
+        m_conn.Connect(url);
+
+        std::string req = "GET " + url.path + " HTTP/1.1\r\n";
+        req += "Host: " + url.host + (url.port != "80" ? ":" + url.port : std::string()) + "\r\n";
+        req += "User-Agent: " + WideToAnsi(GetHttpUserAgent()) + "\r\n";
+        req += "Connection: close\r\n";
+        if ( request.BypassProxies )
+            req += "Cache-Control: no-cache\r\nPragma: no-cache\r\n";
+        req += GetHttpRangeHeader(request);
+        req += request.Headers;
+        req += "\r\n";
+        m_conn.Send(req);
+
+        ReadHeaders();
+
+        m_timeToHeaders = (unsigned)std::chrono::duration_cast<std::chrono::milliseconds>(
+                              std::chrono::steady_clock::now() - start).count();
+
+        std::string value;
+        if ( GetHeader("Transfer-Encoding", value) && value.find("chunked") != std::string::npos )
+        {
+            m_chunked = true;
+        }
+        else if ( GetHeader("Content-Length", value) )
+        {
+            m_hasLength = true;
+            m_remaining = strtoull(value.c_str(), NULL, 10);
+        }
+
+        // these responses never have a body
+        if ( m_statusCode == 204 || m_statusCode == 304 )
+            m_done = true;
+    }
+
+    virtual unsigned GetStatusCode() const { return m_statusCode; }
+
+    virtual bool GetHeader(const char *name, std::string& value) const
+    {
+        for ( size_t i = 0; i < m_headers.size(); i++ )
+        {
+            if ( EqualsNoCase(m_headers[i].first, name) )
+            {
+                value = m_headers[i].second;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    virtual std::string GetURL() const { return m_url; }
+
+    virtual unsigned GetTimeToHeaders() const { return m_timeToHeaders; }
+
+    virtual size_t Read(void *buffer, size_t size)
+    {
+        if ( m_done || size == 0 )
+            return 0;
+
+        if ( m_chunked )
+        {
+            if ( m_remaining == 0 && !NextChunk() )
+                return 0;
+        }
+        else if ( !m_hasLength )
+        {
+            // the body ends when the server closes the connection
+            const size_t len = m_conn.Read(buffer, size);
+            if ( len == 0 )
+                m_done = true;
+            return len;
+        }
+        else if ( m_remaining == 0 )
+        {
+            m_done = true;
+            return 0;
+        }
+
+        const size_t len = m_conn.Read(buffer, (size_t)std::min<unsigned long long>(size, m_remaining));
+        if ( len == 0 )
+            throw DownloadException("Connection closed prematurely");
+        m_remaining -= len;
+        return len;
+    }
+
+private:
+    void ReadHeaders()
+    {
+        std::string line;
+        if ( !m_conn.ReadLine(line) )
+            throw DownloadException("Connection closed prematurely");
+
+        // "HTTP/1.1 200 OK"
+        const size_t space = line.find(' ');
+        if ( line.compare(0, 5, "HTTP/") != 0 || space == std::string::npos )
+            throw DownloadException("Invalid HTTP response");
+        m_statusCode = (unsigned)strtoul(line.c_str() + space + 1, NULL, 10);
+
+        for ( ;; )
+        {
+            if ( !m_conn.ReadLine(line) )
+                throw DownloadException("Connection closed prematurely");
+            if ( line.empty() )
+                break;
+
+            const size_t colon = line.find(':');
+            if ( colon == std::string::npos )
+                continue;
+            const size_t valueStart = line.find_first_not_of(" \t", colon + 1);
+            m_headers.push_back(std::make_pair(line.substr(0, colon),
+                                               valueStart == std::string::npos ? std::string() : line.substr(valueStart)));
+        }
+    }
+
+    // Starts reading next chunk of chunked body. Returns false at the end.
+    bool NextChunk()
+    {
+        std::string line;
+        if ( m_chunkStarted )
+        {
+            // CRLF terminating the previous chunk
+            if ( !m_conn.ReadLine(line) )
+                throw DownloadException("Connection closed prematurely");
+        }
+        m_chunkStarted = true;
+
+        if ( !m_conn.ReadLine(line) )
+            throw DownloadException("Connection closed prematurely");
+        m_remaining = strtoull(line.c_str(), NULL, 16);
+        if ( m_remaining != 0 )
+            return true;
+
+        // skip trailers
+        while ( m_conn.ReadLine(line) && !line.empty() ) {}
+        m_done = true;
+        return false;
+    }
+
+    std::string m_url;
+    SocketConnection m_conn;
+    unsigned m_statusCode;
+    std::vector< std::pair<std::string, std::string> > m_headers;
+    unsigned m_timeToHeaders;
+
+    bool m_chunked;
+    bool m_chunkStarted;
+    bool m_hasLength;
+    unsigned long long m_remaining;  // of Content-Length or current chunk
+    bool m_done;
+};
+
+
+// Portable transport using a new connection for every request.
+class SocketTransport : public IHttpTransport
+{
+public:
+    SocketTransport()
+    {
+#ifdef _WIN32
+        WSADATA wsaData;
+        if ( WSAStartup(MAKEWORD(2, 2), &wsaData) != 0 )
+            throw Win32Exception("Failed to initialize Winsock");
+#endif
+    }
+
+    ~SocketTransport()
+    {
+#ifdef _WIN32
+        WSACleanup();
+#endif
+    }
+
+    virtual IHttpResponse *Send(const HttpRequestParams& request, Thread *onThread)
+    {
+        std::string url = request.URL;
+        for ( int redirects = 0; ; redirects++ )
+        {
+            SocketResponse *response = new SocketResponse(url, onThread);
+            try
+            {
+                response->Open(request);
+            }
+            catch ( ... )
+            {
+                delete response;
+                throw;
+            }
+
+            const unsigned status = response->GetStatusCode();
+            std::string location;
+            if ( (status == 301 || status == 302 || status == 303 || status == 307 || status == 308) &&
+                 response->GetHeader("Location", location) &&
+                 redirects < MAX_REDIRECTS )
+            {
+                delete response;
+                url = ResolveURL(url, location);
+                continue;
+            }
+
+            return response;
+        }
+    }
+};
+
+} // anonymous namespace
+
+
+IHttpTransport *CreateSocketTransport()
+{
+    return new SocketTransport;
+}
+
+} // namespace winsparkle
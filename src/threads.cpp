@@ -25,12 +25,16 @@
 
 #include "threads.h"
 
-#include <windows.h>
-#include <process.h>
+#ifdef _WIN32
+    #include <windows.h>
+    #include <process.h>
+#endif
 
 namespace winsparkle
 {
 
+#ifdef _WIN32
+
 /*--------------------------------------------------------------------------*
                                  Helpers
  *--------------------------------------------------------------------------*/
@@ -115,13 +119,10 @@ Thread::~Thread()
 
 /*static*/ unsigned __stdcall Thread::ThreadEntryPoint(void *data)
 {
+    Thread *thread = reinterpret_cast<Thread*>(data);
     try
     {
-        Thread *thread = reinterpret_cast<Thread*>(data);
         thread->Run();
-
-        if ( !thread->IsJoinable() )
-            delete thread;
     }
     catch ( TerminateThreadException& )
     {
@@ -129,6 +130,9 @@ Thread::~Thread()
     }
     CATCH_ALL_EXCEPTIONS
 
+    if ( !thread->IsJoinable() )
+        delete thread;
+
     return 0;
 }
 
@@ -157,9 +161,160 @@ void Thread::Join()
 }
 
 
-void Thread::TerminateAndJoin()
+bool Thread::Join(unsigned timeoutMilliseconds)
+{
+    if ( !m_handle )
+        throw Win32Exception();
+
+    switch ( WaitForSingleObject(m_handle, timeoutMilliseconds) )
+    {
+        case WAIT_OBJECT_0:
+            return true;
+        case WAIT_TIMEOUT:
+            return false;
+        default:
+            throw Win32Exception();
+    }
+}
+
+
+/*--------------------------------------------------------------------------*
+                                 Timing
+ *--------------------------------------------------------------------------*/
+
+unsigned long long GetMonotonicTime()
+{
+    return GetTickCount64();
+}
+
+
+void SleepMilliseconds(unsigned milliseconds)
+{
+    Sleep(milliseconds);
+}
+
+#else // !_WIN32
+
+/*--------------------------------------------------------------------------*
+                              Thread class
+ *--------------------------------------------------------------------------*/
+
+// The std::thread is created by Start(); name is only used by the Windows
+// debugger.
+Thread::Thread(const char *) : m_finished(false)
+{
+}
+
+
+Thread::~Thread()
+{
+    // like closing the thread's handle on Windows, this doesn't stop it
+    if ( m_thread.joinable() )
+        m_thread.detach();
+}
+
+
+/*static*/ void Thread::ThreadEntryPoint(Thread *thread)
+{
+    try
+    {
+        thread->Run();
+    }
+    catch ( TerminateThreadException& )
+    {
+        // this is OK, just return
+    }
+    CATCH_ALL_EXCEPTIONS
+
+    if ( !thread->IsJoinable() )
+    {
+        delete thread;
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(thread->m_finishedMutex);
+    thread->m_finished = true;
+    thread->m_finishedCond.notify_all();
+}
+
+
+void Thread::Start()
+{
+    std::thread thread(&Thread::ThreadEntryPoint, this);
+    if ( IsJoinable() )
+        m_thread.swap(thread);
+    else
+        thread.detach();
+
+    // Wait until Run() signals that it is fully initialized.
+    // Note that this must be the last manipulation of 'this' in this function!
+    m_signalEvent.WaitUntilSignaled();
+}
+
+
+void Thread::Join()
+{
+    // already joined, as waiting on a finished thread's handle does
+    if ( !m_thread.joinable() )
+        return;
+
+    m_thread.join();
+}
+
+
+bool Thread::Join(unsigned timeoutMilliseconds)
+{
+    if ( !m_thread.joinable() )
+        return true;
+
+    const std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMilliseconds);
+    {
+        std::unique_lock<std::mutex> lock(m_finishedMutex);
+        while ( !m_finished )
+        {
+            if ( m_finishedCond.wait_until(lock, deadline) == std::cv_status::timeout && !m_finished )
+                return false;
+        }
+    }
+
+    m_thread.join();
+    return true;
+}
+
+
+/*--------------------------------------------------------------------------*
+                                 Timing
+ *--------------------------------------------------------------------------*/
+
+unsigned long long GetMonotonicTime()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+void SleepMilliseconds(unsigned milliseconds)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+}
+
+#endif // _WIN32
+
+
+/*--------------------------------------------------------------------------*
+                         Thread class, common code
+ *--------------------------------------------------------------------------*/
+
+void Thread::Terminate()
 {
     m_terminateEvent.Signal();
+}
+
+
+void Thread::TerminateAndJoin()
+{
+    Terminate();
     Join();
 }
 
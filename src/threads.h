@@ -28,11 +28,20 @@
 
 #include "error.h"
 
-#include <windows.h>
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <chrono>
+    #include <condition_variable>
+    #include <mutex>
+    #include <thread>
+#endif
 
 namespace winsparkle
 {
 
+#ifdef _WIN32
+
 /// C++ wrapper for win32 event
 class Event
 {
@@ -90,6 +99,75 @@ private:
     CRITICAL_SECTION m_cs;
 };
 
+#else // !_WIN32
+
+/// Auto-resetting event, behaving like the win32 one
+class Event
+{
+public:
+    Event() : m_signaled(false) {}
+
+    /// Signal the event
+    void Signal()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_signaled = true;
+        m_cond.notify_one();
+    }
+
+    /// Wait until the event is signalled
+    bool WaitUntilSignaled()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while ( !m_signaled )
+            m_cond.wait(lock);
+        m_signaled = false;
+        return true;
+    }
+
+    /// Wait until the event is signalled (true) or timeout ellapses (false)
+    bool WaitUntilSignaled(unsigned timeoutMilliseconds)
+    {
+        const std::chrono::steady_clock::time_point deadline =
+            std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMilliseconds);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while ( !m_signaled )
+        {
+            if ( m_cond.wait_until(lock, deadline) == std::cv_status::timeout && !m_signaled )
+                return false;
+        }
+        m_signaled = false;
+        return true;
+    }
+
+    bool CheckIfSignaled()
+    {
+        return WaitUntilSignaled(0);
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_signaled;
+};
+
+
+/**
+Recursive mutex with the same interface as the win32 critical section.
+*/
+class CriticalSection
+{
+public:
+    void Enter() { m_mutex.lock(); }
+    void Leave() { m_mutex.unlock(); }
+
+private:
+    std::recursive_mutex m_mutex;
+};
+
+#endif // _WIN32
+
 
 /**
 Locks a critical section as RIIA. Use this instead of manually calling
@@ -106,6 +184,34 @@ private:
 };
 
 
+/**
+Runs the current thread in background mode as RIIA, which lowers its CPU
+and I/O priority. Does nothing if @a enable is false.
+
+Background mode is only supported on Windows, elsewhere this does nothing.
+*/
+class BackgroundModeScope
+{
+public:
+#ifdef _WIN32
+    BackgroundModeScope(bool enable = true)
+        : m_enabled(enable && SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN))
+    {}
+
+    ~BackgroundModeScope()
+    {
+        if ( m_enabled )
+            SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+    }
+
+private:
+    bool m_enabled;
+#else
+    BackgroundModeScope(bool = true) {}
+#endif
+};
+
+
 /**
     Lightweight thread class.
 
@@ -147,6 +253,21 @@ public:
      */
     void Join();
 
+    /**
+        Wait for the thread to terminate, for at most @a timeoutMilliseconds.
+
+        Returns false if it is still running.
+     */
+    bool Join(unsigned timeoutMilliseconds);
+
+    /**
+        Signal the thread to terminate, without waiting for it.
+
+        @note The thread must support this and call
+              CheckShouldTerminate() frequently.
+     */
+    void Terminate();
+
     /**
         Signal the thread to terminate and call Join().
 
@@ -178,14 +299,33 @@ protected:
     };
 
 private:
+#ifdef _WIN32
     static unsigned __stdcall ThreadEntryPoint(void *data);
+#else
+    static void ThreadEntryPoint(Thread *thread);
+#endif
 
 protected:
+#ifdef _WIN32
     HANDLE m_handle;
     unsigned m_id;
+#else
+    std::thread m_thread;
+    std::mutex m_finishedMutex;
+    std::condition_variable m_finishedCond;
+    bool m_finished;
+#endif
     Event m_signalEvent, m_terminateEvent;
 };
 
+
+/// Returns time in milliseconds since some fixed point in the past; use it
+/// for measuring intervals, it never goes back.
+unsigned long long GetMonotonicTime();
+
+/// Suspends the calling thread for @a milliseconds.
+void SleepMilliseconds(unsigned milliseconds);
+
 } // namespace winsparkle
 
 #endif // _threads_h_
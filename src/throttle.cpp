@@ -0,0 +1,205 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "throttle.h"
+
+#include <algorithm>
+
+namespace winsparkle
+{
+
+namespace
+{
+
+// Bucket holds at most this many milliseconds' worth of tokens
+const double BURST_DURATION = 250;
+
+// Smallest bucket, so that reads of the smallest size aren't broken up
+const double BURST_MIN = 16 * 1024;
+
+// Background downloads never slow down below this rate, in bytes/s
+const double RATE_MIN = 8 * 1024;
+
+// Target queuing delay, in ms; LEDBAT's TARGET
+const double TARGET_DELAY = 100;
+
+// How strongly the rate reacts to the delay being off target; a sample at
+// the target or above twice the target changes the rate by this fraction
+const double GAIN = 0.25;
+
+// Number of latest samples whose minimum is the current delay, and of
+// minutes whose minimums are the base delay; LEDBAT's CURRENT_FILTER and
+// BASE_HISTORY
+const size_t CURRENT_FILTER = 4;
+const size_t BASE_HISTORY = 10;
+
+// Interval of throughput measurements, in ms
+const unsigned long long MEASURE_INTERVAL = 1000;
+
+} // anonymous namespace
+
+
+DownloadThrottle::DownloadThrottle(size_t rateLimit, bool background)
+    : m_limit(rateLimit),
+      m_background(background),
+      m_rate(double(rateLimit)),
+      m_tokens(0),
+      m_lastRefill(GetMonotonicTime()),
+      m_measured(0),
+      m_measuredBytes(0),
+      m_measureStart(GetMonotonicTime()),
+      m_baseMinuteStart(0)
+{
+    m_tokens = std::max(m_rate * BURST_DURATION / 1000, BURST_MIN);
+}
+
+
+size_t DownloadThrottle::GetRate() const
+{
+    CriticalSectionLocker lock(m_cs);
+    return size_t(m_rate);
+}
+
+
+size_t DownloadThrottle::GetMaxRead() const
+{
+    CriticalSectionLocker lock(m_cs);
+    if ( m_rate == 0 )
+        return 0;
+    return size_t(std::max(m_rate * BURST_DURATION / 1000, BURST_MIN));
+}
+
+
+void DownloadThrottle::Consume(size_t bytes, Thread *onThread)
+{
+    {
+        CriticalSectionLocker lock(m_cs);
+
+        const unsigned long long now = GetMonotonicTime();
+        m_measuredBytes += bytes;
+        if ( now - m_measureStart >= MEASURE_INTERVAL )
+        {
+            m_measured = m_measuredBytes * 1000.0 / (now - m_measureStart);
+            m_measuredBytes = 0;
+            m_measureStart = now;
+        }
+
+        if ( m_rate == 0 )
+            return;
+
+        DoRefill();
+        m_tokens -= bytes;
+    }
+
+    for ( ;; )
+    {
+        unsigned wait;
+        {
+            CriticalSectionLocker lock(m_cs);
+
+            // the limit may have been lifted in the meantime
+            if ( m_rate == 0 )
+                return;
+
+            DoRefill();
+            if ( m_tokens >= 0 )
+                return;
+
+            wait = unsigned(std::min(-m_tokens * 1000 / m_rate + 1, 100.0));
+        }
+
+        if ( onThread )
+            onThread->CheckShouldTerminate();
+        SleepMilliseconds(wait);
+    }
+}
+
+
+void DownloadThrottle::DoRefill()
+{
+    const unsigned long long now = GetMonotonicTime();
+    const double burst = std::max(m_rate * BURST_DURATION / 1000, BURST_MIN);
+    m_tokens = std::min(m_tokens + m_rate * (now - m_lastRefill) / 1000, burst);
+    m_lastRefill = now;
+}
+
+
+void DownloadThrottle::AddDelaySample(unsigned delay)
+{
+    if ( !m_background )
+        return;
+
+    CriticalSectionLocker lock(m_cs);
+
+    const unsigned long long now = GetMonotonicTime();
+
+    // The base delay is the lowest one in the last few minutes, so that
+    // it follows route changes.
+    if ( m_baseDelays.empty() || now - m_baseMinuteStart >= 60 * 1000 )
+    {
+        m_baseDelays.push_back(delay);
+        if ( m_baseDelays.size() > BASE_HISTORY )
+            m_baseDelays.erase(m_baseDelays.begin());
+        m_baseMinuteStart = now;
+    }
+    else if ( delay < m_baseDelays.back() )
+    {
+        m_baseDelays.back() = delay;
+    }
+    const unsigned baseDelay = *std::min_element(m_baseDelays.begin(), m_baseDelays.end());
+
+    // The current delay filters out occasional spikes.
+    m_currentDelays.push_back(delay);
+    if ( m_currentDelays.size() > CURRENT_FILTER )
+        m_currentDelays.pop_front();
+    const unsigned currentDelay = *std::min_element(m_currentDelays.begin(), m_currentDelays.end());
+
+    const double queuingDelay = currentDelay - baseDelay;
+    const double offTarget = std::max((TARGET_DELAY - queuingDelay) / TARGET_DELAY, -1.0);
+
+    if ( m_rate == 0 )
+    {
+        // not limited yet, nothing to do until queues start to fill
+        if ( offTarget >= 0 || m_measured == 0 )
+            return;
+        m_rate = m_measured;
+    }
+
+    DoRefill();
+    m_rate *= 1 + GAIN * offTarget;
+    m_rate = std::max(m_rate, RATE_MIN);
+
+    if ( m_limit != 0 )
+    {
+        m_rate = std::min(m_rate, double(m_limit));
+    }
+    else if ( m_measured != 0 && m_rate > 4 * m_measured )
+    {
+        // the rate limits nothing anymore
+        m_rate = 0;
+    }
+}
+
+} // namespace winsparkle
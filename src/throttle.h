@@ -0,0 +1,112 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _throttle_h_
+#define _throttle_h_
+
+#include "threads.h"
+
+#include <deque>
+#include <vector>
+
+namespace winsparkle
+{
+
+/**
+    Limits the rate of a download, see DownloadFileSegmented().
+
+    The limit is enforced with a token bucket shared by all connections of
+    the download: every byte read consumes a token and readers wait while
+    the bucket is empty. It is refilled at the current rate and holds at most
+    a quarter of a second's worth of tokens, so that bursts stay small.
+
+    In background mode, the rate also adapts to network delay, like LEDBAT
+    (RFC 6817) does: the download slows down as soon as the delay rises
+    above the lowest one seen, i.e. when it starts filling queues on the
+    link, and speeds up again when they drain. Delay samples are provided
+    with AddDelaySample(). Threads of background downloads should run in
+    background mode too, see BackgroundModeScope.
+ */
+class DownloadThrottle
+{
+public:
+    /**
+        Creates the throttle.
+
+        @param rateLimit   Maximum rate in bytes per second, 0 for no limit.
+        @param background  Adapt the rate to network delay.
+     */
+    DownloadThrottle(size_t rateLimit, bool background);
+
+    /// Returns true if in background mode.
+    bool IsBackground() const { return m_background; }
+
+    /// Returns the current rate limit in bytes per second, 0 if none.
+    size_t GetRate() const;
+
+    /// Returns the largest read that should be done at once, 0 if any.
+    size_t GetMaxRead() const;
+
+    /**
+        Accounts for @a bytes that were read and waits until the rate allows
+        reading more.
+
+        Throws if @a onThread is terminated while waiting.
+     */
+    void Consume(size_t bytes, Thread *onThread);
+
+    /**
+        Adds a sample of network delay, e.g. time until a response's headers
+        arrived, in ms.
+
+        Only used in background mode.
+     */
+    void AddDelaySample(unsigned delay);
+
+private:
+    void DoRefill();
+
+    mutable CriticalSection m_cs;
+    const size_t m_limit;
+    const bool m_background;
+
+    double m_rate;                  // current limit, 0 if none
+    double m_tokens;                // may go negative after a large read
+    unsigned long long m_lastRefill;
+
+    // throughput measured over the last interval, used as the initial rate
+    // when backing off without a limit
+    double m_measured;
+    size_t m_measuredBytes;
+    unsigned long long m_measureStart;
+
+    std::deque<unsigned> m_currentDelays;   // latest samples
+    std::vector<unsigned> m_baseDelays;     // lowest delay in each minute
+    unsigned long long m_baseMinuteStart;
+};
+
+} // namespace winsparkle
+
+#endif // _throttle_h_
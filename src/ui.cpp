@@ -155,6 +155,7 @@ struct EventPayload
     size_t       sizeDownloaded, sizeTotal;
     std::wstring updateFile;
     bool         installAutomatically;
+    bool         readyToInstall;
     ErrorCode    error;
     std::string  errorMessage;
 };
@@ -425,7 +426,7 @@ public:
     // change state into "update error"
     void StateUpdateError(ErrorCode err, const std::string& error_message);
     // change state into "a new version is available"
-    void StateUpdateAvailable(const Appcast& info, bool installAutomatically);
+    void StateUpdateAvailable(const Appcast& info, bool installAutomatically, bool readyToInstall);
     // change state into "downloading update"
     void StateDownloading();
     // update download progress
@@ -483,6 +484,8 @@ private:
     UpdateDownloader* m_downloader;
     // whether the update should be installed without prompting the user
     bool m_installAutomatically;
+    // whether the update was downloaded before it was offered to the user
+    bool m_readyToInstall;
     // whether an error occurred (used to properly call NotifyUpdateCancelled)
     bool m_errorOccurred;
     // whether window closure was updater-initiated (i.e. not caused by user)
@@ -498,6 +501,7 @@ UpdateDialog::UpdateDialog()
       m_downloader(NULL)
 {
     m_installAutomatically = false;
+    m_readyToInstall = false;
     m_errorOccurred = false;
     m_closeInitiatedByUpdater = false;
 
@@ -863,10 +867,11 @@ void UpdateDialog::StateUpdateError(ErrorCode err, const std::string& error_mess
     MakeResizable(false);
 }
 
-void UpdateDialog::StateUpdateAvailable(const Appcast& info, bool installAutomatically)
+void UpdateDialog::StateUpdateAvailable(const Appcast& info, bool installAutomatically, bool readyToInstall)
 {
     m_appcast = info;
     m_installAutomatically = installAutomatically;
+    m_readyToInstall = readyToInstall;
 
     if ( installAutomatically )
     {
@@ -898,13 +903,12 @@ void UpdateDialog::StateUpdateAvailable(const Appcast& info, bool installAutomat
         if ( !info.HasDownload() )
             m_installButton->SetLabel(_("Get update"));
 
+        const wxString message = readyToInstall
+            ? _("%s %s is now available (you have %s) and ready to install. Would you like to install it now?")
+            : _("%s %s is now available (you have %s). Would you like to download it now?");
         SetMessage
         (
-            wxString::Format
-            (
-                _("%s %s is now available (you have %s). Would you like to download it now?"),
-                appname, ver_new, ver_my
-            ),
+            wxString::Format(message, appname, ver_new, ver_my),
             showRelnotes ? RELNOTES_WIDTH : MESSAGE_AREA_WIDTH
         );
 
@@ -1027,6 +1031,14 @@ void UpdateDialog::StateUpdateDownloaded(const std::wstring& updateFile, const s
     MakeResizable(false);
 
     ApplicationController::NotifyDownloadComplete();
+
+    // The user already chose to install the update that was downloaded in
+    // advance, there's no need to ask again.
+    if ( m_readyToInstall )
+    {
+        wxCommandEvent nullEvent;
+        OnRunInstaller(nullEvent);
+    }
 }
 
 void UpdateDialog::SkipVersion()
@@ -1409,7 +1421,7 @@ void App::OnUpdateAvailable(wxThreadEvent& event)
     InitWindow();
 
     EventPayload payload(event.GetPayload<EventPayload>());
-    m_win->StateUpdateAvailable(payload.appcast, payload.installAutomatically);
+    m_win->StateUpdateAvailable(payload.appcast, payload.installAutomatically, payload.readyToInstall);
 }
 
 
@@ -1559,7 +1571,8 @@ void UI::NotifyNoUpdates(bool installAutomatically, bool show_dialog)
 
 
 /*static*/
-void UI::NotifyUpdateAvailable(const Appcast& info, bool installAutomatically)
+void UI::NotifyUpdateAvailable(const Appcast& info, bool installAutomatically,
+                               bool readyToInstall)
 {
     ApplicationController::NotifyUpdateFound(info);
 
@@ -1567,6 +1580,7 @@ void UI::NotifyUpdateAvailable(const Appcast& info, bool installAutomatically)
     EventPayload payload;
     payload.appcast = info;
     payload.installAutomatically = installAutomatically;
+    payload.readyToInstall = readyToInstall;
     uit.App().SendMsg(MSG_UPDATE_AVAILABLE, &payload);
 }
 
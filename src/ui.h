@@ -83,8 +83,12 @@ public:
         Notifies the UI that a new version is available.
 
         If the UI thread isn't running yet, it will be launched.
+
+        @param readyToInstall  The update was downloaded in advance, see
+                               UpdateDownloader::Prestage().
      */
-    static void NotifyUpdateAvailable(const Appcast& info, bool installAutomatically);
+    static void NotifyUpdateAvailable(const Appcast& info, bool installAutomatically,
+                                      bool readyToInstall = false);
 
     /**
         Notifies the UI about download progress.
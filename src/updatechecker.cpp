@@ -26,12 +26,16 @@
 
 #include "updatechecker.h"
 #include "appcast.h"
+#include "appcastcache.h"
 #include "ui.h"
 #include "error.h"
 #include "settings.h"
 #include "download.h"
 #include "utils.h"
 #include "appcontroller.h"
+#include "mirrors.h"
+#include "updatedownloader.h"
+#include "version.h"
 
 #include <ctime>
 #include <vector>
@@ -39,7 +43,7 @@
 #include <algorithm>
 #include <string>
 #include <winsparkle.h>
-#include <wininet.h>
+#include <openssl/sha.h>
 
 using namespace std;
 
@@ -47,123 +51,27 @@ namespace winsparkle
 {
 
 /*--------------------------------------------------------------------------*
-                              version comparison
+                                helpers
  *--------------------------------------------------------------------------*/
 
-// Note: This code is based on Sparkle's SUStandardVersionComparator by
-//       Andy Matuschak.
-
 namespace
 {
 
-// String characters classification. Valid components of version numbers
-// are numbers, period or string fragments ("beta" etc.).
-enum CharType
-{
-    Type_Number,
-    Type_Period,
-    Type_String
-};
-
-CharType ClassifyChar(char c)
-{
-    if ( c == '.' )
-        return Type_Period;
-    else if ( c >= '0' && c <= '9' )
-        return Type_Number;
-    else
-        return Type_String;
-}
-
-// Split version string into individual components. A component is continuous
-// run of characters with the same classification. For example, "1.20rc3" would
-// be split into ["1",".","20","rc","3"].
-vector<string> SplitVersionString(const string& version)
+// Downloads a small resource, using the same session as other requests.
+// Returns empty string on failure.
+std::string HttpGet(const std::string& url, Thread *onThread)
 {
-    vector<string> list;
-
-    if ( version.empty() )
-        return list; // nothing to do here
-
-    string s;
-    const size_t len = version.length();
-
-    s = version[0];
-    CharType prevType = ClassifyChar(version[0]);
-
-    for ( size_t i = 1; i < len; i++ )
-    {
-        const char c = version[i];
-        const CharType newType = ClassifyChar(c);
-
-        if ( prevType != newType || prevType == Type_Period )
-        {
-            // We reached a new segment. Period gets special treatment,
-            // because "." always delimiters components in version strings
-            // (and so ".." means there's empty component value).
-            list.push_back(s);
-            s = c;
-        }
-        else
-        {
-            // Add character to current segment and continue.
-            s += c;
-        }
-
-        prevType = newType;
-    }
-
-    // Don't forget to add the last part:
-    list.push_back(s);
-
-    return list;
-}
-
-std::string HttpGetWinINet(const std::wstring& url)
-{
-    const auto hInternet = InternetOpen(L"OETH", INTERNET_OPEN_TYPE_DIRECT, NULL, NULL, 0);
-    if (!hInternet)
+    // errors are described in the response's body, so it's needed even then
+    StringDownloadSink sink;
+    try
     {
-        return "";
+        DownloadFile(url, &sink, onThread, "", Download_AcceptErrors);
     }
-
-    const auto hConnect = InternetOpenUrl(hInternet, url.c_str(), NULL, 0, INTERNET_FLAG_RELOAD, 0);
-    if (!hConnect)
+    catch (const std::exception&)
     {
-        InternetCloseHandle(hInternet);
         return "";
     }
-
-    std::string response;
-    char buffer[512] = {};
-    DWORD bytesRead = 0;
-    while (InternetReadFile(hConnect, buffer, sizeof(buffer) - 1, &bytesRead) && bytesRead > 0)
-    {
-        buffer[bytesRead] = '\0';
-        response.append(buffer, bytesRead);
-    }
-
-    InternetCloseHandle(hConnect);
-    InternetCloseHandle(hInternet);
-    return response;
-}
-
-std::wstring ToWString(const std::string& str)
-{
-    const auto count = MultiByteToWideChar(CP_ACP, 0, str.c_str(), -1, nullptr, 0);
-    if (count == 0)
-    {
-        return {};
-    }
-
-    std::wstring wstr(count, L'\0');
-    if (0 == MultiByteToWideChar(CP_ACP, 0, str.c_str(), -1, &wstr[0], count))
-    {
-        return {};
-    }
-
-    wstr.resize(wstr.size() - 1);
-    return wstr;
+    return sink.data;
 }
 
 std::string ParseGetVersionResponseJSON(const std::string& json, const std::string& key)
@@ -195,12 +103,14 @@ std::string ParseGetVersionResponseJSON(const std::string& json, const std::stri
     return json.substr(start + 1, end - start - 1);
 }
 
-std::string GetServerVersion()
+std::string GetServerVersionURL()
 {
-    const auto host = ApplicationController::GetAvailableHost();
-    const auto url = host + "/getVersion";
-    
-    const auto json_response = HttpGetWinINet(ToWString(url));
+    return ApplicationController::GetAvailableHost() + "/getVersion";
+}
+
+std::string GetServerVersion(const std::string& url, Thread *onThread)
+{
+    const auto json_response = HttpGet(url, onThread);
     if (json_response.empty())
     {
         return "";
@@ -230,97 +140,469 @@ std::string GetServerVersion()
     return "";
 }
 
-} // anonymous namespace
 
+/*--------------------------------------------------------------------------*
+                              server version
+ *--------------------------------------------------------------------------*/
 
-int UpdateChecker::CompareVersions(const string& verA, const string& verB)
+CriticalSection gs_csServerVersion;
+std::string gs_serverVersion;       // last probed version, if successful
+std::string gs_serverVersionURL;    // URL it was probed at
+ULONGLONG gs_serverVersionTime = 0; // when it was probed
+
+// Recently probed server version is reused for this long (in milliseconds),
+// so that checks done shortly after each other, e.g. a manual check after
+// a periodic one, don't repeat the probe.
+ULONGLONG gs_serverVersionTTL = 10 * 60 * 1000;
+
+CriticalSection gs_csStats;
+UpdateCheckStats gs_stats;
+
+CriticalSection gs_csCheckers;
+std::vector<UpdateChecker*> gs_checkers;    // all existing checkers
+Event gs_checkerFinished;                   // signaled when one is destroyed
+
+
+// Probes the server version in the background.
+class ServerVersionProbe : public Thread
 {
-    const vector<string> partsA = SplitVersionString(verA);
-    const vector<string> partsB = SplitVersionString(verB);
+public:
+    ServerVersionProbe(const std::string& url)
+        : Thread("WinSparkle server version"), m_url(url)
+    {}
 
-    // Compare common length of both version strings.
-    const size_t n = min(partsA.size(), partsB.size());
-    for ( size_t i = 0; i < n; i++ )
+    /// Waits until the probe finishes, returns false on timeout.
+    bool WaitUntilFinished(unsigned timeoutMilliseconds)
     {
-        const string& a = partsA[i];
-        const string& b = partsB[i];
+        return WaitForSingleObject(m_handle, timeoutMilliseconds) == WAIT_OBJECT_0;
+    }
+
+    /// Returns the probed version; may only be called once finished.
+    const std::string& GetVersion() const { return m_version; }
 
-        const CharType typeA = ClassifyChar(a[0]);
-        const CharType typeB = ClassifyChar(b[0]);
+protected:
+    virtual void Run()
+    {
+        SignalReady();
+        m_version = GetServerVersion(m_url, this);
+    }
+
+    virtual bool IsJoinable() const { return true; }
+
+private:
+    std::string m_url;
+    std::string m_version;
+};
+
+
+// Provides the server version, either a recently probed one or one probed
+// concurrently with the appcast download.
+class ServerVersionSource
+{
+public:
+    ServerVersionSource(Thread *onThread)
+        : m_thread(onThread), m_probe(NULL), m_available(false)
+    {
+        const std::string url = GetServerVersionURL();
 
-        if ( typeA == typeB )
         {
-            if ( typeA == Type_String )
+            CriticalSectionLocker lock(gs_csServerVersion);
+            if ( !gs_serverVersion.empty() && gs_serverVersionURL == url &&
+                 GetTickCount64() - gs_serverVersionTime < gs_serverVersionTTL )
             {
-                int result = a.compare(b);
-                if ( result != 0 )
-                    return result;
-            }
-            else if ( typeA == Type_Number )
-            {
-                const int intA = atoi(a.c_str());
-                const int intB = atoi(b.c_str());
-                if ( intA > intB )
-                    return 1;
-                else if ( intA < intB )
-                    return -1;
+                m_version = gs_serverVersion;
+                m_available = true;
             }
         }
-        else // components of different types
+
+        if ( m_available )
         {
-            if ( typeA != Type_String && typeB == Type_String )
-            {
-                // 1.2.0 > 1.2rc1
-                return 1;
-            }
-            else if ( typeA == Type_String && typeB != Type_String )
-            {
-                // 1.2rc1 < 1.2.0
-                return -1;
-            }
-            else
+            CriticalSectionLocker lock(gs_csStats);
+            gs_stats.ServerVersionReused++;
+            return;
+        }
+
+        m_probe = new ServerVersionProbe(url);
+        try
+        {
+            m_probe->Start();
+        }
+        catch ( ... )
+        {
+            delete m_probe;
+            throw;
+        }
+        m_url = url;
+    }
+
+    ~ServerVersionSource()
+    {
+        if ( m_probe )
+        {
+            m_probe->TerminateAndJoin();
+            delete m_probe;
+        }
+    }
+
+    // Returns true if the version is known already.
+    bool IsAvailable()
+    {
+        if ( !m_available && m_probe->WaitUntilFinished(0) )
+            OnProbeFinished();
+        return m_available;
+    }
+
+    // Returns the version, waiting for the probe to finish if necessary.
+    const std::string& Get()
+    {
+        while ( !m_available )
+        {
+            if ( m_thread )
+                m_thread->CheckShouldTerminate();
+            if ( m_probe->WaitUntilFinished(100) )
+                OnProbeFinished();
+        }
+        return m_version;
+    }
+
+private:
+    ServerVersionSource(const ServerVersionSource&);
+    ServerVersionSource& operator=(const ServerVersionSource&);
+
+    void OnProbeFinished()
+    {
+        m_version = m_probe->GetVersion();
+        m_available = true;
+
+        // failures aren't remembered, the next check will try again
+        if ( !m_version.empty() )
+        {
+            CriticalSectionLocker lock(gs_csServerVersion);
+            gs_serverVersion = m_version;
+            gs_serverVersionURL = m_url;
+            gs_serverVersionTime = GetTickCount64();
+        }
+    }
+
+    Thread *m_thread;
+    ServerVersionProbe *m_probe;
+    std::string m_url;
+    std::string m_version;
+    bool m_available;
+};
+
+
+// Records duration of an update check in statistics.
+class CheckTimer
+{
+public:
+    CheckTimer() : m_start(GetTickCount64()) {}
+
+    ~CheckTimer()
+    {
+        const unsigned duration = (unsigned)(GetTickCount64() - m_start);
+
+        CriticalSectionLocker lock(gs_csStats);
+        gs_stats.Checks++;
+        gs_stats.TotalDuration += duration;
+        gs_stats.LastDuration = duration;
+        gs_stats.MaxDuration = std::max(gs_stats.MaxDuration, duration);
+    }
+
+private:
+    ULONGLONG m_start;
+};
+
+
+/*--------------------------------------------------------------------------*
+                             appcast evaluation
+ *--------------------------------------------------------------------------*/
+
+// Selects the update to offer while the appcast is being parsed.
+//
+// Only the best candidates are retained instead of collecting, filtering and
+// sorting all items of the feed: the latest applicable version and the
+// earliest critical update newer than the installed version.
+//
+// Items are filtered by the server version, which is being probed while
+// the feed downloads. Until it is known, the data are kept aside.
+//
+// If there is a previously evaluated feed, the sink also computes hash of
+// the feed's content. If neither the feed nor the server version changed
+// since then, the result of parsing it is discarded and the known result is
+// used instead.
+class UpdateSelectingSink : public AppcastDownloadSink
+{
+public:
+    UpdateSelectingSink(const std::string& currentVersion,
+                        ServerVersionSource& serverVersion,
+                        const AppcastCheckResult *known)
+        : m_currentVersion(currentVersion), m_serverVersionSource(serverVersion),
+          m_hasKnown(known != NULL), m_parsing(false), m_unchanged(false),
+          m_hasApplicable(false), m_hasLatest(false), m_hasCritical(false)
+    {
+        if ( known )
+        {
+            m_knownContentHash = known->ContentHash;
+            m_knownServerVersion = known->ServerVersion;
+        }
+        SHA256_Init(&m_hash);
+    }
+
+    virtual void Add(const void *data, size_t len)
+    {
+        if ( m_hasKnown )
+            SHA256_Update(&m_hash, data, len);
+
+        if ( !m_parsing && m_serverVersionSource.IsAvailable() )
+            StartParsing();
+
+        if ( m_parsing )
+            AppcastDownloadSink::Add(data, len);
+        else
+            m_pending.append(static_cast<const char*>(data), len);
+    }
+
+    // The whole feed is needed to compare its hash with the known one, so
+    // then the rest of it is read (and only hashed, the parser ignores it)
+    // after </channel>. Otherwise, the download stops there.
+    virtual bool IsComplete() const
+    {
+        return !m_hasKnown && AppcastDownloadSink::IsComplete();
+    }
+
+    /**
+        Finishes processing of the feed.
+
+        If the feed is identical to the one with the known hash, the result
+        of parsing it is discarded and IsUnchanged() returns true.
+     */
+    void FinishFeed()
+    {
+        if ( m_hasKnown )
+        {
+            unsigned char hash[SHA256_DIGEST_LENGTH];
+            SHA256_Final(hash, &m_hash);
+            m_contentHash.assign(reinterpret_cast<const char*>(hash), sizeof(hash));
+
+            if ( m_contentHash == m_knownContentHash &&
+                 m_serverVersionSource.Get() == m_knownServerVersion )
             {
-                // One is a number and the other is a period. The period
-                // is invalid.
-                return (typeA == Type_Number) ? 1 : -1;
+                m_unchanged = true;
+                return;
             }
         }
+
+        if ( !m_parsing )
+            StartParsing();
+
+        Finish();
     }
 
-    // The versions are equal up to the point where they both still have
-    // parts. Lets check to see if one is larger than the other.
-    if ( partsA.size() == partsB.size() )
-        return 0; // the two strings are identical
+    /// Returns true if the feed and server version are the known ones, so
+    /// that the known result applies.
+    bool IsUnchanged() const { return m_unchanged; }
+
+    /// Returns SHA-256 hash of the feed's content (binary), or an empty
+    /// string if there was no known result to compare it with.
+    const std::string& GetContentHash() const { return m_contentHash; }
+
+    virtual void OnItem(Appcast& item)
+    {
+        // Filter to match the minimum server version
+        if ( m_serverVersion.Compare(ParsedVersion(item.MinServerVersion)) < 0 )
+            return;
 
-    // Lets get the next part of the larger version string
-    // Note that 'n' already holds the index of the part we want.
+        m_hasApplicable = true;
 
-    int shorterResult, longerResult;
-    CharType missingPartType; // ('missing' as in "missing in shorter version")
+        // Versions that are already installed can never be offered
+        const ParsedVersion version(item.Version);
+        if ( m_currentVersion.Compare(version) >= 0 )
+            return;
 
-    if ( partsA.size() > partsB.size() )
+        // If there are several critical updates, the earliest one (and the
+        // first one in feed order if versions are equal) is used.
+        if ( item.CriticalUpdate &&
+             (!m_hasCritical || version.Compare(m_criticalVersion) < 0) )
+        {
+            m_critical = item;
+            m_criticalVersion = version;
+            m_hasCritical = true;
+        }
+
+        // Otherwise, pick the latest version (the last one in feed order
+        // if versions are equal).
+        if ( !m_hasLatest || version.Compare(m_latestVersion) >= 0 )
+        {
+            m_latest = std::move(item);
+            m_latestVersion = version;
+            m_hasLatest = true;
+        }
+    }
+
+    /// Stores the outcome of the selection into @a result.
+    void GetResult(AppcastCheckResult& result)
     {
-        missingPartType = ClassifyChar(partsA[n][0]);
-        shorterResult = -1;
-        longerResult = 1;
+        result.HasApplicableItems = m_hasApplicable;
+        result.HasUpdate = m_hasCritical || m_hasLatest;
+        if ( m_hasCritical )
+            result.Update = std::move(m_critical);
+        else if ( m_hasLatest )
+            result.Update = std::move(m_latest);
+        else
+            result.Update = Appcast();
     }
-    else
+
+private:
+    // Parses the data kept aside so far; waits for the server version.
+    void StartParsing()
     {
-        missingPartType = ClassifyChar(partsB[n][0]);
-        shorterResult = 1;
-        longerResult = -1;
+        m_serverVersion = ParsedVersion(m_serverVersionSource.Get());
+        m_parsing = true;
+
+        AppcastDownloadSink::Add(m_pending.data(), m_pending.length());
+        std::string().swap(m_pending);
     }
 
-    if ( missingPartType == Type_String )
+    ParsedVersion m_currentVersion, m_serverVersion;
+    ServerVersionSource& m_serverVersionSource;
+    SHA256_CTX m_hash;
+    std::string m_contentHash, m_knownContentHash, m_knownServerVersion;
+    bool m_hasKnown, m_parsing, m_unchanged;
+    std::string m_pending;
+    bool m_hasApplicable, m_hasLatest, m_hasCritical;
+    Appcast m_latest, m_critical;
+    ParsedVersion m_latestVersion, m_criticalVersion;
+};
+
+
+/*--------------------------------------------------------------------------*
+                         conditional appcast requests
+ *--------------------------------------------------------------------------*/
+
+// Returns If-None-Match/If-Modified-Since headers for a conditional request
+// for the appcast at @a url, or an empty string if there are no stored
+// validators for it.
+std::string GetConditionalHeaders(const std::string& url)
+{
+    std::string validatorsURL;
+    if ( !Settings::ReadConfigValue("AppcastValidatorsURL", validatorsURL) ||
+         validatorsURL != url )
     {
-        // 1.5 > 1.5b3
-        return shorterResult;
+        return std::string();
     }
-    else
+
+    std::string headers;
+    std::string value;
+    if ( Settings::ReadConfigValue("AppcastETag", value) && !value.empty() )
+        headers += "If-None-Match: " + value + "\r\n";
+    if ( Settings::ReadConfigValue("AppcastLastModified", value) && !value.empty() )
+        headers += "If-Modified-Since: " + value + "\r\n";
+    return headers;
+}
+
+// Remembers the validators of a freshly downloaded appcast.
+void StoreValidators(const std::string& url, const DownloadInfo& info)
+{
+    if ( info.ETag.empty() && info.LastModified.empty() )
     {
-        // 1.5.1 > 1.5
-        return longerResult;
+        Settings::DeleteConfigValue("AppcastValidatorsURL");
+        Settings::DeleteConfigValue("AppcastETag");
+        Settings::DeleteConfigValue("AppcastLastModified");
+        return;
     }
+
+    Settings::WriteConfigValue("AppcastValidatorsURL", url);
+    Settings::WriteConfigValue("AppcastETag", info.ETag);
+    Settings::WriteConfigValue("AppcastLastModified", info.LastModified);
+}
+
+
+// Downloads and evaluates the appcast at url, reusing the cached result if
+// neither the feed nor the server version changed.
+AppcastCheckResult EvaluateAppcast(const std::string& url,
+                                   const std::string& currentVersion,
+                                   ServerVersionSource& serverVersion,
+                                   Thread *onThread)
+{
+    // Only ask for the feed conditionally if we still have the result
+    // of evaluating it, otherwise there would be nothing to reuse.
+    AppcastCheckResult cached;
+    const bool hasCached = AppcastCache::Get(url, currentVersion, cached);
+    bool conditional = hasCached;
+
+    for ( ;; )
+    {
+        std::string headers = Settings::GetHttpHeadersString();
+        if ( conditional )
+            headers += GetConditionalHeaders(url);
+
+        UpdateSelectingSink appcast_sink(currentVersion, serverVersion,
+                                         hasCached ? &cached : NULL);
+        const DownloadInfo info =
+            DownloadFile(url, &appcast_sink, onThread, headers, Download_BypassProxies);
+
+        if ( info.IsNotModified() )
+        {
+            if ( !hasCached )
+                throw std::runtime_error("Update process failed. Please contact support. (3)");
+
+            if ( serverVersion.Get() == cached.ServerVersion )
+            {
+                AppcastCache::RecordHit();
+                return cached;
+            }
+
+            // The feed didn't change, but the server version did, so the
+            // feed must be evaluated again. This is rare enough to just
+            // download it again.
+            conditional = false;
+            continue;
+        }
+
+        appcast_sink.FinishFeed();
+        StoreValidators(url, info);
+
+        if ( appcast_sink.IsUnchanged() )
+        {
+            AppcastCache::RecordHit();
+            return cached;
+        }
+
+        AppcastCache::RecordMiss();
+        AppcastCheckResult result;
+        result.URL = url;
+        result.CurrentVersion = currentVersion;
+        result.ServerVersion = serverVersion.Get();
+        result.ContentHash = appcast_sink.GetContentHash();
+        appcast_sink.GetResult(result);
+        AppcastCache::Store(result);
+        return result;
+    }
+}
+
+} // anonymous namespace
+
+
+int UpdateChecker::CompareVersions(const string& verA, const string& verB)
+{
+    return ParsedVersion(verA).Compare(ParsedVersion(verB));
+}
+
+
+/*static*/
+void UpdateChecker::SetServerVersionTTL(unsigned milliseconds)
+{
+    CriticalSectionLocker lock(gs_csServerVersion);
+    gs_serverVersionTTL = milliseconds;
+}
+
+
+/*static*/
+UpdateCheckStats UpdateChecker::GetStats()
+{
+    CriticalSectionLocker lock(gs_csStats);
+    return gs_stats;
 }
 
 
@@ -330,75 +612,114 @@ int UpdateChecker::CompareVersions(const string& verA, const string& verB)
 
 UpdateChecker::UpdateChecker(): Thread("WinSparkle updates check")
 {
+    CriticalSectionLocker lock(gs_csCheckers);
+    gs_checkers.push_back(this);
+}
+
+UpdateChecker::~UpdateChecker()
+{
+    {
+        CriticalSectionLocker lock(gs_csCheckers);
+        gs_checkers.erase(std::find(gs_checkers.begin(), gs_checkers.end(), this));
+    }
+    gs_checkerFinished.Signal();
+}
+
+/*static*/
+bool UpdateChecker::TerminateAll(unsigned timeoutMilliseconds)
+{
+    const ULONGLONG start = GetTickCount64();
+    for ( ;; )
+    {
+        {
+            // checkers unregister under the lock before they are destroyed
+            CriticalSectionLocker lock(gs_csCheckers);
+            if ( gs_checkers.empty() )
+                return true;
+            for ( size_t i = 0; i < gs_checkers.size(); i++ )
+                gs_checkers[i]->Terminate();
+        }
+
+        const ULONGLONG elapsed = GetTickCount64() - start;
+        if ( elapsed >= timeoutMilliseconds )
+            return false;
+        gs_checkerFinished.WaitUntilSignaled(unsigned(timeoutMilliseconds - elapsed));
+    }
 }
 
 void UpdateChecker::PerformUpdateCheck(bool show_dialog)
 {
+    CheckTimer timer;
+
     try
     {
+        // Pick the best mirror before any requests are made.
+        Mirrors::Probe(Settings::GetAppcastPath(), this);
+
         const std::string url = Settings::GetAppcastURL();
         if ( url.empty() )
             throw std::runtime_error("The update source configuration is missing. Please contact support.");
         CheckForInsecureURL(url, "appcast feed");
 
-        StringDownloadSink appcast_xml;
-        DownloadFile(url, &appcast_xml, this, Settings::GetHttpHeadersString(), Download_BypassProxies);
+        const auto currentVersion = WideToAnsi(Settings::GetAppBuildVersion());
 
-        auto all = Appcast::Load(appcast_xml.data);
-        
-        // Filter to match the minimum server version
-        const auto current_server_version = GetServerVersion();
-        all.erase(std::remove_if(all.begin(), all.end(), [current_server_version](const Appcast& appcast)
-            {
-                return CompareVersions(current_server_version, appcast.MinServerVersion) < 0;
-            }),
-            all.end()
-        );
+        // The server version is probed concurrently with the appcast
+        // download, it is only needed to evaluate the feed.
+        ServerVersionSource serverVersion(this);
+        const AppcastCheckResult result =
+            EvaluateAppcast(url, currentVersion, serverVersion, this);
 
-        if (all.empty())
+        if (!result.HasApplicableItems)
         {
             // No applicable updates in the feed.
             UI::NotifyNoUpdates(ShouldAutomaticallyInstall(), show_dialog);
             return;
         }
 
-        // Sort by version number and pick the latest:
-		std::stable_sort
-        (
-            all.begin(), all.end(),
-            [](const Appcast& a, const Appcast& b) { return CompareVersions(a.Version, b.Version) < 0; }
-        );
-
-        const auto currentVersion = WideToAnsi(Settings::GetAppBuildVersion());
-        const auto pos = std::find_if(all.begin(), all.end(), [&currentVersion](const Appcast& appcast)
-            {
-                return appcast.CriticalUpdate && CompareVersions(currentVersion, appcast.Version) < 0;
-            });
-
-        const auto appcast = pos != all.end() ? *pos : all.back();
-
-        if (!appcast.ReleaseNotesURL.empty())
-            CheckForInsecureURL(appcast.ReleaseNotesURL, "release notes");
-        if (!appcast.GetDownloadURL().empty())
-            CheckForInsecureURL(appcast.GetDownloadURL(), "update file");
-
         Settings::WriteConfigValue("LastCheckTime", time(NULL));
 
-        // Check if our version is out of date.
-        if ( !appcast.IsValid() || CompareVersions(currentVersion, appcast.Version) >= 0 )
+        if ( !result.HasUpdate )
         {
             // The same or newer version is already installed.
             UI::NotifyNoUpdates(ShouldAutomaticallyInstall(), show_dialog);
             return;
         }
 
+        const Appcast& appcast = result.Update;
+
+        if (!appcast.ReleaseNotesURL.empty())
+            CheckForInsecureURL(appcast.ReleaseNotesURL, "release notes");
+        const std::string downloadURL = appcast.GetDownloadURL();
+        if (!downloadURL.empty())
+            CheckForInsecureURL(downloadURL, "update file");
+
         // Check if the user opted to ignore this particular version.
         if ( ShouldSkipUpdate(appcast) && !show_dialog)
         {
             return;
         }
 
-        UI::NotifyUpdateAvailable(appcast, ShouldAutomaticallyInstall());
+        // Download the update before telling the user about it, so that it
+        // can be installed right away. Manual checks don't wait for that.
+        bool prestaged = false;
+        if ( !show_dialog && Settings::GetPrestageUpdates() )
+        {
+            switch ( UpdateDownloader::Prestage(appcast, *this) )
+            {
+                case UpdateDownloader::Prestage_Ready:
+                    prestaged = true;
+                    break;
+                case UpdateDownloader::Prestage_Failed:
+                    // the user can still download it
+                    break;
+                case UpdateDownloader::Prestage_Preempted:
+                    // the user is downloading an update already and the UI
+                    // shows it; this update is offered again by the next check
+                    return;
+            }
+        }
+
+        UI::NotifyUpdateAvailable(appcast, ShouldAutomaticallyInstall(), prestaged);
     }
     catch (const DownloadException& ex)
     {
@@ -418,6 +739,11 @@ void UpdateChecker::PerformUpdateCheck(bool show_dialog)
 
         throw;
     }
+    catch ( const TerminateThreadException& )
+    {
+        // not an error, the checker was terminated by TerminateAll()
+        throw;
+    }
     catch ( ... )
     {
         UI::NotifyUpdateError(Err_Generic, "Unknown exception");
@@ -477,7 +803,8 @@ void PeriodicUpdateChecker::Run()
             }
         }
 
-        m_terminateEvent.WaitUntilSignaled(sleepTimeInSeconds * 1000);
+        if ( m_terminateEvent.WaitUntilSignaled(sleepTimeInSeconds * 1000) )
+            return;
     }
 }
 
@@ -35,6 +35,34 @@ namespace winsparkle
 
 struct Appcast;
 
+/**
+    Statistics of update checks, for diagnostics.
+
+    See UpdateChecker::GetStats().
+ */
+struct UpdateCheckStats
+{
+    UpdateCheckStats()
+        : Checks(0), TotalDuration(0), LastDuration(0), MaxDuration(0),
+          ServerVersionReused(0)
+    {}
+
+    /// Number of performed checks, including failed ones.
+    unsigned Checks;
+
+    /// Total duration of all checks, in milliseconds.
+    unsigned long long TotalDuration;
+
+    /// Duration of the last check, in milliseconds.
+    unsigned LastDuration;
+
+    /// Duration of the longest check, in milliseconds.
+    unsigned MaxDuration;
+
+    /// Number of checks that reused a recently probed server version.
+    unsigned ServerVersionReused;
+};
+
 /**
     This class checks the appcast for updates.
 
@@ -46,6 +74,7 @@ class UpdateChecker : public Thread
 public:
     /// Creates checker thread.
     UpdateChecker();
+    virtual ~UpdateChecker();
 
     /**
         Compares versions @a a and @a b.
@@ -59,6 +88,32 @@ public:
      */
     static int CompareVersions(const std::string& a, const std::string& b);
 
+    /**
+        Returns statistics of update checks performed so far.
+
+        The duration of a check covers all of it: getting the server
+        version, downloading and evaluating the appcast and notifying
+        the UI, including downloading the update in advance if enabled with
+        Settings::SetPrestageUpdates().
+     */
+    static UpdateCheckStats GetStats();
+
+    /**
+        Sets for how long a probed server version is reused by the
+        following checks, in milliseconds (default: 10 minutes).
+
+        Failed probes aren't reused.
+     */
+    static void SetServerVersionTTL(unsigned milliseconds);
+
+    /**
+        Terminates all running checkers and waits until they finish, for at
+        most @a timeoutMilliseconds.
+
+        Returns false if some checkers didn't finish in time.
+     */
+    static bool TerminateAll(unsigned timeoutMilliseconds);
+
 protected:
     /// Should give version be ignored?
     virtual bool ShouldSkipUpdate(const Appcast& appcast) const;
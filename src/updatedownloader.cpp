@@ -25,16 +25,25 @@
 
 #include "appcontroller.h"
 #include "updatedownloader.h"
+#include "archiveextract.h"
 #include "download.h"
+#include "filedigest.h"
+#include "downloadpipeline.h"
+#include "deltapatch.h"
+#include "chunksync.h"
+#include "installercache.h"
+#include "mirrors.h"
+#include "throttle.h"
 #include "settings.h"
 #include "ui.h"
 #include "error.h"
 #include "signatureverifier.h"
+#include "utils.h"
 
 #include <wx/string.h>
 
-#include <sstream>
-#include <rpc.h>
+#include <algorithm>
+#include <io.h>
 #include <time.h>
 
 namespace winsparkle
@@ -47,53 +56,97 @@ namespace winsparkle
 namespace
 {
 
-std::wstring GetUniqueTempDirectoryPrefix()
+// Validates and returns temp directory of the previous download attempt.
+bool GetExistingTempDirectory(std::wstring& tmpdir)
 {
-    wchar_t tmpdir[MAX_PATH + 1];
-    if (GetTempPath(MAX_PATH + 1, tmpdir) == 0)
-        throw Win32Exception("Cannot create temporary directory");
+    if ( !Settings::ReadConfigValue("UpdateTempDir", tmpdir) )
+        return false;
 
-    std::wstring dir(tmpdir);
-    dir += L"Update-";
-    return dir;
+    // Check that the directory actually is a valid update temp dir, to prevent
+    // malicious users from forcing us into writing to arbitrary directories:
+    return InstallerCache::IsDownloadDirectory(tmpdir) &&
+           GetFileAttributes(tmpdir.c_str()) != INVALID_FILE_ATTRIBUTES;
 }
 
-std::wstring CreateUniqueTempDirectory()
+
+// Journal of a partially downloaded update is kept in the configuration, so
+// that interrupted downloads can be resumed, even after restart. It consists
+// of a line with the file name (in UpdateTempDir) followed by the state of
+// the download, see FormatPartialDownload().
+//
+// Config values can't be longer than 255 characters. If the journal doesn't
+// fit, the smallest completed ranges are left out of it (and downloaded again
+// when resuming); if it doesn't fit even without them, it isn't kept at all.
+const size_t MAX_JOURNAL_LENGTH = 255;
+
+bool IsLargerRange(const PartialDownload::Range& a, const PartialDownload::Range& b)
 {
-    // We need to put downloaded updates into a directory of their own, because
-    // if we put it in $TMP, some DLLs could be there and interfere with the
-    // installer.
-    //
-    // This code creates a new randomized directory name and tries to create it;
-    // this process is repeated if the directory already exists.
-    const std::wstring tmpdir = GetUniqueTempDirectoryPrefix();
+    return a.To - a.From > b.To - b.From;
+}
 
-    for ( ;; )
+bool IsEarlierRange(const PartialDownload::Range& a, const PartialDownload::Range& b)
+{
+    return a.From < b.From;
+}
+
+void SaveDownloadJournal(const PartialDownload& state, const std::wstring& filename)
+{
+    std::wstring journal = filename + L'\n' + FormatPartialDownload(state);
+
+    if ( journal.length() > MAX_JOURNAL_LENGTH )
     {
-        std::wstring dir(tmpdir);
-        UUID uuid;
-        UuidCreate(&uuid);
-        RPC_WSTR uuidStr;
-        RPC_STATUS status = UuidToString(&uuid, &uuidStr);
-        dir += reinterpret_cast<wchar_t*>(uuidStr);
-        RpcStringFree(&uuidStr);
+        std::vector<PartialDownload::Range> largest(state.Completed);
+        std::sort(largest.begin(), largest.end(), IsLargerRange);
 
-        if ( CreateDirectory(dir.c_str(), NULL) )
-            return dir;
-        else if ( GetLastError() != ERROR_ALREADY_EXISTS )
-            throw Win32Exception("Cannot create temporary directory");
+        PartialDownload bounded(state);
+        while ( journal.length() > MAX_JOURNAL_LENGTH && !largest.empty() )
+        {
+            largest.pop_back();
+            bounded.Completed = largest;
+            std::sort(bounded.Completed.begin(), bounded.Completed.end(), IsEarlierRange);
+            journal = filename + L'\n' + FormatPartialDownload(bounded);
+        }
+
+        if ( journal.length() > MAX_JOURNAL_LENGTH )
+        {
+            Settings::DeleteConfigValue("UpdateDownloadJournal");
+            return;
+        }
     }
+
+    Settings::WriteConfigValue("UpdateDownloadJournal", journal);
 }
 
-struct UpdateDownloadSink : public IDownloadSink
+bool LoadDownloadJournal(PartialDownload& state, std::wstring& filename)
 {
-    UpdateDownloadSink(Thread& thread, const std::wstring& dir)
-        : m_thread(thread),
-          m_dir(dir), m_file(NULL),
-          m_downloaded(0), m_total(0), m_lastUpdate(-1)
+    std::wstring journal;
+    if ( !Settings::ReadConfigValue("UpdateDownloadJournal", journal) )
+        return false;
+
+    const size_t eol = journal.find(L'\n');
+    if ( eol == std::wstring::npos )
+        return false;
+    filename = journal.substr(0, eol);
+
+    // the file must be directly in UpdateTempDir
+    if ( filename.empty() || filename.find_first_of(L"\\/:") != std::wstring::npos )
+        return false;
+
+    return ParsePartialDownload(journal.substr(eol + 1), state);
+}
+
+
+// Writes downloaded data into the update file in given directory.
+class FileWriterStage : public DownloadStage
+{
+public:
+    FileWriterStage(const std::wstring& dir,
+                    const std::wstring& partialFilename = std::wstring())
+        : m_dir(dir), m_partialFilename(partialFilename), m_file(NULL),
+          m_position(0), m_end(0), m_length(0), m_reserved(0), m_randomAccess(false)
     {}
 
-    ~UpdateDownloadSink() { Close(); }
+    ~FileWriterStage() { Close(); }
 
     void Close()
     {
@@ -104,31 +157,249 @@ struct UpdateDownloadSink : public IDownloadSink
         }
     }
 
-    std::wstring GetFilePath(void) { return m_path; }
+    FILE *GetFile() const { return m_file; }
+    std::wstring GetFilePath() const { return m_path; }
+
+    /// Must be called after the file is accessed by others than this stage.
+    void InvalidatePosition() { m_position = size_t(-1); }
+
+    /// Sets expected size of the file, used if the server doesn't report it.
+    void SetExpectedLength(size_t len) { m_length = len; }
 
-    virtual void SetLength(size_t l) { m_total = l; }
+    virtual void SetLength(size_t len)
+    {
+        m_length = len;
+        DownloadStage::SetLength(len);
+    }
 
     virtual void SetFilename(const std::wstring& filename)
     {
         if ( m_file )
             throw std::runtime_error("Failed to save the update file. Please restart your computer and try again.");
 
+        // starting over, any earlier partial download is useless now
+        Settings::DeleteConfigValue("UpdateDownloadJournal");
+
+        m_filename = filename;
         m_path = m_dir + L"\\" + filename;
         m_file = _wfopen(m_path.c_str(), L"wb");
         if ( !m_file )
             throw std::runtime_error("Failed to save the update file.  Please check disk space and permissions.");
+        m_position = 0;
+        m_end = 0;
+
+        // Reserve the disk space upfront even for sequential downloads, so
+        // that the file doesn't get fragmented. The size is only a hint
+        // here, so failure isn't fatal.
+        m_reserved = 0;
+        if ( m_length && _chsize_s(_fileno(m_file), m_length) == 0 )
+            m_reserved = m_length;
+
+        DownloadStage::SetFilename(filename);
     }
 
-    virtual void Add(const void *data, size_t len)
+    virtual bool ResumePartial(const PartialDownload& state)
+    {
+        if ( m_file || m_partialFilename.empty() )
+            return false;
+
+        m_filename = m_partialFilename;
+        m_path = m_dir + L"\\" + m_filename;
+        m_file = _wfopen(m_path.c_str(), L"r+b");
+        if ( !m_file )
+            return false;
+
+        // the file was preallocated, so it must have the full size already
+        if ( _fseeki64(m_file, 0, SEEK_END) != 0 ||
+             _ftelli64(m_file) != (long long)state.Length ||
+             !DownloadStage::ResumePartial(state) )
+        {
+            Close();
+            return false;
+        }
+
+        m_position = state.Length;
+        m_randomAccess = true;
+        return true;
+    }
+
+    virtual void Preallocate(size_t len)
     {
         if ( !m_file )
             throw std::runtime_error("Update failed. Local file not found.");
 
-        m_thread.CheckShouldTerminate();
+        // reserve the disk space upfront, so that we fail early if there's
+        // not enough of it
+        if ( fflush(m_file) != 0 || _chsize_s(_fileno(m_file), len) != 0 )
+            throw std::runtime_error("Failed to save the update file.  Please check disk space and permissions.");
+        m_randomAccess = true;
+
+        DownloadStage::Preallocate(len);
+    }
+
+    virtual void SaveProgress(const PartialDownload& state)
+    {
+        // make sure the data are written before recording them as done
+        if ( !m_file || fflush(m_file) != 0 )
+            return;
+        if ( Settings::GetDownloadFlushPolicy() == WIN_SPARKLE_FLUSH_ON_PROGRESS &&
+             !FlushToDisk() )
+            return;
 
-        if ( fwrite(data, len, 1, m_file) != 1 )
+        // this is only an optimization, failure to save progress isn't fatal
+        try
+        {
+            SaveDownloadJournal(state, m_filename);
+        }
+        catch ( const std::exception& e )
+        {
+            LogError(e.what());
+        }
+
+        DownloadStage::SaveProgress(state);
+    }
+
+    virtual void Process(const DownloadChunk& chunk)
+    {
+        if ( !m_file )
+            throw std::runtime_error("Update failed. Local file not found.");
+
+        // sequential writes don't need to seek
+        if ( (chunk.Offset != m_position && _fseeki64(m_file, chunk.Offset, SEEK_SET) != 0) ||
+             fwrite(chunk.Data, chunk.Length, 1, m_file) != 1 )
             throw std::runtime_error("Failed to save the update file.  Please check disk space and permissions.");
-        m_downloaded += len;
+        m_position = chunk.Offset + chunk.Length;
+        m_end = std::max(m_end, m_position);
+
+        DownloadStage::Process(chunk);
+    }
+
+    virtual void Finish()
+    {
+        if ( !m_file )
+            throw std::runtime_error("Update failed. Local file not found.");
+
+        // cut off the unused part of reserved space if the hint was wrong
+        if ( !m_randomAccess && m_reserved && m_reserved != m_end )
+        {
+            if ( fflush(m_file) != 0 || _chsize_s(_fileno(m_file), m_end) != 0 )
+                throw std::runtime_error("Failed to save the update file.  Please check disk space and permissions.");
+        }
+
+        if ( Settings::GetDownloadFlushPolicy() != WIN_SPARKLE_FLUSH_NONE )
+        {
+            if ( fflush(m_file) != 0 || !FlushToDisk() )
+                throw std::runtime_error("Failed to save the update file.  Please check disk space and permissions.");
+        }
+
+        DownloadStage::Finish();
+    }
+
+private:
+    // Writes the file's data from OS cache to the disk.
+    bool FlushToDisk()
+    {
+        HANDLE handle = (HANDLE)_get_osfhandle(_fileno(m_file));
+        return handle != INVALID_HANDLE_VALUE && FlushFileBuffers(handle);
+    }
+
+    std::wstring m_dir;
+    std::wstring m_partialFilename;
+    std::wstring m_filename;
+    std::wstring m_path;
+    FILE *m_file;
+    size_t m_position;      // current position in m_file
+    size_t m_end;           // end of data written so far
+    size_t m_length;        // expected size of the file, 0 if unknown
+    size_t m_reserved;      // disk space reserved for sequential download
+    bool m_randomAccess;    // the file was preallocated for random access
+};
+
+
+// Computes SHA-1 digest of data written by FileWriterStage and extracts
+// them with @a extractor, if it's not NULL.
+class DigestStage : public DownloadStage, private IDigestedDataSink
+{
+public:
+    DigestStage(FileWriterStage& writer, ArchiveExtractor *extractor = NULL)
+        : m_writer(writer), m_extractor(extractor),
+          m_digest(extractor ? this : NULL) {}
+
+    /// Gets SHA-1 digest of the downloaded file; must be called before
+    /// the file is closed.
+    bool GetDigest(std::string& digest)
+    {
+        FILE *file = m_writer.GetFile();
+        return file && m_digest.Finish(file, digest);
+    }
+
+    virtual bool ResumePartial(const PartialDownload& state)
+    {
+        if ( !DownloadStage::ResumePartial(state) )
+            return false;
+
+        for ( size_t i = 0; i < state.Completed.size(); i++ )
+            m_digest.Existing(state.Completed[i].From, state.Completed[i].To);
+        return true;
+    }
+
+    virtual void Process(const DownloadChunk& chunk)
+    {
+        // the data must be written first, FileDigest may need to read them
+        DownloadStage::Process(chunk);
+        if ( m_digest.Written(m_writer.GetFile(), chunk.Offset, chunk.Data, chunk.Length) )
+            m_writer.InvalidatePosition();
+    }
+
+private:
+    // the data are passed to the extractor in file order as they are hashed
+    virtual void Add(const void *data, size_t len)
+    {
+        m_extractor->Add(data, len);
+    }
+
+    FileWriterStage& m_writer;
+    ArchiveExtractor *m_extractor;
+    FileDigest m_digest;
+};
+
+
+// Reports download progress to the UI, unless @a notify is false, and checks
+// for thread termination.
+class ProgressStage : public DownloadStage
+{
+public:
+    ProgressStage(Thread& thread, bool notify)
+        : m_thread(thread), m_notify(notify), m_downloaded(0), m_total(0), m_lastUpdate(-1)
+    {}
+
+    virtual void SetLength(size_t len)
+    {
+        m_total = len;
+        DownloadStage::SetLength(len);
+    }
+
+    virtual bool ResumePartial(const PartialDownload& state)
+    {
+        if ( !DownloadStage::ResumePartial(state) )
+            return false;
+
+        m_total = state.Length;
+        m_downloaded = 0;
+        for ( size_t i = 0; i < state.Completed.size(); i++ )
+            m_downloaded += state.Completed[i].To - state.Completed[i].From;
+        return true;
+    }
+
+    virtual void Process(const DownloadChunk& chunk)
+    {
+        m_thread.CheckShouldTerminate();
+
+        DownloadStage::Process(chunk);
+
+        m_downloaded += chunk.Length;
+        if ( !m_notify )
+            return;
 
         // only update at most 10 times/sec so that we don't flood the UI:
         clock_t now = clock();
@@ -140,14 +411,143 @@ struct UpdateDownloadSink : public IDownloadSink
         }
     }
 
+private:
     Thread& m_thread;
+    bool m_notify;
     size_t m_downloaded, m_total;
-    FILE *m_file;
-    std::wstring m_dir;
-    std::wstring m_path;
     clock_t m_lastUpdate;
 };
 
+
+
+// The download that is in progress, see UpdateDownloader::AcquireDownload().
+CriticalSection gs_csActiveDownload;
+UpdateDownloader *gs_activeDownload = NULL;
+
+
+// from netioapi.h, which isn't available with all compilers:
+struct NL_NETWORK_CONNECTIVITY_HINT_
+{
+    int ConnectivityLevel;
+    int ConnectivityCost;
+    BOOLEAN ApproachingDataLimit;
+    BOOLEAN OverDataLimit;
+    BOOLEAN Roaming;
+};
+typedef DWORD (WINAPI *GetNetworkConnectivityHint_t)(NL_NETWORK_CONNECTIVITY_HINT_*);
+
+const int NetworkConnectivityCostHintUnknown = 0;
+const int NetworkConnectivityCostHintUnrestricted = 1;
+
+// Checks if the network connection costs extra. Only Windows 10 version 2004
+// and newer report it, the connection is assumed not to be metered otherwise.
+bool IsConnectionMetered()
+{
+    wchar_t sysdir[MAX_PATH + 1];
+    const UINT len = GetSystemDirectory(sysdir, MAX_PATH + 1);
+    if ( len == 0 || len > MAX_PATH )
+        return false;
+
+    // loaded from the system directory only, to avoid DLL planting attacks
+    const std::wstring path = std::wstring(sysdir) + L"\\iphlpapi.dll";
+    HMODULE dll = LoadLibrary(path.c_str());
+    if ( !dll )
+        return false;
+
+    bool metered = false;
+    GetNetworkConnectivityHint_t getHint =
+        (GetNetworkConnectivityHint_t)GetProcAddress(dll, "GetNetworkConnectivityHint");
+    NL_NETWORK_CONNECTIVITY_HINT_ hint;
+    if ( getHint && getHint(&hint) == 0 )
+    {
+        metered = (hint.ConnectivityCost != NetworkConnectivityCostHintUnknown &&
+                   hint.ConnectivityCost != NetworkConnectivityCostHintUnrestricted) ||
+                  hint.OverDataLimit || hint.Roaming;
+    }
+
+    FreeLibrary(dll);
+    return metered;
+}
+
+
+// Returns free space available to the user in the temporary directory,
+// where updates are downloaded to.
+unsigned long long GetTempDiskFreeSpace()
+{
+    wchar_t tmpdir[MAX_PATH + 1];
+    if ( GetTempPath(MAX_PATH + 1, tmpdir) == 0 )
+        throw Win32Exception("Cannot determine temporary directory");
+
+    ULARGE_INTEGER available;
+    if ( !GetDiskFreeSpaceEx(tmpdir, &available, NULL, NULL) )
+        throw Win32Exception("Cannot determine free disk space");
+
+    return available.QuadPart;
+}
+
+
+// Returns staging directory for files extracted from archives downloaded
+// into @a dir.
+std::wstring GetExtractionStagingDirectory(const std::wstring& dir)
+{
+    return dir + L"\\~extracting";
+}
+
+// Returns directory next to @a archive where its files are extracted.
+std::wstring GetExtractedDirectory(const std::wstring& archive)
+{
+    const size_t sep = archive.find_last_of(L'\\');
+    const size_t dot = archive.find_last_of(L'.');
+    if ( dot != std::wstring::npos && sep != std::wstring::npos && dot > sep + 1 )
+        return archive.substr(0, dot);
+    else
+        return archive + L"_files";
+}
+
+// Moves files extracted from @a archive while it was downloaded by
+// @a streamed, if it's not NULL, to their final directory, or extracts
+// them from the archive if that failed. The archive must be verified
+// already.
+//
+// Returns path to the directory or to the archive itself if it isn't
+// an archive or can't be extracted, in which case it's used as is.
+std::wstring ExtractArchive(const std::wstring& archive, ArchiveExtractor *streamed)
+{
+    const std::wstring dir = GetExtractedDirectory(archive);
+
+    if ( streamed )
+    {
+        try
+        {
+            if ( !streamed->Finish() )
+                return archive;
+            streamed->Commit(dir);
+            return dir;
+        }
+        catch (const std::exception& e)
+        {
+            LogError(std::string("Failed to extract the update while downloading it: ") + e.what());
+        }
+    }
+
+    const std::wstring staging =
+        GetExtractionStagingDirectory(archive.substr(0, archive.find_last_of(L'\\')));
+    try
+    {
+        ArchiveExtractor extractor(staging);
+        if ( !extractor.ExtractFile(archive) )
+            return archive;
+        extractor.Commit(dir);
+        return dir;
+    }
+    catch (const std::exception& e)
+    {
+        LogError(std::string("Failed to extract the update: ") + e.what());
+        DeleteDirectory(staging);
+        return archive;
+    }
+}
+
 } // anonymous namespace
 
 
@@ -155,9 +555,11 @@ struct UpdateDownloadSink : public IDownloadSink
                             updater initialization
  *--------------------------------------------------------------------------*/
 
-UpdateDownloader::UpdateDownloader(const Appcast& appcast)
+UpdateDownloader::UpdateDownloader(const Appcast& appcast, bool prestage)
     : Thread("WinSparkle updater"),
-      m_appcast(appcast)
+      m_appcast(appcast),
+      m_prestage(prestage),
+      m_prestageResult(Prestage_Failed)
 {
 }
 
@@ -171,26 +573,68 @@ void UpdateDownloader::Run()
     // no initialization to do, so signal readiness immediately
     SignalReady();
 
+    if ( !AcquireDownload() )
+    {
+        m_prestageResult = Prestage_Preempted;
+        return;
+    }
+
     try
     {
-      const std::wstring tmpdir = CreateUniqueTempDirectory();
-      Settings::WriteConfigValue("UpdateTempDir", tmpdir);
-
-      UpdateDownloadSink sink(*this, tmpdir);
-      DownloadFile(m_appcast.GetDownloadURL(), &sink, this);
-      sink.Close();
-
-      if (Settings::HasDSAPubKeyPem())
-      {
-          SignatureVerifier::VerifyDSASHA1SignatureValid(sink.GetFilePath(), m_appcast.enclosure.DsaSignature);
-      }
-      else
-      {
-          // backward compatibility - accept as is, but complain about it
-          LogError("Using unsigned updates!");
-      }
-      
-      UI::NotifyUpdateDownloaded(sink.GetFilePath(), m_appcast);
+        if ( m_prestage )
+            RunPrestage();
+        else
+            RunDownload();
+    }
+    catch ( ... )
+    {
+        ReleaseDownload();
+        throw;
+    }
+
+    ReleaseDownload();
+}
+
+
+bool UpdateDownloader::AcquireDownload()
+{
+    for ( ;; )
+    {
+        {
+            CriticalSectionLocker lock(gs_csActiveDownload);
+            if ( !gs_activeDownload )
+            {
+                gs_activeDownload = this;
+                return true;
+            }
+
+            if ( m_prestage )
+                return false;
+
+            // the download started by the user takes over, resuming it
+            if ( gs_activeDownload->m_prestage )
+                gs_activeDownload->m_terminateEvent.Signal();
+        }
+
+        Sleep(100);
+        CheckShouldTerminate();
+    }
+}
+
+
+void UpdateDownloader::ReleaseDownload()
+{
+    CriticalSectionLocker lock(gs_csActiveDownload);
+    gs_activeDownload = NULL;
+}
+
+
+void UpdateDownloader::RunDownload()
+{
+    try
+    {
+        const std::wstring installer = DownloadUpdate();
+        UI::NotifyUpdateDownloaded(installer, m_appcast);
     }
     catch (const DownloadException& ex)
     {
@@ -216,6 +660,323 @@ void UpdateDownloader::Run()
 }
 
 
+void UpdateDownloader::RunPrestage()
+{
+    // nobody is waiting for it, so don't get in the way of the application
+    BackgroundModeScope mode;
+
+    try
+    {
+        DownloadUpdate();
+        m_prestageResult = Prestage_Ready;
+    }
+    catch (TerminateThreadException&)
+    {
+        // the user's download took over, see AcquireDownload(), or the
+        // checker that waits for this was terminated
+        m_prestageResult = Prestage_Preempted;
+        throw;
+    }
+    catch (BadSignatureException& ex)
+    {
+        CleanLeftovers();  // remove potentially corrupted file
+        LogError(std::string("Failed to download the update in advance: ") + ex.what());
+    }
+    catch (const std::exception& ex)
+    {
+        LogError(std::string("Failed to download the update in advance: ") + ex.what());
+    }
+}
+
+
+/*static*/
+UpdateDownloader::PrestageResult UpdateDownloader::Prestage(const Appcast& appcast, Thread& caller)
+{
+    // only cached installers can be used later
+    if ( !appcast.HasDownload() || InstallerCache::GetKey(appcast.enclosure).empty() )
+        return Prestage_Failed;
+
+    if ( !ApplicationController::CanPrestageOnConnection(IsConnectionMetered()) )
+        return Prestage_Failed;
+
+    try
+    {
+        if ( !ApplicationController::CanPrestageWithDiskSpace(appcast.enclosure.Length,
+                                                              GetTempDiskFreeSpace()) )
+            return Prestage_Failed;
+    }
+    catch (const std::exception& e)
+    {
+        LogError(e.what());
+        return Prestage_Failed;
+    }
+
+    UpdateDownloader *downloader = new UpdateDownloader(appcast, true);
+    downloader->Start();
+
+    try
+    {
+        while ( !downloader->Join(100) )
+            caller.CheckShouldTerminate();
+    }
+    catch ( ... )
+    {
+        downloader->TerminateAndJoin();
+        delete downloader;
+        throw;
+    }
+
+    const PrestageResult result = downloader->m_prestageResult;
+    delete downloader;
+
+    return result;
+}
+
+
+std::wstring UpdateDownloader::DownloadUpdate()
+{
+    const std::string url = m_appcast.GetDownloadURL();
+    const bool extract = Settings::GetExtractArchives();
+
+    // The update may have been downloaded already, e.g. if it was postponed.
+    // The cached file is verified again, it could have been modified.
+    const std::string cacheKey = InstallerCache::GetKey(m_appcast.enclosure);
+    std::wstring cached;
+    if ( !cacheKey.empty() && InstallerCache::Find(cacheKey, cached) )
+    {
+        try
+        {
+            SignatureVerifier::VerifyDSASHA1SignatureValid(cached, m_appcast.enclosure.DsaSignature);
+            InstallerCache::RecordHit(cacheKey);
+            // extract it again, the extracted files could be modified too
+            return extract ? ExtractArchive(cached, NULL) : cached;
+        }
+        catch (BadSignatureException&)
+        {
+            InstallerCache::Remove(cacheKey);
+        }
+    }
+
+    // The installer of the installed version, if it is in the cache, can
+    // be used to download less. The result can only be verified with the
+    // signature, so this is only done with signed updates.
+    const std::string installedVersion = WideToAnsi(Settings::GetAppBuildVersion());
+    std::wstring retained;
+    const bool hasRetained = Settings::HasDSAPubKeyPem() &&
+                             InstallerCache::FindVersion(installedVersion, retained);
+
+    // Use delta update if there's one for the installed version:
+    const Appcast::Enclosure *delta = NULL;
+    std::string deltaURL;
+    if ( hasRetained &&
+         (delta = m_appcast.FindDelta(installedVersion)) != NULL &&
+         IsDeltaPatchSupported() )
+    {
+        deltaURL = m_appcast.GetDeltaDownloadURL(*delta);
+    }
+
+    // Resume interrupted download of the same file, if there's any:
+    PartialDownload partial;
+    std::wstring partialFilename;
+    std::wstring tmpdir;
+    const bool resume = LoadDownloadJournal(partial, partialFilename) &&
+                        (partial.URL == url || (!deltaURL.empty() && partial.URL == deltaURL)) &&
+                        GetExistingTempDirectory(tmpdir);
+    if ( !resume )
+    {
+        Settings::DeleteConfigValue("UpdateDownloadJournal");
+        CleanLeftovers();
+
+        tmpdir = InstallerCache::CreateDownloadDirectory();
+        Settings::WriteConfigValue("UpdateTempDir", tmpdir);
+    }
+
+    // Archives are extracted while they are downloaded, except for deltas:
+    std::wstring installer;
+    std::wstring extracted;
+    std::wstring *extractTo = extract ? &extracted : NULL;
+
+    if ( !deltaURL.empty() && (!resume || partial.URL == deltaURL) )
+    {
+        // any problem with the delta only means the full update is needed
+        try
+        {
+            installer = DownloadDelta(deltaURL, *delta, retained, tmpdir,
+                                      resume ? &partial : NULL,
+                                      resume ? partialFilename : std::wstring());
+        }
+        catch (const std::exception& e)
+        {
+            LogError(std::string("Delta update failed, downloading the full update: ") + e.what());
+            Settings::DeleteConfigValue("UpdateDownloadJournal");
+        }
+    }
+
+    // Otherwise, reuse the unchanged parts of the retained installer:
+    const std::string chunkIndexURL = hasRetained ? m_appcast.GetChunkIndexURL() : std::string();
+    if ( installer.empty() && !resume && !chunkIndexURL.empty() )
+    {
+        try
+        {
+            installer = DownloadChunked(url, chunkIndexURL, retained, tmpdir, extractTo);
+        }
+        catch (const std::exception& e)
+        {
+            LogError(std::string("Chunked download failed, downloading the full update: ") + e.what());
+            Settings::DeleteConfigValue("UpdateDownloadJournal");
+        }
+    }
+
+    if ( installer.empty() )
+    {
+        const bool resumeFull = resume && partial.URL == url;
+        installer = Download(url, m_appcast.enclosure, tmpdir,
+                             resumeFull ? &partial : NULL,
+                             resumeFull ? partialFilename : std::wstring(),
+                             extractTo);
+    }
+
+    if ( extract && extracted.empty() )
+        extracted = ExtractArchive(installer, NULL);
+
+    InstallerCache::RecordMiss();
+    if ( !cacheKey.empty() )
+    {
+        // the download directory is owned by the cache from now on; this
+        // is only an optimization, failure to cache it isn't fatal
+        try
+        {
+            InstallerCache::Add(cacheKey, m_appcast.Version, installer);
+            Settings::DeleteConfigValue("UpdateTempDir");
+        }
+        catch (const std::exception& e)
+        {
+            LogError(e.what());
+        }
+    }
+
+    return extract ? extracted : installer;
+}
+
+
+std::wstring UpdateDownloader::Download(const std::string& url,
+                                        const Appcast::Enclosure& enclosure,
+                                        const std::wstring& tmpdir,
+                                        PartialDownload *resumeFrom,
+                                        const std::wstring& partialFilename,
+                                        std::wstring *extracted)
+{
+    FileWriterStage writer(tmpdir, partialFilename);
+    writer.SetExpectedLength(enclosure.Length);
+    ArchiveExtractor extractor(GetExtractionStagingDirectory(tmpdir));
+    DigestStage digester(writer, extracted ? &extractor : NULL);
+    ProgressStage progress(*this, !m_prestage);
+
+    const bool lowPriority = m_prestage ||
+        Settings::GetDownloadPriority() == WIN_SPARKLE_DOWNLOAD_PRIORITY_BACKGROUND;
+    DownloadThrottle throttle(Settings::GetDownloadRateLimit(), lowPriority);
+
+    // Hashing and writing is done on a separate thread, so that slow
+    // disks don't hold back the network transfer. Note that it must be
+    // declared after the stages it uses, so that its thread is stopped
+    // before they are destroyed.
+    AsyncWriteStage background(1024 * 1024, 4, lowPriority);
+
+    DownloadPipeline pipeline;
+    pipeline.Append(&progress);
+    pipeline.Append(&background);
+    pipeline.Append(&digester);
+    pipeline.Append(&writer);
+
+    MirrorFailover mirrors;
+    DownloadFileSegmented(url, &pipeline, this, 4, resumeFrom, &mirrors, &throttle);
+    pipeline.Finish();
+
+    std::string digest;
+    const bool hasDigest = digester.GetDigest(digest);
+    writer.Close();
+
+    // the file is complete, there's nothing to resume anymore
+    Settings::DeleteConfigValue("UpdateDownloadJournal");
+
+    if (Settings::HasDSAPubKeyPem())
+    {
+        // the file was hashed while downloading, unless that failed
+        if (hasDigest)
+            SignatureVerifier::VerifyDSASHA1DigestSignatureValid(digest, enclosure.DsaSignature);
+        else
+            SignatureVerifier::VerifyDSASHA1SignatureValid(writer.GetFilePath(), enclosure.DsaSignature);
+    }
+    else
+    {
+        // backward compatibility - accept as is, but complain about it
+        LogError("Using unsigned updates!");
+    }
+
+    // the extracted files can only be used now that the archive is verified
+    if ( extracted )
+        *extracted = ExtractArchive(writer.GetFilePath(), &extractor);
+
+    return writer.GetFilePath();
+}
+
+
+std::wstring UpdateDownloader::DownloadDelta(const std::string& url,
+                                             const Appcast::Enclosure& delta,
+                                             const std::wstring& source,
+                                             const std::wstring& tmpdir,
+                                             PartialDownload *resumeFrom,
+                                             const std::wstring& partialFilename)
+{
+    // the delta has its own signature, so that only deltas that come
+    // from us are ever applied
+    const std::wstring deltaFile = Download(url, delta, tmpdir, resumeFrom, partialFilename, NULL);
+
+    // the result has the same name as the installer it was created from
+    const std::wstring target = tmpdir + source.substr(source.find_last_of(L'\\'));
+    if ( target == deltaFile )
+        throw std::runtime_error("Delta update has the same name as the installer.");
+
+    ApplyDeltaPatch(source, deltaFile, target);
+    DeleteFile(deltaFile.c_str());
+
+    // verify the result as if it was downloaded in full
+    SignatureVerifier::VerifyDSASHA1SignatureValid(target, m_appcast.enclosure.DsaSignature);
+
+    return target;
+}
+
+
+std::wstring UpdateDownloader::DownloadChunked(const std::string& url,
+                                               const std::string& indexURL,
+                                               const std::wstring& source,
+                                               const std::wstring& tmpdir,
+                                               std::wstring *extracted)
+{
+    StringDownloadSink index;
+    DownloadFile(indexURL, &index, this);
+
+    // the result has the same name as the installer it was created from
+    const std::wstring filename = source.substr(source.find_last_of(L'\\') + 1);
+
+    PartialDownload state;
+    const ChunkSyncStats stats =
+        PrepareChunkSync(index.data, source, tmpdir + L"\\" + filename, state, this);
+
+    if ( m_appcast.enclosure.Length && stats.Length != m_appcast.enclosure.Length )
+        throw std::runtime_error("Chunk index doesn't match the update.");
+    if ( stats.Reused == 0 )
+        throw std::runtime_error("Nothing to reuse from the previous update.");
+
+    // the download continues as if it was interrupted after the reused
+    // parts were downloaded, even after restart
+    state.URL = url;
+    SaveDownloadJournal(state, filename);
+
+    return Download(url, m_appcast.enclosure, tmpdir, &state, filename, extracted);
+}
+
+
 /*--------------------------------------------------------------------------*
                                cleanup
  *--------------------------------------------------------------------------*/
@@ -224,40 +985,36 @@ void UpdateDownloader::CleanLeftovers()
 {
     // Note: this is called at startup. Do not use wxWidgets from this code!
 
-    std::wstring tmpdir;
-    if ( !Settings::ReadConfigValue("UpdateTempDir", tmpdir) )
-        return;
+    // Keep partially downloaded update, its download can be resumed later.
+    std::wstring journal;
+    const bool resumable = Settings::ReadConfigValue("UpdateDownloadJournal", journal);
 
-    // Check that the directory actually is a valid update temp dir, to prevent
-    // malicious users from forcing us into deleting arbitrary directories:
-    try
+    std::wstring tmpdir;
+    if ( Settings::ReadConfigValue("UpdateTempDir", tmpdir) )
     {
-        if (tmpdir.find(GetUniqueTempDirectoryPrefix()) != 0)
+        // Check that the directory actually is a valid update temp dir, to prevent
+        // malicious users from forcing us into deleting arbitrary directories:
+        if ( !InstallerCache::IsDownloadDirectory(tmpdir) )
         {
             Settings::DeleteConfigValue("UpdateTempDir");
-            return;
+            tmpdir.clear();
         }
+        else if ( !resumable && InstallerCache::DeleteDownloadDirectory(tmpdir) )
+        {
+            Settings::DeleteConfigValue("UpdateTempDir");
+            tmpdir.clear();
+        }
+        // else: try another time, this is just a "soft" error
     }
-    catch (Win32Exception&) // cannot determine temp directory
+
+    try
     {
-        return;
+        InstallerCache::Trim(WideToAnsi(Settings::GetAppBuildVersion()), tmpdir);
     }
-
-    tmpdir.append(1, '\0'); // double NULL-terminate for SHFileOperation
-
-    SHFILEOPSTRUCT fos = {0};
-    fos.wFunc = FO_DELETE;
-    fos.pFrom = tmpdir.c_str();
-    fos.fFlags = FOF_NO_UI | // Vista+-only
-                 FOF_SILENT |
-                 FOF_NOCONFIRMATION |
-                 FOF_NOERRORUI;
-
-    if ( SHFileOperation(&fos) == 0 )
+    catch (const std::exception& e)
     {
-        Settings::DeleteConfigValue("UpdateTempDir");
+        LogError(e.what());
     }
-    // else: try another time, this is just a "soft" error
 }
 
 } // namespace winsparkle
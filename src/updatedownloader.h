@@ -43,8 +43,41 @@ namespace winsparkle
 class UpdateDownloader : public Thread
 {
 public:
-    /// Creates updater thread.
-    UpdateDownloader(const Appcast& appcast);
+    /// Result of Prestage().
+    enum PrestageResult
+    {
+        Prestage_Ready,         // the update is in the cache, ready to install
+        Prestage_Failed,        // not downloaded, e.g. because of an error or policy
+        Prestage_Preempted      // gave way to the download started by the user
+    };
+
+    /**
+        Creates updater thread.
+
+        @param appcast   The update to download.
+        @param prestage  Download the update silently, with low priority,
+                         see Prestage().
+     */
+    UpdateDownloader(const Appcast& appcast, bool prestage = false);
+
+    /**
+        Downloads and verifies the update before the user is told about it,
+        so that it's ready to install right away.
+
+        The download runs in background mode and doesn't show any UI. It is
+        only done for updates that can be cached, see InstallerCache, and if
+        the disk space and network connection policies allow it, see
+        ApplicationController::CanPrestageWithDiskSpace(). It gives way to
+        the download started by the user, which resumes it.
+
+        Blocks until the download is finished. If @a caller is terminated
+        meanwhile, the download is terminated too and
+        TerminateThreadException is thrown.
+
+        @param appcast  The update to download.
+        @param caller   Thread that calls this, normally the UpdateChecker.
+     */
+    static PrestageResult Prestage(const Appcast& appcast, Thread& caller);
 
     /**
         Perform any necessary cleanup after previous updates.
@@ -52,6 +85,10 @@ public:
         Should be called on launch to get rid of leftover junk from previous
         updates, such as the installer files. Call it as soon as possible,
         before using other WinSparkle functionality.
+
+        Partially downloaded update is kept if its download can be resumed.
+        Cached installers are evicted if the cache is over its limit, see
+        InstallerCache::Trim().
      */
     static void CleanLeftovers();
 
@@ -60,8 +97,61 @@ protected:
     virtual void Run();
     virtual bool IsJoinable() const { return true; }
 
+private:
+    // Makes sure only one update is downloaded at a time, because downloads
+    // share the journal and the download directory. Pre-staging gives up if
+    // another download is in progress and it is interrupted by the others.
+    // Returns false if pre-staging should give up.
+    bool AcquireDownload();
+    void ReleaseDownload();
+
+    // Runs the download started by the user, reporting the result to the UI.
+    void RunDownload();
+
+    // Runs the download in the background, only logging errors.
+    void RunPrestage();
+
+    // Downloads and verifies the update, using the cached installer if
+    // possible, and adds it to the cache. Returns path to the installer,
+    // or to the directory with its files if it's an archive that is
+    // extracted, see Settings::GetExtractArchives().
+    std::wstring DownloadUpdate();
+
+    // Downloads the file into tmpdir and verifies its signature. Returns
+    // path to the file. If @a extracted isn't NULL, the file is extracted
+    // while downloading if it's an archive and @a extracted receives path
+    // to the extracted files, or to the file itself if it isn't extracted.
+    std::wstring Download(const std::string& url,
+                          const Appcast::Enclosure& enclosure,
+                          const std::wstring& tmpdir,
+                          PartialDownload *resumeFrom,
+                          const std::wstring& partialFilename,
+                          std::wstring *extracted);
+
+    // Downloads the delta update and applies it to the source installer.
+    // Returns path to the patched installer, verified with the signature
+    // of the full update. Throws on failure.
+    std::wstring DownloadDelta(const std::string& url,
+                               const Appcast::Enclosure& delta,
+                               const std::wstring& source,
+                               const std::wstring& tmpdir,
+                               PartialDownload *resumeFrom,
+                               const std::wstring& partialFilename);
+
+    // Downloads the update reusing chunks of the source installer that are
+    // listed in the chunk index, see PrepareChunkSync(). Returns path to
+    // the verified installer. Throws on failure. @a extracted is as in
+    // Download().
+    std::wstring DownloadChunked(const std::string& url,
+                                 const std::string& indexURL,
+                                 const std::wstring& source,
+                                 const std::wstring& tmpdir,
+                                 std::wstring *extracted);
+
 private:
     Appcast m_appcast;
+    bool m_prestage;
+    PrestageResult m_prestageResult;
 };
 
 } // namespace winsparkle
@@ -31,6 +31,11 @@
 #include <string>
 #include <string.h>
 
+#ifdef _WIN32
+    #include <windows.h>
+    #include <shellapi.h>
+#endif
+
 namespace winsparkle
 {
 
@@ -80,6 +85,8 @@ inline std::wstring AnsiToWide(const std::string& s)
 }
 
 
+#ifdef _WIN32
+
 // Checking of Windows version
 
 inline bool IsWindowsVistaOrGreater()
@@ -115,6 +122,25 @@ inline T* LoadDynamicFunc(const char *func, const char *dll)
     LoadDynamicFunc<decltype(func)>(#func, #dll)
 
 
+// Deletes the directory with all its content.
+inline bool DeleteDirectory(std::wstring dir)
+{
+    dir.append(1, '\0'); // double NULL-terminate for SHFileOperation
+
+    SHFILEOPSTRUCT fos = {0};
+    fos.wFunc = FO_DELETE;
+    fos.pFrom = dir.c_str();
+    fos.fFlags = FOF_NO_UI | // Vista+-only
+                 FOF_SILENT |
+                 FOF_NOCONFIRMATION |
+                 FOF_NOERRORUI;
+
+    return SHFileOperation(&fos) == 0;
+}
+
+#endif // _WIN32
+
+
 // Check for insecure URLs
 inline bool CheckForInsecureURL(const std::string& url, const std::string& purpose)
 {
@@ -0,0 +1,249 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *  Copyright (C) 2007 Andy Matuschak
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "version.h"
+
+#include <cstdlib>
+
+namespace winsparkle
+{
+
+// Note: This code is based on Sparkle's SUStandardVersionComparator by
+//       Andy Matuschak.
+
+ParsedVersion::ParsedVersion(const std::string& version)
+    : m_version(version), m_count(0)
+{
+    const char *s = m_version.c_str();
+    const size_t len = m_version.length();
+
+    size_t i = 0;
+    while ( i < len )
+    {
+        Token t;
+        t.offset = unsigned(i);
+        t.number = 0;
+
+        const char c = s[i];
+        if ( c == '.' )
+        {
+            // Period gets special treatment, because "." always delimiters
+            // components in version strings (and so ".." means there's empty
+            // component value).
+            t.type = Token_Period;
+            i++;
+        }
+        else if ( c >= '0' && c <= '9' )
+        {
+            t.type = Token_Number;
+            t.number = atoi(s + i); // stops at the first non-digit
+            while ( i < len && s[i] >= '0' && s[i] <= '9' )
+                i++;
+        }
+        else
+        {
+            t.type = Token_String;
+            while ( i < len && s[i] != '.' && !(s[i] >= '0' && s[i] <= '9') )
+                i++;
+        }
+
+        t.length = unsigned(i - t.offset);
+        AddToken(t);
+    }
+}
+
+
+void ParsedVersion::AddToken(const Token& t)
+{
+    if ( m_count < INLINE_TOKENS )
+        m_inline[m_count] = t;
+    else
+        m_extra.push_back(t);
+    m_count++;
+}
+
+
+int ParsedVersion::Compare(const ParsedVersion& other) const
+{
+    // Compare common length of both version strings.
+    const size_t n = m_count < other.m_count ? m_count : other.m_count;
+    for ( size_t i = 0; i < n; i++ )
+    {
+        const Token& a = GetToken(i);
+        const Token& b = other.GetToken(i);
+
+        if ( a.type == b.type )
+        {
+            if ( a.type == Token_String )
+            {
+                int result = m_version.compare(a.offset, a.length,
+                                               other.m_version, b.offset, b.length);
+                if ( result != 0 )
+                    return result;
+            }
+            else if ( a.type == Token_Number )
+            {
+                if ( a.number > b.number )
+                    return 1;
+                else if ( a.number < b.number )
+                    return -1;
+            }
+        }
+        else // components of different types
+        {
+            if ( a.type != Token_String && b.type == Token_String )
+            {
+                // 1.2.0 > 1.2rc1
+                return 1;
+            }
+            else if ( a.type == Token_String && b.type != Token_String )
+            {
+                // 1.2rc1 < 1.2.0
+                return -1;
+            }
+            else
+            {
+                // One is a number and the other is a period. The period
+                // is invalid.
+                return (a.type == Token_Number) ? 1 : -1;
+            }
+        }
+    }
+
+    // The versions are equal up to the point where they both still have
+    // parts. Lets check to see if one is larger than the other.
+    if ( m_count == other.m_count )
+        return 0; // the two strings are identical
+
+    // Lets get the next part of the larger version string
+    // Note that 'n' already holds the index of the part we want.
+
+    int shorterResult, longerResult;
+    TokenType missingPartType; // ('missing' as in "missing in shorter version")
+
+    if ( m_count > other.m_count )
+    {
+        missingPartType = GetToken(n).type;
+        shorterResult = -1;
+        longerResult = 1;
+    }
+    else
+    {
+        missingPartType = other.GetToken(n).type;
+        shorterResult = 1;
+        longerResult = -1;
+    }
+
+    if ( missingPartType == Token_String )
+    {
+        // 1.5 > 1.5b3
+        return shorterResult;
+    }
+    else
+    {
+        // 1.5.1 > 1.5
+        return longerResult;
+    }
+}
+
+
+// Sort keys are sequences of tagged components terminated by Key_End. Tags
+// are ordered so that at any given position, string components sort before
+// end of the version, which sorts before periods and those before numbers --
+// exactly as Compare() orders components of different types.
+enum SortKeyTag
+{
+    Key_String         = 0x01, // string bytes (0x00 escaped), then 0x00 0x00
+    Key_End            = 0x02,
+    Key_Period         = 0x03,
+    Key_NegativeNumber = 0x04, // 4 big-endian bytes of number ^ 0x80000000
+    Key_Number         = 0x05  // length byte, then big-endian significant bytes
+};
+
+std::string ParsedVersion::GetSortKey() const
+{
+    std::string key;
+    key.reserve(m_count * 3 + 1);
+
+    for ( size_t i = 0; i < m_count; i++ )
+    {
+        const Token& t = GetToken(i);
+
+        switch ( t.type )
+        {
+            case Token_String:
+            {
+                key += char(Key_String);
+                for ( unsigned j = 0; j < t.length; j++ )
+                {
+                    const char c = m_version[t.offset + j];
+                    key += c;
+                    if ( c == 0 )
+                        key += char(0xFF);
+                }
+                key += char(0x00);
+                key += char(0x00);
+                break;
+            }
+
+            case Token_Period:
+                key += char(Key_Period);
+                break;
+
+            case Token_Number:
+            {
+                // Numbers don't normally get negative, but atoi() may
+                // produce one on overflow and Compare() would honor that.
+                const unsigned n = unsigned(t.number);
+                if ( t.number < 0 )
+                {
+                    const unsigned biased = n ^ 0x80000000u;
+                    key += char(Key_NegativeNumber);
+                    for ( int shift = 24; shift >= 0; shift -= 8 )
+                        key += char((biased >> shift) & 0xFF);
+                }
+                else
+                {
+                    // Longer encoding means larger number, so that small
+                    // numbers can be stored in a single byte.
+                    int len = 0;
+                    while ( len < 4 && (n >> (8 * len)) != 0 )
+                        len++;
+                    key += char(Key_Number);
+                    key += char(len);
+                    for ( int j = len - 1; j >= 0; j-- )
+                        key += char((n >> (8 * j)) & 0xFF);
+                }
+                break;
+            }
+        }
+    }
+
+    key += char(Key_End);
+    return key;
+}
+
+} // namespace winsparkle
@@ -0,0 +1,116 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *  Copyright (C) 2007 Andy Matuschak
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _version_h_
+#define _version_h_
+
+#include <string>
+#include <vector>
+
+namespace winsparkle
+{
+
+/**
+    Version string split into components, ready for fast comparisons.
+
+    A component is a continuous run of characters of the same kind: a number,
+    a period or a string fragment ("beta" etc.). For example, "1.20rc3" is
+    split into ["1",".","20","rc","3"].
+
+    The string is parsed only once, when the object is created. Components
+    are stored inline for all but unusually long version strings, so that
+    neither parsing nor comparing them allocates memory.
+ */
+class ParsedVersion
+{
+public:
+    /// Creates an empty version.
+    ParsedVersion() : m_count(0) {}
+
+    /// Parses version string @a version.
+    explicit ParsedVersion(const std::string& version);
+
+    /// Returns the original version string.
+    const std::string& GetString() const { return m_version; }
+
+    /**
+        Compares this version with @a other.
+
+        This implements the semantics of UpdateChecker::CompareVersions().
+
+        @return 0 if the versions are identical, negative value if this
+                version is smaller than @a other, positive value if it
+                is larger.
+     */
+    int Compare(const ParsedVersion& other) const;
+
+    /**
+        Returns order-preserving binary key for this version.
+
+        Comparing keys of two versions bytewise (as memcmp() or
+        std::string::compare() do) gives the same order as Compare() does,
+        including special cases such as "1.2rc1" < "1.2.0" or
+        "1.5" > "1.5b3". This makes the keys suitable for sorting, binary
+        searching or storing in caches.
+
+        Keys of typical versions such as "1.22.333" fit into 16 bytes.
+     */
+    std::string GetSortKey() const;
+
+private:
+    // Kinds of version string components.
+    enum TokenType
+    {
+        Token_Number,
+        Token_Period,
+        Token_String
+    };
+
+    struct Token
+    {
+        TokenType type;
+        unsigned  offset;   // position in m_version
+        unsigned  length;
+        int       number;   // numeric value of Token_Number
+    };
+
+    const Token& GetToken(size_t i) const
+        { return i < INLINE_TOKENS ? m_inline[i] : m_extra[i - INLINE_TOKENS]; }
+
+    void AddToken(const Token& t);
+
+    // enough for anything like "1.22.333.4444beta5"
+    static const size_t INLINE_TOKENS = 16;
+
+    std::string        m_version;
+    size_t             m_count;
+    Token              m_inline[INLINE_TOKENS];
+    std::vector<Token> m_extra; // only used for more than INLINE_TOKENS tokens
+};
+
+} // namespace winsparkle
+
+#endif // _version_h_
@@ -0,0 +1,430 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "httptransport.h"
+
+#include "error.h"
+#include "threads.h"
+#include "utils.h"
+
+#include <string>
+#include <vector>
+#include <string.h>
+#include <windows.h>
+#include <wininet.h>
+
+#ifndef INTERNET_OPTION_ENABLE_HTTP_PROTOCOL
+    #define INTERNET_OPTION_ENABLE_HTTP_PROTOCOL 148
+#endif
+#ifndef HTTP_PROTOCOL_FLAG_HTTP2
+    #define HTTP_PROTOCOL_FLAG_HTTP2 0x2
+#endif
+#ifndef INTERNET_OPTION_HTTP_DECODING
+	#define INTERNET_OPTION_HTTP_DECODING 65
+#endif
+
+
+namespace winsparkle
+{
+
+/*--------------------------------------------------------------------------*
+                                helpers
+ *--------------------------------------------------------------------------*/
+
+namespace
+{
+
+struct InetHandle
+{
+    InetHandle(HINTERNET handle = 0) : m_handle(handle) {}
+
+    ~InetHandle()
+    {
+        Close();
+    }
+
+    InetHandle& operator=(HINTERNET handle)
+    {
+        Close();
+        m_handle = handle;
+        return *this;
+    }
+
+    void Close()
+    {
+        if (m_handle)
+        {
+            InternetCloseHandle(m_handle);
+            m_handle = NULL;
+        }
+    }
+
+    operator HINTERNET() const { return m_handle; }
+
+    HINTERNET m_handle;
+};
+
+
+bool GetHttpHeader(HINTERNET handle, DWORD whatToGet, DWORD& output)
+{
+    DWORD outputSize = sizeof(output);
+    DWORD headerIndex = 0;
+    return HttpQueryInfoA
+           (
+               handle,
+               whatToGet | HTTP_QUERY_FLAG_NUMBER,
+               &output,
+               &outputSize,
+               &headerIndex
+           ) == TRUE;
+}
+
+
+bool GetCustomHttpHeader(HINTERNET handle, const char *name, std::string& output)
+{
+    // HTTP_QUERY_CUSTOM takes the header's name in the output buffer
+    std::vector<char> buffer(strlen(name) + 256);
+    for ( ;; )
+    {
+        strcpy(&buffer[0], name);
+        DWORD outputSize = (DWORD)buffer.size();
+        DWORD headerIndex = 0;
+        if ( HttpQueryInfoA(handle, HTTP_QUERY_CUSTOM, &buffer[0], &outputSize, &headerIndex) )
+        {
+            output.assign(&buffer[0], outputSize);
+            return true;
+        }
+
+        if ( GetLastError() != ERROR_INSUFFICIENT_BUFFER )
+            return false;
+        buffer.resize(outputSize + 1);
+    }
+}
+
+
+struct DownloadCallbackContext
+{
+    DownloadCallbackContext(InetHandle *conn_) : conn(conn_), lastError(ERROR_SUCCESS) {}
+    InetHandle *conn;
+    DWORD lastError;
+    Event eventRequestComplete;
+};
+
+void CALLBACK DownloadInternetStatusCallback(_In_ HINTERNET hInternet,
+                                             _In_ DWORD_PTR dwContext,
+                                             _In_ DWORD     dwInternetStatus,
+                                             _In_ LPVOID    lpvStatusInformation,
+                                             _In_ DWORD     dwStatusInformationLength)
+{
+    DownloadCallbackContext *context = (DownloadCallbackContext*)dwContext;
+    INTERNET_ASYNC_RESULT *res = (INTERNET_ASYNC_RESULT*)lpvStatusInformation;
+
+    switch (dwInternetStatus)
+    {
+        case INTERNET_STATUS_HANDLE_CREATED:
+            context->conn->m_handle = (HINTERNET)(res->dwResult);
+            break;
+
+        case INTERNET_STATUS_REQUEST_COMPLETE:
+            context->lastError = res->dwError;
+            context->eventRequestComplete.Signal();
+            break;
+    }
+}
+
+void WaitUntilSignaledWithTerminationCheck(Event& event, Thread *thread)
+{
+    for (;;)
+    {
+        if (thread)
+            thread->CheckShouldTerminate();
+        if (event.WaitUntilSignaled(100))
+            return;
+    }
+}
+
+
+DWORD GetRequestFlags(const HttpRequestParams& request)
+{
+    // Never allow local caching, always contact the server for both
+    // appcast feeds and downloads. This is useful in case of
+    // misconfigured servers.
+    DWORD dwFlags = INTERNET_FLAG_NO_CACHE_WRITE | INTERNET_FLAG_RELOAD;
+    // For some requests (appcast feeds), don't even allow proxies to cache,
+    // as we need the most up-to-date information.
+    if ( request.BypassProxies )
+        dwFlags |= INTERNET_FLAG_PRAGMA_NOCACHE;
+    if ( request.URL.compare(0, 8, "https://") == 0 )
+        dwFlags |= INTERNET_FLAG_SECURE;
+    return dwFlags;
+}
+
+
+// WinINet session, shared by the transport and all requests made with it.
+//
+// Closing the session handle cancels requests that use it, so it is
+// reference-counted and only closed when the transport closed it and no
+// request that uses it is left.
+class WinINetSession
+{
+public:
+    // Opens the session, with one reference.
+    WinINetSession() : m_refCount(1)
+    {
+        m_handle = InternetOpen
+                   (
+                       GetHttpUserAgent().c_str(),
+                       INTERNET_OPEN_TYPE_PRECONFIG,
+                       NULL, // lpszProxyName
+                       NULL, // lpszProxyBypass
+                       INTERNET_FLAG_ASYNC // dwFlags
+                   );
+        if ( !m_handle )
+            throw DownloadException();
+
+        DWORD dwOption = HTTP_PROTOCOL_FLAG_HTTP2;
+        InternetSetOptionW(m_handle, INTERNET_OPTION_ENABLE_HTTP_PROTOCOL, &dwOption, sizeof(dwOption));
+
+        InternetSetStatusCallback(m_handle, &DownloadInternetStatusCallback);
+    }
+
+    HINTERNET GetHandle() const { return m_handle; }
+
+    void AddRef() { InterlockedIncrement(&m_refCount); }
+
+    // Releases a reference; the session is closed when there are none left.
+    void Release()
+    {
+        if ( InterlockedDecrement(&m_refCount) == 0 )
+            delete this;
+    }
+
+private:
+    ~WinINetSession()
+    {
+        InternetSetStatusCallback(m_handle, NULL);
+        InternetCloseHandle(m_handle);
+    }
+
+    WinINetSession(const WinINetSession&);
+    WinINetSession& operator=(const WinINetSession&);
+
+    HINTERNET m_handle;
+    volatile LONG m_refCount;
+};
+
+
+// A single HTTP request, performed in WinINet's async mode.
+class WinINetResponse : public IHttpResponse
+{
+public:
+    // Takes ownership of a reference to @a session.
+    WinINetResponse(WinINetSession *session, Thread *onThread)
+        : m_session(session), m_context(&m_conn), m_thread(onThread), m_timeToHeaders(0)
+    {}
+
+    ~WinINetResponse()
+    {
+        // the request must be closed before its session
+        m_conn.Close();
+        m_session->Release();
+    }
+
+    // Sends the request and waits for the response's headers.
+    void Open(const HttpRequestParams& request)
+    {
+        std::string headers = request.Headers + GetHttpRangeHeader(request);
+        if ( request.AcceptEncoding && IsWindowsVistaOrGreater() )
+            headers += "Accept-Encoding: gzip, deflate\r\n";
+
+        const ULONGLONG start = GetTickCount64();
+
+        HINTERNET conn_raw = InternetOpenUrlA
+                             (
+                                 m_session->GetHandle(),
+                                 request.URL.c_str(),
+                                 headers.c_str(),
+                                 (DWORD)headers.length(),
+                                 GetRequestFlags(request),
+                                 (DWORD_PTR)&m_context  // dwContext
+                             );
+        // InternetOpenUrl() may return NULL handle and then fill it in asynchronously from
+        // DownloadInternetStatusCallback. We must make sure we don't overwrite the handle
+        // in that case, or throw an error.
+        if (conn_raw)
+        {
+            m_conn = conn_raw;
+        }
+        else
+        {
+            if (GetLastError() != ERROR_IO_PENDING)
+                throw DownloadException();
+        }
+
+        WaitUntilSignaledWithTerminationCheck(m_context.eventRequestComplete, m_thread);
+
+        m_timeToHeaders = (unsigned)(GetTickCount64() - start);
+
+        // Decoding is enabled per request, because ranges of the same
+        // session's other requests must not be decoded; it only needs to be
+        // enabled before reading the body.
+        if ( request.AcceptEncoding && IsWindowsVistaOrGreater() )
+        {
+            DWORD dwEnableHttpDecoding = TRUE;
+            InternetSetOptionW(m_conn, INTERNET_OPTION_HTTP_DECODING, &dwEnableHttpDecoding, sizeof(dwEnableHttpDecoding));
+        }
+    }
+
+    virtual unsigned GetStatusCode() const
+    {
+        DWORD statusCode;
+        if ( !GetHttpHeader(m_conn, HTTP_QUERY_STATUS_CODE, statusCode) )
+            return 0;
+        return statusCode;
+    }
+
+    virtual bool GetHeader(const char *name, std::string& value) const
+    {
+        return GetCustomHttpHeader(m_conn, name, value);
+    }
+
+    virtual std::string GetURL() const
+    {
+        DWORD ousize = 0;
+        InternetQueryOptionA(m_conn, INTERNET_OPTION_URL, NULL, &ousize);
+        if ( GetLastError() != ERROR_INSUFFICIENT_BUFFER )
+            return std::string();
+
+        DataBuffer<char> optionurl(ousize);
+        if ( !InternetQueryOptionA(m_conn, INTERNET_OPTION_URL, optionurl, &ousize) )
+            return std::string();
+        return std::string(optionurl);
+    }
+
+    virtual unsigned GetTimeToHeaders() const { return m_timeToHeaders; }
+
+    virtual size_t Read(void *buffer, size_t size)
+    {
+        for ( ;; )
+        {
+            INTERNET_BUFFERS ibuf = { 0 };
+            ibuf.dwStructSize = sizeof(ibuf);
+            ibuf.lpvBuffer = buffer;
+            ibuf.dwBufferLength = (DWORD)size;
+
+            if (!InternetReadFileEx(m_conn, &ibuf, IRF_ASYNC | IRF_NO_WAIT, NULL))
+            {
+                if (GetLastError() != ERROR_IO_PENDING)
+                    throw DownloadException();
+
+                WaitUntilSignaledWithTerminationCheck(m_context.eventRequestComplete, m_thread);
+                continue;
+            }
+
+            if (ibuf.dwBufferLength == 0 && m_context.lastError != ERROR_SUCCESS)
+                throw DownloadException();
+
+            return ibuf.dwBufferLength;
+        }
+    }
+
+private:
+    WinINetResponse(const WinINetResponse&);
+    WinINetResponse& operator=(const WinINetResponse&);
+
+    WinINetSession *m_session;
+    InetHandle m_conn;
+    DownloadCallbackContext m_context;
+    Thread *m_thread;
+    unsigned m_timeToHeaders;
+};
+
+
+// Transport using single WinINet session for all requests.
+//
+// Keep-alive connections and TLS sessions are only reused within the same
+// session, so using a single one saves connection setup when the server is
+// contacted repeatedly, e.g. for the server version, the appcast and then
+// the update itself.
+class WinINetTransport : public IHttpTransport
+{
+public:
+    WinINetTransport() : m_session(NULL) {}
+
+    virtual IHttpResponse *Send(const HttpRequestParams& request, Thread *onThread)
+    {
+        WinINetResponse *response = new WinINetResponse(GetSession(), onThread);
+        try
+        {
+            response->Open(request);
+        }
+        catch ( ... )
+        {
+            delete response;
+            throw;
+        }
+        return response;
+    }
+
+    virtual void Close()
+    {
+        WinINetSession *session;
+        {
+            CriticalSectionLocker lock(m_cs);
+            session = m_session;
+            m_session = NULL;
+        }
+
+        // running requests keep the session open until they finish
+        if ( session )
+            session->Release();
+    }
+
+private:
+    // Returns the session with a reference added for the caller.
+    WinINetSession *GetSession()
+    {
+        CriticalSectionLocker lock(m_cs);
+
+        if ( !m_session )
+            m_session = new WinINetSession;
+
+        m_session->AddRef();
+        return m_session;
+    }
+
+    CriticalSection m_cs;
+    WinINetSession *m_session;  // holds one reference
+};
+
+} // anonymous namespace
+
+
+IHttpTransport *CreateWinINetTransport()
+{
+    return new WinINetTransport;
+}
+
+} // namespace winsparkle
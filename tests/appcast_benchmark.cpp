@@ -0,0 +1,196 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+// Benchmarks of appcast parsing: of synthetic feeds of 10 to 100k items, which
+// is dominated by dispatching on element and attribute names, and of
+// pathological feeds with heavy entity use, which make expat report text in
+// many tiny pieces. Heap allocations made per parsed item are counted too.
+
+#include "appcast.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+using namespace winsparkle;
+
+namespace
+{
+
+// Number of allocations done with operator new so far. Expat's own buffers
+// are allocated with malloc() and aren't counted, but they are per parser,
+// not per item.
+std::atomic<unsigned long long> g_allocations(0);
+
+} // anonymous namespace
+
+void *operator new(std::size_t size)
+{
+    g_allocations++;
+    if ( void *p = malloc(size ? size : 1) )
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+namespace
+{
+
+std::string MakeFeed(int items)
+{
+    std::string feed =
+        "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+        "<rss version=\"2.0\" xmlns:sparkle=\"http://www.andymatuschak.org/xml-namespaces/sparkle\""
+        " xmlns:dc=\"http://purl.org/dc/elements/1.1/\">\n"
+        "<channel>\n"
+        "<title>Benchmark</title>\n"
+        "<link>https://example.com/</link>\n";
+
+    char buf[1024];
+    for ( int i = 0; i < items; i++ )
+    {
+        // includes unknown elements and attributes, as real feeds do
+        snprintf(buf, sizeof(buf),
+            "<item>\n"
+            "<title>Version 1.%d</title>\n"
+            "<pubDate>Mon, 01 Jan 2024 00:00:00 +0000</pubDate>\n"
+            "<dc:creator>Someone</dc:creator>\n"
+            "<sparkle:releaseNotesLink>https://example.com/notes/1.%d.html</sparkle:releaseNotesLink>\n"
+            "<sparkle:minimumSystemVersion>6.1</sparkle:minimumSystemVersion>\n"
+            "<enclosure url=\"https://example.com/app-1.%d.exe\" length=\"%d\" type=\"application/octet-stream\""
+            " sparkle:version=\"1.%d\" sparkle:shortVersionString=\"1.%d\" sparkle:os=\"windows\""
+            " sparkle:dsaSignature=\"MC0CFQCv5Yf2LJd2uZUkQ0dO4bxSigna\"/>\n"
+            "<sparkle:deltas>\n"
+            "<enclosure url=\"1.%d-from-1.%d.delta\" sparkle:version=\"1.%d\" sparkle:deltaFrom=\"1.%d\""
+            " length=\"1000\" sparkle:dsaSignature=\"MC0CFQDelta\"/>\n"
+            "</sparkle:deltas>\n"
+            "</item>\n",
+            i, i, i, 1000000 + i, i, i, i, i - 1, i, i - 1);
+        feed += buf;
+    }
+
+    feed += "</channel>\n</rss>\n";
+    return feed;
+}
+
+
+std::string MakeEntitiesFeed(int entities)
+{
+    std::string text;
+    for ( int i = 0; i < entities; i++ )
+        text += (i % 2) ? "&amp;" : "&#x20;";
+
+    return
+        "<rss xmlns:sparkle=\"http://www.andymatuschak.org/xml-namespaces/sparkle\"><channel><item>"
+        "<sparkle:version>1.0</sparkle:version>"
+        "<title>" + text + "</title>"
+        "<description>" + text + "</description>"
+        "<sparkle:releaseNotesLink>" + text + "x</sparkle:releaseNotesLink>"
+        "<link>" + text + "x</link>"
+        "</item></channel></rss>";
+}
+
+
+// Parses the feed repeat times in chunks of the given size, returns time of
+// one parse in ms or -1 if it didn't find expected number of items. Number
+// of allocations per parsed item is stored in allocsPerItem.
+double Parse(const std::string& feed, size_t chunkSize, int repeat, size_t expectedItems,
+             double& allocsPerItem)
+{
+    size_t parsed = 0;
+
+    const unsigned long long allocations = g_allocations;
+    const auto start = std::chrono::steady_clock::now();
+    for ( int r = 0; r < repeat; r++ )
+    {
+        AppcastDownloadSink sink;
+        for ( size_t pos = 0; pos < feed.size(); pos += chunkSize )
+            sink.Add(feed.data() + pos, std::min(chunkSize, feed.size() - pos));
+        parsed += sink.Finish().size();
+    }
+    const double ms = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - start).count();
+    allocsPerItem = double(g_allocations - allocations) / (expectedItems * repeat);
+
+    if ( parsed != expectedItems * repeat )
+    {
+        fprintf(stderr, "parsed %u items instead of %u\n",
+                (unsigned)parsed, (unsigned)(expectedItems * repeat));
+        return -1;
+    }
+
+    return ms / repeat;
+}
+
+} // anonymous namespace
+
+
+int main()
+{
+    printf("%8s %12s %10s %10s %12s\n", "items", "bytes", "ms", "MB/s", "allocs/item");
+
+    for ( int items = 10; items <= 100000; items *= 10 )
+    {
+        const std::string feed = MakeFeed(items);
+
+        // parse small feeds repeatedly to get measurable times
+        double allocsPerItem;
+        const double ms = Parse(feed, 16384, 100000 / items, items, allocsPerItem);
+        if ( ms < 0 )
+            return 1;
+
+        printf("%8d %12u %10.3f %10.1f %12.1f\n",
+               items, (unsigned)feed.size(), ms,
+               (double)feed.size() / (1024 * 1024) / (ms / 1000),
+               allocsPerItem);
+    }
+
+    // time per entity must stay the same as their number grows
+    printf("\n%8s %12s %10s %10s\n", "entities", "bytes", "ms", "ns/entity");
+
+    for ( int entities = 1000; entities <= 1000000; entities *= 10 )
+    {
+        const std::string feed = MakeEntitiesFeed(entities);
+
+        double allocsPerItem;
+        const double ms = Parse(feed, 1024, 1000000 / entities, 1, allocsPerItem);
+        if ( ms < 0 )
+            return 1;
+
+        printf("%8d %12u %10.3f %10.1f\n",
+               entities, (unsigned)feed.size(), ms, ms * 1e6 / (4.0 * entities));
+    }
+
+    return 0;
+}
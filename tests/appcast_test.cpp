@@ -0,0 +1,397 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+// Tests of AppcastDownloadSink, which parses the appcast as it's downloaded,
+// and of filtering its items for the current OS and architecture.
+
+#include "appcast.h"
+#include "test.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+using namespace winsparkle;
+
+namespace
+{
+
+// The feed uses everything the parser understands, with long names, entities
+// and CDATA sections, so that chunk boundaries fall everywhere in them.
+const char FEED[] =
+    "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+    "<rss version=\"2.0\" xmlns:sparkle=\"http://www.andymatuschak.org/xml-namespaces/sparkle\">\n"
+    "  <channel>\n"
+    "    <title>Test &amp; Co. Changelog</title>\n"
+    "    <item>\n"
+    "      <title>Version 2.0 &lt;beta&gt;</title>\n"
+    "      <description><![CDATA[<ul><li>New &amp; improved</li></ul>]]> and more</description>\n"
+    "      <sparkle:releaseNotesLink>\n"
+    "        https://example.com/notes/2.0.html\n"
+    "      </sparkle:releaseNotesLink>\n"
+    "      <sparkle:minimumSystemVersion>6.1</sparkle:minimumSystemVersion>\n"
+    "      <sparkle:criticalUpdate/>\n"
+    "      <enclosure url=\"https://example.com/app-2.0.exe\" length=\"123456789\"\n"
+    "                 sparkle:version=\"2.0.1234\" sparkle:shortVersionString=\"2.0\"\n"
+    "                 sparkle:dsaSignature=\"MC0CFQCv+sig==\" sparkle:os=\"windows\"\n"
+    "                 sparkle:installerArguments=\"/S /D=&quot;x&quot;\"\n"
+    "                 sparkle:chunkIndex=\"app-2.0.exe.chunks\" type=\"application/octet-stream\"/>\n"
+    "      <sparkle:deltas>\n"
+    "        <enclosure url=\"2.0-from-1.9.delta\" sparkle:version=\"2.0.1234\" sparkle:deltaFrom=\"1.9\"\n"
+    "                   length=\"1485\" sparkle:dsaSignature=\"MCwCFdelta==\"/>\n"
+    "      </sparkle:deltas>\n"
+    "    </item>\n"
+    "    <item>\n"
+    "      <title>Version 1.9</title>\n"
+    "      <sparkle:version>1.9</sparkle:version>\n"
+    "      <sparkle:minimumServerVersion>3.1</sparkle:minimumServerVersion>\n"
+    "      <sparkle:dsaSignature>legacy-signature</sparkle:dsaSignature>\n"
+    "      <link> https://example.com/download </link>\n"
+    "      <description><![CDATA[]]></description>\n"
+    "    </item>\n"
+    "  </channel>\n"
+    // nothing after </channel> may be parsed, this isn't even well-formed:
+    "  <garbage attr='</channel>' & more <<";
+
+size_t FeedLength()
+{
+    return sizeof(FEED) - 1;
+}
+
+
+std::vector<Appcast> ParseInChunks(size_t chunkSize, bool& completeEarly)
+{
+    AppcastDownloadSink sink;
+    completeEarly = false;
+
+    const size_t end = FeedLength();
+    for ( size_t pos = 0; pos < end; pos += chunkSize )
+    {
+        if ( sink.IsComplete() )
+        {
+            completeEarly = true;
+            break;
+        }
+        sink.Add(FEED + pos, std::min(chunkSize, end - pos));
+    }
+
+    return sink.Finish();
+}
+
+
+bool SameEnclosure(const Appcast::Enclosure& a, const Appcast::Enclosure& b)
+{
+    return a.DownloadURL == b.DownloadURL &&
+           a.DsaSignature == b.DsaSignature &&
+           a.OS == b.OS &&
+           a.InstallerArguments == b.InstallerArguments &&
+           a.Length == b.Length &&
+           a.DeltaFrom == b.DeltaFrom &&
+           a.ChunkIndexURL == b.ChunkIndexURL;
+}
+
+bool SameItem(const Appcast& a, const Appcast& b)
+{
+    if ( a.Deltas.size() != b.Deltas.size() )
+        return false;
+    for ( size_t i = 0; i < a.Deltas.size(); i++ )
+    {
+        if ( !SameEnclosure(a.Deltas[i], b.Deltas[i]) )
+            return false;
+    }
+
+    return a.Version == b.Version &&
+           a.ShortVersionString == b.ShortVersionString &&
+           a.ReleaseNotesURL == b.ReleaseNotesURL &&
+           a.WebBrowserURL == b.WebBrowserURL &&
+           a.Title == b.Title &&
+           a.Description == b.Description &&
+           a.MinOSVersion == b.MinOSVersion &&
+           a.MinServerVersion == b.MinServerVersion &&
+           a.CriticalUpdate == b.CriticalUpdate &&
+           SameEnclosure(a.enclosure, b.enclosure);
+}
+
+
+void TestWholeFeed()
+{
+    bool completeEarly;
+    const std::vector<Appcast> items = ParseInChunks(FeedLength(), completeEarly);
+
+    CHECK_EQUAL(items.size(), 2u);
+    if ( items.size() != 2 )
+        return;
+
+    const Appcast& a = items[0];
+    CHECK_EQUAL(a.Title, "Version 2.0 <beta>");
+    CHECK_EQUAL(a.Description, "<ul><li>New &amp; improved</li></ul> and more");
+    CHECK_EQUAL(a.ReleaseNotesURL, "https://example.com/notes/2.0.html");
+    CHECK_EQUAL(a.MinOSVersion, "6.1");
+    CHECK(a.CriticalUpdate);
+    CHECK_EQUAL(a.Version, "2.0.1234");
+    CHECK_EQUAL(a.ShortVersionString, "2.0");
+    CHECK_EQUAL(a.enclosure.DownloadURL, "https://example.com/app-2.0.exe");
+    CHECK_EQUAL(a.enclosure.Length, 123456789u);
+    CHECK_EQUAL(a.enclosure.DsaSignature, "MC0CFQCv+sig==");
+    CHECK_EQUAL(a.enclosure.OS, "windows");
+    CHECK_EQUAL(a.enclosure.InstallerArguments, "/S /D=\"x\"");
+    CHECK_EQUAL(a.enclosure.ChunkIndexURL, "app-2.0.exe.chunks");
+    CHECK_EQUAL(a.Deltas.size(), 1u);
+    if ( a.Deltas.size() == 1 )
+    {
+        CHECK_EQUAL(a.Deltas[0].DownloadURL, "2.0-from-1.9.delta");
+        CHECK_EQUAL(a.Deltas[0].DeltaFrom, "1.9");
+        CHECK_EQUAL(a.Deltas[0].Length, 1485u);
+        CHECK_EQUAL(a.Deltas[0].DsaSignature, "MCwCFdelta==");
+    }
+
+    const Appcast& b = items[1];
+    CHECK_EQUAL(b.Title, "Version 1.9");
+    CHECK_EQUAL(b.Version, "1.9");
+    CHECK_EQUAL(b.MinServerVersion, "3.1");
+    CHECK_EQUAL(b.WebBrowserURL, "https://example.com/download");
+    CHECK_EQUAL(b.Description, "");
+    CHECK(!b.CriticalUpdate);
+    CHECK(b.Deltas.empty());
+}
+
+
+// Every chunk size puts the chunk boundaries into different places, e.g. in
+// the middle of element and attribute names, entities and CDATA sections.
+void TestAllChunkSizes()
+{
+    bool completeEarly;
+    const std::vector<Appcast> expected = ParseInChunks(FeedLength(), completeEarly);
+
+    for ( size_t chunkSize = 1; chunkSize <= FeedLength(); chunkSize++ )
+    {
+        const std::vector<Appcast> items = ParseInChunks(chunkSize, completeEarly);
+
+        bool same = items.size() == expected.size();
+        for ( size_t i = 0; same && i < items.size(); i++ )
+            same = SameItem(items[i], expected[i]);
+
+        if ( !same )
+        {
+            std::ostringstream s;
+            s << "items parsed in chunks of " << chunkSize << " bytes";
+            winsparkle::test::ReportFailure(__FILE__, __LINE__, s.str());
+        }
+    }
+}
+
+
+// The transfer can stop once </channel> is parsed and whatever follows it is
+// never parsed. Note that expat may defer a token split across chunks until
+// more data arrives, so the stop isn't always right after </channel>.
+void TestStopsAfterChannel()
+{
+    const std::string feed(FEED);
+
+    for ( size_t chunkSize = 1; chunkSize <= 64; chunkSize++ )
+    {
+        AppcastDownloadSink sink;
+        size_t pos = 0;
+        while ( !sink.IsComplete() && pos < feed.length() )
+        {
+            const size_t len = std::min(chunkSize, feed.length() - pos);
+            sink.Add(feed.data() + pos, len);
+            pos += len;
+        }
+
+        // anything that still arrives is ignored
+        sink.Add(feed.data(), feed.length());
+        CHECK_EQUAL(sink.Finish().size(), 2u);
+        CHECK(sink.IsComplete());
+    }
+
+    // with all data available, nothing after </channel> is needed
+    AppcastDownloadSink sink;
+    sink.Add(feed.data(), feed.find("</channel>") + strlen("</channel>"));
+    CHECK(sink.IsComplete());
+}
+
+
+// Expat reports every entity and every chunk as a separate piece of text;
+// all of them must end up in the value, trimmed only once at its end.
+void TestEntityHeavyText()
+{
+    std::string url, notes, expectedNotes;
+    for ( int i = 0; i < 2000; i++ )
+    {
+        url += "a&amp;";
+        notes += "&lt;p&gt; &#x20;";
+        expectedNotes += "<p>  ";
+    }
+    expectedNotes.erase(expectedNotes.length() - 2);
+
+    const std::string feed =
+        "<rss xmlns:sparkle=\"http://www.andymatuschak.org/xml-namespaces/sparkle\"><channel><item>"
+        "<sparkle:version>1.0</sparkle:version>"
+        "<sparkle:releaseNotesLink> &#10;" + url + "&#32; </sparkle:releaseNotesLink>"
+        "<link>" + notes + "</link>"
+        "<description>" + notes + "</description>"
+        "</item></channel></rss>";
+
+    std::string expectedURL;
+    for ( int i = 0; i < 2000; i++ )
+        expectedURL += "a&";
+
+    for ( size_t chunkSize = 1; chunkSize <= 1024; chunkSize *= 4 )
+    {
+        AppcastDownloadSink sink;
+        for ( size_t pos = 0; pos < feed.length(); pos += chunkSize )
+            sink.Add(feed.data() + pos, std::min(chunkSize, feed.length() - pos));
+
+        const std::vector<Appcast> items = sink.Finish();
+        CHECK_EQUAL(items.size(), 1u);
+        if ( items.size() != 1 )
+            continue;
+
+        CHECK(items[0].ReleaseNotesURL == expectedURL);
+        CHECK(items[0].WebBrowserURL == expectedNotes);
+        // description isn't trimmed
+        CHECK(items[0].Description == expectedNotes + "  ");
+    }
+}
+
+
+void TestTruncatedFeed()
+{
+    const std::string feed(FEED);
+    const size_t truncated = feed.find("<item>", feed.find("<item>") + 1);
+
+    AppcastDownloadSink sink;
+    sink.Add(feed.data(), truncated);
+    CHECK(!sink.IsComplete());
+    CHECK_THROWS(sink.Finish(), std::runtime_error);
+}
+
+
+// OS markers of the current architecture and of another one, see appcast.cpp
+#ifdef _WIN64
+  #if defined(__AARCH64EL__) || defined(_M_ARM64)
+    #define OS_ARCH       "windows-arm64"
+    #define OS_OTHER_ARCH "windows-x64"
+  #else
+    #define OS_ARCH       "windows-x64"
+    #define OS_OTHER_ARCH "windows-arm64"
+  #endif
+#else
+    #define OS_ARCH       "windows-x86"
+    #define OS_OTHER_ARCH "windows-x64"
+#endif
+
+void TestOSFiltering()
+{
+    const std::string feed =
+        "<rss xmlns:sparkle=\"http://www.andymatuschak.org/xml-namespaces/sparkle\"><channel>\n"
+        // the enclosure for this architecture is preferred to any other...
+        "<item><title>Arch</title><sparkle:version>2.0</sparkle:version>\n"
+        "  <enclosure url=\"https://example.com/other\" sparkle:os=\"" OS_OTHER_ARCH "\"/>\n"
+        "  <enclosure url=\"https://example.com/any\"/>\n"
+        "  <enclosure url=\"https://example.com/generic\" sparkle:os=\"windows\"/>\n"
+        "  <enclosure url=\"https://example.com/arch\" sparkle:os=\"" OS_ARCH "\"/>\n"
+        "</item>\n"
+        // ...then the one for any Windows, to one without OS
+        "<item><title>Generic</title><sparkle:version>2.0</sparkle:version>\n"
+        "  <enclosure url=\"https://example.com/any\"/>\n"
+        "  <enclosure url=\"https://example.com/other\" sparkle:os=\"" OS_OTHER_ARCH "\"/>\n"
+        "  <enclosure url=\"https://example.com/generic\" sparkle:os=\"windows\"/>\n"
+        "</item>\n"
+        "<item><title>Any</title><sparkle:version>2.0</sparkle:version>\n"
+        "  <enclosure url=\"https://example.com/other\" sparkle:os=\"" OS_OTHER_ARCH "\"/>\n"
+        "  <enclosure url=\"https://example.com/any\"/>\n"
+        "</item>\n"
+        // items without a compatible enclosure are skipped
+        "<item><title>Other arch</title><sparkle:version>2.0</sparkle:version>\n"
+        "  <enclosure url=\"https://example.com/other\" sparkle:os=\"" OS_OTHER_ARCH "\"/>\n"
+        "</item>\n"
+        "<item><title>macOS</title><sparkle:version>2.0</sparkle:version>\n"
+        "  <enclosure url=\"https://example.com/mac\" sparkle:os=\"macos\"/>\n"
+        "</item>\n"
+        // so are items for a newer Windows version
+        "<item><title>Future</title><sparkle:version>2.0</sparkle:version>\n"
+        "  <sparkle:minimumSystemVersion>99.0</sparkle:minimumSystemVersion>\n"
+        "  <enclosure url=\"https://example.com/generic\" sparkle:os=\"windows\"/>\n"
+        "</item>\n"
+        // and incompatible deltas
+        "<item><title>Deltas</title><sparkle:version>2.0</sparkle:version>\n"
+        "  <enclosure url=\"https://example.com/generic\" sparkle:os=\"windows\"/>\n"
+        "  <sparkle:deltas>\n"
+        "    <enclosure url=\"https://example.com/d1\" sparkle:deltaFrom=\"1.1\" sparkle:os=\"" OS_OTHER_ARCH "\"/>\n"
+        "    <enclosure url=\"https://example.com/d2\" sparkle:deltaFrom=\"1.2\"/>\n"
+        "    <enclosure url=\"https://example.com/d3\" sparkle:deltaFrom=\"1.3\" sparkle:os=\"macos\"/>\n"
+        "    <enclosure url=\"https://example.com/d4\" sparkle:deltaFrom=\"1.4\" sparkle:os=\"" OS_ARCH "\"/>\n"
+        "  </sparkle:deltas>\n"
+        "</item>\n"
+        "</channel></rss>\n";
+
+    const std::vector<Appcast> items = Appcast::Load(feed);
+    CHECK_EQUAL(items.size(), 4u);
+    if ( items.size() != 4 )
+        return;
+
+    CHECK_EQUAL(items[0].Title, "Arch");
+    CHECK_EQUAL(items[0].enclosure.DownloadURL, "https://example.com/arch");
+    CHECK_EQUAL(items[1].Title, "Generic");
+    CHECK_EQUAL(items[1].enclosure.DownloadURL, "https://example.com/generic");
+    CHECK_EQUAL(items[2].Title, "Any");
+    CHECK_EQUAL(items[2].enclosure.DownloadURL, "https://example.com/any");
+
+    CHECK_EQUAL(items[3].Title, "Deltas");
+    CHECK_EQUAL(items[3].Deltas.size(), 2u);
+    if ( items[3].Deltas.size() == 2 )
+    {
+        CHECK_EQUAL(items[3].Deltas[0].DeltaFrom, "1.2");
+        CHECK_EQUAL(items[3].Deltas[1].DeltaFrom, "1.4");
+    }
+}
+
+
+void TestMalformedFeed()
+{
+    const char feed[] = "<rss><channel><item></channel></item></rss>";
+
+    AppcastDownloadSink sink;
+    CHECK_THROWS(sink.Add(feed, sizeof(feed) - 1), std::runtime_error);
+}
+
+} // anonymous namespace
+
+
+int main()
+{
+    TestWholeFeed();
+    TestAllChunkSizes();
+    TestStopsAfterChannel();
+    TestEntityHeavyText();
+    TestTruncatedFeed();
+    TestOSFiltering();
+    TestMalformedFeed();
+
+    return TestResult();
+}
@@ -0,0 +1,333 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// Tests of the appcast cache's file: the stored result is loaded back intact,
+// and damaged files are rejected.
+
+#include "appcastcache.h"
+#include "settings.h"
+#include "test.h"
+
+#include <windows.h>
+
+#include <cstdio>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+using namespace winsparkle;
+
+namespace
+{
+
+const char FEED_URL[] = "https://example.com/appcast.xml";
+const char INSTALLED_VERSION[] = "1.0";
+
+// Configuration kept in memory, so that the tests don't leave anything in
+// the registry.
+std::map<std::string, std::wstring> g_config;
+
+int __cdecl ConfigRead(const char *name, wchar_t *buf, size_t len, void *)
+{
+    std::map<std::string, std::wstring>::const_iterator i = g_config.find(name);
+    if ( i == g_config.end() || i->second.length() >= len )
+        return FALSE;
+    wcscpy(buf, i->second.c_str());
+    return TRUE;
+}
+
+void __cdecl ConfigWrite(const char *name, const wchar_t *value, void *)
+{
+    g_config[name] = value;
+}
+
+void __cdecl ConfigDelete(const char *name, void *)
+{
+    g_config.erase(name);
+}
+
+
+Appcast::Enclosure MakeEnclosure(const std::string& name)
+{
+    Appcast::Enclosure e;
+    e.DownloadURL = "https://example.com/" + name;
+    e.DsaSignature = "MC0CFQCv+" + name + "==";
+    e.OS = "windows-x64";
+    e.InstallerArguments = "/S /D=\"x\"";
+    e.Length = 123456789;
+    e.ChunkIndexURL = name + ".chunks";
+    return e;
+}
+
+// Result with every field set.
+AppcastCheckResult MakeResult()
+{
+    AppcastCheckResult r;
+    r.URL = FEED_URL;
+    r.CurrentVersion = INSTALLED_VERSION;
+    r.ServerVersion = "3.1";
+    // binary, with zero bytes
+    r.ContentHash = std::string("\x00\x01\xfe\xff", 4) + std::string(28, '\x5a');
+    r.HasApplicableItems = true;
+    r.HasUpdate = true;
+
+    Appcast& a = r.Update;
+    a.Version = "2.0.1234";
+    a.ShortVersionString = "2.0";
+    a.ReleaseNotesURL = "https://example.com/notes/2.0.html";
+    a.Title = "Version 2.0";
+    a.Description = "<ul><li>New &amp; improved</li></ul>" + std::string(10000, '.');
+    a.MinOSVersion = "6.1";
+    a.MinServerVersion = "3.0";
+    a.CriticalUpdate = true;
+    a.enclosure = MakeEnclosure("app-2.0.exe");
+
+    Appcast::Enclosure delta = MakeEnclosure("2.0-from-1.0.delta");
+    delta.DeltaFrom = INSTALLED_VERSION;
+    delta.ChunkIndexURL.clear();
+    a.Deltas.push_back(delta);
+    delta.DeltaFrom = "0.9";
+    a.Deltas.push_back(delta);
+
+    return r;
+}
+
+bool SameEnclosure(const Appcast::Enclosure& a, const Appcast::Enclosure& b)
+{
+    return a.DownloadURL == b.DownloadURL &&
+           a.DsaSignature == b.DsaSignature &&
+           a.OS == b.OS &&
+           a.InstallerArguments == b.InstallerArguments &&
+           a.Length == b.Length &&
+           a.DeltaFrom == b.DeltaFrom &&
+           a.ChunkIndexURL == b.ChunkIndexURL;
+}
+
+bool SameResult(const AppcastCheckResult& x, const AppcastCheckResult& y)
+{
+    const Appcast& a = x.Update;
+    const Appcast& b = y.Update;
+
+    if ( a.Deltas.size() != b.Deltas.size() )
+        return false;
+    for ( size_t i = 0; i < a.Deltas.size(); i++ )
+    {
+        if ( !SameEnclosure(a.Deltas[i], b.Deltas[i]) )
+            return false;
+    }
+
+    return x.URL == y.URL &&
+           x.CurrentVersion == y.CurrentVersion &&
+           x.ServerVersion == y.ServerVersion &&
+           x.ContentHash == y.ContentHash &&
+           x.HasApplicableItems == y.HasApplicableItems &&
+           x.HasUpdate == y.HasUpdate &&
+           a.Version == b.Version &&
+           a.ShortVersionString == b.ShortVersionString &&
+           a.ReleaseNotesURL == b.ReleaseNotesURL &&
+           a.WebBrowserURL == b.WebBrowserURL &&
+           a.Title == b.Title &&
+           a.Description == b.Description &&
+           a.MinOSVersion == b.MinOSVersion &&
+           a.MinServerVersion == b.MinServerVersion &&
+           a.CriticalUpdate == b.CriticalUpdate &&
+           SameEnclosure(a.enclosure, b.enclosure);
+}
+
+
+std::wstring GetCacheFile()
+{
+    std::wstring path;
+    Settings::ReadConfigValue("AppcastCacheFile", path);
+    return path;
+}
+
+std::string ReadTestFile(const std::wstring& path)
+{
+    std::string data;
+    FILE *f = _wfopen(path.c_str(), L"rb");
+    if ( !f )
+        throw std::runtime_error("can't open test file");
+    char buffer[4096];
+    size_t len;
+    while ( (len = fread(buffer, 1, sizeof(buffer), f)) > 0 )
+        data.append(buffer, len);
+    fclose(f);
+    return data;
+}
+
+void WriteTestFile(const std::wstring& path, const std::string& data)
+{
+    FILE *f = _wfopen(path.c_str(), L"wb");
+    if ( !f )
+        throw std::runtime_error("can't create test file");
+    fwrite(data.data(), 1, data.size(), f);
+    fclose(f);
+}
+
+// Checks if the cache file loads, as it does in a new process.
+bool LoadsFromFile()
+{
+    AppcastCache::Unload();
+    AppcastCheckResult loaded;
+    return AppcastCache::Get(FEED_URL, INSTALLED_VERSION, loaded);
+}
+
+
+void TestRoundTrip()
+{
+    const AppcastCheckResult stored = MakeResult();
+    AppcastCache::Store(stored);
+    CHECK(!GetCacheFile().empty());
+
+    AppcastCache::Unload();
+    AppcastCheckResult loaded;
+    CHECK(AppcastCache::Get(FEED_URL, INSTALLED_VERSION, loaded));
+    CHECK(SameResult(loaded, stored));
+
+    // it's only used for the same feed and installed version
+    AppcastCheckResult other;
+    CHECK(!AppcastCache::Get("https://example.com/other.xml", INSTALLED_VERSION, other));
+    CHECK(!AppcastCache::Get(FEED_URL, "1.1", other));
+
+    // a result without an update is stored too
+    AppcastCheckResult noUpdate;
+    noUpdate.URL = FEED_URL;
+    noUpdate.CurrentVersion = INSTALLED_VERSION;
+    noUpdate.HasApplicableItems = true;
+    AppcastCache::Store(noUpdate);
+
+    AppcastCache::Unload();
+    CHECK(AppcastCache::Get(FEED_URL, INSTALLED_VERSION, loaded));
+    CHECK(SameResult(loaded, noUpdate));
+}
+
+
+void TestCorrupted()
+{
+    AppcastCache::Store(MakeResult());
+    const std::wstring path = GetCacheFile();
+    const std::string data = ReadTestFile(path);
+    CHECK(LoadsFromFile());
+
+    // the header is 44 bytes: magic, version, payload size and checksum
+    const size_t HEADER_SIZE = 4 + 4 + 4 + 32;
+    const size_t damaged[] = { 0, 4, 8, 12, 43, HEADER_SIZE, data.size() / 2, data.size() - 1 };
+    for ( size_t i = 0; i < sizeof(damaged) / sizeof(damaged[0]); i++ )
+    {
+        std::string corrupted(data);
+        corrupted[damaged[i]] ^= 0x10;
+        WriteTestFile(path, corrupted);
+        if ( LoadsFromFile() )
+        {
+            winsparkle::test::ReportFailure(__FILE__, __LINE__,
+                                            "file with byte " + std::to_string(damaged[i]) + " damaged was loaded");
+        }
+    }
+
+    // truncated or extended files
+    WriteTestFile(path, data.substr(0, data.size() - 1));
+    CHECK(!LoadsFromFile());
+    WriteTestFile(path, data.substr(0, HEADER_SIZE));
+    CHECK(!LoadsFromFile());
+    WriteTestFile(path, data + '\0');
+    CHECK(!LoadsFromFile());
+    WriteTestFile(path, std::string());
+    CHECK(!LoadsFromFile());
+
+    // a missing file just isn't loaded
+    DeleteFile(path.c_str());
+    CHECK(!LoadsFromFile());
+
+    // the original data are fine
+    WriteTestFile(path, data);
+    CHECK(LoadsFromFile());
+
+    // the file is only used from the temporary directory, which is where
+    // it's created
+    g_config["AppcastCacheFile"] = L"C:\\Windows\\appcast.cache";
+    CHECK(!LoadsFromFile());
+    g_config["AppcastCacheFile"] = path;
+    CHECK(LoadsFromFile());
+}
+
+
+void TestReplacesCorrupted()
+{
+    AppcastCache::Store(MakeResult());
+    const std::wstring path = GetCacheFile();
+    WriteTestFile(path, "garbage");
+    CHECK(!LoadsFromFile());
+
+    // a new result replaces the corrupted file
+    const AppcastCheckResult stored = MakeResult();
+    AppcastCache::Store(stored);
+    CHECK(GetCacheFile() == path);
+
+    AppcastCache::Unload();
+    AppcastCheckResult loaded;
+    CHECK(AppcastCache::Get(FEED_URL, INSTALLED_VERSION, loaded));
+    CHECK(SameResult(loaded, stored));
+}
+
+
+void TestCounters()
+{
+    const unsigned hits = AppcastCache::GetHitCount();
+    const unsigned misses = AppcastCache::GetMissCount();
+
+    AppcastCache::RecordHit();
+    AppcastCache::RecordHit();
+    AppcastCache::RecordMiss();
+
+    CHECK_EQUAL(AppcastCache::GetHitCount() - hits, 2u);
+    CHECK_EQUAL(AppcastCache::GetMissCount() - misses, 1u);
+
+    // they are statistics of this process, not of the cached result
+    AppcastCache::Unload();
+    CHECK_EQUAL(AppcastCache::GetHitCount() - hits, 2u);
+}
+
+} // anonymous namespace
+
+
+int main()
+{
+    win_sparkle_config_methods_t config;
+    config.config_read = &ConfigRead;
+    config.config_write = &ConfigWrite;
+    config.config_delete = &ConfigDelete;
+    config.user_data = NULL;
+    Settings::SetConfigMethods(&config);
+
+    TestRoundTrip();
+    TestCorrupted();
+    TestReplacesCorrupted();
+    TestCounters();
+
+    DeleteFile(GetCacheFile().c_str());
+
+    return TestResult();
+}
@@ -0,0 +1,481 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+// Tests of extracting ZIP archives: stored and deflated entries, entries
+// with data descriptors, damaged archives and names that would be written
+// outside of the target directory.
+
+#include "archiveextract.h"
+#include "test.h"
+#include "utils.h"
+
+#include <windows.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+using namespace winsparkle;
+
+namespace
+{
+
+const unsigned METHOD_STORED = 0;
+const unsigned METHOD_DEFLATED = 8;
+const unsigned FLAG_DATA_DESCRIPTOR = 0x0008;
+
+// DEFLATED_TEXT is GetText() compressed with raw deflate; this zlib
+// doesn't include the compressor.
+const unsigned char DEFLATED_TEXT[] =
+{
+    0x0b, 0xcf, 0xcc, 0x0b, 0x2e, 0x48, 0x2c, 0xca, 0xce, 0x49, 0x55, 0x48,
+    0xad, 0x28, 0x29, 0x4a, 0x4c, 0x2e, 0x29, 0x56, 0x48, 0x2c, 0x4a, 0xce,
+    0xc8, 0x2c, 0x4b, 0x2d, 0x56, 0x28, 0xcf, 0xc8, 0x04, 0x8a, 0x97, 0x64,
+    0xa4, 0x56, 0x02, 0xc5, 0x52, 0x15, 0x92, 0x52, 0x33, 0xf3, 0xd2, 0x15,
+    0x52, 0xf2, 0xcb, 0xf3, 0x72, 0xf2, 0x13, 0x53, 0x52, 0x53, 0xf4, 0x14,
+    0xc2, 0x47, 0x75, 0x8f, 0xea, 0x1e, 0xd5, 0x3d, 0x88, 0x75, 0x03, 0x00
+};
+
+std::string GetText()
+{
+    std::string text;
+    for ( int i = 0; i < 16; i++ )
+        text += "WinSparkle extracts archives while they are being downloaded. ";
+    return text;
+}
+
+std::string GetDeflatedText()
+{
+    return std::string((const char*)DEFLATED_TEXT, sizeof(DEFLATED_TEXT));
+}
+
+unsigned long GetCRC(const std::string& data)
+{
+    return crc32(crc32(0L, Z_NULL, 0), (const Bytef*)data.data(), (uInt)data.size());
+}
+
+
+/*--------------------------------------------------------------------------*
+                              making archives
+ *--------------------------------------------------------------------------*/
+
+void PutUInt16(std::string& out, unsigned value)
+{
+    out += char(value & 0xFF);
+    out += char((value >> 8) & 0xFF);
+}
+
+void PutUInt32(std::string& out, unsigned long value)
+{
+    PutUInt16(out, value & 0xFFFF);
+    PutUInt16(out, (value >> 16) & 0xFFFF);
+}
+
+// Appends entry with @a data, which is @a content compressed with @a method.
+// With a data descriptor, the CRC and sizes follow the data instead of being
+// in the header; its signature is optional.
+void AddEntry(std::string& zip, const std::string& name,
+              const std::string& content, const std::string& data,
+              unsigned method, unsigned flags = 0, bool descriptorSignature = true)
+{
+    const unsigned long crc = GetCRC(content);
+    const bool descriptor = (flags & FLAG_DATA_DESCRIPTOR) != 0;
+
+    PutUInt32(zip, 0x04034b50);
+    PutUInt16(zip, 20);                     // version needed
+    PutUInt16(zip, flags);
+    PutUInt16(zip, method);
+    PutUInt32(zip, 0);                      // time and date
+    PutUInt32(zip, descriptor ? 0 : crc);
+    PutUInt32(zip, descriptor ? 0 : (unsigned long)data.size());
+    PutUInt32(zip, descriptor ? 0 : (unsigned long)content.size());
+    PutUInt16(zip, (unsigned)name.size());
+    PutUInt16(zip, 0);                      // extra field
+    zip += name;
+    zip += data;
+
+    if ( descriptor )
+    {
+        if ( descriptorSignature )
+            PutUInt32(zip, 0x08074b50);
+        PutUInt32(zip, crc);
+        PutUInt32(zip, (unsigned long)data.size());
+        PutUInt32(zip, (unsigned long)content.size());
+    }
+}
+
+void AddStored(std::string& zip, const std::string& name, const std::string& content)
+{
+    AddEntry(zip, name, content, content, METHOD_STORED);
+}
+
+void AddDeflated(std::string& zip, const std::string& name, unsigned flags = 0)
+{
+    AddEntry(zip, name, GetText(), GetDeflatedText(), METHOD_DEFLATED, flags);
+}
+
+// The central directory isn't used by the extractor, so only the end of
+// central directory record is added.
+void EndArchive(std::string& zip)
+{
+    PutUInt32(zip, 0x06054b50);
+    zip.append(18, '\0');
+}
+
+
+/*--------------------------------------------------------------------------*
+                                  helpers
+ *--------------------------------------------------------------------------*/
+
+std::wstring TempPath(const wchar_t *name)
+{
+    wchar_t dir[MAX_PATH + 1];
+    GetTempPath(MAX_PATH + 1, dir);
+    return std::wstring(dir) + L"WinSparkle_archiveextract_test_" + name;
+}
+
+const std::wstring STAGING_DIR = TempPath(L"staging");
+const std::wstring TARGET_DIR = TempPath(L"target");
+
+bool FileExists(const std::wstring& path)
+{
+    return GetFileAttributes(path.c_str()) != INVALID_FILE_ATTRIBUTES;
+}
+
+void WriteTestFile(const std::wstring& path, const std::string& data)
+{
+    FILE *f = _wfopen(path.c_str(), L"wb");
+    if ( !f )
+        throw std::runtime_error("can't create test file");
+    fwrite(data.data(), 1, data.size(), f);
+    fclose(f);
+}
+
+std::string ReadTestFile(const std::wstring& path)
+{
+    std::string data;
+    FILE *f = _wfopen(path.c_str(), L"rb");
+    if ( !f )
+        return data;
+    char buf[4096];
+    size_t len;
+    while ( (len = fread(buf, 1, sizeof(buf), f)) > 0 )
+        data.append(buf, len);
+    fclose(f);
+    return data;
+}
+
+void Cleanup()
+{
+    if ( FileExists(STAGING_DIR) )
+        DeleteDirectory(STAGING_DIR);
+    if ( FileExists(TARGET_DIR) )
+        DeleteDirectory(TARGET_DIR);
+}
+
+// Feeds the archive to @a extractor in pieces of @a chunk bytes, as if it
+// were downloaded.
+void Feed(ArchiveExtractor& extractor, const std::string& zip, size_t chunk)
+{
+    for ( size_t pos = 0; pos < zip.size(); pos += chunk )
+        extractor.Add(zip.data() + pos, std::min(chunk, zip.size() - pos));
+}
+
+// Returns true if extracting the archive fails.
+bool Fails(const std::string& zip)
+{
+    ArchiveExtractor extractor(STAGING_DIR);
+    Feed(extractor, zip, zip.size());
+    try
+    {
+        extractor.Finish();
+        return false;
+    }
+    catch ( const std::runtime_error& )
+    {
+        return true;
+    }
+}
+
+
+/*--------------------------------------------------------------------------*
+                                   tests
+ *--------------------------------------------------------------------------*/
+
+// Stored and deflated entries are extracted, whatever the pieces the archive
+// arrives in are.
+void TestStoredAndDeflated()
+{
+    std::string zip;
+    AddStored(zip, "readme.txt", "Read me.");
+    AddStored(zip, "bin/", "");
+    AddDeflated(zip, "bin/app.exe");
+    AddStored(zip, "empty.txt", "");
+    EndArchive(zip);
+
+    const size_t chunks[] = { 1, 7, 4096 };
+    for ( size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++ )
+    {
+        {
+            ArchiveExtractor extractor(STAGING_DIR);
+            Feed(extractor, zip, chunks[i]);
+            CHECK(extractor.Finish());
+            extractor.Commit(TARGET_DIR);
+        }
+
+        CHECK_EQUAL(ReadTestFile(TARGET_DIR + L"\\readme.txt"), std::string("Read me."));
+        CHECK(ReadTestFile(TARGET_DIR + L"\\bin\\app.exe") == GetText());
+        CHECK(FileExists(TARGET_DIR + L"\\empty.txt"));
+        CHECK(!FileExists(STAGING_DIR));
+        Cleanup();
+    }
+}
+
+
+// Data descriptors follow deflated data when the sizes weren't known in
+// advance, with or without signature.
+void TestDataDescriptor()
+{
+    std::string zip;
+    AddDeflated(zip, "a.exe", FLAG_DATA_DESCRIPTOR);
+    AddEntry(zip, "b.exe", GetText(), GetDeflatedText(), METHOD_DEFLATED, FLAG_DATA_DESCRIPTOR, false);
+    AddStored(zip, "c.txt", "C");
+    EndArchive(zip);
+
+    {
+        ArchiveExtractor extractor(STAGING_DIR);
+        Feed(extractor, zip, 3);
+        CHECK(extractor.Finish());
+        extractor.Commit(TARGET_DIR);
+    }
+    CHECK(ReadTestFile(TARGET_DIR + L"\\a.exe") == GetText());
+    CHECK(ReadTestFile(TARGET_DIR + L"\\b.exe") == GetText());
+    CHECK_EQUAL(ReadTestFile(TARGET_DIR + L"\\c.txt"), std::string("C"));
+    Cleanup();
+
+    // stored data don't tell where they end
+    zip.clear();
+    AddEntry(zip, "a.exe", "data", "data", METHOD_STORED, FLAG_DATA_DESCRIPTOR);
+    EndArchive(zip);
+    CHECK(Fails(zip));
+    Cleanup();
+}
+
+
+void TestTruncated()
+{
+    std::string zip;
+    AddStored(zip, "readme.txt", "Read me.");
+    AddDeflated(zip, "app.exe");
+    EndArchive(zip);
+
+    // in the header, in stored data, in deflated data and before the end
+    const size_t lengths[] = { 10, 45, zip.size() - 40, zip.size() - 22 };
+    for ( size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++ )
+    {
+        ArchiveExtractor extractor(STAGING_DIR);
+        Feed(extractor, zip.substr(0, lengths[i]), 16);
+        CHECK_THROWS(extractor.Finish(), std::runtime_error);
+        CHECK_THROWS(extractor.Commit(TARGET_DIR), std::runtime_error);
+        CHECK(!FileExists(TARGET_DIR));
+    }
+
+    Cleanup();
+}
+
+
+void TestCorrupted()
+{
+    // CRC in the header doesn't match
+    std::string zip;
+    AddEntry(zip, "readme.txt", "Read me!", "Read me.", METHOD_STORED);
+    EndArchive(zip);
+    CHECK(Fails(zip));
+
+    // ...or in the data descriptor
+    zip.clear();
+    AddEntry(zip, "app.exe", GetText() + "!", GetDeflatedText(), METHOD_DEFLATED, FLAG_DATA_DESCRIPTOR);
+    EndArchive(zip);
+    CHECK(Fails(zip));
+
+    // damaged deflated data
+    std::string damaged = GetDeflatedText();
+    damaged[10] ^= 0x55;
+    zip.clear();
+    AddEntry(zip, "app.exe", GetText(), damaged, METHOD_DEFLATED);
+    EndArchive(zip);
+    CHECK(Fails(zip));
+
+    // garbage instead of the next entry
+    zip.clear();
+    AddStored(zip, "readme.txt", "Read me.");
+    zip += "garbage";
+    CHECK(Fails(zip));
+
+    Cleanup();
+}
+
+
+// Names that would be written outside of the directory, or to devices, are
+// rejected.
+void TestInvalidNames()
+{
+    const char *const names[] =
+    {
+        "../evil.exe",
+        "..\\evil.exe",
+        "a/../../evil.exe",
+        "a\\..\\..\\evil.exe",
+        "C:evil.exe",
+        "C:/evil.exe",
+        "C:\\evil.exe",
+        "/evil.exe",
+        "\\evil.exe",
+        "\\\\server\\share\\evil.exe",
+        "a//evil.exe",
+        "./evil.exe",
+        ".. /evil.exe",
+        "a./evil.exe",
+        "evil.exe:stream",
+        "evil?.exe",
+        "CON",
+        "nul.txt",
+        "bin/Aux.exe",
+        "PRN",
+        "com1",
+        "LPT9.log",
+        "nul .txt",
+        "CONOUT$",
+        ""
+    };
+
+    for ( size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++ )
+    {
+        std::string zip;
+        AddStored(zip, names[i], "evil");
+        EndArchive(zip);
+        if ( !Fails(zip) )
+        {
+            winsparkle::test::ReportFailure(__FILE__, __LINE__,
+                std::string("invalid name \"") + names[i] + "\" was accepted");
+        }
+    }
+
+    CHECK(!FileExists(TempPath(L"evil.exe")));
+    Cleanup();
+
+    // names that only resemble devices are fine
+    std::string zip;
+    AddStored(zip, "console/contents.txt", "1");
+    AddStored(zip, "com10.dll", "2");
+    AddStored(zip, "lpt.txt", "3");
+    AddStored(zip, "nul_/.config", "4");
+    EndArchive(zip);
+    CHECK(!Fails(zip));
+    Cleanup();
+}
+
+
+void TestNotArchive()
+{
+    ArchiveExtractor extractor(STAGING_DIR);
+    Feed(extractor, "MZ, this is an installer", 8);
+    CHECK(!extractor.Finish());
+    CHECK(!FileExists(STAGING_DIR));
+}
+
+
+// Committing replaces files of an earlier extraction.
+void TestCommitReplaces()
+{
+    CreateDirectory(TARGET_DIR.c_str(), NULL);
+    CreateDirectory((TARGET_DIR + L"\\bin").c_str(), NULL);
+    WriteTestFile(TARGET_DIR + L"\\stale.txt", "stale");
+    WriteTestFile(TARGET_DIR + L"\\bin\\app.exe", "old");
+
+    std::string zip;
+    AddDeflated(zip, "bin/app.exe");
+    EndArchive(zip);
+
+    {
+        ArchiveExtractor extractor(STAGING_DIR);
+        Feed(extractor, zip, 100);
+        CHECK(extractor.Finish());
+        extractor.Commit(TARGET_DIR);
+    }
+
+    CHECK(!FileExists(TARGET_DIR + L"\\stale.txt"));
+    CHECK(ReadTestFile(TARGET_DIR + L"\\bin\\app.exe") == GetText());
+    CHECK(!FileExists(STAGING_DIR));
+    Cleanup();
+}
+
+
+void TestExtractFile()
+{
+    std::string zip;
+    AddDeflated(zip, "app.exe");
+    EndArchive(zip);
+
+    const std::wstring path = TempPath(L"update.zip");
+    WriteTestFile(path, zip);
+    {
+        ArchiveExtractor extractor(STAGING_DIR);
+        CHECK(extractor.ExtractFile(path));
+        extractor.Commit(TARGET_DIR);
+    }
+    CHECK(ReadTestFile(TARGET_DIR + L"\\app.exe") == GetText());
+
+    // files that aren't archives are left alone
+    WriteTestFile(path, "MZ installer");
+    {
+        ArchiveExtractor extractor(STAGING_DIR);
+        CHECK(!extractor.ExtractFile(path));
+    }
+
+    DeleteFile(path.c_str());
+    Cleanup();
+}
+
+} // anonymous namespace
+
+
+int main()
+{
+    Cleanup();
+
+    TestStoredAndDeflated();
+    TestDataDescriptor();
+    TestTruncated();
+    TestCorrupted();
+    TestInvalidNames();
+    TestNotArchive();
+    TestCommitReplaces();
+    TestExtractFile();
+
+    return TestResult();
+}
@@ -0,0 +1,181 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+// Benchmark of AsyncWriteStage with an artificially slow disk: data arrive
+// from a simulated network connection at a steady rate and are written by
+// a disk that is fast on average, but stops for a while every few MBs, as
+// when an antivirus scans the file. Without AsyncWriteStage, the thread
+// reading from the network is blocked by every write and every stop of the
+// disk; with it, the reads continue while the queued buffers absorb them.
+//
+// Usage: asyncwrite_benchmark [total MB]
+
+#include "downloadpipeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace winsparkle;
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+const double NETWORK_MB_PER_SEC = 50;
+const size_t NETWORK_READ_SIZE = 64 * 1024;
+
+const double DISK_MB_PER_SEC = 200;
+const size_t DISK_STALL_EVERY = 16 * 1024 * 1024;
+const int DISK_STALL_MS = 250;
+
+double Ms(Clock::duration d)
+{
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+Clock::duration FromSeconds(double s)
+{
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(s));
+}
+
+// Waits more precisely than sleeping alone does.
+void WaitUntil(Clock::time_point t)
+{
+    for ( ;; )
+    {
+        const double left = Ms(t - Clock::now());
+        if ( left <= 0 )
+            return;
+        SleepMilliseconds(left > 20 ? unsigned(left - 16) : 0);
+    }
+}
+
+
+// Writes data at DISK_MB_PER_SEC, stopping for DISK_STALL_MS every
+// DISK_STALL_EVERY bytes.
+class SlowDiskStage : public DownloadStage
+{
+public:
+    SlowDiskStage() : m_written(0), m_busyUntil(Clock::now()) {}
+
+    virtual void Process(const DownloadChunk& chunk)
+    {
+        m_busyUntil = std::max(m_busyUntil, Clock::now()) +
+                      FromSeconds(chunk.Length / (DISK_MB_PER_SEC * 1024 * 1024));
+
+        if ( (m_written + chunk.Length) / DISK_STALL_EVERY != m_written / DISK_STALL_EVERY )
+            m_busyUntil += std::chrono::milliseconds(DISK_STALL_MS);
+        m_written += chunk.Length;
+
+        WaitUntil(m_busyUntil);
+        DownloadStage::Process(chunk);
+    }
+
+private:
+    size_t m_written;
+    Clock::time_point m_busyUntil;
+};
+
+
+struct Result
+{
+    double total;       // ms until all data were written
+    double maxBlocked;  // longest time spent in one Add() call, in ms
+    double blocked;     // total time spent in Add() calls, in ms
+};
+
+
+Result Run(size_t total, bool async)
+{
+    std::vector<char> data(NETWORK_READ_SIZE, 'x');
+    const Clock::duration readInterval =
+        FromSeconds(NETWORK_READ_SIZE / (NETWORK_MB_PER_SEC * 1024 * 1024));
+
+    SlowDiskStage disk;
+    AsyncWriteStage *writer = async ? new AsyncWriteStage(1024 * 1024, 16) : NULL;
+
+    DownloadPipeline pipeline;
+    if ( writer )
+        pipeline.Append(writer);
+    pipeline.Append(&disk);
+
+    Result result = { 0, 0, 0 };
+    const Clock::time_point start = Clock::now();
+    Clock::time_point arrival = start;
+
+    for ( size_t done = 0; done < total; done += NETWORK_READ_SIZE )
+    {
+        WaitUntil(arrival);
+
+        const Clock::time_point before = Clock::now();
+        pipeline.Add(&data[0], NETWORK_READ_SIZE);
+        const Clock::time_point after = Clock::now();
+
+        const double blocked = Ms(after - before);
+        result.maxBlocked = std::max(result.maxBlocked, blocked);
+        result.blocked += blocked;
+
+        // the sender pauses while the data aren't read, as it does when
+        // the receive window is full, so the next read comes later
+        arrival = after + readInterval;
+    }
+    pipeline.Finish();
+
+    result.total = Ms(Clock::now() - start);
+    delete writer;
+    return result;
+}
+
+} // anonymous namespace
+
+
+int main(int argc, char **argv)
+{
+    const size_t mb = argc > 1 ? atoi(argv[1]) : 128;
+    const size_t total = mb * 1024 * 1024;
+
+    printf("%u MB from a %.0f MB/s network to a %.0f MB/s disk stopping for "
+           "%d ms every %u MB, times in ms\n\n",
+           unsigned(mb), NETWORK_MB_PER_SEC, DISK_MB_PER_SEC,
+           DISK_STALL_MS, unsigned(DISK_STALL_EVERY / (1024 * 1024)));
+    printf("%-10s %10s %12s %12s\n", "writes", "total", "max blocked", "blocked");
+
+    for ( int async = 0; async <= 1; async++ )
+    {
+        const Result r = Run(total, async != 0);
+        printf("%-10s %10.0f %12.1f %12.0f\n",
+               async ? "async" : "blocking", r.total, r.maxBlocked, r.blocked);
+    }
+
+    printf("\n(transfer at network rate takes %.0f ms)\n",
+           total / (NETWORK_MB_PER_SEC * 1024 * 1024) * 1000);
+
+    return 0;
+}
@@ -0,0 +1,476 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+// Tests of chunk sync: matching the chunk index against the previous
+// installer, leaving short runs of reused chunks to the download and
+// finishing the download against FakeHttpTransport.
+
+#include "chunksync.h"
+#include "test.h"
+#include "fakehttp.h"
+
+#include <openssl/sha.h>
+
+#include <windows.h>
+
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace winsparkle;
+using namespace winsparkle::test;
+
+namespace
+{
+
+const char INSTALLER_URL[] = "http://example.com/installer.exe";
+
+// Smaller chunks than bin/make_chunk_index.py uses, so that the test
+// files can be small too.
+const unsigned MIN_SIZE = 4 * 1024;
+const unsigned MASK_BITS = 12;
+const unsigned MAX_SIZE = 64 * 1024;
+
+// Runs of reused data shorter than this are downloaded, see chunksync.cpp.
+const size_t MIN_REUSED_RUN = 64 * 1024;
+
+std::string MakeData(size_t len, unsigned seed)
+{
+    std::string data(len, '\0');
+    unsigned x = seed;
+    for ( size_t i = 0; i < len; i++ )
+    {
+        x = x * 1103515245 + 12345;
+        data[i] = char(x >> 16);
+    }
+    return data;
+}
+
+std::string SHA256Of(const std::string& data)
+{
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    SHA256(reinterpret_cast<const unsigned char*>(data.data()), data.size(), hash);
+    return std::string(reinterpret_cast<const char*>(hash), sizeof(hash));
+}
+
+
+/*--------------------------------------------------------------------------*
+                              chunk index
+ *--------------------------------------------------------------------------*/
+
+void PutUInt32(std::string& out, unsigned long long value)
+{
+    for ( int i = 0; i < 4; i++ )
+        out += char((value >> (8 * i)) & 0xFF);
+}
+
+// Splits the data the way bin/make_chunk_index.py does.
+std::vector<std::string> SplitIntoChunks(const std::string& data)
+{
+    unsigned gear[256];
+    unsigned long long x = 0;
+    for ( int i = 0; i < 256; i++ )
+    {
+        x += 0x9E3779B97F4A7C15ULL;
+        unsigned long long z = x;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        z ^= z >> 31;
+        gear[i] = unsigned(z >> 32);
+    }
+
+    const unsigned mask = 0xFFFFFFFFU << (32 - MASK_BITS);
+    std::vector<std::string> chunks;
+    size_t start = 0;
+    unsigned hash = 0;
+    for ( size_t i = 0; i < data.size(); i++ )
+    {
+        hash = (hash << 1) + gear[(unsigned char)data[i]];
+        const size_t len = i - start + 1;
+        if ( (len >= MIN_SIZE && (hash & mask) == 0) || len >= MAX_SIZE )
+        {
+            chunks.push_back(data.substr(start, len));
+            start = i + 1;
+            hash = 0;
+        }
+    }
+    if ( start < data.size() )
+        chunks.push_back(data.substr(start));
+    return chunks;
+}
+
+std::string MakeIndex(const std::string& data)
+{
+    const std::vector<std::string> chunks = SplitIntoChunks(data);
+
+    std::string index("WSCI");
+    PutUInt32(index, 1);
+    PutUInt32(index, MIN_SIZE);
+    PutUInt32(index, MASK_BITS);
+    PutUInt32(index, MAX_SIZE);
+    PutUInt32(index, data.size());
+    PutUInt32(index, 0);
+    PutUInt32(index, chunks.size());
+    for ( size_t i = 0; i < chunks.size(); i++ )
+    {
+        PutUInt32(index, chunks[i].size());
+        index += SHA256Of(chunks[i]);
+    }
+    return index;
+}
+
+
+/*--------------------------------------------------------------------------*
+                                  helpers
+ *--------------------------------------------------------------------------*/
+
+std::wstring TempFile(const wchar_t *name)
+{
+    wchar_t dir[MAX_PATH + 1];
+    GetTempPath(MAX_PATH + 1, dir);
+    return std::wstring(dir) + L"WinSparkle_chunksync_test_" + name;
+}
+
+const std::wstring PREVIOUS_FILE = TempFile(L"previous.exe");
+const std::wstring TARGET_FILE = TempFile(L"installer.exe");
+
+bool FileExists(const std::wstring& path)
+{
+    return GetFileAttributes(path.c_str()) != INVALID_FILE_ATTRIBUTES;
+}
+
+void WriteTestFile(const std::wstring& path, const std::string& data)
+{
+    FILE *f = _wfopen(path.c_str(), L"wb");
+    if ( !f )
+        throw std::runtime_error("can't create test file");
+    fwrite(data.data(), 1, data.size(), f);
+    fclose(f);
+}
+
+std::string ReadTestFile(const std::wstring& path)
+{
+    std::string data;
+    FILE *f = _wfopen(path.c_str(), L"rb");
+    if ( !f )
+        return data;
+    char buf[4096];
+    size_t len;
+    while ( (len = fread(buf, 1, sizeof(buf), f)) > 0 )
+        data.append(buf, len);
+    fclose(f);
+    return data;
+}
+
+
+// Writes the download into the file prepared by PrepareChunkSync(), like
+// UpdateDownloader does.
+struct FileSink : public IRandomAccessDownloadSink
+{
+    FileSink(const std::wstring& path) : path(path), file(NULL), resumed(false) {}
+    ~FileSink() { Close(); }
+
+    void Close()
+    {
+        if ( file )
+            fclose(file);
+        file = NULL;
+    }
+
+    virtual void SetLength(size_t) {}
+    virtual void SetFilename(const std::wstring&) {}
+
+    virtual void Add(const void *data, size_t len)
+    {
+        if ( !file )
+            file = _wfopen(path.c_str(), L"wb");
+        fwrite(data, 1, len, file);
+    }
+
+    virtual void Preallocate(size_t)
+    {
+        Close();
+        file = _wfopen(path.c_str(), L"w+b");
+    }
+
+    virtual void AddAt(size_t offset, const void *data, size_t len)
+    {
+        if ( _fseeki64(file, offset, SEEK_SET) != 0 || fwrite(data, 1, len, file) != len )
+            throw std::runtime_error("can't write test file");
+    }
+
+    virtual bool ResumePartial(const PartialDownload&)
+    {
+        file = _wfopen(path.c_str(), L"r+b");
+        resumed = file != NULL;
+        return resumed;
+    }
+
+    virtual void SaveProgress(const PartialDownload&) {}
+
+    std::wstring path;
+    FILE *file;
+    bool resumed;
+};
+
+
+bool Overlaps(const PartialDownload& state, size_t from, size_t to)
+{
+    for ( size_t i = 0; i < state.Completed.size(); i++ )
+    {
+        if ( state.Completed[i].From < to && state.Completed[i].To > from )
+            return true;
+    }
+    return false;
+}
+
+// Checks that the reused ranges are in the target file and worth reusing.
+void CheckCompleted(const PartialDownload& state, const std::string& data)
+{
+    const std::string target = ReadTestFile(TARGET_FILE);
+    CHECK_EQUAL(target.size(), data.size());
+    for ( size_t i = 0; i < state.Completed.size(); i++ )
+    {
+        const PartialDownload::Range& r = state.Completed[i];
+        CHECK(r.To - r.From >= MIN_REUSED_RUN);
+        CHECK(target.compare(r.From, r.To - r.From, data, r.From, r.To - r.From) == 0);
+    }
+}
+
+
+/*--------------------------------------------------------------------------*
+                                   tests
+ *--------------------------------------------------------------------------*/
+
+// Unchanged chunks are reused, wherever they are in the new file, and
+// only the rest is downloaded.
+void TestReuseChangedFile()
+{
+    const std::string previous = MakeData(2 * 1024 * 1024, 1);
+    WriteTestFile(PREVIOUS_FILE, previous);
+
+    // data inserted, changed and removed in a few places
+    std::string update = previous;
+    update.insert(500 * 1024, MakeData(100, 2));
+    update[1536 * 1024] ^= 0x55;
+    update.erase(1800 * 1024, 5000);
+
+    PartialDownload state;
+    const ChunkSyncStats stats =
+        PrepareChunkSync(MakeIndex(update), PREVIOUS_FILE, TARGET_FILE, state, NULL);
+    CHECK_EQUAL(stats.Length, update.size());
+    CHECK_EQUAL(state.Length, update.size());
+    CHECK(stats.Reused > update.size() * 8 / 10);
+    CHECK(!Overlaps(state, 500 * 1024, 500 * 1024 + 100));
+    CHECK(!Overlaps(state, 1536 * 1024, 1536 * 1024 + 1));
+    CheckCompleted(state, update);
+
+    // finish it
+    FakeHttpTransport transport;
+    FakeHttpTransportScope scope(transport);
+    FakeResource installer;
+    installer.Body = update;
+    installer.ETag = "\"installer-2\"";
+    transport.Add(INSTALLER_URL, installer);
+
+    state.URL = INSTALLER_URL;
+    {
+        FileSink sink(TARGET_FILE);
+        DownloadFileSegmented(INSTALLER_URL, &sink, NULL, 4, &state);
+        CHECK(sink.resumed);
+    }
+    CHECK(ReadTestFile(TARGET_FILE) == update);
+    CHECK_EQUAL(transport.GetServedBytes(INSTALLER_URL), update.size() - stats.Reused);
+
+    const std::vector<HttpRequestParams> requests = transport.GetRequests();
+    for ( size_t i = 0; i < requests.size(); i++ )
+        CHECK(requests[i].HasRange && !Overlaps(state, requests[i].RangeFrom, requests[i].RangeTo));
+
+    DeleteFile(TARGET_FILE.c_str());
+}
+
+
+void TestReuseMovedChunks()
+{
+    const std::string previous = MakeData(1024 * 1024, 3);
+    WriteTestFile(PREVIOUS_FILE, previous);
+
+    const std::string update = previous.substr(700 * 1024) + previous.substr(0, 700 * 1024);
+
+    PartialDownload state;
+    const ChunkSyncStats stats =
+        PrepareChunkSync(MakeIndex(update), PREVIOUS_FILE, TARGET_FILE, state, NULL);
+    CHECK(stats.Reused > update.size() * 9 / 10);
+    CheckCompleted(state, update);
+
+    DeleteFile(TARGET_FILE.c_str());
+}
+
+
+// Reused chunks between changes that are close to each other aren't worth
+// an extra Range request, so the changes are downloaded with one.
+void TestCoalesceShortRuns()
+{
+    const std::string previous = MakeData(2 * 1024 * 1024, 4);
+    WriteTestFile(PREVIOUS_FILE, previous);
+
+    const size_t first = 1000 * 1024;
+    const size_t second = first + 30 * 1024;
+    std::string update = previous;
+    update[first] ^= 0x55;
+    update[second] ^= 0x55;
+
+    // the chunks between the changes are the same...
+    const std::vector<std::string> chunks = SplitIntoChunks(update);
+    size_t unchanged = 0;
+    for ( size_t i = 0, pos = 0; i < chunks.size(); pos += chunks[i].size(), i++ )
+    {
+        if ( pos > first && pos + chunks[i].size() <= second )
+            unchanged++;
+    }
+    CHECK(unchanged > 0);
+
+    // ...but they are downloaded anyway
+    PartialDownload state;
+    PrepareChunkSync(MakeIndex(update), PREVIOUS_FILE, TARGET_FILE, state, NULL);
+    CHECK(!Overlaps(state, first, second + 1));
+    CheckCompleted(state, update);
+
+    // so is all of a small file
+    const std::string small = previous.substr(0, 48 * 1024);
+    std::string smallUpdate = small;
+    smallUpdate[20 * 1024] ^= 0x55;
+    PrepareChunkSync(MakeIndex(smallUpdate), PREVIOUS_FILE, TARGET_FILE, state, NULL);
+    CHECK(state.Completed.empty());
+
+    // unless it's entirely reused
+    WriteTestFile(PREVIOUS_FILE, small);
+    const ChunkSyncStats stats = PrepareChunkSync(MakeIndex(small), PREVIOUS_FILE, TARGET_FILE, state, NULL);
+    CHECK_EQUAL(stats.Reused, small.size());
+    CHECK_EQUAL(state.Completed.size(), 1u);
+
+    DeleteFile(TARGET_FILE.c_str());
+}
+
+
+// If the index doesn't match the file on the server, the assembled file
+// doesn't pass verification and the update is downloaded in full, as
+// UpdateDownloader does.
+void TestFallbackOnHashMismatch()
+{
+    const std::string previous = MakeData(2 * 1024 * 1024, 5);
+    WriteTestFile(PREVIOUS_FILE, previous);
+
+    // the index was made for another build than the one on the server
+    std::string indexed = previous;
+    indexed[100] ^= 0x55;
+    std::string update = previous;
+    update[1024 * 1024] ^= 0x55;
+
+    FakeHttpTransport transport;
+    FakeHttpTransportScope scope(transport);
+    FakeResource installer;
+    installer.Body = update;
+    installer.ETag = "\"installer-2\"";
+    transport.Add(INSTALLER_URL, installer);
+
+    PartialDownload state;
+    const ChunkSyncStats stats =
+        PrepareChunkSync(MakeIndex(indexed), PREVIOUS_FILE, TARGET_FILE, state, NULL);
+    CHECK(stats.Reused > 0);
+
+    state.URL = INSTALLER_URL;
+    {
+        FileSink sink(TARGET_FILE);
+        DownloadFileSegmented(INSTALLER_URL, &sink, NULL, 4, &state);
+    }
+    CHECK(SHA256Of(ReadTestFile(TARGET_FILE)) != SHA256Of(update));
+
+    transport.ClearRequests();
+    {
+        FileSink sink(TARGET_FILE);
+        DownloadFileSegmented(INSTALLER_URL, &sink, NULL, 4);
+        CHECK(!sink.resumed);
+    }
+    CHECK(SHA256Of(ReadTestFile(TARGET_FILE)) == SHA256Of(update));
+
+    // nothing to reuse from an unrelated file, which UpdateDownloader
+    // doesn't bother finishing
+    WriteTestFile(PREVIOUS_FILE, MakeData(2 * 1024 * 1024, 6));
+    const ChunkSyncStats unrelated =
+        PrepareChunkSync(MakeIndex(update), PREVIOUS_FILE, TARGET_FILE, state, NULL);
+    CHECK_EQUAL(unrelated.Reused, 0u);
+    CHECK(state.Completed.empty());
+
+    DeleteFile(TARGET_FILE.c_str());
+}
+
+
+// Damaged indexes are rejected without leaving the target file behind.
+void TestInvalidIndex()
+{
+    const std::string previous = MakeData(256 * 1024, 7);
+    WriteTestFile(PREVIOUS_FILE, previous);
+    const std::string index = MakeIndex(previous);
+
+    std::vector<std::string> damaged;
+    damaged.push_back("");
+    damaged.push_back(index.substr(0, index.size() - 1));
+    damaged.push_back(index + "x");
+    damaged.push_back("WSCX" + index.substr(4));
+    std::string wrongLength = index;
+    wrongLength[24] ^= 1;
+    damaged.push_back(wrongLength);
+    std::string tooSmallChunks = index;
+    tooSmallChunks[8] = 1;
+    tooSmallChunks[9] = 0;
+    damaged.push_back(tooSmallChunks);
+
+    for ( size_t i = 0; i < damaged.size(); i++ )
+    {
+        PartialDownload state;
+        CHECK_THROWS(PrepareChunkSync(damaged[i], PREVIOUS_FILE, TARGET_FILE, state, NULL),
+                     std::runtime_error);
+        CHECK(!FileExists(TARGET_FILE));
+    }
+}
+
+} // anonymous namespace
+
+
+int main()
+{
+    TestReuseChangedFile();
+    TestReuseMovedChunks();
+    TestCoalesceShortRuns();
+    TestFallbackOnHashMismatch();
+    TestInvalidIndex();
+
+    DeleteFile(PREVIOUS_FILE.c_str());
+
+    return TestResult();
+}
@@ -0,0 +1,208 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+// Benchmark of delta updates: how many bytes a delta saves over downloading
+// the full installer and how long applying it takes, for synthetic
+// installers with different amounts of changes. Installers are mostly
+// compressed data, so the unchanged parts are random data.
+//
+// Usage: deltapatch_benchmark [installer size in MB]
+
+#include "deltapatch.h"
+
+#include <windows.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+using namespace winsparkle;
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+// from msdelta.h, which isn't available with all compilers:
+typedef long long DELTA_FILE_TYPE;
+typedef long long DELTA_FLAG_TYPE;
+struct DELTA_INPUT
+{
+    const void *lpStart;
+    size_t uSize;
+    BOOL Editable;
+};
+typedef BOOL (WINAPI *CreateDeltaW_t)(DELTA_FILE_TYPE, DELTA_FLAG_TYPE, DELTA_FLAG_TYPE,
+                                      LPCWSTR, LPCWSTR, LPCWSTR, LPCWSTR,
+                                      DELTA_INPUT, const FILETIME*, unsigned, LPCWSTR);
+
+const DELTA_FILE_TYPE DELTA_FILE_TYPE_RAW = 1;
+
+// changed parts of the installer are this big, e.g. a rebuilt file in it
+const size_t CHANGE_SIZE = 64 * 1024;
+
+double Ms(Clock::time_point start, Clock::time_point end)
+{
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+CreateDeltaW_t GetCreateDeltaFunc()
+{
+    wchar_t sysdir[MAX_PATH + 1];
+    const UINT len = GetSystemDirectory(sysdir, MAX_PATH + 1);
+    if ( len == 0 || len > MAX_PATH )
+        return NULL;
+
+    HMODULE dll = LoadLibrary((std::wstring(sysdir) + L"\\msdelta.dll").c_str());
+    if ( !dll )
+        return NULL;
+    return (CreateDeltaW_t)GetProcAddress(dll, "CreateDeltaW");
+}
+
+std::wstring TempFile(const wchar_t *name)
+{
+    wchar_t dir[MAX_PATH + 1];
+    GetTempPath(MAX_PATH + 1, dir);
+    return std::wstring(dir) + L"WinSparkle_deltapatch_benchmark_" + name;
+}
+
+void WriteTestFile(const std::wstring& path, const std::string& data)
+{
+    FILE *f = _wfopen(path.c_str(), L"wb");
+    if ( !f || fwrite(data.data(), 1, data.size(), f) != data.size() )
+    {
+        fprintf(stderr, "can't write temporary file\n");
+        exit(1);
+    }
+    fclose(f);
+}
+
+unsigned long long FileSize(const std::wstring& path)
+{
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    if ( !GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &attr) )
+        return 0;
+    return (unsigned long long)attr.nFileSizeHigh << 32 | attr.nFileSizeLow;
+}
+
+void Randomize(std::string& data, size_t from, size_t len, unsigned& seed)
+{
+    for ( size_t i = from; i < from + len; i++ )
+    {
+        seed = seed * 1103515245 + 12345;
+        data[i] = char(seed >> 16);
+    }
+}
+
+// Changes @a percent of the installer in CHANGE_SIZE blocks spread over it
+// and inserts one more block in the middle, which moves everything after it.
+std::string ChangeInstaller(const std::string& installer, double percent)
+{
+    std::string changed(installer);
+    unsigned seed = 42;
+
+    const size_t blocks = installer.size() / CHANGE_SIZE;
+    const size_t count = std::max(size_t(1), size_t(blocks * percent / 100));
+    for ( size_t i = 0; i < count; i++ )
+        Randomize(changed, (i * blocks / count) * CHANGE_SIZE, CHANGE_SIZE, seed);
+
+    std::string inserted(CHANGE_SIZE, '\0');
+    Randomize(inserted, 0, CHANGE_SIZE, seed);
+    changed.insert(changed.size() / 2, inserted);
+
+    return changed;
+}
+
+} // anonymous namespace
+
+
+int main(int argc, char **argv)
+{
+    const size_t mb = argc > 1 ? atoi(argv[1]) : 64;
+
+    CreateDeltaW_t createDelta = GetCreateDeltaFunc();
+    if ( !createDelta || !IsDeltaPatchSupported() )
+    {
+        fprintf(stderr, "MSDelta is not available\n");
+        return 1;
+    }
+
+    const std::wstring oldFile = TempFile(L"old");
+    const std::wstring newFile = TempFile(L"new");
+    const std::wstring delta = TempFile(L"delta");
+    const std::wstring target = TempFile(L"target");
+
+    std::string installer(mb * 1024 * 1024, '\0');
+    unsigned seed = 1;
+    Randomize(installer, 0, installer.size(), seed);
+    WriteTestFile(oldFile, installer);
+
+    printf("%u MB installer, apply times in ms\n\n", unsigned(mb));
+    printf("%-9s %12s %12s %8s %10s\n", "changed", "full bytes", "delta bytes", "saved", "apply");
+
+    const double percents[] = { 0.1, 1, 10, 50 };
+    for ( size_t i = 0; i < sizeof(percents) / sizeof(percents[0]); i++ )
+    {
+        const std::string changed = ChangeInstaller(installer, percents[i]);
+        WriteTestFile(newFile, changed);
+
+        DELTA_INPUT noOptions = { NULL, 0, FALSE };
+        FILETIME time;
+        GetSystemTimeAsFileTime(&time);
+        if ( !createDelta(DELTA_FILE_TYPE_RAW, 0, 0,
+                          oldFile.c_str(), newFile.c_str(), NULL, NULL,
+                          noOptions, &time, 0, delta.c_str()) )
+        {
+            fprintf(stderr, "creating delta failed\n");
+            return 1;
+        }
+
+        // best of several runs, the first one also fills the disk cache
+        double apply = 0;
+        for ( int run = 0; run < 3; run++ )
+        {
+            const Clock::time_point start = Clock::now();
+            ApplyDeltaPatch(oldFile, delta, target);
+            const double ms = Ms(start, Clock::now());
+            apply = run == 0 ? ms : std::min(apply, ms);
+        }
+
+        const unsigned long long full = changed.size();
+        const unsigned long long deltaSize = FileSize(delta);
+        printf("%7.1f %%  %12llu %12llu %7.1f%% %10.1f\n",
+               percents[i], full, deltaSize,
+               100.0 * (1.0 - double(deltaSize) / full), apply);
+    }
+
+    DeleteFile(oldFile.c_str());
+    DeleteFile(newFile.c_str());
+    DeleteFile(delta.c_str());
+    DeleteFile(target.c_str());
+
+    return 0;
+}
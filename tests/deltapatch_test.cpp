@@ -0,0 +1,310 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+// Tests of delta updates: picking the delta for the installed version and
+// applying it, including the failures that make the updater fall back to
+// downloading the full update.
+
+#include "appcast.h"
+#include "deltapatch.h"
+#include "error.h"
+#include "test.h"
+
+#include <windows.h>
+
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+using namespace winsparkle;
+
+namespace
+{
+
+// from msdelta.h, which isn't available with all compilers:
+typedef long long DELTA_FILE_TYPE;
+typedef long long DELTA_FLAG_TYPE;
+struct DELTA_INPUT
+{
+    const void *lpStart;
+    size_t uSize;
+    BOOL Editable;
+};
+typedef BOOL (WINAPI *CreateDeltaW_t)(DELTA_FILE_TYPE, DELTA_FLAG_TYPE, DELTA_FLAG_TYPE,
+                                      LPCWSTR, LPCWSTR, LPCWSTR, LPCWSTR,
+                                      DELTA_INPUT, const FILETIME*, unsigned, LPCWSTR);
+
+const DELTA_FILE_TYPE DELTA_FILE_TYPE_RAW = 1;
+
+CreateDeltaW_t GetCreateDeltaFunc()
+{
+    wchar_t sysdir[MAX_PATH + 1];
+    const UINT len = GetSystemDirectory(sysdir, MAX_PATH + 1);
+    if ( len == 0 || len > MAX_PATH )
+        return NULL;
+
+    HMODULE dll = LoadLibrary((std::wstring(sysdir) + L"\\msdelta.dll").c_str());
+    if ( !dll )
+        return NULL;
+    return (CreateDeltaW_t)GetProcAddress(dll, "CreateDeltaW");
+}
+
+
+std::wstring TempFile(const wchar_t *name)
+{
+    wchar_t dir[MAX_PATH + 1];
+    GetTempPath(MAX_PATH + 1, dir);
+    return std::wstring(dir) + L"WinSparkle_deltapatch_test_" + name;
+}
+
+bool FileExists(const std::wstring& path)
+{
+    return GetFileAttributes(path.c_str()) != INVALID_FILE_ATTRIBUTES;
+}
+
+void WriteTestFile(const std::wstring& path, const std::string& data)
+{
+    FILE *f = _wfopen(path.c_str(), L"wb");
+    if ( !f )
+        throw std::runtime_error("can't create test file");
+    fwrite(data.data(), 1, data.size(), f);
+    fclose(f);
+}
+
+std::string ReadTestFile(const std::wstring& path)
+{
+    std::string data;
+    FILE *f = _wfopen(path.c_str(), L"rb");
+    if ( !f )
+        return data;
+    char buf[4096];
+    size_t len;
+    while ( (len = fread(buf, 1, sizeof(buf), f)) > 0 )
+        data.append(buf, len);
+    fclose(f);
+    return data;
+}
+
+std::string MakeData(size_t len, unsigned seed)
+{
+    std::string data(len, '\0');
+    unsigned x = seed;
+    for ( size_t i = 0; i < len; i++ )
+    {
+        x = x * 1103515245 + 12345;
+        data[i] = char(x >> 16);
+    }
+    return data;
+}
+
+
+// Files of a delta update from "old" to "new", removed when done.
+struct DeltaFiles
+{
+    DeltaFiles()
+        : oldFile(TempFile(L"old")),
+          newFile(TempFile(L"new")),
+          otherFile(TempFile(L"other")),
+          delta(TempFile(L"delta")),
+          target(TempFile(L"target"))
+    {
+        oldData = MakeData(256 * 1024, 1);
+        newData = oldData;
+        for ( size_t i = 0; i < newData.size(); i += 4096 )
+            newData[i] ^= 0x5a;
+        newData += MakeData(16 * 1024, 2);
+
+        WriteTestFile(oldFile, oldData);
+        WriteTestFile(newFile, newData);
+        WriteTestFile(otherFile, MakeData(oldData.size(), 3));
+    }
+
+    ~DeltaFiles()
+    {
+        DeleteFile(oldFile.c_str());
+        DeleteFile(newFile.c_str());
+        DeleteFile(otherFile.c_str());
+        DeleteFile(delta.c_str());
+        DeleteFile(target.c_str());
+    }
+
+    bool CreateDelta(CreateDeltaW_t createDelta)
+    {
+        DELTA_INPUT noOptions = { NULL, 0, FALSE };
+        FILETIME time;
+        GetSystemTimeAsFileTime(&time);
+        return createDelta(DELTA_FILE_TYPE_RAW, 0, 0,
+                           oldFile.c_str(), newFile.c_str(), NULL, NULL,
+                           noOptions, &time, 0, delta.c_str()) != FALSE;
+    }
+
+    std::wstring oldFile, newFile, otherFile, delta, target;
+    std::string oldData, newData;
+};
+
+
+Appcast MakeAppcast()
+{
+    Appcast a;
+    a.Version = "2.0";
+    a.enclosure.DownloadURL = "app-2.0.exe";
+    a.enclosure.OS = "windows-x64";
+
+    Appcast::Enclosure d;
+    d.DeltaFrom = "1.8";
+    d.DownloadURL = "2.0-from-1.8.delta";
+    a.Deltas.push_back(d);
+
+    d.DeltaFrom = "1.9";
+    d.DownloadURL = "2.0-from-1.9-x86.delta";
+    d.OS = "windows-x86";
+    a.Deltas.push_back(d);
+
+    d.DownloadURL = "2.0-from-1.9-x64.delta";
+    d.OS = "windows-x64";
+    a.Deltas.push_back(d);
+
+    return a;
+}
+
+} // anonymous namespace
+
+
+void TestFindDelta()
+{
+    const Appcast a = MakeAppcast();
+
+    const Appcast::Enclosure *d = a.FindDelta("1.8");
+    CHECK(d != NULL);
+    if ( d )
+        CHECK_EQUAL(d->DownloadURL, "2.0-from-1.8.delta");
+
+    // the delta for the same OS as the full update is preferred
+    d = a.FindDelta("1.9");
+    CHECK(d != NULL);
+    if ( d )
+        CHECK_EQUAL(d->DownloadURL, "2.0-from-1.9-x64.delta");
+}
+
+
+void TestNoDeltaForVersion()
+{
+    // versions without a delta are updated with the full download
+    const Appcast a = MakeAppcast();
+    CHECK(a.FindDelta("1.7") == NULL);
+    CHECK(a.FindDelta("") == NULL);
+    CHECK(a.FindDelta("1.9.1") == NULL);
+
+    Appcast noDeltas;
+    noDeltas.Version = "2.0";
+    CHECK(noDeltas.FindDelta("1.9") == NULL);
+}
+
+
+void TestUnsupported()
+{
+    if ( IsDeltaPatchSupported() )
+        return;
+
+    // without MSDelta, applying fails and the full update is used instead
+    DeltaFiles files;
+    CHECK_THROWS(ApplyDeltaPatch(files.oldFile, files.delta, files.target),
+                 std::runtime_error);
+    CHECK(!FileExists(files.target));
+}
+
+
+void TestApplyDelta(CreateDeltaW_t createDelta)
+{
+    DeltaFiles files;
+    CHECK(files.CreateDelta(createDelta));
+
+    ApplyDeltaPatch(files.oldFile, files.delta, files.target);
+    CHECK(ReadTestFile(files.target) == files.newData);
+
+    // an existing target is replaced
+    WriteTestFile(files.target, "stale");
+    ApplyDeltaPatch(files.oldFile, files.delta, files.target);
+    CHECK(ReadTestFile(files.target) == files.newData);
+}
+
+
+void TestWrongSource(CreateDeltaW_t createDelta)
+{
+    // e.g. the user modified or replaced the installed version's installer
+    DeltaFiles files;
+    CHECK(files.CreateDelta(createDelta));
+
+    CHECK_THROWS(ApplyDeltaPatch(files.otherFile, files.delta, files.target),
+                 Win32Exception);
+    CHECK(!FileExists(files.target));
+
+    CHECK_THROWS(ApplyDeltaPatch(TempFile(L"missing"), files.delta, files.target),
+                 Win32Exception);
+    CHECK(!FileExists(files.target));
+}
+
+
+void TestCorruptDelta(CreateDeltaW_t createDelta)
+{
+    DeltaFiles files;
+    CHECK(files.CreateDelta(createDelta));
+
+    std::string delta = ReadTestFile(files.delta);
+    CHECK(!delta.empty());
+    delta.resize(delta.size() / 2);
+    WriteTestFile(files.delta, delta);
+
+    CHECK_THROWS(ApplyDeltaPatch(files.oldFile, files.delta, files.target),
+                 Win32Exception);
+    CHECK(!FileExists(files.target));
+}
+
+
+int main()
+{
+    TestFindDelta();
+    TestNoDeltaForVersion();
+    TestUnsupported();
+
+    if ( IsDeltaPatchSupported() )
+    {
+        CreateDeltaW_t createDelta = GetCreateDeltaFunc();
+        CHECK(createDelta != NULL);
+        if ( createDelta )
+        {
+            TestApplyDelta(createDelta);
+            TestWrongSource(createDelta);
+            TestCorruptDelta(createDelta);
+        }
+    }
+    else
+    {
+        printf("MSDelta is not available, skipping tests of applying deltas\n");
+    }
+
+    return TestResult();
+}
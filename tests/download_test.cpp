@@ -0,0 +1,618 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+// Tests of downloads, run against FakeHttpTransport.
+
+#include "download.h"
+#include "test.h"
+#include "fakehttp.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace winsparkle;
+using namespace winsparkle::test;
+
+namespace
+{
+
+const char APPCAST_URL[] = "http://example.com/appcast.xml";
+const char INSTALLER_URL[] = "http://example.com/installer.exe";
+
+std::string MakeData(size_t length)
+{
+    std::string data(length, '\0');
+    for ( size_t i = 0; i < length; i++ )
+        data[i] = char((i * 7919) >> 3);
+    return data;
+}
+
+
+// Stores downloaded data in memory, checking that no byte is written twice.
+struct MemorySink : public IRandomAccessDownloadSink
+{
+    MemorySink() : preallocated(false), overwritten(false), resumed(false) {}
+
+    virtual void SetLength(size_t) {}
+    virtual void SetFilename(const std::wstring& name) { filename = name; }
+
+    virtual void Add(const void *data, size_t len)
+    {
+        this->data.append(static_cast<const char*>(data), len);
+    }
+
+    virtual void Preallocate(size_t len)
+    {
+        preallocated = true;
+        data.assign(len, '\0');
+        written.assign(len, false);
+    }
+
+    virtual void AddAt(size_t offset, const void *data, size_t len)
+    {
+        CHECK(offset + len <= this->data.size());
+        for ( size_t i = offset; i < offset + len; i++ )
+        {
+            if ( written[i] )
+                overwritten = true;
+            written[i] = true;
+        }
+        this->data.replace(offset, len, static_cast<const char*>(data), len);
+    }
+
+    // Data of the partial download, as if stored in a file.
+    void SetPartialData(const std::string& data, const PartialDownload& state)
+    {
+        partialData.assign(data.size(), '\0');
+        for ( size_t i = 0; i < state.Completed.size(); i++ )
+        {
+            const PartialDownload::Range& r = state.Completed[i];
+            partialData.replace(r.From, r.To - r.From, data, r.From, r.To - r.From);
+        }
+    }
+
+    virtual bool ResumePartial(const PartialDownload& state)
+    {
+        if ( partialData.size() != state.Length )
+            return false;
+
+        resumed = true;
+        data = partialData;
+        written.assign(state.Length, false);
+        for ( size_t i = 0; i < state.Completed.size(); i++ )
+        {
+            for ( size_t j = state.Completed[i].From; j < state.Completed[i].To; j++ )
+                written[j] = true;
+        }
+        return true;
+    }
+
+    virtual void SaveProgress(const PartialDownload& state)
+    {
+        progress = state;
+    }
+
+    std::wstring filename;
+    std::string data;
+    bool preallocated;
+    std::vector<bool> written;
+    bool overwritten;
+
+    std::string partialData;
+    bool resumed;
+    PartialDownload progress;
+};
+
+size_t CountRangeRequests(const std::vector<HttpRequestParams>& requests)
+{
+    size_t count = 0;
+    for ( size_t i = 0; i < requests.size(); i++ )
+    {
+        if ( requests[i].HasRange )
+            count++;
+    }
+    return count;
+}
+
+
+/*--------------------------------------------------------------------------*
+                           conditional requests
+ *--------------------------------------------------------------------------*/
+
+void TestConditionalRequest()
+{
+    FakeHttpTransport transport;
+    FakeHttpTransportScope scope(transport);
+
+    FakeResource appcast;
+    appcast.Body = "<rss><channel></channel></rss>";
+    appcast.ETag = "\"v1\"";
+    appcast.LastModified = "Mon, 01 Jan 2024 00:00:00 GMT";
+    transport.Add(APPCAST_URL, appcast);
+
+    // unconditional request gets the data and the validators
+    {
+        StringDownloadSink sink;
+        const DownloadInfo info = DownloadFile(APPCAST_URL, &sink, NULL);
+        CHECK_EQUAL(info.StatusCode, 200u);
+        CHECK(!info.IsNotModified());
+        CHECK_EQUAL(info.ETag, appcast.ETag);
+        CHECK_EQUAL(info.LastModified, appcast.LastModified);
+        CHECK_EQUAL(sink.data, appcast.Body);
+    }
+
+    // conditional requests for unchanged resource don't pass any data
+    const std::string validators[] =
+    {
+        "If-None-Match: \"v1\"\r\n",
+        "If-Modified-Since: Mon, 01 Jan 2024 00:00:00 GMT\r\n",
+        "If-None-Match: \"v1\"\r\nIf-Modified-Since: Mon, 01 Jan 2024 00:00:00 GMT\r\n"
+    };
+    for ( size_t i = 0; i < sizeof(validators) / sizeof(validators[0]); i++ )
+    {
+        transport.ClearRequests();
+
+        StringDownloadSink sink;
+        const DownloadInfo info = DownloadFile(APPCAST_URL, &sink, NULL, "X-Custom: 1\r\n" + validators[i]);
+        CHECK(info.IsNotModified());
+        CHECK(sink.data.empty());
+
+        // the headers were sent as given
+        const std::vector<HttpRequestParams> requests = transport.GetRequests();
+        CHECK_EQUAL(requests.size(), 1u);
+        if ( !requests.empty() )
+            CHECK_EQUAL(requests[0].Headers, "X-Custom: 1\r\n" + validators[i]);
+    }
+
+    // changed resource is downloaded again, with new validators
+    appcast.Body = "<rss><channel><item/></channel></rss>";
+    appcast.ETag = "\"v2\"";
+    appcast.LastModified = "Tue, 02 Jan 2024 00:00:00 GMT";
+    transport.Add(APPCAST_URL, appcast);
+    {
+        StringDownloadSink sink;
+        const DownloadInfo info = DownloadFile(APPCAST_URL, &sink, NULL, validators[2]);
+        CHECK_EQUAL(info.StatusCode, 200u);
+        CHECK_EQUAL(info.ETag, "\"v2\"");
+        CHECK_EQUAL(info.LastModified, appcast.LastModified);
+        CHECK_EQUAL(sink.data, appcast.Body);
+    }
+}
+
+
+void TestErrorResponse()
+{
+    FakeHttpTransport transport;
+    FakeHttpTransportScope scope(transport);
+
+    StringDownloadSink sink;
+    CHECK_THROWS(DownloadFile("http://example.com/missing", &sink, NULL), std::runtime_error);
+
+    // unless explicitly accepted
+    const DownloadInfo info = DownloadFile("http://example.com/missing", &sink, NULL, "", Download_AcceptErrors);
+    CHECK_EQUAL(info.StatusCode, 404u);
+}
+
+
+
+/*--------------------------------------------------------------------------*
+                           segmented downloads
+ *--------------------------------------------------------------------------*/
+
+FakeResource MakeInstaller(size_t length)
+{
+    FakeResource installer;
+    installer.Body = MakeData(length);
+    installer.ETag = "\"installer-1\"";
+    installer.ReadSize = 64 * 1024;
+    installer.ReadDelay = 1;
+    return installer;
+}
+
+
+// Connections that become idle take over parts of the remaining data, so
+// that the whole resource is downloaded exactly once over several of them.
+void TestSegmentedDownload()
+{
+    FakeHttpTransport transport;
+    FakeHttpTransportScope scope(transport);
+
+    const FakeResource installer = MakeInstaller(8 * 1024 * 1024 + 123);
+    transport.Add(INSTALLER_URL, installer);
+
+    MemorySink sink;
+    const DownloadInfo info = DownloadFileSegmented(INSTALLER_URL, &sink, NULL, 4);
+    CHECK_EQUAL(info.StatusCode, 200u);
+    CHECK(sink.preallocated);
+    CHECK(!sink.overwritten);
+    CHECK(sink.data == installer.Body);
+    CHECK(sink.filename == L"installer.exe");
+
+    const std::vector<HttpRequestParams> requests = transport.GetRequests();
+    const size_t ranges = CountRangeRequests(requests);
+    // the initial request is used for the first segment, at most three more
+    // connections steal halves of the largest segment, which can repeat as
+    // they finish
+    CHECK(ranges >= 3);
+    for ( size_t i = 0; i < requests.size(); i++ )
+    {
+        if ( !requests[i].HasRange )
+            continue;
+        // range requests are conditional, so that different versions of
+        // the resource are never mixed
+        std::string ifRange;
+        CHECK(FakeHttpTransport::GetRequestHeader(requests[i], "If-Range", ifRange));
+        CHECK_EQUAL(ifRange, installer.ETag);
+        CHECK(requests[i].RangeFrom < requests[i].RangeTo);
+    }
+}
+
+
+// Without range support or with few connections, the download is a single
+// stream.
+void TestUnsegmentedDownload()
+{
+    FakeHttpTransport transport;
+    FakeHttpTransportScope scope(transport);
+
+    FakeResource installer = MakeInstaller(5 * 1024 * 1024);
+    installer.AcceptRanges = false;
+    transport.Add(INSTALLER_URL, installer);
+
+    {
+        MemorySink sink;
+        DownloadFileSegmented(INSTALLER_URL, &sink, NULL, 4);
+        CHECK(!sink.preallocated);
+        CHECK(sink.data == installer.Body);
+        CHECK_EQUAL(transport.GetRequests().size(), 1u);
+    }
+
+    // too small to be worth it
+    installer = MakeInstaller(100 * 1024);
+    transport.Add(INSTALLER_URL, installer);
+    transport.ClearRequests();
+    {
+        MemorySink sink;
+        DownloadFileSegmented(INSTALLER_URL, &sink, NULL, 4);
+        CHECK(!sink.preallocated);
+        CHECK(sink.data == installer.Body);
+        CHECK_EQUAL(transport.GetRequests().size(), 1u);
+    }
+
+    installer = MakeInstaller(5 * 1024 * 1024);
+    transport.Add(INSTALLER_URL, installer);
+    transport.ClearRequests();
+    {
+        MemorySink sink;
+        DownloadFileSegmented(INSTALLER_URL, &sink, NULL, 1);
+        CHECK(sink.data == installer.Body);
+        CHECK_EQUAL(transport.GetRequests().size(), 1u);
+    }
+}
+
+
+
+/*--------------------------------------------------------------------------*
+                           resuming downloads
+ *--------------------------------------------------------------------------*/
+
+PartialDownload MakePartialDownload(const FakeResource& resource)
+{
+    PartialDownload state;
+    state.URL = INSTALLER_URL;
+    state.Validator = resource.ETag;
+    state.Length = resource.Body.size();
+
+    PartialDownload::Range r1 = { 0, 3 * 1024 * 1024 + 17 };
+    PartialDownload::Range r2 = { 5 * 1024 * 1024, 6 * 1024 * 1024 };
+    state.Completed.push_back(r1);
+    state.Completed.push_back(r2);
+    return state;
+}
+
+
+void TestPartialDownloadFormat()
+{
+    const PartialDownload state = MakePartialDownload(MakeInstaller(8 * 1024 * 1024));
+
+    PartialDownload parsed;
+    CHECK(ParsePartialDownload(FormatPartialDownload(state), parsed));
+    CHECK_EQUAL(parsed.URL, state.URL);
+    CHECK_EQUAL(parsed.Validator, state.Validator);
+    CHECK_EQUAL(parsed.Length, state.Length);
+    CHECK_EQUAL(parsed.Completed.size(), 2u);
+    if ( parsed.Completed.size() == 2 )
+    {
+        CHECK_EQUAL(parsed.Completed[0].From, state.Completed[0].From);
+        CHECK_EQUAL(parsed.Completed[0].To, state.Completed[0].To);
+        CHECK_EQUAL(parsed.Completed[1].From, state.Completed[1].From);
+        CHECK_EQUAL(parsed.Completed[1].To, state.Completed[1].To);
+    }
+
+    // nothing downloaded yet
+    PartialDownload empty;
+    empty.URL = INSTALLER_URL;
+    empty.Length = 100;
+    CHECK(ParsePartialDownload(FormatPartialDownload(empty), parsed));
+    CHECK(parsed.Completed.empty());
+    CHECK(parsed.Validator.empty());
+
+    // damaged journals are rejected, so that the download starts over
+    const wchar_t *const damaged[] =
+    {
+        L"",
+        L"http://example.com/installer.exe",
+        L"http://example.com/installer.exe\n\"v1\"\n",
+        L"\n\"v1\"\n100\n0-10 ",
+        L"http://example.com/installer.exe\n\"v1\"\nlong\n0-10 ",
+        L"http://example.com/installer.exe\n\"v1\"\n100x\n0-10 ",
+        L"http://example.com/installer.exe\n\"v1\"\n100\n0-10 20-",
+        L"http://example.com/installer.exe\n\"v1\"\n100\n0-10 20+30 ",
+        L"http://example.com/installer.exe\n\"v1\"\n100\n10-10 ",
+        L"http://example.com/installer.exe\n\"v1\"\n100\n20-10 ",
+        L"http://example.com/installer.exe\n\"v1\"\n100\n0-101 ",
+        L"http://example.com/installer.exe\n\"v1\"\n100\n0-10 garbage",
+        L"http://example.com/installer.exe\n\"v1\"\n100\n0-99999999999999999999999 "
+    };
+    for ( size_t i = 0; i < sizeof(damaged) / sizeof(damaged[0]); i++ )
+    {
+        if ( ParsePartialDownload(damaged[i], parsed) )
+        {
+            winsparkle::test::ReportFailure(__FILE__, __LINE__,
+                "damaged journal " + std::to_string(i) + " was accepted");
+        }
+    }
+}
+
+
+// Only missing ranges are downloaded when resuming.
+void TestResumeDownload()
+{
+    FakeHttpTransport transport;
+    FakeHttpTransportScope scope(transport);
+
+    const FakeResource installer = MakeInstaller(8 * 1024 * 1024);
+    transport.Add(INSTALLER_URL, installer);
+
+    const PartialDownload state = MakePartialDownload(installer);
+
+    MemorySink sink;
+    sink.SetPartialData(installer.Body, state);
+    DownloadFileSegmented(INSTALLER_URL, &sink, NULL, 4, &state);
+
+    CHECK(sink.resumed);
+    CHECK(!sink.preallocated);
+    CHECK(!sink.overwritten);
+    CHECK(sink.data == installer.Body);
+
+    // all requests were conditional range requests for missing data
+    const std::vector<HttpRequestParams> requests = transport.GetRequests();
+    CHECK(!requests.empty());
+    for ( size_t i = 0; i < requests.size(); i++ )
+    {
+        const HttpRequestParams& r = requests[i];
+        CHECK(r.HasRange);
+        std::string ifRange;
+        CHECK(FakeHttpTransport::GetRequestHeader(r, "If-Range", ifRange) && ifRange == installer.ETag);
+        for ( size_t j = 0; j < state.Completed.size(); j++ )
+            CHECK(r.RangeTo <= state.Completed[j].From || r.RangeFrom >= state.Completed[j].To);
+    }
+}
+
+
+// If the resource changed since, partial data are discarded.
+void TestResumeChangedResource()
+{
+    FakeHttpTransport transport;
+    FakeHttpTransportScope scope(transport);
+
+    FakeResource installer = MakeInstaller(8 * 1024 * 1024);
+    const PartialDownload state = MakePartialDownload(installer);
+
+    installer.Body[100] ^= 1;
+    installer.ETag = "\"installer-2\"";
+    transport.Add(INSTALLER_URL, installer);
+
+    MemorySink sink;
+    sink.SetPartialData(MakeInstaller(8 * 1024 * 1024).Body, state);
+    DownloadFileSegmented(INSTALLER_URL, &sink, NULL, 4, &state);
+
+    CHECK(!sink.resumed);
+    CHECK(sink.preallocated);
+    CHECK(sink.data == installer.Body);
+}
+
+
+// If the resource is shorter than the saved progress, the server responds
+// with 416 and the download starts over.
+void TestResumeUnsatisfiableRange()
+{
+    FakeHttpTransport transport;
+    FakeHttpTransportScope scope(transport);
+
+    const PartialDownload state = MakePartialDownload(MakeInstaller(8 * 1024 * 1024));
+
+    const FakeResource installer = MakeInstaller(2 * 1024 * 1024);
+    transport.Add(INSTALLER_URL, installer);
+
+    MemorySink sink;
+    sink.SetPartialData(MakeInstaller(8 * 1024 * 1024).Body, state);
+    const DownloadInfo info = DownloadFileSegmented(INSTALLER_URL, &sink, NULL, 4, &state);
+
+    CHECK_EQUAL(info.StatusCode, 200u);
+    CHECK(!sink.resumed);
+    CHECK(sink.data == installer.Body);
+}
+
+
+// Interrupted download saves its progress and can be resumed from it.
+void TestInterruptedDownload()
+{
+    FakeHttpTransport transport;
+    FakeHttpTransportScope scope(transport);
+
+    FakeResource installer = MakeInstaller(8 * 1024 * 1024);
+    installer.FailAfter = 1536 * 1024;
+    transport.Add(INSTALLER_URL, installer);
+
+    MemorySink sink;
+    CHECK_THROWS(DownloadFileSegmented(INSTALLER_URL, &sink, NULL, 4), DownloadException);
+
+    const PartialDownload progress = sink.progress;
+    CHECK_EQUAL(progress.URL, std::string(INSTALLER_URL));
+    CHECK_EQUAL(progress.Validator, installer.ETag);
+    CHECK(!progress.Completed.empty());
+
+    size_t completed = 0;
+    for ( size_t i = 0; i < progress.Completed.size(); i++ )
+    {
+        const PartialDownload::Range& r = progress.Completed[i];
+        completed += r.To - r.From;
+        // saved ranges were really written
+        CHECK(sink.data.compare(r.From, r.To - r.From, installer.Body, r.From, r.To - r.From) == 0);
+    }
+    CHECK(completed > 0 && completed < installer.Body.size());
+
+    // the journal survives a restart
+    PartialDownload journal;
+    CHECK(ParsePartialDownload(FormatPartialDownload(progress), journal));
+
+    installer.FailAfter = size_t(-1);
+    transport.Add(INSTALLER_URL, installer);
+    transport.ClearRequests();
+
+    MemorySink resumed;
+    resumed.partialData = sink.data;
+    DownloadFileSegmented(INSTALLER_URL, &resumed, NULL, 4, &journal);
+    CHECK(resumed.resumed);
+    CHECK(!resumed.overwritten);
+    CHECK(resumed.data == installer.Body);
+
+    size_t downloaded = 0;
+    const std::vector<HttpRequestParams> requests = transport.GetRequests();
+    for ( size_t i = 0; i < requests.size(); i++ )
+        downloaded += requests[i].RangeTo - requests[i].RangeFrom;
+    CHECK(downloaded <= installer.Body.size() - completed);
+}
+
+
+/*--------------------------------------------------------------------------*
+                                read sizes
+ *--------------------------------------------------------------------------*/
+
+// Returns statistics of reads done since @a before.
+DownloadReadStats ReadStatsSince(const DownloadReadStats& before)
+{
+    DownloadReadStats stats = GetDownloadReadStats();
+    stats.Reads -= before.Reads;
+    stats.Bytes -= before.Bytes;
+    stats.TotalLatency -= before.TotalLatency;
+    for ( std::map<size_t, unsigned long long>::const_iterator i = before.ReadSizes.begin();
+          i != before.ReadSizes.end(); ++i )
+    {
+        stats.ReadSizes[i->first] -= i->second;
+        if ( stats.ReadSizes[i->first] == 0 )
+            stats.ReadSizes.erase(i->first);
+    }
+    return stats;
+}
+
+
+// Reads grow while the connection has more data ready than they can take.
+void TestReadSizeGrows()
+{
+    FakeHttpTransport transport;
+    FakeHttpTransportScope scope(transport);
+
+    FakeResource installer;
+    installer.Body = MakeData(8 * 1024 * 1024);
+    transport.Add(INSTALLER_URL, installer);
+
+    const DownloadReadStats before = GetDownloadReadStats();
+    StringDownloadSink sink;
+    DownloadFile(INSTALLER_URL, &sink, NULL);
+    CHECK(sink.data == installer.Body);
+
+    DownloadReadStats stats = ReadStatsSince(before);
+    CHECK_EQUAL(stats.Bytes, installer.Body.size());
+
+    // 16 KB, 64 KB and 256 KB once each, then the largest reads only, and
+    // one more read to find out that there's nothing left
+    CHECK_EQUAL(stats.ReadSizes[16 * 1024], 1u);
+    CHECK_EQUAL(stats.ReadSizes[64 * 1024], 1u);
+    CHECK_EQUAL(stats.ReadSizes[256 * 1024], 1u);
+    CHECK_EQUAL(stats.ReadSizes.size(), 4u);
+    CHECK_EQUAL(stats.ReadSizes[1024 * 1024], 9u);
+}
+
+
+// Reads stay small when the connection delivers little data at a time.
+void TestReadSizeOnSlowConnection()
+{
+    FakeHttpTransport transport;
+    FakeHttpTransportScope scope(transport);
+
+    FakeResource installer;
+    installer.Body = MakeData(256 * 1024);
+    installer.ReadSize = 8 * 1024;
+    installer.ReadDelay = 2;
+    transport.Add(INSTALLER_URL, installer);
+
+    const DownloadReadStats before = GetDownloadReadStats();
+    StringDownloadSink sink;
+    DownloadFile(INSTALLER_URL, &sink, NULL);
+    CHECK(sink.data == installer.Body);
+
+    DownloadReadStats stats = ReadStatsSince(before);
+    CHECK_EQUAL(stats.Reads, installer.Body.size() / installer.ReadSize + 1);
+    CHECK_EQUAL(stats.ReadSizes.size(), 1u);
+    CHECK_EQUAL(stats.ReadSizes[16 * 1024], stats.Reads);
+
+    // the time spent waiting for the data is measured
+    CHECK(stats.TotalLatency >= stats.Reads * 1000);
+    CHECK(stats.MaxLatency >= 2000);
+}
+
+} // anonymous namespace
+
+
+int main()
+{
+    TestConditionalRequest();
+    TestErrorResponse();
+    TestSegmentedDownload();
+    TestUnsegmentedDownload();
+    TestPartialDownloadFormat();
+    TestResumeDownload();
+    TestResumeChangedResource();
+    TestResumeUnsatisfiableRange();
+    TestInterruptedDownload();
+    TestReadSizeGrows();
+    TestReadSizeOnSlowConnection();
+
+    return TestResult();
+}
@@ -0,0 +1,182 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+// Throughput benchmark of DownloadPipeline with an in-memory source: of data
+// read into a fixed 10 KB buffer and copied by the sink, as DownloadFile()
+// used to do, and of data read into pooled buffers of several sizes that are
+// passed through the stages by reference.
+//
+// Usage: downloadpipeline_benchmark [total MB]
+
+#include "downloadpipeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace winsparkle;
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+// Accounts for the data passing through it, like progress reporting does.
+class CountingStage : public DownloadStage
+{
+public:
+    CountingStage() : Bytes(0) {}
+
+    virtual void Process(const DownloadChunk& chunk)
+    {
+        Bytes += chunk.Length;
+        DownloadStage::Process(chunk);
+    }
+
+    size_t Bytes;
+};
+
+
+// Keeps a reference to the last buffer it got, or a copy of the last data if
+// they weren't in a buffer, as a stage storing them for later would.
+class KeepingStage : public DownloadStage
+{
+public:
+    KeepingStage() : m_buffer(NULL) {}
+    ~KeepingStage() { Reset(); }
+
+    virtual void Process(const DownloadChunk& chunk)
+    {
+        Reset();
+        if ( chunk.Buffer )
+        {
+            m_buffer = chunk.Buffer;
+            m_buffer->AddRef();
+        }
+        else
+        {
+            m_copy.assign(chunk.Data, chunk.Data + chunk.Length);
+        }
+        DownloadStage::Process(chunk);
+    }
+
+private:
+    void Reset()
+    {
+        if ( m_buffer )
+            m_buffer->Release();
+        m_buffer = NULL;
+    }
+
+    DownloadBuffer *m_buffer;
+    std::vector<char> m_copy;
+};
+
+
+// "Downloads" @a total bytes from memory through a pipeline of @a stages
+// counting stages and a KeepingStage, reading @a readSize bytes at a time.
+// Returns throughput in MB/s.
+double Run(const std::vector<char>& source, size_t total, size_t readSize, bool pooled, int stages)
+{
+    std::vector<CountingStage> counters(stages);
+    KeepingStage keeper;
+
+    DownloadPipeline pipeline;
+    for ( int i = 0; i < stages; i++ )
+        pipeline.Append(&counters[i]);
+    pipeline.Append(&keeper);
+
+    BufferPool& pool = BufferPool::GetShared(readSize);
+    char fixed[10240];
+
+    const Clock::time_point start = Clock::now();
+
+    size_t pos = 0;
+    for ( size_t done = 0; done < total; )
+    {
+        const size_t len = std::min(std::min(readSize, total - done), source.size() - pos);
+
+        // the read itself, i.e. copying from the network stack
+        if ( pooled )
+        {
+            DownloadBuffer *buffer = pool.Get();
+            memcpy(buffer->GetData(), &source[pos], len);
+            pipeline.AddBuffer(buffer, len);
+            buffer->Release();
+        }
+        else
+        {
+            memcpy(fixed, &source[pos], len);
+            pipeline.Add(fixed, len);
+        }
+
+        done += len;
+        pos = (pos + len) % source.size();
+    }
+    pipeline.Finish();
+
+    const double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    if ( !counters.empty() && counters[0].Bytes != total )
+        printf("(lost data)\n");
+    return total / (1024.0 * 1024.0) / (ms / 1000.0);
+}
+
+} // anonymous namespace
+
+
+int main(int argc, char **argv)
+{
+    const size_t mb = argc > 1 ? atoi(argv[1]) : 2048;
+    const size_t total = mb * 1024 * 1024;
+
+    std::vector<char> source(4 * 1024 * 1024);
+    for ( size_t i = 0; i < source.size(); i++ )
+        source[i] = char(i * 7919 >> 5);
+
+    printf("%u MB through the pipeline, throughput in MB/s\n\n", unsigned(mb));
+    printf("%-22s %10s %10s\n", "reads", "1 stage", "4 stages");
+
+    printf("%-22s", "10 KB, copied");
+    for ( int stages = 0; stages <= 3; stages += 3 )
+        printf(" %10.0f", Run(source, total, 10240, false, stages));
+    printf("\n");
+
+    const size_t sizes[] = { 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024 };
+    for ( size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++ )
+    {
+        char label[32];
+        snprintf(label, sizeof(label), "%u KB, pooled", unsigned(sizes[i] / 1024));
+        printf("%-22s", label);
+        for ( int stages = 0; stages <= 3; stages += 3 )
+            printf(" %10.0f", Run(source, total, sizes[i], true, stages));
+        printf("\n");
+    }
+
+    return 0;
+}
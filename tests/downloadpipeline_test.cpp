@@ -0,0 +1,573 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+// Tests of DownloadPipeline, its stages and the pool of buffers passed
+// between them, including AsyncWriteStage, which passes them to the
+// following stages on a separate thread.
+
+#include "downloadpipeline.h"
+#include "test.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace winsparkle;
+
+namespace
+{
+
+// Records calls and the data passed through it.
+class RecordingStage : public DownloadStage
+{
+public:
+    RecordingStage(const std::string& name, std::string& log, bool resume = true)
+        : Length(0), m_name(name), m_log(log), m_resume(resume) {}
+
+    virtual void SetLength(size_t len)
+    {
+        Log("SetLength");
+        Length = len;
+        DownloadStage::SetLength(len);
+    }
+
+    virtual void SetFilename(const std::wstring& filename)
+    {
+        Log("SetFilename");
+        Filename = filename;
+        DownloadStage::SetFilename(filename);
+    }
+
+    virtual void Preallocate(size_t len)
+    {
+        Log("Preallocate");
+        DownloadStage::Preallocate(len);
+    }
+
+    virtual bool ResumePartial(const PartialDownload& state)
+    {
+        Log("ResumePartial");
+        return m_resume && DownloadStage::ResumePartial(state);
+    }
+
+    virtual void Process(const DownloadChunk& chunk)
+    {
+        Log("Process");
+        Chunks.push_back(chunk);
+        Data.append(chunk.Data, chunk.Length);
+        DownloadStage::Process(chunk);
+    }
+
+    virtual void Finish()
+    {
+        Log("Finish");
+        DownloadStage::Finish();
+    }
+
+    size_t Length;
+    std::wstring Filename;
+    std::vector<DownloadChunk> Chunks;
+    std::string Data;
+
+private:
+    void Log(const char *call)
+    {
+        m_log += m_name + "." + call + " ";
+    }
+
+    std::string m_name;
+    std::string& m_log;
+    bool m_resume;
+};
+
+
+// Blocks processing of data until it's opened, like a very slow disk.
+class GateStage : public DownloadStage
+{
+public:
+    GateStage() : m_open(false), m_processed(0) {}
+
+    void Open()
+    {
+        {
+            CriticalSectionLocker lock(m_cs);
+            m_open = true;
+        }
+        m_opened.Signal();
+    }
+
+    size_t GetProcessed()
+    {
+        CriticalSectionLocker lock(m_cs);
+        return m_processed;
+    }
+
+    virtual void Process(const DownloadChunk& chunk)
+    {
+        for ( ;; )
+        {
+            {
+                CriticalSectionLocker lock(m_cs);
+                if ( m_open )
+                    break;
+            }
+            m_opened.WaitUntilSignaled();
+        }
+
+        {
+            CriticalSectionLocker lock(m_cs);
+            m_processed += chunk.Length;
+        }
+        DownloadStage::Process(chunk);
+    }
+
+private:
+    CriticalSection m_cs;
+    Event m_opened;
+    bool m_open;
+    size_t m_processed;
+};
+
+
+// Fails after processing given amount of data.
+class FailingStage : public DownloadStage
+{
+public:
+    FailingStage(size_t failAfter) : m_left(failAfter) {}
+
+    virtual void Process(const DownloadChunk& chunk)
+    {
+        if ( chunk.Length > m_left )
+            throw std::runtime_error("disk full");
+        m_left -= chunk.Length;
+        DownloadStage::Process(chunk);
+    }
+
+private:
+    size_t m_left;
+};
+
+
+// Adds data to a pipeline on its own thread, counting finished Add() calls.
+class ProducerThread : public Thread
+{
+public:
+    ProducerThread(DownloadPipeline& pipeline, const std::string& data, size_t chunkSize)
+        : Thread("test producer"),
+          m_pipeline(pipeline), m_data(data), m_chunkSize(chunkSize), m_added(0)
+    {}
+
+    size_t GetAdded()
+    {
+        CriticalSectionLocker lock(m_cs);
+        return m_added;
+    }
+
+protected:
+    virtual void Run()
+    {
+        SignalReady();
+
+        for ( size_t offset = 0; offset < m_data.size(); offset += m_chunkSize )
+        {
+            m_pipeline.Add(m_data.data() + offset, std::min(m_chunkSize, m_data.size() - offset));
+            CriticalSectionLocker lock(m_cs);
+            m_added++;
+        }
+    }
+
+    virtual bool IsJoinable() const { return true; }
+
+private:
+    DownloadPipeline& m_pipeline;
+    const std::string& m_data;
+    size_t m_chunkSize;
+    CriticalSection m_cs;
+    size_t m_added;
+};
+
+
+std::string MakeData(size_t len)
+{
+    std::string data(len, '\0');
+    for ( size_t i = 0; i < len; i++ )
+        data[i] = char((i * 7919) >> 3);
+    return data;
+}
+
+
+void TestBufferPool()
+{
+    BufferPool pool(1000, 2);
+    CHECK_EQUAL(pool.GetBufferSize(), 1000u);
+
+    DownloadBuffer *a = pool.Get();
+    DownloadBuffer *b = pool.Get();
+    DownloadBuffer *c = pool.Get();
+    CHECK(a != b && b != c && a != c);
+    CHECK_EQUAL(a->GetCapacity(), 1000u);
+    a->GetData()[999] = 'x';
+
+    // released buffers are reused, most recently released first
+    a->Release();
+    b->Release();
+    CHECK(pool.Get() == b);
+    CHECK(pool.Get() == a);
+    b->Release();
+    a->Release();
+
+    // but only up to the limit, the rest is freed
+    c->Release();
+    DownloadBuffer *d = pool.Get();
+    DownloadBuffer *e = pool.Get();
+    CHECK((d == a && e == b) || (d == b && e == a));
+    d->Release();
+    e->Release();
+
+    // a buffer is reused only after all references are released
+    DownloadBuffer *f = pool.Get();
+    f->AddRef();
+    f->Release();
+    DownloadBuffer *g = pool.Get();
+    CHECK(g != f);
+    f->Release();
+    g->Release();
+    DownloadBuffer *h = pool.Get();
+    CHECK(h == g);
+    h->Release();
+}
+
+
+void TestSharedPools()
+{
+    CHECK_EQUAL(BufferPool::GetShared(0).GetBufferSize(), 16u * 1024);
+    CHECK_EQUAL(BufferPool::GetShared(10240).GetBufferSize(), 16u * 1024);
+    CHECK_EQUAL(BufferPool::GetShared(16 * 1024).GetBufferSize(), 16u * 1024);
+    CHECK_EQUAL(BufferPool::GetShared(16 * 1024 + 1).GetBufferSize(), 64u * 1024);
+    CHECK_EQUAL(BufferPool::GetShared(100 * 1024).GetBufferSize(), 256u * 1024);
+    CHECK_EQUAL(BufferPool::GetShared(1024 * 1024).GetBufferSize(), 1024u * 1024);
+    CHECK_EQUAL(BufferPool::GetShared(100 * 1024 * 1024).GetBufferSize(), 1024u * 1024);
+    CHECK(&BufferPool::GetShared(1) == &BufferPool::GetShared(2));
+}
+
+
+void TestStageOrder()
+{
+    std::string log;
+    RecordingStage first("first", log), second("second", log);
+
+    DownloadPipeline pipeline;
+    pipeline.Append(&first);
+    pipeline.Append(&second);
+
+    pipeline.SetFilename(L"setup.exe");
+    pipeline.SetLength(6);
+    pipeline.Add("abc", 3);
+    pipeline.Add("def", 3);
+    pipeline.Finish();
+
+    CHECK_EQUAL(log,
+                "first.SetFilename second.SetFilename "
+                "first.SetLength second.SetLength "
+                "first.Process second.Process "
+                "first.Process second.Process "
+                "first.Finish second.Finish ");
+    CHECK(second.Filename == L"setup.exe");
+    CHECK_EQUAL(second.Length, 6u);
+    CHECK_EQUAL(second.Data, "abcdef");
+
+    // sequential data are given offsets
+    CHECK_EQUAL(second.Chunks.size(), 2u);
+    CHECK_EQUAL(second.Chunks[0].Offset, 0u);
+    CHECK_EQUAL(second.Chunks[1].Offset, 3u);
+    CHECK(second.Chunks[0].Buffer == NULL);
+}
+
+
+void TestRandomAccess()
+{
+    std::string log;
+    RecordingStage stage("stage", log);
+
+    DownloadPipeline pipeline;
+    pipeline.Append(&stage);
+
+    pipeline.Preallocate(100);
+    pipeline.AddAt(50, "xyz", 3);
+    pipeline.AddAt(10, "ab", 2);
+
+    CHECK_EQUAL(log, "stage.Preallocate stage.Process stage.Process ");
+    CHECK_EQUAL(stage.Chunks.size(), 2u);
+    CHECK_EQUAL(stage.Chunks[0].Offset, 50u);
+    CHECK_EQUAL(stage.Chunks[1].Offset, 10u);
+    CHECK_EQUAL(stage.Data, "xyzab");
+}
+
+
+void TestBuffersAreNotCopied()
+{
+    std::string log;
+    RecordingStage first("first", log), second("second", log);
+
+    DownloadPipeline pipeline;
+    pipeline.Append(&first);
+    pipeline.Append(&second);
+
+    BufferPool pool(100, 4);
+    DownloadBuffer *buffer = pool.Get();
+    memcpy(buffer->GetData(), "hello", 5);
+    pipeline.AddBuffer(buffer, 5);
+    pipeline.AddBufferAt(1000, buffer, 2);
+
+    for ( int i = 0; i < 2; i++ )
+    {
+        const RecordingStage& stage = i ? second : first;
+        CHECK_EQUAL(stage.Chunks.size(), 2u);
+        CHECK(stage.Chunks[0].Buffer == buffer);
+        CHECK(stage.Chunks[0].Data == buffer->GetData());
+        CHECK_EQUAL(stage.Chunks[0].Offset, 0u);
+        CHECK_EQUAL(stage.Chunks[0].Length, 5u);
+        CHECK(stage.Chunks[1].Data == buffer->GetData());
+        CHECK_EQUAL(stage.Chunks[1].Offset, 1000u);
+    }
+
+    buffer->Release();
+}
+
+
+void TestResume()
+{
+    PartialDownload state;
+    state.Length = 100;
+
+    // an empty pipeline can't resume anything
+    {
+        DownloadPipeline pipeline;
+        CHECK(!pipeline.ResumePartial(state));
+    }
+
+    // all stages must agree
+    {
+        std::string log;
+        RecordingStage first("first", log), second("second", log);
+        DownloadPipeline pipeline;
+        pipeline.Append(&first);
+        pipeline.Append(&second);
+        CHECK(pipeline.ResumePartial(state));
+        CHECK_EQUAL(log, "first.ResumePartial second.ResumePartial ");
+    }
+    {
+        std::string log;
+        RecordingStage first("first", log), second("second", log, false);
+        DownloadPipeline pipeline;
+        pipeline.Append(&first);
+        pipeline.Append(&second);
+        CHECK(!pipeline.ResumePartial(state));
+    }
+    {
+        // the following stages aren't asked if one refuses
+        std::string log;
+        RecordingStage first("first", log, false), second("second", log);
+        DownloadPipeline pipeline;
+        pipeline.Append(&first);
+        pipeline.Append(&second);
+        CHECK(!pipeline.ResumePartial(state));
+        CHECK_EQUAL(log, "first.ResumePartial ");
+    }
+}
+
+
+void TestAsyncWrite()
+{
+    const std::string data = MakeData(100000);
+
+    std::string log;
+    AsyncWriteStage async(4096, 2);
+    RecordingStage stage("stage", log);
+
+    DownloadPipeline pipeline;
+    pipeline.Append(&async);
+    pipeline.Append(&stage);
+
+    pipeline.SetLength(data.size());
+    for ( size_t offset = 0; offset < data.size(); offset += 1000 )
+        pipeline.Add(data.data() + offset, std::min<size_t>(1000, data.size() - offset));
+    pipeline.Finish();
+
+    CHECK(stage.Data == data);
+    CHECK_EQUAL(stage.Length, data.size());
+
+    // small chunks are gathered into large buffers
+    CHECK_EQUAL(stage.Chunks.size(), (data.size() + 4095) / 4096);
+    for ( size_t i = 0; i < stage.Chunks.size(); i++ )
+    {
+        CHECK_EQUAL(stage.Chunks[i].Offset, i * 4096);
+        CHECK(stage.Chunks[i].Buffer != NULL);
+    }
+}
+
+
+void TestAsyncWriteRandomAccess()
+{
+    const std::string data = MakeData(10000);
+
+    std::string log;
+    AsyncWriteStage async(4096, 2);
+    RecordingStage stage("stage", log);
+
+    DownloadPipeline pipeline;
+    pipeline.Append(&async);
+    pipeline.Append(&stage);
+
+    // two segments, interleaved
+    pipeline.Preallocate(data.size());
+    for ( size_t offset = 0; offset < 5000; offset += 500 )
+    {
+        pipeline.AddAt(offset, data.data() + offset, 500);
+        pipeline.AddAt(5000 + offset, data.data() + 5000 + offset, 500);
+    }
+    pipeline.Finish();
+
+    // only contiguous data are gathered
+    std::string result(data.size(), '\0');
+    size_t total = 0;
+    for ( size_t i = 0; i < stage.Chunks.size(); i++ )
+    {
+        const DownloadChunk& c = stage.Chunks[i];
+        CHECK_EQUAL(c.Length, 500u);
+        memcpy(&result[c.Offset], stage.Data.data() + total, c.Length);
+        total += c.Length;
+    }
+    CHECK(result == data);
+
+    // other calls are forwarded after the data queued before them
+    CHECK_EQUAL(log.find("stage.Preallocate "), 0u);
+    CHECK_EQUAL(log.rfind("stage.Finish "), log.size() - strlen("stage.Finish "));
+}
+
+
+void TestAsyncWriteBackPressure()
+{
+    const std::string data = MakeData(20 * 1000);
+
+    AsyncWriteStage async(1000, 2);
+    GateStage gate;
+    std::string log;
+    RecordingStage stage("stage", log);
+
+    DownloadPipeline pipeline;
+    pipeline.Append(&async);
+    pipeline.Append(&gate);
+    pipeline.Append(&stage);
+
+    ProducerThread *producer = new ProducerThread(pipeline, data, 1000);
+    producer->Start();
+
+    // one buffer is being processed and two are queued, the producer waits
+    // until there's room for the next one
+    SleepMilliseconds(300);
+    CHECK_EQUAL(producer->GetAdded(), 3u);
+    CHECK_EQUAL(gate.GetProcessed(), 0u);
+
+    gate.Open();
+    producer->Join();
+    delete producer;
+    pipeline.Finish();
+
+    CHECK(stage.Data == data);
+}
+
+
+void TestAsyncWriteError()
+{
+    const std::string data = MakeData(100000);
+
+    // the error is reported by a later call on the producer's side
+    {
+        AsyncWriteStage async(4096, 2);
+        FailingStage failing(10000);
+
+        DownloadPipeline pipeline;
+        pipeline.Append(&async);
+        pipeline.Append(&failing);
+
+        bool thrown = false;
+        try
+        {
+            for ( size_t offset = 0; offset < data.size(); offset += 1000 )
+                pipeline.Add(data.data() + offset, 1000);
+            pipeline.Finish();
+        }
+        catch ( const std::runtime_error& e )
+        {
+            thrown = true;
+            CHECK_EQUAL(std::string(e.what()), "disk full");
+        }
+        CHECK(thrown);
+    }
+
+    // progress isn't saved after data were lost
+    {
+        AsyncWriteStage async(4096, 2);
+        FailingStage failing(0);
+        std::string log;
+        RecordingStage stage("stage", log);
+
+        DownloadPipeline pipeline;
+        pipeline.Append(&async);
+        pipeline.Append(&failing);
+        pipeline.Append(&stage);
+
+        pipeline.AddAt(0, data.data(), 100);
+
+        PartialDownload state;
+        pipeline.SaveProgress(state);
+        CHECK(!pipeline.ResumePartial(state));
+        CHECK_THROWS(pipeline.Finish(), std::runtime_error);
+        CHECK_EQUAL(log, "");
+    }
+}
+
+} // anonymous namespace
+
+
+int main()
+{
+    TestBufferPool();
+    TestSharedPools();
+    TestStageOrder();
+    TestRandomAccess();
+    TestBuffersAreNotCopied();
+    TestResume();
+    TestAsyncWrite();
+    TestAsyncWriteRandomAccess();
+    TestAsyncWriteBackPressure();
+    TestAsyncWriteError();
+
+    return TestResult();
+}
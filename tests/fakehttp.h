@@ -0,0 +1,300 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef _fakehttp_h_
+#define _fakehttp_h_
+
+#include "error.h"
+#include "httptransport.h"
+#include "threads.h"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+    In-process stand-in for HTTP servers, installed with SetHttpTransport().
+
+    It serves resources added with FakeHttpTransport::Add(), including
+    conditional (If-None-Match, If-Modified-Since, If-Range) and range
+    requests (with 416 for ranges beyond the end), and records all requests
+    it received.
+ */
+
+namespace winsparkle
+{
+namespace test
+{
+
+/// Resource served by FakeHttpTransport.
+struct FakeResource
+{
+    FakeResource()
+        : Status(200), AcceptRanges(true),
+          ReadSize(0), ReadDelay(0), FailAfter(size_t(-1)), FailWithWin32Error(false)
+    {}
+
+    std::string Body;
+
+    /// Validators sent with the response, if not empty.
+    std::string ETag;
+    std::string LastModified;
+
+    /// Status code of successful responses; e.g. 500 to simulate failure.
+    unsigned Status;
+
+    /// Whether range requests are supported.
+    bool AcceptRanges;
+
+    /// Maximum size of data returned by a single Read(), 0 for unlimited.
+    size_t ReadSize;
+
+    /// Time every Read() takes, in milliseconds.
+    unsigned ReadDelay;
+
+    /// The server fails after it sent this many bytes of the resource in
+    /// total, in all responses: reading more and new requests throw.
+    size_t FailAfter;
+
+    /// Failures throw Win32Exception, as WinINet's do, instead of
+    /// DownloadException.
+    bool FailWithWin32Error;
+};
+
+
+/// Throws the exception @a resource fails with.
+inline void ThrowFailure(const FakeResource& resource, const char *msg)
+{
+    if ( resource.FailWithWin32Error )
+        throw Win32Exception(msg);
+    throw DownloadException(msg);
+}
+
+
+class FakeHttpResponse : public IHttpResponse
+{
+public:
+    FakeHttpResponse(unsigned status, const std::string& url, const FakeResource& resource,
+                     size_t from, size_t to, Thread *onThread,
+                     CriticalSection *cs = NULL, size_t *served = NULL)
+        : m_status(status), m_url(url), m_resource(resource),
+          m_pos(from), m_end(to), m_thread(onThread),
+          m_cs(cs), m_served(served)
+    {
+        if ( status == 200 || status == 206 )
+        {
+            m_headers["Content-Length"] = std::to_string(to - from);
+            if ( resource.AcceptRanges )
+                m_headers["Accept-Ranges"] = "bytes";
+            if ( status == 206 )
+            {
+                m_headers["Content-Range"] = "bytes " + std::to_string(from) + "-" +
+                                             std::to_string(to - 1) + "/" +
+                                             std::to_string(resource.Body.size());
+            }
+        }
+        if ( !resource.ETag.empty() )
+            m_headers["ETag"] = resource.ETag;
+        if ( !resource.LastModified.empty() )
+            m_headers["Last-Modified"] = resource.LastModified;
+    }
+
+    virtual unsigned GetStatusCode() const { return m_status; }
+
+    virtual bool GetHeader(const char *name, std::string& value) const
+    {
+        std::map<std::string, std::string>::const_iterator i = m_headers.find(name);
+        if ( i == m_headers.end() )
+            return false;
+        value = i->second;
+        return true;
+    }
+
+    virtual std::string GetURL() const { return m_url; }
+
+    virtual unsigned GetTimeToHeaders() const { return 1; }
+
+    virtual size_t Read(void *buffer, size_t size)
+    {
+        if ( m_thread )
+            m_thread->CheckShouldTerminate();
+        if ( m_resource.ReadDelay )
+            SleepMilliseconds(m_resource.ReadDelay);
+
+        size = std::min(size, m_end - m_pos);
+        if ( m_resource.ReadSize )
+            size = std::min(size, m_resource.ReadSize);
+
+        if ( m_served && size )
+        {
+            CriticalSectionLocker lock(*m_cs);
+            if ( *m_served >= m_resource.FailAfter )
+                ThrowFailure(m_resource, "Connection lost");
+            size = std::min(size, m_resource.FailAfter - *m_served);
+            *m_served += size;
+        }
+
+        memcpy(buffer, m_resource.Body.data() + m_pos, size);
+        m_pos += size;
+        return size;
+    }
+
+private:
+    unsigned m_status;
+    std::string m_url;
+    FakeResource m_resource;
+    std::map<std::string, std::string> m_headers;
+    size_t m_pos, m_end;
+    Thread *m_thread;
+    CriticalSection *m_cs;
+    size_t *m_served;
+};
+
+
+class FakeHttpTransport : public IHttpTransport
+{
+public:
+    /// Adds resource to serve at @a url, replacing any previous one.
+    void Add(const std::string& url, const FakeResource& resource)
+    {
+        CriticalSectionLocker lock(m_cs);
+        m_resources[url] = resource;
+        m_served[url] = 0;
+    }
+
+    /// Returns all requests received so far.
+    std::vector<HttpRequestParams> GetRequests()
+    {
+        CriticalSectionLocker lock(m_cs);
+        return m_requests;
+    }
+
+    void ClearRequests()
+    {
+        CriticalSectionLocker lock(m_cs);
+        m_requests.clear();
+    }
+
+    /// Returns number of bytes of the resource at @a url sent so far.
+    size_t GetServedBytes(const std::string& url)
+    {
+        CriticalSectionLocker lock(m_cs);
+        return m_served[url];
+    }
+
+    virtual IHttpResponse *Send(const HttpRequestParams& request, Thread *onThread)
+    {
+        if ( onThread )
+            onThread->CheckShouldTerminate();
+
+        CriticalSectionLocker lock(m_cs);
+        m_requests.push_back(request);
+
+        std::map<std::string, FakeResource>::const_iterator i = m_resources.find(request.URL);
+        if ( i == m_resources.end() )
+            return new FakeHttpResponse(404, request.URL, FakeResource(), 0, 0, onThread);
+
+        const FakeResource& r = i->second;
+        const size_t length = r.Body.size();
+        size_t *served = &m_served[request.URL];
+
+        if ( *served >= r.FailAfter )
+            ThrowFailure(r, "Connection refused");
+
+        if ( r.Status != 200 )
+            return new FakeHttpResponse(r.Status, request.URL, r, 0, 0, onThread);
+
+        std::string value;
+        if ( GetRequestHeader(request, "If-None-Match", value) )
+        {
+            if ( !r.ETag.empty() && value == r.ETag )
+                return new FakeHttpResponse(304, request.URL, r, 0, 0, onThread);
+        }
+        else if ( GetRequestHeader(request, "If-Modified-Since", value) )
+        {
+            if ( !r.LastModified.empty() && value == r.LastModified )
+                return new FakeHttpResponse(304, request.URL, r, 0, 0, onThread);
+        }
+
+        bool useRange = request.HasRange && r.AcceptRanges;
+        if ( useRange && GetRequestHeader(request, "If-Range", value) )
+            useRange = value == r.ETag || value == r.LastModified;
+
+        if ( useRange && request.RangeFrom >= length )
+            return new FakeHttpResponse(416, request.URL, r, 0, 0, onThread);
+
+        if ( useRange )
+        {
+            const size_t to = std::min(request.RangeTo, length);
+            return new FakeHttpResponse(206, request.URL, r, request.RangeFrom, to, onThread, &m_cs, served);
+        }
+
+        return new FakeHttpResponse(200, request.URL, r, 0, length, onThread, &m_cs, served);
+    }
+
+    /// Returns value of request header @a name.
+    static bool GetRequestHeader(const HttpRequestParams& request, const char *name, std::string& value)
+    {
+        const std::string prefix = std::string(name) + ": ";
+        const std::string& headers = request.Headers;
+
+        for ( size_t pos = 0; pos < headers.size(); )
+        {
+            size_t end = headers.find("\r\n", pos);
+            if ( end == std::string::npos )
+                end = headers.size();
+            if ( headers.compare(pos, prefix.size(), prefix) == 0 )
+            {
+                value = headers.substr(pos + prefix.size(), end - pos - prefix.size());
+                return true;
+            }
+            pos = end + 2;
+        }
+        return false;
+    }
+
+private:
+    CriticalSection m_cs;
+    std::map<std::string, FakeResource> m_resources;
+    std::map<std::string, size_t> m_served;
+    std::vector<HttpRequestParams> m_requests;
+};
+
+
+/// Uses FakeHttpTransport for all downloads during its lifetime.
+class FakeHttpTransportScope
+{
+public:
+    FakeHttpTransportScope(FakeHttpTransport& transport) { SetHttpTransport(&transport); }
+    ~FakeHttpTransportScope() { SetHttpTransport(NULL); }
+};
+
+} // namespace test
+} // namespace winsparkle
+
+#endif // _fakehttp_h_
@@ -0,0 +1,167 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _fakeui_h_
+#define _fakeui_h_
+
+#include "ui.h"
+#include "threads.h"
+
+#include <string>
+
+/*
+    Stand-in for WinSparkle's UI, for tests of the update checker and
+    downloader: it records the notifications instead of showing them.
+
+    It defines UI's methods and the part of the DLL's API the checker uses,
+    so the test must not be linked with ui.cpp and dll_api.cpp, and only
+    one of its files may include this header.
+ */
+
+namespace winsparkle
+{
+namespace test
+{
+
+/// Notifications received by the UI.
+struct UINotifications
+{
+    UINotifications()
+        : NoUpdates(0), Errors(0), UpdateAvailable(0), ReadyToInstall(false),
+          UpdateDownloaded(0)
+    {}
+
+    unsigned NoUpdates;
+    unsigned Errors;
+
+    unsigned UpdateAvailable;
+    Appcast Update;             // of the last NotifyUpdateAvailable()
+    bool ReadyToInstall;        // ditto
+
+    unsigned UpdateDownloaded;
+    std::wstring UpdateFile;    // of the last NotifyUpdateDownloaded()
+};
+
+
+class FakeUI
+{
+public:
+    /// Returns notifications received since the last Reset().
+    static UINotifications Get()
+    {
+        CriticalSectionLocker lock(GetLock());
+        return GetData();
+    }
+
+    static void Reset()
+    {
+        CriticalSectionLocker lock(GetLock());
+        GetData() = UINotifications();
+        GetEvent().WaitUntilSignaled(0);
+    }
+
+    /// Waits for the next notification other than download progress,
+    /// returns false on timeout.
+    static bool WaitForNotification(unsigned timeoutMilliseconds)
+    {
+        return GetEvent().WaitUntilSignaled(timeoutMilliseconds);
+    }
+
+    static CriticalSection& GetLock()
+    {
+        static CriticalSection cs;
+        return cs;
+    }
+
+    static UINotifications& GetData()
+    {
+        static UINotifications data;
+        return data;
+    }
+
+    static Event& GetEvent()
+    {
+        static Event event;
+        return event;
+    }
+};
+
+} // namespace test
+
+
+void UI::NotifyNoUpdates(bool, bool)
+{
+    {
+        CriticalSectionLocker lock(test::FakeUI::GetLock());
+        test::FakeUI::GetData().NoUpdates++;
+    }
+    test::FakeUI::GetEvent().Signal();
+}
+
+void UI::NotifyUpdateError(ErrorCode, const char *)
+{
+    {
+        CriticalSectionLocker lock(test::FakeUI::GetLock());
+        test::FakeUI::GetData().Errors++;
+    }
+    test::FakeUI::GetEvent().Signal();
+}
+
+void UI::NotifyUpdateAvailable(const Appcast& info, bool, bool readyToInstall)
+{
+    {
+        CriticalSectionLocker lock(test::FakeUI::GetLock());
+        test::UINotifications& data = test::FakeUI::GetData();
+        data.UpdateAvailable++;
+        data.Update = info;
+        data.ReadyToInstall = readyToInstall;
+    }
+    test::FakeUI::GetEvent().Signal();
+}
+
+void UI::NotifyDownloadProgress(size_t, size_t)
+{
+}
+
+void UI::NotifyUpdateDownloaded(const std::wstring& updateFile, const Appcast&)
+{
+    {
+        CriticalSectionLocker lock(test::FakeUI::GetLock());
+        test::UINotifications& data = test::FakeUI::GetData();
+        data.UpdateDownloaded++;
+        data.UpdateFile = updateFile;
+    }
+    test::FakeUI::GetEvent().Signal();
+}
+
+} // namespace winsparkle
+
+
+int __cdecl win_sparkle_get_update_check_interval()
+{
+    return 24 * 60 * 60;
+}
+
+#endif // _fakeui_h_
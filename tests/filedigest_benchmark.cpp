@@ -0,0 +1,166 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+// Benchmark of the time from receiving the last byte of a large update to
+// having its SHA-1 digest ready for signature verification: when it's
+// computed while downloading with FileDigest, and when the file is read and
+// hashed again after the download, as it was before.
+//
+// Usage: filedigest_benchmark [size in MB]
+
+#include "filedigest.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace winsparkle;
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+const size_t CHUNK_SIZE = 64 * 1024;
+
+double Ms(Clock::time_point start, Clock::time_point end)
+{
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+struct Result
+{
+    double download;    // ms spent writing (and hashing) the data
+    double ready;       // ms from the last write to the digest
+};
+
+
+// "Downloads" @a size bytes into a temporary file, in @a segments written
+// interleaved, and gets the file's digest.
+Result Run(size_t size, size_t segments, bool incremental)
+{
+    std::vector<char> chunk(CHUNK_SIZE);
+    for ( size_t i = 0; i < chunk.size(); i++ )
+        chunk[i] = char(i * 7);
+
+    FILE *file = tmpfile();
+    if ( !file )
+    {
+        fprintf(stderr, "can't create temporary file\n");
+        exit(1);
+    }
+
+    FileDigest digest;
+    const size_t segment = size / segments;
+
+    const Clock::time_point start = Clock::now();
+    for ( size_t offset = 0; offset < size - (segments - 1) * segment; offset += CHUNK_SIZE )
+    {
+        for ( size_t s = 0; s < segments; s++ )
+        {
+            const size_t from = s * segment + offset;
+            const size_t end = s == segments - 1 ? size : (s + 1) * segment;
+            if ( from >= end )
+                continue;
+            const size_t len = std::min(CHUNK_SIZE, end - from);
+            _fseeki64(file, from, SEEK_SET);
+            fwrite(&chunk[0], 1, len, file);
+            if ( incremental )
+                digest.Written(file, from, &chunk[0], len);
+        }
+    }
+    fflush(file);
+    const Clock::time_point downloaded = Clock::now();
+
+    std::string sha1;
+    if ( incremental )
+    {
+        if ( !digest.Finish(file, sha1) )
+        {
+            fprintf(stderr, "digest failed\n");
+            exit(1);
+        }
+    }
+    else
+    {
+        SHA_CTX ctx;
+        SHA1_Init(&ctx);
+        _fseeki64(file, 0, SEEK_SET);
+        size_t len;
+        while ( (len = fread(&chunk[0], 1, chunk.size(), file)) > 0 )
+            SHA1_Update(&ctx, &chunk[0], len);
+        unsigned char buf[SHA_DIGEST_LENGTH];
+        SHA1_Final(buf, &ctx);
+        sha1.assign(reinterpret_cast<const char*>(buf), sizeof(buf));
+    }
+    const Clock::time_point ready = Clock::now();
+
+    fclose(file);
+
+    Result result;
+    result.download = Ms(start, downloaded);
+    result.ready = Ms(downloaded, ready);
+    return result;
+}
+
+} // anonymous namespace
+
+
+int main(int argc, char **argv)
+{
+    const size_t mb = argc > 1 ? atoi(argv[1]) : 256;
+    const size_t size = mb * 1024 * 1024;
+
+    // the file is in the OS cache when it's read back, so this is the best
+    // case for hashing after the download
+    printf("%u MB file, times in ms\n\n", unsigned(mb));
+    printf("%-9s %-12s %10s %10s\n", "segments", "digest", "download", "ready");
+
+    const size_t segments[] = { 1, 4 };
+    for ( size_t i = 0; i < sizeof(segments) / sizeof(segments[0]); i++ )
+    {
+        for ( int incremental = 0; incremental <= 1; incremental++ )
+        {
+            // best of several runs, the first ones also fill the disk cache
+            Result r = Run(size, segments[i], incremental != 0);
+            for ( int run = 0; run < 2; run++ )
+            {
+                const Result next = Run(size, segments[i], incremental != 0);
+                r.download = std::min(r.download, next.download);
+                r.ready = std::min(r.ready, next.ready);
+            }
+            printf("%-9u %-12s %10.1f %10.1f\n",
+                   unsigned(segments[i]),
+                   incremental ? "incremental" : "after",
+                   r.download, r.ready);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,278 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+// Tests of FileDigest, which hashes the update file while it's downloaded,
+// including segmented and resumed downloads that write it out of order.
+
+#include "filedigest.h"
+#include "test.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace winsparkle;
+
+namespace
+{
+
+std::string MakeData(size_t len)
+{
+    std::string data(len, '\0');
+    unsigned x = 12345;
+    for ( size_t i = 0; i < len; i++ )
+    {
+        x = x * 1103515245 + 12345;
+        data[i] = char(x >> 16);
+    }
+    return data;
+}
+
+std::string Sha1(const std::string& data)
+{
+    unsigned char sha1[SHA_DIGEST_LENGTH];
+    SHA1(reinterpret_cast<const unsigned char*>(data.data()), data.size(), sha1);
+    return std::string(reinterpret_cast<const char*>(sha1), sizeof(sha1));
+}
+
+
+// Collects data passed to the sink
+struct CollectingSink : public IDigestedDataSink
+{
+    virtual void Add(const void *data, size_t len)
+    {
+        Data.append(static_cast<const char*>(data), len);
+    }
+
+    std::string Data;
+};
+
+
+// Writes data to the file and passes them to FileDigest, like DigestStage
+// does during the download.
+class FileWriter
+{
+public:
+    FileWriter(FileDigest& digest, const std::string& data)
+        : m_digest(digest), m_data(data), m_file(tmpfile()), m_reads(0) {}
+
+    ~FileWriter()
+    {
+        if ( m_file )
+            fclose(m_file);
+    }
+
+    FILE *GetFile() const { return m_file; }
+    int GetReads() const { return m_reads; }
+
+    // stores data, but doesn't tell FileDigest about them
+    void Store(size_t from, size_t to)
+    {
+        fseek(m_file, long(from), SEEK_SET);
+        fwrite(m_data.data() + from, 1, to - from, m_file);
+        fflush(m_file);
+    }
+
+    // writes data in chunks of @a chunkSize
+    void Write(size_t from, size_t to, size_t chunkSize)
+    {
+        for ( size_t offset = from; offset < to; offset += chunkSize )
+        {
+            const size_t len = std::min(chunkSize, to - offset);
+            Store(offset, offset + len);
+            if ( m_digest.Written(m_file, offset, m_data.data() + offset, len) )
+                m_reads++;
+        }
+    }
+
+private:
+    FileDigest& m_digest;
+    const std::string& m_data;
+    FILE *m_file;
+    int m_reads;
+};
+
+
+void TestSequential()
+{
+    const std::string data = MakeData(100000);
+
+    // network reads have arbitrary sizes
+    const size_t chunks[] = { 1, 7, 4096, 65537, 100000 };
+    for ( size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++ )
+    {
+        CollectingSink sink;
+        FileDigest digest(&sink);
+        FileWriter writer(digest, data);
+        writer.Write(0, data.size(), chunks[i]);
+
+        std::string result;
+        CHECK(digest.Finish(writer.GetFile(), result));
+        CHECK(result == Sha1(data));
+        CHECK(sink.Data == data);
+
+        // sequential data don't have to be read back
+        CHECK_EQUAL(writer.GetReads(), 0);
+    }
+}
+
+
+void TestSegmented()
+{
+    // larger than the most FileDigest catches up at once
+    const size_t len = 3 * 1024 * 1024 + 123;
+    const std::string data = MakeData(len);
+
+    for ( size_t segments = 2; segments <= 5; segments++ )
+    {
+        const size_t segment = len / segments;
+
+        CollectingSink sink;
+        FileDigest digest(&sink);
+        FileWriter writer(digest, data);
+
+        // write the segments interleaved, as parallel connections would,
+        // the last one first
+        const size_t chunk = 16 * 1024 + 1;
+        for ( size_t offset = 0; offset < segment + len % segments; offset += chunk )
+        {
+            for ( size_t s = segments; s-- > 0; )
+            {
+                const size_t from = s * segment + offset;
+                const size_t end = s == segments - 1 ? len : (s + 1) * segment;
+                if ( from < end )
+                    writer.Write(from, std::min(from + chunk, end), chunk);
+            }
+        }
+
+        std::string result;
+        CHECK(digest.Finish(writer.GetFile(), result));
+        CHECK(result == Sha1(data));
+        CHECK(sink.Data == data);
+        CHECK(writer.GetReads() > 0);
+    }
+}
+
+
+void TestBackwards()
+{
+    const size_t len = 2 * 1024 * 1024;
+    const std::string data = MakeData(len);
+
+    FileDigest digest;
+    FileWriter writer(digest, data);
+
+    // nothing can be hashed until the very last write
+    const size_t chunk = 64 * 1024;
+    for ( size_t offset = len; offset > 0; offset -= chunk )
+        writer.Write(offset - chunk, offset, chunk);
+
+    std::string result;
+    CHECK(digest.Finish(writer.GetFile(), result));
+    CHECK(result == Sha1(data));
+}
+
+
+void TestResumed()
+{
+    const std::string data = MakeData(200000);
+
+    CollectingSink sink;
+    FileDigest digest(&sink);
+    FileWriter writer(digest, data);
+
+    // ranges downloaded before the download was interrupted, out of order
+    // and overlapping
+    writer.Store(50000, 90000);
+    writer.Store(0, 20000);
+    writer.Store(150000, 200000);
+    digest.Existing(50000, 90000);
+    digest.Existing(150000, 200000);
+    digest.Existing(0, 20000);
+    digest.Existing(60000, 70000);
+
+    writer.Write(90000, 150000, 1000);
+    writer.Write(20000, 50000, 3000);
+
+    std::string result;
+    CHECK(digest.Finish(writer.GetFile(), result));
+    CHECK(result == Sha1(data));
+    CHECK(sink.Data == data);
+}
+
+
+void TestIncomplete()
+{
+    const std::string data = MakeData(100000);
+
+    // a hole in the data
+    {
+        FileDigest digest;
+        FileWriter writer(digest, data);
+        writer.Write(0, 40000, 1000);
+        writer.Write(50000, 100000, 1000);
+
+        std::string result;
+        CHECK(!digest.Finish(writer.GetFile(), result));
+    }
+
+    // the file is longer than the data that were hashed
+    {
+        FileDigest digest;
+        FileWriter writer(digest, data);
+        writer.Store(90000, 100000);
+        writer.Write(0, 90000, 1000);
+
+        std::string result;
+        CHECK(!digest.Finish(writer.GetFile(), result));
+    }
+
+    // data registered as existing aren't in the file
+    {
+        FileDigest digest;
+        FileWriter writer(digest, data);
+        digest.Existing(50000, 100000);
+        writer.Write(0, 50000, 1000);
+
+        std::string result;
+        CHECK(!digest.Finish(writer.GetFile(), result));
+    }
+}
+
+} // anonymous namespace
+
+
+int main()
+{
+    TestSequential();
+    TestSegmented();
+    TestBackwards();
+    TestResumed();
+    TestIncomplete();
+
+    return TestResult();
+}
@@ -0,0 +1,271 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+// Tests of the installer cache: least recently used entries are evicted
+// first, the installed version's installer is kept and hits and misses are
+// counted.
+
+#include "installercache.h"
+#include "settings.h"
+#include "test.h"
+
+#include <windows.h>
+
+#include <cstdio>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+using namespace winsparkle;
+
+namespace
+{
+
+const unsigned long long INSTALLER_SIZE = 1000;
+
+// Configuration kept in memory, so that the tests don't leave anything in
+// the registry. Like the registry, it doesn't accept values longer than
+// 255 characters.
+std::map<std::string, std::wstring> g_config;
+
+int __cdecl ConfigRead(const char *name, wchar_t *buf, size_t len, void *)
+{
+    std::map<std::string, std::wstring>::const_iterator i = g_config.find(name);
+    if ( i == g_config.end() || i->second.length() >= len || i->second.length() > 255 )
+        return FALSE;
+    wcscpy(buf, i->second.c_str());
+    return TRUE;
+}
+
+void __cdecl ConfigWrite(const char *name, const wchar_t *value, void *)
+{
+    g_config[name] = value;
+}
+
+void __cdecl ConfigDelete(const char *name, void *)
+{
+    g_config.erase(name);
+}
+
+void WriteTestFile(const std::wstring& path, unsigned long long size)
+{
+    FILE *f = _wfopen(path.c_str(), L"wb");
+    if ( !f )
+        throw std::runtime_error("can't create test file");
+    const std::string data(size_t(size), 'x');
+    fwrite(data.data(), 1, data.size(), f);
+    fclose(f);
+}
+
+bool FileExists(const std::wstring& path)
+{
+    return GetFileAttributes(path.c_str()) != INVALID_FILE_ATTRIBUTES;
+}
+
+// Downloads an installer into the cache, as UpdateDownloader does.
+std::wstring AddInstaller(const std::string& key, const std::string& version)
+{
+    const std::wstring path = InstallerCache::CreateDownloadDirectory() + L"\\Setup.exe";
+    WriteTestFile(path, INSTALLER_SIZE);
+    InstallerCache::Add(key, version, path);
+    return path;
+}
+
+bool IsCached(const std::string& key)
+{
+    std::wstring path;
+    return InstallerCache::Find(key, path);
+}
+
+// Removes all entries and the download directories.
+void ClearCache()
+{
+    Settings::SetInstallerCacheLimit(0);
+    InstallerCache::Trim("", L"");
+}
+
+
+void TestLeastRecentlyUsed()
+{
+    Settings::SetInstallerCacheLimit(3 * INSTALLER_SIZE);
+    const InstallerCacheStats before = InstallerCache::GetStats();
+
+    AddInstaller("k1", "1.1");
+    AddInstaller("k2", "1.2");
+    AddInstaller("k3", "1.3");
+    InstallerCache::Trim("", L"");
+    CHECK(IsCached("k1") && IsCached("k2") && IsCached("k3"));
+
+    // k1 was used again, so k2 is the least recently used one now
+    InstallerCache::RecordHit("k1");
+    AddInstaller("k4", "1.4");
+    InstallerCache::Trim("", L"");
+    CHECK(IsCached("k1"));
+    CHECK(!IsCached("k2"));
+    CHECK(IsCached("k3") && IsCached("k4"));
+
+    const InstallerCacheStats after = InstallerCache::GetStats();
+    CHECK_EQUAL(after.Evictions - before.Evictions, 1u);
+    CHECK_EQUAL(after.BytesEvicted - before.BytesEvicted, INSTALLER_SIZE);
+
+    // the same installer downloaded again replaces the older entry
+    const std::wstring path = AddInstaller("k3", "1.3");
+    std::wstring found;
+    CHECK(InstallerCache::Find("k3", found) && found == path);
+    InstallerCache::Trim("", L"");
+    CHECK(IsCached("k1") && IsCached("k3") && IsCached("k4"));
+
+    ClearCache();
+    CHECK(!IsCached("k1") && !IsCached("k3") && !IsCached("k4"));
+}
+
+
+// The installed version's installer is kept for delta updates, even if it
+// was used least recently or is larger than the limit.
+void TestKeepInstalledVersion()
+{
+    Settings::SetInstallerCacheLimit(2 * INSTALLER_SIZE);
+
+    const std::wstring installed = AddInstaller("installed", "1.0");
+    AddInstaller("k1", "1.1");
+    AddInstaller("k2", "1.2");
+    InstallerCache::Trim("1.0", L"");
+    CHECK(IsCached("installed") && IsCached("k1") && IsCached("k2"));
+
+    AddInstaller("k3", "1.3");
+    InstallerCache::Trim("1.0", L"");
+    CHECK(IsCached("installed"));
+    CHECK(!IsCached("k1"));
+    CHECK(IsCached("k2") && IsCached("k3"));
+
+    std::wstring path;
+    CHECK(InstallerCache::FindVersion("1.0", path) && path == installed);
+    CHECK(!InstallerCache::FindVersion("1.1", path));
+
+    Settings::SetInstallerCacheLimit(INSTALLER_SIZE / 2);
+    InstallerCache::Trim("1.0", L"");
+    CHECK(IsCached("installed"));
+    CHECK(!IsCached("k2") && !IsCached("k3"));
+
+    // ...unless caching is disabled
+    ClearCache();
+    CHECK(!IsCached("installed"));
+    CHECK(!FileExists(installed));
+}
+
+
+// Directories of abandoned downloads are deleted, unless they are in use.
+void TestLeftovers()
+{
+    Settings::SetInstallerCacheLimit(10 * INSTALLER_SIZE);
+
+    const std::wstring cached = AddInstaller("k1", "1.1");
+    const std::wstring abandoned = InstallerCache::CreateDownloadDirectory() + L"\\Setup.exe";
+    WriteTestFile(abandoned, INSTALLER_SIZE);
+    const std::wstring inUseDir = InstallerCache::CreateDownloadDirectory();
+    const std::wstring inUse = inUseDir + L"\\Setup.exe";
+    WriteTestFile(inUse, INSTALLER_SIZE);
+
+    InstallerCache::Trim("", inUseDir);
+    CHECK(FileExists(cached));
+    CHECK(!FileExists(abandoned));
+    CHECK(FileExists(inUse));
+
+    // cache entries aren't deleted as download directories
+    CHECK(InstallerCache::DeleteDownloadDirectory(cached.substr(0, cached.rfind(L'\\'))));
+    CHECK(FileExists(cached));
+    CHECK(InstallerCache::DeleteDownloadDirectory(inUseDir));
+    CHECK(!FileExists(inUse));
+
+    ClearCache();
+}
+
+
+// Entries that can't be stored in the configuration aren't cached.
+void TestLongFilename()
+{
+    Settings::SetInstallerCacheLimit(10 * INSTALLER_SIZE);
+
+    const std::string key(64, 'a');
+    const std::wstring path = InstallerCache::CreateDownloadDirectory() + L"\\" + std::wstring(200, L'x') + L".exe";
+    WriteTestFile(path, INSTALLER_SIZE);
+    CHECK_THROWS(InstallerCache::Add(key, "1.1", path), std::runtime_error);
+    CHECK(!IsCached(key));
+
+    // ...but the others still are
+    AddInstaller(key, "1.1");
+    AddInstaller(std::string(64, 'b'), "1.2");
+    CHECK(IsCached(key) && IsCached(std::string(64, 'b')));
+
+    ClearCache();
+}
+
+
+void TestStats()
+{
+    Settings::SetInstallerCacheLimit(10 * INSTALLER_SIZE);
+    const InstallerCacheStats before = InstallerCache::GetStats();
+
+    AddInstaller("k1", "1.1");
+    InstallerCache::RecordMiss();
+    InstallerCache::RecordHit("k1");
+    InstallerCache::RecordHit("k1");
+    // unknown installers aren't hits
+    InstallerCache::RecordHit("unknown");
+
+    const InstallerCacheStats after = InstallerCache::GetStats();
+    CHECK_EQUAL(after.Misses - before.Misses, 1u);
+    CHECK_EQUAL(after.Hits - before.Hits, 2u);
+    CHECK_EQUAL(after.BytesSaved - before.BytesSaved, 2 * INSTALLER_SIZE);
+
+    ClearCache();
+}
+
+} // anonymous namespace
+
+
+int main()
+{
+    win_sparkle_config_methods_t config;
+    config.config_read = &ConfigRead;
+    config.config_write = &ConfigWrite;
+    config.config_delete = &ConfigDelete;
+    config.user_data = NULL;
+    Settings::SetConfigMethods(&config);
+
+    TestLeastRecentlyUsed();
+    TestKeepInstalledVersion();
+    TestLeftovers();
+    TestLongFilename();
+    TestStats();
+
+    // delete the cache directory itself too
+    std::wstring dir;
+    if ( Settings::ReadConfigValue("InstallerCacheDir", dir) )
+        RemoveDirectory(dir.c_str());
+
+    return TestResult();
+}
@@ -0,0 +1,322 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef _localhttp_h_
+#define _localhttp_h_
+
+#ifdef _WIN32
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+#else
+    #include <arpa/inet.h>
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <netinet/in.h>
+    #include <sys/select.h>
+    #include <sys/socket.h>
+    #include <unistd.h>
+#endif
+
+#include "threads.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+    Real HTTP/1.1 server on the loopback interface, for tests of the
+    transports and of the download engine over actual connections.
+
+    It serves the same resource for all paths, supports range requests
+    and keeps connections alive, and counts the connections and requests
+    it received.
+ */
+
+namespace winsparkle
+{
+namespace test
+{
+
+#ifdef _WIN32
+typedef SOCKET SocketHandle;
+inline void CloseSocket(SocketHandle s) { closesocket(s); }
+inline bool WouldBlock() { return WSAGetLastError() == WSAEWOULDBLOCK; }
+#else
+typedef int SocketHandle;
+const SocketHandle INVALID_SOCKET = -1;
+inline void CloseSocket(SocketHandle s) { close(s); }
+inline bool WouldBlock() { return errno == EAGAIN || errno == EWOULDBLOCK; }
+#endif
+
+
+class LocalHttpServer : public Thread
+{
+public:
+    LocalHttpServer(const std::string& body)
+        : Thread("test HTTP server"),
+          m_body(body), m_listener(INVALID_SOCKET), m_port(0),
+          m_connections(0), m_requests(0)
+    {
+#ifdef _WIN32
+        WSADATA wsa;
+        WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+
+        m_listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        socklen_t addrlen = sizeof(addr);
+        if ( m_listener == INVALID_SOCKET ||
+             bind(m_listener, (sockaddr*)&addr, sizeof(addr)) != 0 ||
+             listen(m_listener, SOMAXCONN) != 0 ||
+             getsockname(m_listener, (sockaddr*)&addr, &addrlen) != 0 )
+        {
+            throw std::runtime_error("can't start test HTTP server");
+        }
+        m_port = ntohs(addr.sin_port);
+    }
+
+    ~LocalHttpServer()
+    {
+        for ( size_t i = 0; i < m_clients.size(); i++ )
+            CloseSocket(m_clients[i].socket);
+        if ( m_listener != INVALID_SOCKET )
+            CloseSocket(m_listener);
+#ifdef _WIN32
+        WSACleanup();
+#endif
+    }
+
+    std::string GetURL(const char *path) const
+    {
+        char url[64];
+        snprintf(url, sizeof(url), "http://127.0.0.1:%u%s", unsigned(m_port), path);
+        return url;
+    }
+
+    unsigned GetConnections()
+    {
+        CriticalSectionLocker lock(m_cs);
+        return m_connections;
+    }
+
+    unsigned GetRequests()
+    {
+        CriticalSectionLocker lock(m_cs);
+        return m_requests;
+    }
+
+protected:
+    virtual void Run()
+    {
+        SignalReady();
+
+        for ( ;; )
+        {
+            CheckShouldTerminate();
+
+            SocketHandle maxSocket = m_listener;
+            fd_set readable, writable;
+            FD_ZERO(&readable);
+            FD_ZERO(&writable);
+            FD_SET(m_listener, &readable);
+            for ( size_t i = 0; i < m_clients.size(); i++ )
+            {
+                FD_SET(m_clients[i].socket, &readable);
+                if ( m_clients[i].sent < m_clients[i].response.size() )
+                    FD_SET(m_clients[i].socket, &writable);
+                maxSocket = std::max(maxSocket, m_clients[i].socket);
+            }
+
+            timeval timeout = { 0, 100 * 1000 };
+            if ( select(int(maxSocket + 1), &readable, &writable, NULL, &timeout) <= 0 )
+                continue;
+
+            if ( FD_ISSET(m_listener, &readable) )
+            {
+                Client client;
+                client.socket = accept(m_listener, NULL, NULL);
+                client.sent = 0;
+                if ( client.socket != INVALID_SOCKET )
+                {
+                    SetNonBlocking(client.socket);
+                    m_clients.push_back(client);
+                    CriticalSectionLocker lock(m_cs);
+                    m_connections++;
+                }
+            }
+
+            for ( size_t i = 0; i < m_clients.size(); )
+            {
+                Client& client = m_clients[i];
+                if ( (FD_ISSET(client.socket, &readable) && !Receive(client)) ||
+                     (FD_ISSET(client.socket, &writable) && !Send(client)) )
+                {
+                    CloseSocket(client.socket);
+                    m_clients.erase(m_clients.begin() + i);
+                }
+                else
+                {
+                    i++;
+                }
+            }
+        }
+    }
+
+    virtual bool IsJoinable() const { return true; }
+
+private:
+    struct Client
+    {
+        SocketHandle socket;
+        std::string request;    // data of the request received so far
+        std::string response;   // data of the responses to send
+        size_t sent;            // ...of which were already sent
+    };
+
+    static void SetNonBlocking(SocketHandle s)
+    {
+#ifdef _WIN32
+        u_long nonBlocking = 1;
+        ioctlsocket(s, FIONBIO, &nonBlocking);
+#else
+        fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+#endif
+    }
+
+    // Reads data of the client's requests and queues responses to them.
+    // Returns false when the connection should be closed.
+    bool Receive(Client& client)
+    {
+        char buffer[4096];
+        const int len = recv(client.socket, buffer, sizeof(buffer), 0);
+        if ( len < 0 && WouldBlock() )
+            return true;
+        if ( len <= 0 )
+            return false;
+        client.request.append(buffer, len);
+
+        // requests have no body
+        for ( ;; )
+        {
+            const size_t end = client.request.find("\r\n\r\n");
+            if ( end == std::string::npos )
+                return true;
+            const std::string headers = client.request.substr(0, end);
+            client.request.erase(0, end + 4);
+
+            {
+                CriticalSectionLocker lock(m_cs);
+                m_requests++;
+            }
+
+            if ( client.sent == client.response.size() )
+            {
+                client.response.clear();
+                client.sent = 0;
+            }
+            client.response += Respond(headers);
+        }
+    }
+
+    // Sends as much of the queued responses as the connection accepts.
+    bool Send(Client& client)
+    {
+        const size_t len = std::min(client.response.size() - client.sent, size_t(64 * 1024));
+        const int n = send(client.socket, client.response.data() + client.sent, int(len), 0);
+        if ( n < 0 && WouldBlock() )
+            return true;
+        if ( n <= 0 )
+            return false;
+        client.sent += n;
+        return true;
+    }
+
+    // Returns the response to the request with given headers.
+    std::string Respond(const std::string& request) const
+    {
+        size_t from = 0, to = m_body.size();
+        bool partial = false;
+
+        const size_t range = request.find("\r\nRange: bytes=");
+        if ( range != std::string::npos )
+        {
+            unsigned long long rangeFrom, rangeTo;
+            if ( sscanf(request.c_str() + range, "\r\nRange: bytes=%llu-%llu", &rangeFrom, &rangeTo) == 2 &&
+                 rangeFrom <= rangeTo && rangeTo < m_body.size() )
+            {
+                from = size_t(rangeFrom);
+                to = size_t(rangeTo) + 1;
+                partial = true;
+            }
+        }
+
+        char headers[256];
+        if ( partial )
+        {
+            snprintf(headers, sizeof(headers),
+                     "HTTP/1.1 206 Partial Content\r\n"
+                     "Content-Range: bytes %u-%u/%u\r\n",
+                     unsigned(from), unsigned(to - 1), unsigned(m_body.size()));
+        }
+        else
+        {
+            snprintf(headers, sizeof(headers), "HTTP/1.1 200 OK\r\n");
+        }
+
+        char common[256];
+        snprintf(common, sizeof(common),
+                 "Content-Length: %u\r\n"
+                 "Accept-Ranges: bytes\r\n"
+                 "ETag: \"1\"\r\n"
+                 "Connection: keep-alive\r\n"
+                 "\r\n",
+                 unsigned(to - from));
+
+        return headers + std::string(common) + m_body.substr(from, to - from);
+    }
+
+    std::string m_body;
+    SocketHandle m_listener;
+    unsigned short m_port;
+    std::vector<Client> m_clients;
+
+    CriticalSection m_cs;
+    unsigned m_connections;
+    unsigned m_requests;
+};
+
+} // namespace test
+} // namespace winsparkle
+
+#endif // _localhttp_h_
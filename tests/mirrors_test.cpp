@@ -0,0 +1,384 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+// Tests of mirrors' ranking and of failover between them, run against
+// FakeHttpTransport.
+
+#include "mirrors.h"
+#include "test.h"
+#include "fakehttp.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace winsparkle;
+using namespace winsparkle::test;
+
+namespace
+{
+
+const char MIRROR_A[] = "http://a.example.com";
+const char MIRROR_B[] = "http://b.example.com";
+const char MIRROR_C[] = "http://c.example.com";
+const char INSTALLER_PATH[] = "/installer.exe";
+
+std::string MakeData(size_t length)
+{
+    std::string data(length, '\0');
+    for ( size_t i = 0; i < length; i++ )
+        data[i] = char((i * 7919) >> 3);
+    return data;
+}
+
+FakeResource MakeInstaller(size_t length)
+{
+    FakeResource installer;
+    installer.Body = MakeData(length);
+    installer.ETag = "\"installer-1\"";
+    installer.ReadSize = 64 * 1024;
+    installer.ReadDelay = 1;
+    return installer;
+}
+
+void AddMirrors()
+{
+    Mirrors::Clear();
+    Mirrors::Add(MIRROR_A);
+    Mirrors::Add(MIRROR_B);
+    Mirrors::Add(MIRROR_C);
+}
+
+std::vector<std::string> GetRanking()
+{
+    std::vector<std::string> hosts;
+    const std::vector<MirrorStats> stats = Mirrors::GetStats();
+    for ( size_t i = 0; i < stats.size(); i++ )
+        hosts.push_back(stats[i].Host);
+    return hosts;
+}
+
+MirrorStats GetStats(const std::string& host)
+{
+    const std::vector<MirrorStats> stats = Mirrors::GetStats();
+    for ( size_t i = 0; i < stats.size(); i++ )
+    {
+        if ( stats[i].Host == host )
+            return stats[i];
+    }
+    return MirrorStats();
+}
+
+size_t CountRequestsTo(const std::vector<HttpRequestParams>& requests, const std::string& host)
+{
+    size_t count = 0;
+    for ( size_t i = 0; i < requests.size(); i++ )
+    {
+        if ( requests[i].URL.compare(0, host.length(), host) == 0 )
+            count++;
+    }
+    return count;
+}
+
+
+// Stores downloaded data in memory; optionally fails to, like a full disk.
+struct MemorySink : public IRandomAccessDownloadSink
+{
+    MemorySink() : failing(false) {}
+
+    virtual void SetLength(size_t) {}
+    virtual void SetFilename(const std::wstring&) {}
+
+    virtual void Add(const void *data, size_t len)
+    {
+        if ( failing )
+            throw std::runtime_error("Disk full");
+        this->data.append(static_cast<const char*>(data), len);
+    }
+
+    virtual void Preallocate(size_t len)
+    {
+        data.assign(len, '\0');
+    }
+
+    virtual void AddAt(size_t offset, const void *data, size_t len)
+    {
+        if ( failing )
+            throw std::runtime_error("Disk full");
+        this->data.replace(offset, len, static_cast<const char*>(data), len);
+    }
+
+    virtual bool ResumePartial(const PartialDownload&) { return false; }
+    virtual void SaveProgress(const PartialDownload&) {}
+
+    std::string data;
+    bool failing;
+};
+
+
+/*--------------------------------------------------------------------------*
+                                  ranking
+ *--------------------------------------------------------------------------*/
+
+void TestRanking()
+{
+    AddMirrors();
+
+    // duplicates and trailing slashes are ignored
+    Mirrors::Add(std::string(MIRROR_B) + "/");
+    CHECK_EQUAL(Mirrors::GetStats().size(), 3u);
+
+    // nothing is known yet, so the order of registration is kept
+    std::vector<std::string> ranking = GetRanking();
+    CHECK(ranking.size() == 3 && ranking[0] == MIRROR_A && ranking[1] == MIRROR_B && ranking[2] == MIRROR_C);
+
+    // measured hosts come first, by latency
+    Mirrors::ReportSuccess(MIRROR_C, 50);
+    Mirrors::ReportSuccess(MIRROR_B, 20);
+    ranking = GetRanking();
+    CHECK(ranking.size() == 3 && ranking[0] == MIRROR_B && ranking[1] == MIRROR_C && ranking[2] == MIRROR_A);
+    CHECK_EQUAL(Mirrors::GetBestHost(), std::string(MIRROR_B));
+
+    // throughput outweighs small differences in latency...
+    Mirrors::ReportSuccess(MIRROR_B, 20, 1024 * 1024, 1000);
+    Mirrors::ReportSuccess(MIRROR_C, 50, 10 * 1024 * 1024, 1000);
+    CHECK_EQUAL(Mirrors::GetBestHost(), std::string(MIRROR_C));
+
+    // ...but small transfers don't say anything about it
+    Mirrors::ReportSuccess(MIRROR_B, 20, 1024, 1);
+    CHECK_EQUAL(Mirrors::GetBestHost(), std::string(MIRROR_C));
+
+    const MirrorStats stats = GetStats(MIRROR_B);
+    CHECK_EQUAL(stats.Transfers, 3u);
+    CHECK_EQUAL(stats.Failures, 0u);
+    CHECK_EQUAL(stats.SmoothedRTT, 20.0);
+    CHECK_EQUAL(stats.Throughput, 1024.0 * 1024);
+
+    Mirrors::Clear();
+    CHECK(Mirrors::IsEmpty());
+    CHECK(Mirrors::GetBestHost().empty());
+}
+
+
+// Hosts that failed recently are avoided until they succeed again.
+void TestFailureBackoff()
+{
+    AddMirrors();
+    Mirrors::ReportSuccess(MIRROR_A, 10);
+    Mirrors::ReportSuccess(MIRROR_B, 20);
+
+    Mirrors::ReportFailure(MIRROR_A);
+    std::vector<std::string> ranking = GetRanking();
+    CHECK(ranking.size() == 3 && ranking[0] == MIRROR_B && ranking[1] == MIRROR_C && ranking[2] == MIRROR_A);
+    CHECK_EQUAL(GetStats(MIRROR_A).Failures, 1u);
+
+    // failures of unknown hosts are ignored
+    Mirrors::ReportFailure("http://unknown.example.com");
+    CHECK_EQUAL(Mirrors::GetStats().size(), 3u);
+
+    Mirrors::ReportSuccess(MIRROR_A, 10);
+    CHECK_EQUAL(Mirrors::GetBestHost(), std::string(MIRROR_A));
+    CHECK_EQUAL(GetStats(MIRROR_A).Failures, 1u);
+
+    Mirrors::Clear();
+}
+
+
+void TestFindHost()
+{
+    AddMirrors();
+
+    std::string path;
+    CHECK_EQUAL(Mirrors::FindHost(std::string(MIRROR_B) + INSTALLER_PATH, &path), std::string(MIRROR_B));
+    CHECK_EQUAL(path, std::string(INSTALLER_PATH));
+    CHECK_EQUAL(Mirrors::FindHost(MIRROR_C), std::string(MIRROR_C));
+
+    // only whole host names match
+    CHECK(Mirrors::FindHost("http://a.example.com.evil.com/installer.exe").empty());
+    CHECK(Mirrors::FindHost("http://example.com/installer.exe").empty());
+
+    Mirrors::Clear();
+}
+
+
+// Probes find out which mirrors respond.
+void TestProbe()
+{
+    FakeHttpTransport transport;
+    FakeHttpTransportScope scope(transport);
+
+    Mirrors::Clear();
+    Mirrors::Add(MIRROR_A);
+    Mirrors::Add(MIRROR_B);
+
+    // A doesn't have the appcast
+    FakeResource appcast;
+    appcast.Body = "<rss/>";
+    transport.Add(std::string(MIRROR_B) + "/appcast.xml", appcast);
+
+    Mirrors::Probe("/appcast.xml", NULL);
+    CHECK_EQUAL(Mirrors::GetBestHost(), std::string(MIRROR_B));
+    CHECK_EQUAL(GetStats(MIRROR_A).Failures, 1u);
+    CHECK_EQUAL(GetStats(MIRROR_B).Transfers, 1u);
+
+    // not again so soon
+    transport.ClearRequests();
+    Mirrors::Probe("/appcast.xml", NULL);
+    CHECK(transport.GetRequests().empty());
+
+    Mirrors::Clear();
+}
+
+
+/*--------------------------------------------------------------------------*
+                                  failover
+ *--------------------------------------------------------------------------*/
+
+// Each mirror is tried once, best ranked first.
+void TestFailoverOrder()
+{
+    AddMirrors();
+    Mirrors::ReportSuccess(MIRROR_C, 10);
+
+    MirrorFailover failover;
+    CHECK_EQUAL(failover.GetFailoverURL(std::string(MIRROR_A) + INSTALLER_PATH),
+                std::string(MIRROR_C) + INSTALLER_PATH);
+    CHECK_EQUAL(failover.GetFailoverURL(std::string(MIRROR_C) + INSTALLER_PATH),
+                std::string(MIRROR_B) + INSTALLER_PATH);
+    CHECK(failover.GetFailoverURL(std::string(MIRROR_B) + INSTALLER_PATH).empty());
+
+    // the failures were recorded
+    CHECK_EQUAL(GetStats(MIRROR_A).Failures, 1u);
+    CHECK_EQUAL(GetStats(MIRROR_B).Failures, 1u);
+    CHECK_EQUAL(GetStats(MIRROR_C).Failures, 1u);
+
+    // other servers have no mirrors
+    MirrorFailover other;
+    CHECK(other.GetFailoverURL("http://example.com/installer.exe").empty());
+
+    Mirrors::Clear();
+}
+
+
+// Error responses move the download to another mirror.
+void TestFailoverOnErrorResponse()
+{
+    FakeHttpTransport transport;
+    FakeHttpTransportScope scope(transport);
+    AddMirrors();
+
+    FakeResource broken;
+    broken.Status = 500;
+    transport.Add(std::string(MIRROR_A) + INSTALLER_PATH, broken);
+    const FakeResource installer = MakeInstaller(2 * 1024 * 1024);
+    transport.Add(std::string(MIRROR_B) + INSTALLER_PATH, installer);
+
+    MemorySink sink;
+    MirrorFailover failover;
+    DownloadFileSegmented(std::string(MIRROR_A) + INSTALLER_PATH, &sink, NULL, 4, NULL, &failover);
+    CHECK(sink.data == installer.Body);
+    CHECK_EQUAL(GetStats(MIRROR_A).Failures, 1u);
+    CHECK(GetStats(MIRROR_B).Transfers > 0);
+    CHECK_EQUAL(CountRequestsTo(transport.GetRequests(), MIRROR_C), 0u);
+
+    Mirrors::Clear();
+}
+
+
+// Transport errors in the middle of a segmented download move it to another
+// mirror too; segments already downloaded are kept.
+void TestFailoverOnTransportError()
+{
+    FakeHttpTransport transport;
+    FakeHttpTransportScope scope(transport);
+    AddMirrors();
+
+    FakeResource dying = MakeInstaller(8 * 1024 * 1024);
+    dying.FailAfter = 1536 * 1024;
+    dying.FailWithWin32Error = true;
+    transport.Add(std::string(MIRROR_A) + INSTALLER_PATH, dying);
+    const FakeResource installer = MakeInstaller(8 * 1024 * 1024);
+    transport.Add(std::string(MIRROR_B) + INSTALLER_PATH, installer);
+
+    MemorySink sink;
+    MirrorFailover failover;
+    DownloadFileSegmented(std::string(MIRROR_A) + INSTALLER_PATH, &sink, NULL, 4, NULL, &failover);
+    CHECK(sink.data == installer.Body);
+    CHECK(GetStats(MIRROR_A).Failures > 0);
+    CHECK(transport.GetServedBytes(std::string(MIRROR_B) + INSTALLER_PATH) < installer.Body.size());
+
+    // the rest was downloaded with range requests from B
+    const std::vector<HttpRequestParams> requests = transport.GetRequests();
+    CHECK(CountRequestsTo(requests, MIRROR_B) > 0);
+    for ( size_t i = 0; i < requests.size(); i++ )
+    {
+        if ( requests[i].URL.compare(0, strlen(MIRROR_B), MIRROR_B) == 0 )
+            CHECK(requests[i].HasRange);
+    }
+
+    Mirrors::Clear();
+}
+
+
+// Failures to store the data aren't the server's fault.
+void TestNoFailoverOnSinkError()
+{
+    FakeHttpTransport transport;
+    FakeHttpTransportScope scope(transport);
+    AddMirrors();
+
+    const FakeResource installer = MakeInstaller(2 * 1024 * 1024);
+    transport.Add(std::string(MIRROR_A) + INSTALLER_PATH, installer);
+    transport.Add(std::string(MIRROR_B) + INSTALLER_PATH, installer);
+
+    MemorySink sink;
+    sink.failing = true;
+    MirrorFailover failover;
+    CHECK_THROWS(DownloadFileSegmented(std::string(MIRROR_A) + INSTALLER_PATH, &sink, NULL, 4, NULL, &failover),
+                 std::runtime_error);
+    CHECK_EQUAL(CountRequestsTo(transport.GetRequests(), MIRROR_B), 0u);
+    CHECK_EQUAL(GetStats(MIRROR_A).Failures, 0u);
+
+    Mirrors::Clear();
+}
+
+} // anonymous namespace
+
+
+int main()
+{
+    TestRanking();
+    TestFailureBackoff();
+    TestFindHost();
+    TestProbe();
+    TestFailoverOrder();
+    TestFailoverOnErrorResponse();
+    TestFailoverOnTransportError();
+    TestNoFailoverOnSinkError();
+
+    return TestResult();
+}
@@ -0,0 +1,227 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+// Throughput benchmark of reading downloaded data at several simulated
+// bandwidth and latency points: with reads of a fixed 10 KB buffer, as
+// DownloadFile() used to do, and with the adaptive read size it uses now.
+//
+// The simulated link delivers data at the given bandwidth and every read
+// costs the given latency, like a round-trip through WinINet's callbacks
+// does. A read returns whatever data arrived, up to the requested size.
+//
+// Usage: readsize_benchmark
+
+#include "download.h"
+#include "httptransport.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+using namespace winsparkle;
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+const size_t PACKET_SIZE = 1460;
+
+double Seconds(Clock::duration d)
+{
+    return std::chrono::duration<double>(d).count();
+}
+
+void SpinUntil(Clock::time_point t)
+{
+    while ( Clock::now() < t )
+        ;
+}
+
+
+class SimulatedResponse : public IHttpResponse
+{
+public:
+    SimulatedResponse(size_t length, double bytesPerSec, double latency)
+        : m_length(length), m_rate(bytesPerSec), m_latency(latency),
+          m_pos(0), m_start(Clock::now())
+    {}
+
+    virtual unsigned GetStatusCode() const { return 200; }
+
+    virtual bool GetHeader(const char *name, std::string& value) const
+    {
+        if ( strcmp(name, "Content-Length") != 0 )
+            return false;
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%u", unsigned(m_length));
+        value = buf;
+        return true;
+    }
+
+    virtual std::string GetURL() const { return "http://example.com/installer.exe"; }
+
+    virtual unsigned GetTimeToHeaders() const { return 1; }
+
+    virtual size_t Read(void *buffer, size_t size)
+    {
+        SpinUntil(Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                                     std::chrono::duration<double>(m_latency)));
+
+        if ( m_pos == m_length )
+            return 0;
+
+        // wait for at least one packet, then take all that arrived
+        const size_t first = std::min(m_pos + PACKET_SIZE, m_length);
+        SpinUntil(m_start + std::chrono::duration_cast<Clock::duration>(
+                                std::chrono::duration<double>(first / m_rate)));
+
+        const size_t arrived = std::min(m_length, size_t(Seconds(Clock::now() - m_start) * m_rate));
+        const size_t len = std::min(size, std::max(arrived, first) - m_pos);
+        m_pos += len;
+        (void)buffer; // the data themselves don't matter
+        return len;
+    }
+
+private:
+    size_t m_length;
+    double m_rate, m_latency;
+    size_t m_pos;
+    Clock::time_point m_start;
+};
+
+
+class SimulatedTransport : public IHttpTransport
+{
+public:
+    SimulatedTransport(size_t length, double bytesPerSec, double latency)
+        : m_length(length), m_rate(bytesPerSec), m_latency(latency) {}
+
+    virtual IHttpResponse *Send(const HttpRequestParams&, Thread*)
+    {
+        return new SimulatedResponse(m_length, m_rate, m_latency);
+    }
+
+private:
+    size_t m_length;
+    double m_rate, m_latency;
+};
+
+
+struct CountingSink : public IDownloadSink
+{
+    CountingSink() : Bytes(0), Calls(0) {}
+
+    virtual void SetLength(size_t) {}
+    virtual void SetFilename(const std::wstring&) {}
+    virtual void Add(const void *, size_t len) { Bytes += len; Calls++; }
+
+    size_t Bytes;
+    size_t Calls;
+};
+
+
+struct Point
+{
+    const char *name;
+    double bytesPerSec;
+    double latency;     // per read, in seconds
+};
+
+} // anonymous namespace
+
+
+int main()
+{
+    const Point points[] =
+    {
+        { "2 Mbit/s, 1 ms",    2e6 / 8,  1e-3 },
+        { "100 Mbit/s, 200 us", 100e6 / 8, 200e-6 },
+        { "1 Gbit/s, 50 us",   1e9 / 8,  50e-6 },
+        { "10 Gbit/s, 20 us",  10e9 / 8, 20e-6 },
+    };
+
+    printf("%-20s %-9s %10s %9s %10s %12s\n",
+           "link", "reads", "MB/s", "calls", "avg read", "avg latency");
+
+    for ( size_t i = 0; i < sizeof(points) / sizeof(points[0]); i++ )
+    {
+        const Point& p = points[i];
+
+        // about a second's worth of data, at most 512 MB
+        const size_t length = std::min(size_t(p.bytesPerSec), size_t(512) * 1024 * 1024);
+        SimulatedTransport transport(length, p.bytesPerSec, p.latency);
+        SetHttpTransport(&transport);
+
+        for ( int adaptive = 0; adaptive <= 1; adaptive++ )
+        {
+            CountingSink sink;
+            size_t reads = 0;
+            double latency = 0;
+
+            const Clock::time_point start = Clock::now();
+            if ( adaptive )
+            {
+                const DownloadReadStats before = GetDownloadReadStats();
+                DownloadFile("http://example.com/installer.exe", &sink, NULL);
+                const DownloadReadStats after = GetDownloadReadStats();
+                reads = size_t(after.Reads - before.Reads);
+                latency = (after.TotalLatency - before.TotalLatency) / 1e6;
+            }
+            else
+            {
+                HttpRequestParams request;
+                request.URL = "http://example.com/installer.exe";
+                IHttpResponse *response = transport.Send(request, NULL);
+                char buffer[10240];
+                for ( ;; )
+                {
+                    const Clock::time_point before = Clock::now();
+                    const size_t len = response->Read(buffer, sizeof(buffer));
+                    latency += Seconds(Clock::now() - before);
+                    reads++;
+                    if ( len == 0 )
+                        break;
+                    sink.Add(buffer, len);
+                }
+                delete response;
+            }
+            const double seconds = Seconds(Clock::now() - start);
+
+            printf("%-20s %-9s %10.1f %9u %8.1f KB %9.1f us\n",
+                   p.name, adaptive ? "adaptive" : "10 KB",
+                   sink.Bytes / seconds / (1024 * 1024),
+                   unsigned(sink.Calls),
+                   sink.Bytes / 1024.0 / reads,
+                   latency * 1e6 / reads);
+        }
+
+        SetHttpTransport(NULL);
+    }
+
+    return 0;
+}
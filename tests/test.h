@@ -0,0 +1,108 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef _test_h_
+#define _test_h_
+
+#include <iostream>
+#include <sstream>
+#include <string>
+
+/*
+    Minimal helpers for WinSparkle's tests.
+
+    Every test is a program that checks its expectations with the CHECK*()
+    macros below and returns TestResult() from main(), which is non-zero if
+    any of them failed.
+ */
+
+namespace winsparkle
+{
+namespace test
+{
+
+inline int& FailuresCount()
+{
+    static int count = 0;
+    return count;
+}
+
+inline void ReportFailure(const char *file, int line, const std::string& what)
+{
+    std::cerr << file << "(" << line << "): check failed: " << what << std::endl;
+    FailuresCount()++;
+}
+
+template<typename T, typename U>
+void CheckEqual(const T& actual, const U& expected,
+                const char *expr, const char *file, int line)
+{
+    if ( actual == expected )
+        return;
+
+    std::ostringstream s;
+    s << expr << " (got \"" << actual << "\", expected \"" << expected << "\")";
+    ReportFailure(file, line, s.str());
+}
+
+} // namespace test
+} // namespace winsparkle
+
+
+/// Checks that @a cond is true.
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if ( !(cond) )                                                      \
+            ::winsparkle::test::ReportFailure(__FILE__, __LINE__, #cond);   \
+    } while (0)
+
+/// Checks that @a actual equals @a expected, printing both if it doesn't.
+#define CHECK_EQUAL(actual, expected)                                       \
+    ::winsparkle::test::CheckEqual((actual), (expected),                    \
+                                   #actual " == " #expected,                \
+                                   __FILE__, __LINE__)
+
+/// Checks that evaluating @a expr throws @a exception.
+#define CHECK_THROWS(expr, exception)                                       \
+    do {                                                                    \
+        bool thrown_ = false;                                               \
+        try { expr; }                                                       \
+        catch (const exception&) { thrown_ = true; }                        \
+        if ( !thrown_ )                                                     \
+            ::winsparkle::test::ReportFailure(__FILE__, __LINE__,           \
+                                              #expr " throws " #exception); \
+    } while (0)
+
+/// Returns exit code of the test program.
+inline int TestResult()
+{
+    const int failures = winsparkle::test::FailuresCount();
+    if ( failures )
+        std::cerr << failures << " check(s) failed" << std::endl;
+    return failures ? 1 : 0;
+}
+
+#endif // _test_h_
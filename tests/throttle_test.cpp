@@ -0,0 +1,241 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+// Tests of DownloadThrottle: of the rates achieved by throttled downloads,
+// both from a fake transport and from a local server, and of the adaptation
+// of the rate to network delay in background mode.
+
+// localhttp.h includes winsock2.h, which must come before windows.h
+#include "localhttp.h"
+
+#include "throttle.h"
+#include "download.h"
+#include "test.h"
+#include "fakehttp.h"
+
+#include <algorithm>
+#include <string>
+
+using namespace winsparkle;
+using namespace winsparkle::test;
+
+namespace
+{
+
+const char INSTALLER_URL[] = "http://example.com/installer.exe";
+
+// Memory sink for segmented downloads.
+struct MemorySink : public IRandomAccessDownloadSink
+{
+    virtual void SetLength(size_t) {}
+    virtual void SetFilename(const std::wstring&) {}
+    virtual void Add(const void *buf, size_t len) { data.append((const char*)buf, len); }
+    virtual void Preallocate(size_t len) { data.resize(len); }
+    virtual void AddAt(size_t offset, const void *buf, size_t len) { data.replace(offset, len, (const char*)buf, len); }
+    virtual bool ResumePartial(const PartialDownload&) { return false; }
+    virtual void SaveProgress(const PartialDownload&) {}
+
+    std::string data;
+};
+
+
+// Downloads @a body from @a url with given limit and number of connections
+// and returns the achieved rate in bytes per second.
+double MeasureRate(const std::string& url, const std::string& body, size_t limit, unsigned connections)
+{
+    DownloadThrottle throttle(limit, false);
+    MemorySink sink;
+
+    const unsigned long long start = GetMonotonicTime();
+    DownloadFileSegmented(url, &sink, NULL, connections, NULL, NULL, &throttle);
+    const unsigned long long duration = GetMonotonicTime() - start;
+
+    CHECK(sink.data == body);
+
+    // the initial burst comes for free
+    const double burst = limit / 4.0;
+    return (body.size() - burst) * 1000.0 / std::max<unsigned long long>(duration, 1);
+}
+
+
+// The rate stays close to the limit, regardless of the number of
+// connections sharing it.
+void TestRateLimit()
+{
+    const size_t limit = 1024 * 1024;
+
+    FakeHttpTransport transport;
+    FakeHttpTransportScope scope(transport);
+
+    FakeResource installer;
+    installer.Body = std::string(2 * limit, 'x');
+    installer.ETag = "\"1\"";
+    transport.Add(INSTALLER_URL, installer);
+
+    const unsigned connections[] = { 1, 4 };
+    for ( size_t i = 0; i < sizeof(connections) / sizeof(connections[0]); i++ )
+    {
+        const double rate = MeasureRate(INSTALLER_URL, installer.Body, limit, connections[i]);
+        CHECK(rate <= limit * 1.1);
+        CHECK(rate >= limit * 0.8);
+    }
+}
+
+
+// The same over real connections to a local server, where the throttle
+// only slows down reading and TCP flow control has to slow down the server.
+// The resource is large enough to be downloaded in segments.
+void TestRateLimitFromServer()
+{
+    const size_t limit = 2 * 1024 * 1024;
+    const std::string body(2 * limit, 'x');
+
+    LocalHttpServer *server = new LocalHttpServer(body);
+    server->Start();
+
+    IHttpTransport *transport = CreateSocketTransport();
+    SetHttpTransport(transport);
+
+    const unsigned connections[] = { 1, 4 };
+    for ( size_t i = 0; i < sizeof(connections) / sizeof(connections[0]); i++ )
+    {
+        const double rate = MeasureRate(server->GetURL("/installer.exe"), body, limit, connections[i]);
+        CHECK(rate <= limit * 1.1);
+        CHECK(rate >= limit * 0.8);
+    }
+
+    // the segments were actually downloaded over several connections
+    CHECK(server->GetConnections() > 2);
+
+    SetHttpTransport(NULL);
+    delete transport;
+
+    server->TerminateAndJoin();
+    delete server;
+}
+
+
+void TestNoLimit()
+{
+    DownloadThrottle throttle(0, false);
+    CHECK_EQUAL(throttle.GetRate(), 0u);
+    CHECK_EQUAL(throttle.GetMaxRead(), 0u);
+
+    // never waits
+    const unsigned long long start = GetMonotonicTime();
+    for ( int i = 0; i < 1000; i++ )
+        throttle.Consume(1024 * 1024, NULL);
+    CHECK(GetMonotonicTime() - start < 100);
+
+    // delay doesn't matter outside of background mode
+    for ( int i = 0; i < 10; i++ )
+        throttle.AddDelaySample(i == 0 ? 10 : 1000);
+    CHECK_EQUAL(throttle.GetRate(), 0u);
+}
+
+
+void TestMaxRead()
+{
+    // reads are limited to the burst, a quarter of a second's worth
+    DownloadThrottle fast(4 * 1024 * 1024, false);
+    CHECK_EQUAL(fast.GetMaxRead(), 1024u * 1024);
+
+    // but not below the smallest read size
+    DownloadThrottle slow(1024, false);
+    CHECK_EQUAL(slow.GetMaxRead(), 16u * 1024);
+}
+
+
+// In background mode, the rate decreases as the delay rises above the base
+// delay and recovers when it drops again, never above the limit.
+void TestBackgroundBackOff()
+{
+    const size_t limit = 1024 * 1024;
+    DownloadThrottle throttle(limit, true);
+    CHECK(throttle.IsBackground());
+
+    // no queuing
+    for ( int i = 0; i < 10; i++ )
+        throttle.AddDelaySample(20);
+    CHECK_EQUAL(throttle.GetRate(), limit);
+
+    // queues fill up: the rate drops, down to the minimum
+    size_t previous = throttle.GetRate();
+    for ( int i = 0; i < 4; i++ )
+    {
+        throttle.AddDelaySample(400);
+        throttle.AddDelaySample(400);
+        throttle.AddDelaySample(400);
+        throttle.AddDelaySample(400);
+        CHECK(throttle.GetRate() < previous);
+        previous = throttle.GetRate();
+    }
+    for ( int i = 0; i < 100; i++ )
+        throttle.AddDelaySample(400);
+    CHECK_EQUAL(throttle.GetRate(), 8u * 1024);
+
+    // a single spike is ignored
+    throttle.AddDelaySample(20);
+    throttle.AddDelaySample(20);
+    throttle.AddDelaySample(20);
+    throttle.AddDelaySample(20);
+    previous = throttle.GetRate();
+    throttle.AddDelaySample(400);
+    CHECK(throttle.GetRate() > previous);
+
+    // queues drain: the rate recovers, up to the limit
+    for ( int i = 0; i < 100; i++ )
+        throttle.AddDelaySample(20);
+    CHECK_EQUAL(throttle.GetRate(), limit);
+}
+
+
+// Without a limit, a background download is only slowed down once its
+// throughput is known.
+void TestBackgroundWithoutLimit()
+{
+    DownloadThrottle throttle(0, true);
+
+    throttle.AddDelaySample(20);
+    for ( int i = 0; i < 10; i++ )
+        throttle.AddDelaySample(400);
+    CHECK_EQUAL(throttle.GetRate(), 0u);
+}
+
+} // anonymous namespace
+
+
+int main()
+{
+    TestRateLimit();
+    TestRateLimitFromServer();
+    TestNoLimit();
+    TestMaxRead();
+    TestBackgroundBackOff();
+    TestBackgroundWithoutLimit();
+
+    return TestResult();
+}
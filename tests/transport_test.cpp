@@ -0,0 +1,265 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+// Tests of the transports against a local HTTP server: of the portable
+// socket transport and, on Windows, of the WinINet one, which should share
+// one keep-alive connection for all requests of an update check instead of
+// setting up a new one for each.
+
+// localhttp.h includes winsock2.h, which must come before windows.h
+#include "localhttp.h"
+
+#include "download.h"
+#include "httptransport.h"
+#include "threads.h"
+#include "test.h"
+
+#ifdef _WIN32
+    #include "settings.h"
+#endif
+
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace winsparkle;
+using namespace winsparkle::test;
+
+namespace
+{
+
+std::string MakeData(size_t length)
+{
+    std::string data(length, '\0');
+    for ( size_t i = 0; i < length; i++ )
+        data[i] = char((i * 7919) >> 3);
+    return data;
+}
+
+
+// Memory sink for segmented downloads.
+struct MemorySink : public IRandomAccessDownloadSink
+{
+    virtual void SetLength(size_t) {}
+    virtual void SetFilename(const std::wstring&) {}
+    virtual void Add(const void *buf, size_t len) { data.append((const char*)buf, len); }
+    virtual void Preallocate(size_t len) { data.resize(len); }
+    virtual void AddAt(size_t offset, const void *buf, size_t len) { data.replace(offset, len, (const char*)buf, len); }
+    virtual bool ResumePartial(const PartialDownload&) { return false; }
+    virtual void SaveProgress(const PartialDownload&) {}
+
+    std::string data;
+};
+
+
+// Reads the rest of the response's body.
+std::string ReadBody(IHttpResponse& response)
+{
+    std::string data;
+    std::vector<char> buffer(64 * 1024);
+    for ( ;; )
+    {
+        const size_t len = response.Read(&buffer[0], buffer.size());
+        if ( len == 0 )
+            break;
+        data.append(&buffer[0], len);
+    }
+    return data;
+}
+
+
+void TestSocketTransport()
+{
+    const std::string body = MakeData(256 * 1024);
+
+    LocalHttpServer *server = new LocalHttpServer(body);
+    server->Start();
+
+    IHttpTransport *transport = CreateSocketTransport();
+    SetHttpTransport(transport);
+
+    StringDownloadSink sink;
+    const DownloadInfo info = DownloadFile(server->GetURL("/installer.exe"), &sink, NULL);
+    CHECK_EQUAL(info.StatusCode, 200u);
+    CHECK_EQUAL(info.ETag, std::string("\"1\""));
+    CHECK(sink.data == body);
+
+    SetHttpTransport(NULL);
+    delete transport;
+
+    server->TerminateAndJoin();
+    delete server;
+}
+
+
+void TestSocketTransportRange()
+{
+    const std::string body = MakeData(256 * 1024);
+
+    LocalHttpServer *server = new LocalHttpServer(body);
+    server->Start();
+
+    IHttpTransport *transport = CreateSocketTransport();
+
+    HttpRequestParams request;
+    request.URL = server->GetURL("/installer.exe");
+    request.HasRange = true;
+    request.RangeFrom = 1000;
+    request.RangeTo = 100 * 1000;
+    IHttpResponse *response = transport->Send(request, NULL);
+    CHECK_EQUAL(response->GetStatusCode(), 206u);
+
+    std::string contentRange;
+    CHECK(response->GetHeader("content-range", contentRange));
+    CHECK_EQUAL(contentRange, std::string("bytes 1000-99999/262144"));
+    CHECK(ReadBody(*response) == body.substr(1000, 99 * 1000));
+    delete response;
+
+    delete transport;
+
+    server->TerminateAndJoin();
+    delete server;
+}
+
+
+// The download engine splits large downloads into segments downloaded over
+// several connections.
+void TestSegmentedDownload()
+{
+    const std::string body = MakeData(8 * 1024 * 1024);
+
+    LocalHttpServer *server = new LocalHttpServer(body);
+    server->Start();
+
+    IHttpTransport *transport = CreateSocketTransport();
+    SetHttpTransport(transport);
+
+    MemorySink sink;
+    const DownloadInfo info = DownloadFileSegmented(server->GetURL("/installer.exe"), &sink, NULL, 4);
+    CHECK_EQUAL(info.StatusCode, 200u);
+    CHECK(sink.data == body);
+    CHECK(server->GetConnections() > 1);
+
+    SetHttpTransport(NULL);
+    delete transport;
+
+    server->TerminateAndJoin();
+    delete server;
+}
+
+
+#ifdef _WIN32
+
+// The server version, the appcast and the installer are downloaded over
+// the same connection.
+void TestConnectionReuse()
+{
+    const std::string body(256 * 1024, 'x');
+
+    LocalHttpServer *server = new LocalHttpServer(body);
+    server->Start();
+
+    IHttpTransport *transport = CreateWinINetTransport();
+    SetHttpTransport(transport);
+
+    const char *paths[] = { "/getVersion", "/appcast.xml", "/installer.exe" };
+    for ( size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++ )
+    {
+        StringDownloadSink sink;
+        const DownloadInfo info = DownloadFile(server->GetURL(paths[i]), &sink, NULL);
+        CHECK_EQUAL(info.StatusCode, 200u);
+        CHECK(sink.data == body);
+    }
+
+    CHECK_EQUAL(server->GetRequests(), 3u);
+    CHECK_EQUAL(server->GetConnections(), 1u);
+
+    SetHttpTransport(NULL);
+    transport->Close();
+    delete transport;
+
+    server->TerminateAndJoin();
+    delete server;
+}
+
+
+// Closing the transport doesn't break requests that are still running.
+void TestCloseWhileRunning()
+{
+    const std::string body(1024 * 1024, 'x');
+
+    LocalHttpServer *server = new LocalHttpServer(body);
+    server->Start();
+
+    IHttpTransport *transport = CreateWinINetTransport();
+
+    HttpRequestParams request;
+    request.URL = server->GetURL("/installer.exe");
+    IHttpResponse *response = transport->Send(request, NULL);
+    CHECK_EQUAL(response->GetStatusCode(), 200u);
+
+    transport->Close();
+
+    CHECK(ReadBody(*response) == body);
+    delete response;
+
+    // the transport opens a new session for the next request
+    IHttpResponse *next = transport->Send(request, NULL);
+    CHECK_EQUAL(next->GetStatusCode(), 200u);
+    delete next;
+
+    transport->Close();
+    delete transport;
+
+    server->TerminateAndJoin();
+    delete server;
+}
+
+#endif // _WIN32
+
+} // anonymous namespace
+
+
+int main()
+{
+#ifdef _WIN32
+    // test executables don't have the VERSIONINFO resource with the defaults
+    Settings::SetAppName(L"WinSparkle Tests");
+    Settings::SetAppVersion(L"1.0");
+#endif
+
+    TestSocketTransport();
+    TestSocketTransportRange();
+    TestSegmentedDownload();
+
+#ifdef _WIN32
+    TestConnectionReuse();
+    TestCloseWhileRunning();
+#endif
+
+    return TestResult();
+}
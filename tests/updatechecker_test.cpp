@@ -0,0 +1,541 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// Tests of update checks, run against FakeHttpTransport: choosing the update
+// to offer, reusing the result of evaluating an unchanged appcast and probing
+// the server version concurrently with the appcast download.
+
+#include "updatechecker.h"
+#include "appcastcache.h"
+#include "appcontroller.h"
+#include "settings.h"
+#include "test.h"
+#include "fakehttp.h"
+#include "fakeui.h"
+
+#include <windows.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace winsparkle;
+using namespace winsparkle::test;
+
+namespace
+{
+
+const char HOST[] = "https://updates.example.com";
+const char APPCAST_PATH[] = "/appcast.xml";
+const char APPCAST_URL[] = "https://updates.example.com/appcast.xml";
+const char SERVER_VERSION_URL[] = "https://updates.example.com/getVersion";
+
+FakeHttpTransport g_transport;
+
+// Configuration kept in memory, so that the tests don't leave anything in
+// the registry.
+std::map<std::string, std::wstring> g_config;
+
+int __cdecl ConfigRead(const char *name, wchar_t *buf, size_t len, void *)
+{
+    std::map<std::string, std::wstring>::const_iterator i = g_config.find(name);
+    if ( i == g_config.end() || i->second.length() >= len )
+        return FALSE;
+    wcscpy(buf, i->second.c_str());
+    return TRUE;
+}
+
+void __cdecl ConfigWrite(const char *name, const wchar_t *value, void *)
+{
+    g_config[name] = value;
+}
+
+void __cdecl ConfigDelete(const char *name, void *)
+{
+    g_config.erase(name);
+}
+
+const char* __cdecl GetHost()
+{
+    return HOST;
+}
+
+
+// Returns <item> of the appcast for @a version, which requires at least
+// @a minServerVersion if not empty.
+std::string MakeItem(const std::string& version, const std::string& minServerVersion = "")
+{
+    std::string item =
+        "    <item>\n"
+        "      <title>Version " + version + "</title>\n";
+    if ( !minServerVersion.empty() )
+        item += "      <sparkle:minimumServerVersion>" + minServerVersion + "</sparkle:minimumServerVersion>\n";
+    item +=
+        "      <enclosure url=\"https://updates.example.com/app-" + version + ".exe\"\n"
+        "                 length=\"1000\" sparkle:version=\"" + version + "\"\n"
+        "                 sparkle:os=\"windows\" type=\"application/octet-stream\"/>\n"
+        "    </item>\n";
+    return item;
+}
+
+// Returns @a item with @a from replaced by @a to.
+std::string Replace(std::string item, const std::string& from, const std::string& to)
+{
+    const size_t pos = item.find(from);
+    if ( pos != std::string::npos )
+        item.replace(pos, from.length(), to);
+    return item;
+}
+
+// Marks the item as a critical update.
+std::string Critical(const std::string& item)
+{
+    return Replace(item, "    </item>", "      <sparkle:criticalUpdate/>\n    </item>");
+}
+
+// Changes title of the item, to tell apart items of the same version.
+std::string Titled(const std::string& item, const std::string& title)
+{
+    const size_t from = item.find("<title>") + 7;
+    return Replace(item, item.substr(from, item.find("</title>") - from), title);
+}
+
+// Changes the OS the item is for.
+std::string ForOS(const std::string& item, const std::string& os)
+{
+    return Replace(item, "sparkle:os=\"windows\"", "sparkle:os=\"" + os + "\"");
+}
+
+std::string MakeFeed(const std::string& items)
+{
+    return
+        "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+        "<rss version=\"2.0\" xmlns:sparkle=\"http://www.andymatuschak.org/xml-namespaces/sparkle\">\n"
+        "  <channel>\n"
+        + items +
+        "  </channel>\n"
+        "</rss>\n";
+}
+
+// Publishes the appcast, which takes @a readDelay milliseconds to download.
+void PublishFeed(const std::string& feed, unsigned readDelay = 0)
+{
+    FakeResource appcast;
+    appcast.Body = feed;
+    appcast.ReadDelay = readDelay;
+    g_transport.Add(APPCAST_URL, appcast);
+}
+
+// Publishes the server version, which takes @a readDelay milliseconds
+// to download.
+void PublishServerVersion(const std::string& version, unsigned readDelay = 0)
+{
+    FakeResource serverVersion;
+    serverVersion.Body = "{\"oethServerVersion\": \"" + version + "\"}";
+    serverVersion.ReadDelay = readDelay;
+    g_transport.Add(SERVER_VERSION_URL, serverVersion);
+}
+
+unsigned CountRequests(const std::string& url)
+{
+    const std::vector<HttpRequestParams> requests = g_transport.GetRequests();
+    unsigned count = 0;
+    for ( size_t i = 0; i < requests.size(); i++ )
+    {
+        if ( requests[i].URL == url )
+            count++;
+    }
+    return count;
+}
+
+
+// Removes the result of the previous check, as if the app never checked.
+void ForgetAppcastCache()
+{
+    std::wstring cacheFile;
+    if ( Settings::ReadConfigValue("AppcastCacheFile", cacheFile) )
+        DeleteFile(cacheFile.c_str());
+    Settings::DeleteConfigValue("AppcastCacheFile");
+    AppcastCache::Unload();
+}
+
+
+// Update checker that can be waited for.
+class TestUpdateChecker : public OneShotUpdateChecker
+{
+protected:
+    virtual bool IsJoinable() const { return true; }
+};
+
+// Performs a periodic update check, returns what the user was told.
+UINotifications Check()
+{
+    FakeUI::Reset();
+
+    TestUpdateChecker checker;
+    checker.Start();
+    checker.Join();
+
+    return FakeUI::Get();
+}
+
+
+const unsigned SERVER_VERSION_TTL = 10 * 60 * 1000;
+
+void TestSelection()
+{
+    UpdateChecker::SetServerVersionTTL(0);
+    PublishServerVersion("3.0");
+
+    // the latest version is offered, regardless of order of the items
+    PublishFeed(MakeFeed(MakeItem("2.0") + MakeItem("2.2") + MakeItem("2.1")));
+    UINotifications ui = Check();
+    CHECK_EQUAL(ui.UpdateAvailable, 1u);
+    CHECK_EQUAL(ui.Update.Version, "2.2");
+
+    // ...and the last one of several items of the same version
+    PublishFeed(MakeFeed(Titled(MakeItem("2.0"), "First") + Titled(MakeItem("2.0"), "Second")));
+    ui = Check();
+    CHECK_EQUAL(ui.Update.Title, "Second");
+
+    // versions that are already installed are never offered
+    PublishFeed(MakeFeed(MakeItem("0.9") + MakeItem("1.0")));
+    ui = Check();
+    CHECK_EQUAL(ui.UpdateAvailable, 0u);
+    CHECK_EQUAL(ui.NoUpdates, 1u);
+
+    // a critical update takes precedence over newer versions; of several
+    // ones, the earliest version is offered, and the first one of the same
+    // version
+    PublishFeed(MakeFeed(MakeItem("2.2") +
+                         Critical(MakeItem("2.1")) +
+                         Critical(Titled(MakeItem("2.0"), "First")) +
+                         Critical(Titled(MakeItem("2.0"), "Second")) +
+                         MakeItem("1.5")));
+    ui = Check();
+    CHECK_EQUAL(ui.UpdateAvailable, 1u);
+    CHECK_EQUAL(ui.Update.Version, "2.0");
+    CHECK_EQUAL(ui.Update.Title, "First");
+    CHECK(ui.Update.CriticalUpdate);
+
+    // critical updates that are already installed don't matter
+    PublishFeed(MakeFeed(Critical(MakeItem("0.9")) + Critical(MakeItem("1.0")) + MakeItem("2.0")));
+    ui = Check();
+    CHECK_EQUAL(ui.Update.Version, "2.0");
+    CHECK(!ui.Update.CriticalUpdate);
+
+    // items that require a newer server are ignored, critical ones too
+    PublishFeed(MakeFeed(MakeItem("2.0", "3.0") +
+                         MakeItem("2.1", "3.0.1") +
+                         Critical(MakeItem("1.5", "4.0"))));
+    ui = Check();
+    CHECK_EQUAL(ui.Update.Version, "2.0");
+    CHECK(!ui.Update.CriticalUpdate);
+
+    PublishFeed(MakeFeed(MakeItem("2.0", "3.1")));
+    ui = Check();
+    CHECK_EQUAL(ui.UpdateAvailable, 0u);
+    CHECK_EQUAL(ui.NoUpdates, 1u);
+
+    // so are items for other OS
+    PublishFeed(MakeFeed(MakeItem("2.0") + ForOS(MakeItem("2.1"), "macos")));
+    ui = Check();
+    CHECK_EQUAL(ui.Update.Version, "2.0");
+
+    UpdateChecker::SetServerVersionTTL(SERVER_VERSION_TTL);
+}
+
+
+void TestUnchangedFeed()
+{
+    PublishServerVersion("3.0");
+    PublishFeed(MakeFeed(MakeItem("1.5") + MakeItem("2.0")));
+
+    // without a previous result, there is nothing to compare the feed with
+    // and its hash isn't computed, so the first check after that doesn't
+    // reuse the result either
+    ForgetAppcastCache();
+
+    unsigned hits = AppcastCache::GetHitCount();
+    unsigned misses = AppcastCache::GetMissCount();
+
+    UINotifications ui = Check();
+    CHECK_EQUAL(ui.UpdateAvailable, 1u);
+    CHECK_EQUAL(ui.Update.Version, "2.0");
+    CHECK_EQUAL(AppcastCache::GetHitCount() - hits, 0u);
+    CHECK_EQUAL(AppcastCache::GetMissCount() - misses, 1u);
+
+    ui = Check();
+    CHECK_EQUAL(ui.Update.Version, "2.0");
+    CHECK_EQUAL(AppcastCache::GetHitCount() - hits, 0u);
+    CHECK_EQUAL(AppcastCache::GetMissCount() - misses, 2u);
+
+    // the same content is downloaded again, but not evaluated again
+    hits = AppcastCache::GetHitCount();
+    misses = AppcastCache::GetMissCount();
+
+    ui = Check();
+    CHECK_EQUAL(ui.UpdateAvailable, 1u);
+    CHECK_EQUAL(ui.Update.Version, "2.0");
+    CHECK_EQUAL(ui.Update.enclosure.DownloadURL, "https://updates.example.com/app-2.0.exe");
+    CHECK_EQUAL(AppcastCache::GetHitCount() - hits, 1u);
+    CHECK_EQUAL(AppcastCache::GetMissCount() - misses, 0u);
+
+    // the result is kept in a file, so that it's reused after restart too
+    AppcastCache::Unload();
+    hits = AppcastCache::GetHitCount();
+
+    ui = Check();
+    CHECK_EQUAL(ui.UpdateAvailable, 1u);
+    CHECK_EQUAL(ui.Update.Version, "2.0");
+    CHECK_EQUAL(AppcastCache::GetHitCount() - hits, 1u);
+}
+
+
+void TestChangedFeed()
+{
+    PublishServerVersion("3.0");
+    PublishFeed(MakeFeed(MakeItem("2.0")));
+    Check();
+
+    // a new item is found
+    unsigned hits = AppcastCache::GetHitCount();
+    unsigned misses = AppcastCache::GetMissCount();
+
+    PublishFeed(MakeFeed(MakeItem("2.0") + MakeItem("2.1")));
+    UINotifications ui = Check();
+    CHECK_EQUAL(ui.UpdateAvailable, 1u);
+    CHECK_EQUAL(ui.Update.Version, "2.1");
+    CHECK_EQUAL(AppcastCache::GetHitCount() - hits, 0u);
+    CHECK_EQUAL(AppcastCache::GetMissCount() - misses, 1u);
+
+    // any change of the content counts, even in the part after </channel>
+    // that isn't parsed
+    misses = AppcastCache::GetMissCount();
+
+    PublishFeed(MakeFeed(MakeItem("2.0") + MakeItem("2.1")) + "<!-- comment -->\n");
+    ui = Check();
+    CHECK_EQUAL(ui.Update.Version, "2.1");
+    CHECK_EQUAL(AppcastCache::GetMissCount() - misses, 1u);
+
+    // the item is withdrawn
+    misses = AppcastCache::GetMissCount();
+
+    PublishFeed(MakeFeed(MakeItem("1.0")));
+    ui = Check();
+    CHECK_EQUAL(ui.UpdateAvailable, 0u);
+    CHECK_EQUAL(ui.NoUpdates, 1u);
+    CHECK_EQUAL(AppcastCache::GetMissCount() - misses, 1u);
+}
+
+
+void TestStopsAfterChannel()
+{
+    PublishServerVersion("3.0");
+
+    FakeResource appcast;
+    appcast.Body = MakeFeed(MakeItem("2.0")) + "<!--" + std::string(256 * 1024, '-') + "-->\n";
+    appcast.ReadSize = 4096;
+
+    // without a previous result, the download stops after </channel>
+    ForgetAppcastCache();
+
+    g_transport.Add(APPCAST_URL, appcast);
+    UINotifications ui = Check();
+    CHECK_EQUAL(ui.Update.Version, "2.0");
+    CHECK(g_transport.GetServedBytes(APPCAST_URL) < 64 * 1024);
+
+    // with one, all of the feed is needed to compare it with the previous one
+    g_transport.Add(APPCAST_URL, appcast);
+    ui = Check();
+    CHECK_EQUAL(ui.Update.Version, "2.0");
+    CHECK_EQUAL(g_transport.GetServedBytes(APPCAST_URL), appcast.Body.size());
+
+    const unsigned hits = AppcastCache::GetHitCount();
+    g_transport.Add(APPCAST_URL, appcast);
+    ui = Check();
+    CHECK_EQUAL(ui.Update.Version, "2.0");
+    CHECK_EQUAL(AppcastCache::GetHitCount() - hits, 1u);
+}
+
+
+void TestServerVersionReused()
+{
+    PublishServerVersion("3.0");
+    PublishFeed(MakeFeed(MakeItem("2.0") + MakeItem("2.1", "4.0")));
+
+    // a version probed by earlier tests isn't reused with zero TTL
+    UpdateChecker::SetServerVersionTTL(0);
+    g_transport.ClearRequests();
+    UINotifications ui = Check();
+    CHECK_EQUAL(CountRequests(SERVER_VERSION_URL), 1u);
+    CHECK_EQUAL(ui.Update.Version, "2.0");
+
+    // the following checks don't probe it again, even if it changed
+    UpdateChecker::SetServerVersionTTL(SERVER_VERSION_TTL);
+    PublishServerVersion("4.0");
+
+    for ( int i = 0; i < 2; i++ )
+    {
+        g_transport.ClearRequests();
+        const unsigned reused = UpdateChecker::GetStats().ServerVersionReused;
+
+        ui = Check();
+        CHECK_EQUAL(CountRequests(SERVER_VERSION_URL), 0u);
+        CHECK_EQUAL(CountRequests(APPCAST_URL), 1u);
+        CHECK_EQUAL(UpdateChecker::GetStats().ServerVersionReused - reused, 1u);
+        CHECK_EQUAL(ui.Update.Version, "2.0");
+    }
+}
+
+
+void TestServerVersionExpires()
+{
+    PublishServerVersion("3.0");
+    PublishFeed(MakeFeed(MakeItem("2.0") + MakeItem("2.1", "4.0")));
+
+    UpdateChecker::SetServerVersionTTL(0);
+    UINotifications ui = Check();
+    CHECK_EQUAL(ui.Update.Version, "2.0");
+
+    // the server was upgraded since, which is noticed when the TTL expires
+    UpdateChecker::SetServerVersionTTL(200);
+    PublishServerVersion("4.0");
+    Sleep(300);
+
+    g_transport.ClearRequests();
+    const unsigned reused = UpdateChecker::GetStats().ServerVersionReused;
+
+    ui = Check();
+    CHECK_EQUAL(CountRequests(SERVER_VERSION_URL), 1u);
+    CHECK_EQUAL(UpdateChecker::GetStats().ServerVersionReused - reused, 0u);
+    CHECK_EQUAL(ui.Update.Version, "2.1");
+
+    UpdateChecker::SetServerVersionTTL(SERVER_VERSION_TTL);
+}
+
+
+void TestFailedProbeNotReused()
+{
+    PublishFeed(MakeFeed(MakeItem("2.0") + MakeItem("2.1", "4.0")));
+
+    // the version probed by earlier tests expires
+    UpdateChecker::SetServerVersionTTL(200);
+    Sleep(300);
+
+    FakeResource failing;
+    failing.Status = 500;
+    g_transport.Add(SERVER_VERSION_URL, failing);
+    Check();
+
+    // the server works again and is asked again right away
+    PublishServerVersion("4.0");
+    g_transport.ClearRequests();
+
+    const UINotifications ui = Check();
+    CHECK_EQUAL(CountRequests(SERVER_VERSION_URL), 1u);
+    CHECK_EQUAL(ui.Update.Version, "2.1");
+
+    UpdateChecker::SetServerVersionTTL(SERVER_VERSION_TTL);
+}
+
+
+void TestConcurrentProbe()
+{
+    UpdateChecker::SetServerVersionTTL(0);
+
+    const std::string feed = MakeFeed(MakeItem("2.0") + MakeItem("2.1", "4.0"));
+    const unsigned DELAY = 300;   // of every read
+
+    // the check takes this long with just the appcast download being slow
+    PublishServerVersion("4.0");
+    PublishFeed(feed, DELAY);
+    ULONGLONG start = GetTickCount64();
+    UINotifications ui = Check();
+    const ULONGLONG slowFeed = GetTickCount64() - start;
+    CHECK_EQUAL(ui.Update.Version, "2.1");
+    CHECK(slowFeed >= DELAY);
+
+    // and as long with a slow server version too, because it's probed
+    // meanwhile; it would take twice as long otherwise
+    PublishServerVersion("4.0", DELAY);
+    start = GetTickCount64();
+    ui = Check();
+    const ULONGLONG slowBoth = GetTickCount64() - start;
+    CHECK_EQUAL(ui.Update.Version, "2.1");
+    if ( slowBoth >= slowFeed + slowFeed / 2 )
+    {
+        winsparkle::test::ReportFailure(__FILE__, __LINE__,
+                                        "the probe didn't overlap the appcast download (" +
+                                        std::to_string(slowBoth) + " ms instead of " +
+                                        std::to_string(slowFeed) + " ms)");
+    }
+    CHECK(UpdateChecker::GetStats().LastDuration >= slowBoth - 50);
+
+    // the feed may also be downloaded before the server version is known
+    PublishFeed(feed);
+    ui = Check();
+    CHECK_EQUAL(ui.Update.Version, "2.1");
+
+    PublishServerVersion("3.0", DELAY);
+    ui = Check();
+    CHECK_EQUAL(ui.Update.Version, "2.0");
+
+    UpdateChecker::SetServerVersionTTL(SERVER_VERSION_TTL);
+}
+
+} // anonymous namespace
+
+
+int main()
+{
+    win_sparkle_config_methods_t config;
+    config.config_read = &ConfigRead;
+    config.config_write = &ConfigWrite;
+    config.config_delete = &ConfigDelete;
+    config.user_data = NULL;
+    Settings::SetConfigMethods(&config);
+
+    Settings::SetAppName(L"WinSparkle Test");
+    Settings::SetAppVersion(L"1.0");
+    Settings::SetAppBuildVersion(L"1.0");
+    Settings::SetAppcastPath(APPCAST_PATH);
+    ApplicationController::SetGetAvailableHostCallback(&GetHost);
+
+    FakeHttpTransportScope scope(g_transport);
+
+    TestSelection();
+    TestUnchangedFeed();
+    TestChangedFeed();
+    TestStopsAfterChannel();
+    TestServerVersionReused();
+    TestServerVersionExpires();
+    TestFailedProbeNotReused();
+    TestConcurrentProbe();
+
+    ForgetAppcastCache();
+
+    return TestResult();
+}
@@ -0,0 +1,410 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// Tests of downloading updates in advance: the update checker pre-stages
+// the update before notifying the user, the user's download uses it, and
+// pre-staging stops when the checker is terminated or the user starts
+// downloading.
+
+#include "updatechecker.h"
+#include "updatedownloader.h"
+#include "appcontroller.h"
+#include "installercache.h"
+#include "settings.h"
+#include "test.h"
+#include "fakehttp.h"
+#include "fakeui.h"
+
+#include <windows.h>
+#include <openssl/dsa.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/sha.h>
+
+#include <cstdio>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace winsparkle;
+using namespace winsparkle::test;
+
+namespace
+{
+
+const char HOST[] = "https://updates.example.com";
+const char APPCAST_PATH[] = "/appcast.xml";
+const char APPCAST_URL[] = "https://updates.example.com/appcast.xml";
+const char SERVER_VERSION_URL[] = "https://updates.example.com/getVersion";
+const char INSTALLER_URL[] = "https://updates.example.com/oeth-agent/downloads/2.0/windows.exe";
+
+const size_t INSTALLER_SIZE = 1024 * 1024;
+
+FakeHttpTransport g_transport;
+
+// Configuration kept in memory, so that the tests don't leave anything in
+// the registry.
+std::map<std::string, std::wstring> g_config;
+
+int __cdecl ConfigRead(const char *name, wchar_t *buf, size_t len, void *)
+{
+    std::map<std::string, std::wstring>::const_iterator i = g_config.find(name);
+    if ( i == g_config.end() || i->second.length() >= len )
+        return FALSE;
+    wcscpy(buf, i->second.c_str());
+    return TRUE;
+}
+
+void __cdecl ConfigWrite(const char *name, const wchar_t *value, void *)
+{
+    g_config[name] = value;
+}
+
+void __cdecl ConfigDelete(const char *name, void *)
+{
+    g_config.erase(name);
+}
+
+const char* __cdecl GetHost()
+{
+    return HOST;
+}
+
+// The tests don't depend on the machine's connection and free space.
+int __cdecl AllowPrestageWithDiskSpace(unsigned long long, unsigned long long)
+{
+    return 1;
+}
+
+int __cdecl AllowPrestageOnConnection(int)
+{
+    return 1;
+}
+
+
+// Key the updates are signed with, generated for the tests.
+DSA *g_key = NULL;
+
+void GenerateKey()
+{
+    g_key = DSA_new();
+    if ( !g_key ||
+         !DSA_generate_parameters_ex(g_key, 1024, NULL, 0, NULL, NULL, NULL) ||
+         !DSA_generate_key(g_key) )
+    {
+        throw std::runtime_error("can't generate DSA key");
+    }
+
+    BIO *bio = BIO_new(BIO_s_mem());
+    PEM_write_bio_DSA_PUBKEY(bio, g_key);
+    char *pem = NULL;
+    const long len = BIO_get_mem_data(bio, &pem);
+    Settings::SetDSAPubKeyPem(std::string(pem, len));
+    BIO_free(bio);
+}
+
+// Returns the signature of @a data, as sparkle:dsaSignature contains it.
+std::string Sign(const std::string& data)
+{
+    unsigned char sha1[SHA_DIGEST_LENGTH];
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    SHA1(reinterpret_cast<const unsigned char*>(data.data()), data.size(), sha1);
+    SHA1(sha1, sizeof(sha1), digest);
+
+    std::vector<unsigned char> signature(DSA_size(g_key));
+    unsigned len = 0;
+    if ( !DSA_sign(0, digest, sizeof(digest), &signature[0], &len, g_key) )
+        throw std::runtime_error("can't sign test data");
+
+    std::vector<unsigned char> base64(4 * ((len + 2) / 3) + 1);
+    const int base64len = EVP_EncodeBlock(&base64[0], &signature[0], int(len));
+    return std::string(reinterpret_cast<const char*>(&base64[0]), base64len);
+}
+
+
+std::string MakeData(size_t length)
+{
+    std::string data(length, '\0');
+    for ( size_t i = 0; i < length; i++ )
+        data[i] = char((i * 7919) >> 3);
+    return data;
+}
+
+std::string ReadTestFile(const std::wstring& path)
+{
+    std::string data;
+    FILE *f = _wfopen(path.c_str(), L"rb");
+    if ( !f )
+        return data;
+    char buffer[4096];
+    size_t len;
+    while ( (len = fread(buffer, 1, sizeof(buffer), f)) > 0 )
+        data.append(buffer, len);
+    fclose(f);
+    return data;
+}
+
+
+// Published update: the feed with a single item and its installer.
+struct Update
+{
+    std::string Installer;
+    std::string Feed;
+    Appcast Item;
+    std::string CacheKey;
+};
+
+// Publishes an update, served with @a readDelay milliseconds per 16 KB.
+Update Publish(unsigned readDelay)
+{
+    Update update;
+    update.Installer = MakeData(INSTALLER_SIZE);
+    update.Feed =
+        "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+        "<rss version=\"2.0\" xmlns:sparkle=\"http://www.andymatuschak.org/xml-namespaces/sparkle\">\n"
+        "  <channel>\n"
+        "    <item>\n"
+        "      <title>Version 2.0</title>\n"
+        "      <enclosure url=\"" + std::string(INSTALLER_URL) + "\"\n"
+        "                 length=\"" + std::to_string(INSTALLER_SIZE) + "\"\n"
+        "                 sparkle:version=\"2.0\" sparkle:os=\"windows\"\n"
+        "                 sparkle:dsaSignature=\"" + Sign(update.Installer) + "\"\n"
+        "                 type=\"application/octet-stream\"/>\n"
+        "    </item>\n"
+        "  </channel>\n"
+        "</rss>\n";
+    update.Item = Appcast::Load(update.Feed).at(0);
+    update.CacheKey = InstallerCache::GetKey(update.Item.enclosure);
+
+    FakeResource appcast;
+    appcast.Body = update.Feed;
+    g_transport.Add(APPCAST_URL, appcast);
+
+    FakeResource serverVersion;
+    serverVersion.Body = "{\"oethServerVersion\": \"3.0\"}";
+    g_transport.Add(SERVER_VERSION_URL, serverVersion);
+
+    FakeResource installer;
+    installer.Body = update.Installer;
+    installer.ReadSize = 16 * 1024;
+    installer.ReadDelay = readDelay;
+    g_transport.Add(INSTALLER_URL, installer);
+
+    return update;
+}
+
+// Starts with nothing downloaded or cached.
+void Reset()
+{
+    Settings::SetInstallerCacheLimit(0);
+    InstallerCache::Trim("", L"");
+    Settings::SetInstallerCacheLimit(1024 * 1024 * 1024);
+    g_config.clear();
+
+    g_transport.ClearRequests();
+    FakeUI::Reset();
+}
+
+bool IsCached(const std::string& key, std::wstring& path)
+{
+    return InstallerCache::Find(key, path);
+}
+
+bool WasRequested(const std::string& url)
+{
+    const std::vector<HttpRequestParams> requests = g_transport.GetRequests();
+    for ( size_t i = 0; i < requests.size(); i++ )
+    {
+        if ( requests[i].URL == url )
+            return true;
+    }
+    return false;
+}
+
+// Waits until the installer starts downloading.
+bool WaitForInstallerDownload()
+{
+    for ( int i = 0; i < 1000; i++ )
+    {
+        if ( g_transport.GetServedBytes(INSTALLER_URL) > 0 )
+            return true;
+        Sleep(10);
+    }
+    return false;
+}
+
+
+// Update checker that can be waited for.
+class TestUpdateChecker : public OneShotUpdateChecker
+{
+protected:
+    virtual bool IsJoinable() const { return true; }
+};
+
+
+void TestPrestage()
+{
+    Reset();
+    const Update update = Publish(0);
+
+    TestUpdateChecker checker;
+    checker.Start();
+    checker.Join();
+
+    // the user is told about the update only when it's downloaded
+    const UINotifications ui = FakeUI::Get();
+    CHECK_EQUAL(ui.UpdateAvailable, 1u);
+    CHECK(ui.ReadyToInstall);
+    CHECK_EQUAL(ui.Update.Version, "2.0");
+    CHECK_EQUAL(ui.UpdateDownloaded, 0u);
+
+    std::wstring cached;
+    CHECK(IsCached(update.CacheKey, cached));
+    CHECK(ReadTestFile(cached) == update.Installer);
+}
+
+
+void TestCacheHitOnClick()
+{
+    Reset();
+    const Update update = Publish(0);
+
+    TestUpdateChecker checker;
+    checker.Start();
+    checker.Join();
+    CHECK(FakeUI::Get().ReadyToInstall);
+
+    std::wstring cached;
+    CHECK(IsCached(update.CacheKey, cached));
+
+    // the user clicks "Install update"
+    g_transport.ClearRequests();
+    const InstallerCacheStats before = InstallerCache::GetStats();
+
+    UpdateDownloader downloader(FakeUI::Get().Update);
+    downloader.Start();
+    downloader.Join();
+
+    const UINotifications ui = FakeUI::Get();
+    CHECK_EQUAL(ui.UpdateDownloaded, 1u);
+    CHECK(ui.UpdateFile == cached);
+    CHECK(!WasRequested(INSTALLER_URL));
+
+    const InstallerCacheStats after = InstallerCache::GetStats();
+    CHECK_EQUAL(after.Hits - before.Hits, 1u);
+    CHECK_EQUAL(after.Misses - before.Misses, 0u);
+}
+
+
+void TestTerminateAllStopsPrestage()
+{
+    Reset();
+    // takes 64 * 200 ms / 4 connections = 3.2 s
+    const Update update = Publish(200);
+
+    UpdateChecker *checker = new OneShotUpdateChecker();
+    checker->Start();   // deletes itself when done
+    CHECK(WaitForInstallerDownload());
+
+    const ULONGLONG start = GetTickCount64();
+    CHECK(UpdateChecker::TerminateAll(2000));
+    CHECK(GetTickCount64() - start < 2000);
+
+    // the download stopped and nothing was offered
+    const size_t served = g_transport.GetServedBytes(INSTALLER_URL);
+    CHECK(served < INSTALLER_SIZE);
+    Sleep(500);
+    CHECK_EQUAL(g_transport.GetServedBytes(INSTALLER_URL), served);
+
+    CHECK_EQUAL(FakeUI::Get().UpdateAvailable, 0u);
+    std::wstring cached;
+    CHECK(!IsCached(update.CacheKey, cached));
+}
+
+
+void TestNoNotificationWhenPreempted()
+{
+    Reset();
+    const Update update = Publish(200);
+
+    TestUpdateChecker checker;
+    checker.Start();
+    CHECK(WaitForInstallerDownload());
+
+    // the user starts downloading the update while it's being pre-staged
+    // (e.g. after a manual check), so the checker gives way to it
+    UpdateDownloader downloader(update.Item);
+    downloader.Start();
+    checker.Join();
+
+    CHECK_EQUAL(FakeUI::Get().UpdateAvailable, 0u);
+
+    // no need to wait for the rest of the slow download
+    FakeResource installer;
+    installer.Body = update.Installer;
+    g_transport.Add(INSTALLER_URL, installer);
+    downloader.Join();
+
+    const UINotifications ui = FakeUI::Get();
+    CHECK_EQUAL(ui.UpdateAvailable, 0u);
+    CHECK_EQUAL(ui.UpdateDownloaded, 1u);
+    CHECK(ReadTestFile(ui.UpdateFile) == update.Installer);
+}
+
+} // anonymous namespace
+
+
+int main()
+{
+    win_sparkle_config_methods_t config;
+    config.config_read = &ConfigRead;
+    config.config_write = &ConfigWrite;
+    config.config_delete = &ConfigDelete;
+    config.user_data = NULL;
+    Settings::SetConfigMethods(&config);
+
+    Settings::SetAppName(L"WinSparkle Test");
+    Settings::SetAppVersion(L"1.0");
+    Settings::SetAppBuildVersion(L"1.0");
+    Settings::SetAppcastPath(APPCAST_PATH);
+    Settings::SetPrestageUpdates(true);
+    ApplicationController::SetGetAvailableHostCallback(&GetHost);
+    ApplicationController::SetPrestageDiskSpaceCallback(&AllowPrestageWithDiskSpace);
+    ApplicationController::SetPrestageMeteredConnectionCallback(&AllowPrestageOnConnection);
+    GenerateKey();
+
+    FakeHttpTransportScope scope(g_transport);
+
+    TestPrestage();
+    TestCacheHitOnClick();
+    TestTerminateAllStopsPrestage();
+    TestNoNotificationWhenPreempted();
+
+    Reset();
+    DSA_free(g_key);
+
+    return TestResult();
+}
@@ -0,0 +1,161 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+// Benchmark of sorting 100k versions with the original string-based
+// comparison, with ParsedVersion and with its sort keys, and of finding the
+// installed version's rank among them.
+
+#include "version.h"
+#include "version_reference.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace winsparkle;
+using winsparkle::test::ReferenceCompareVersions;
+
+namespace
+{
+
+const int VERSIONS_COUNT = 100000;
+
+// Generates versions like real feeds have, e.g. "2.13.4" or "3.0rc2".
+std::vector<std::string> MakeVersions()
+{
+    static const char *const suffixes[] = { "", "", "", "", "a1", "b2", "beta3", "rc1" };
+
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> component(0, 30);
+    std::uniform_int_distribution<int> components(2, 4);
+    std::uniform_int_distribution<int> suffix(0, 7);
+
+    std::vector<std::string> versions;
+    versions.reserve(VERSIONS_COUNT);
+
+    for ( int i = 0; i < VERSIONS_COUNT; i++ )
+    {
+        std::string v = std::to_string(component(rng));
+        const int n = components(rng);
+        for ( int c = 1; c < n; c++ )
+            v += "." + std::to_string(component(rng));
+        v += suffixes[suffix(rng)];
+        versions.push_back(v);
+    }
+
+    return versions;
+}
+
+double ElapsedMs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - start).count();
+}
+
+} // anonymous namespace
+
+
+int main()
+{
+    const std::vector<std::string> versions = MakeVersions();
+
+    std::vector<std::string> byStrings(versions);
+    auto start = std::chrono::steady_clock::now();
+    std::stable_sort(byStrings.begin(), byStrings.end(),
+        [](const std::string& a, const std::string& b) { return ReferenceCompareVersions(a, b) < 0; });
+    const double stringsMs = ElapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    std::vector<ParsedVersion> parsed(versions.begin(), versions.end());
+    const double parseMs = ElapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    std::stable_sort(parsed.begin(), parsed.end(),
+        [](const ParsedVersion& a, const ParsedVersion& b) { return a.Compare(b) < 0; });
+    const double parsedMs = ElapsedMs(start);
+
+    for ( int i = 0; i < VERSIONS_COUNT; i++ )
+    {
+        if ( parsed[i].GetString() != byStrings[i] )
+        {
+            fprintf(stderr, "sort results differ at %d\n", i);
+            return 1;
+        }
+    }
+
+    start = std::chrono::steady_clock::now();
+    std::vector<std::string> keys;
+    keys.reserve(parsed.size());
+    for ( int i = 0; i < VERSIONS_COUNT; i++ )
+        keys.push_back(ParsedVersion(versions[i]).GetSortKey());
+    const double keysMs = ElapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    std::sort(keys.begin(), keys.end());
+    const double keysSortMs = ElapsedMs(start);
+
+    // rank of some installed versions among all of them, i.e. how many
+    // versions in the feed are newer
+    static const char *const installed[] = { "0.1", "3.14.15", "15.2rc1", "29.30.30" };
+    const int LOOKUPS = 100000;
+    size_t newer = 0, newerByKeys = 0;
+
+    start = std::chrono::steady_clock::now();
+    for ( int i = 0; i < LOOKUPS; i++ )
+    {
+        const ParsedVersion v(installed[i % 4]);
+        newer += parsed.end() - std::upper_bound(parsed.begin(), parsed.end(), v,
+            [](const ParsedVersion& a, const ParsedVersion& b) { return a.Compare(b) < 0; });
+    }
+    const double lookupMs = ElapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    for ( int i = 0; i < LOOKUPS; i++ )
+    {
+        const std::string key = ParsedVersion(installed[i % 4]).GetSortKey();
+        newerByKeys += keys.end() - std::upper_bound(keys.begin(), keys.end(), key);
+    }
+    const double keysLookupMs = ElapsedMs(start);
+
+    if ( newer != newerByKeys )
+    {
+        fprintf(stderr, "lookup results differ\n");
+        return 1;
+    }
+
+    printf("sorting %d versions:\n", VERSIONS_COUNT);
+    printf("  CompareVersions() on strings:  %8.1f ms\n", stringsMs);
+    printf("  ParsedVersion:                 %8.1f ms (+ %.1f ms parsing)\n", parsedMs, parseMs);
+    printf("  sort keys:                     %8.1f ms (+ %.1f ms parsing and encoding)\n", keysSortMs, keysMs);
+    printf("ranking installed version %d times:\n", LOOKUPS);
+    printf("  ParsedVersion:                 %8.1f ms\n", lookupMs);
+    printf("  sort keys:                     %8.1f ms\n", keysLookupMs);
+
+    return 0;
+}
@@ -0,0 +1,172 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *  Copyright (C) 2007 Andy Matuschak
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef _version_reference_h_
+#define _version_reference_h_
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+/*
+    The original implementation of UpdateChecker::CompareVersions(), before
+    ParsedVersion, which splits versions into a vector of strings and uses
+    atoi() for every comparison. ParsedVersion is tested and benchmarked
+    against it.
+ */
+
+namespace winsparkle
+{
+namespace test
+{
+
+enum CharType
+{
+    Type_Number,
+    Type_Period,
+    Type_String
+};
+
+inline CharType ClassifyChar(char c)
+{
+    if ( c == '.' )
+        return Type_Period;
+    else if ( c >= '0' && c <= '9' )
+        return Type_Number;
+    else
+        return Type_String;
+}
+
+inline std::vector<std::string> SplitVersionString(const std::string& version)
+{
+    std::vector<std::string> list;
+
+    if ( version.empty() )
+        return list;
+
+    std::string s;
+    const size_t len = version.length();
+
+    s = version[0];
+    CharType prevType = ClassifyChar(version[0]);
+
+    for ( size_t i = 1; i < len; i++ )
+    {
+        const char c = version[i];
+        const CharType newType = ClassifyChar(c);
+
+        if ( prevType != newType || prevType == Type_Period )
+        {
+            list.push_back(s);
+            s = c;
+        }
+        else
+        {
+            s += c;
+        }
+
+        prevType = newType;
+    }
+
+    list.push_back(s);
+
+    return list;
+}
+
+inline int ReferenceCompareVersions(const std::string& verA, const std::string& verB)
+{
+    const std::vector<std::string> partsA = SplitVersionString(verA);
+    const std::vector<std::string> partsB = SplitVersionString(verB);
+
+    const size_t n = std::min(partsA.size(), partsB.size());
+    for ( size_t i = 0; i < n; i++ )
+    {
+        const std::string& a = partsA[i];
+        const std::string& b = partsB[i];
+
+        const CharType typeA = ClassifyChar(a[0]);
+        const CharType typeB = ClassifyChar(b[0]);
+
+        if ( typeA == typeB )
+        {
+            if ( typeA == Type_String )
+            {
+                int result = a.compare(b);
+                if ( result != 0 )
+                    return result;
+            }
+            else if ( typeA == Type_Number )
+            {
+                const int intA = atoi(a.c_str());
+                const int intB = atoi(b.c_str());
+                if ( intA > intB )
+                    return 1;
+                else if ( intA < intB )
+                    return -1;
+            }
+        }
+        else
+        {
+            if ( typeA != Type_String && typeB == Type_String )
+                return 1;
+            else if ( typeA == Type_String && typeB != Type_String )
+                return -1;
+            else
+                return (typeA == Type_Number) ? 1 : -1;
+        }
+    }
+
+    if ( partsA.size() == partsB.size() )
+        return 0;
+
+    int shorterResult, longerResult;
+    CharType missingPartType;
+
+    if ( partsA.size() > partsB.size() )
+    {
+        missingPartType = ClassifyChar(partsA[n][0]);
+        shorterResult = -1;
+        longerResult = 1;
+    }
+    else
+    {
+        missingPartType = ClassifyChar(partsB[n][0]);
+        shorterResult = 1;
+        longerResult = -1;
+    }
+
+    if ( missingPartType == Type_String )
+        return shorterResult;
+    else
+        return longerResult;
+}
+
+} // namespace test
+} // namespace winsparkle
+
+#endif // _version_reference_h_
@@ -0,0 +1,317 @@
+/*
+ *  This file is part of WinSparkle (https://winsparkle.org)
+ *
+ *  Copyright (C) 2009-2024 Vaclav Slavik
+ *  Copyright (C) 2007 Andy Matuschak
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a
+ *  copy of this software and associated documentation files (the "Software"),
+ *  to deal in the Software without restriction, including without limitation
+ *  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ *  and/or sell copies of the Software, and to permit persons to whom the
+ *  Software is furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ *  DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+// Property tests of ParsedVersion, checked against the original
+// implementation of UpdateChecker::CompareVersions().
+
+#include "version.h"
+#include "test.h"
+#include "version_reference.h"
+
+#include <cctype>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace winsparkle;
+using winsparkle::test::ReferenceCompareVersions;
+
+namespace
+{
+
+/*--------------------------------------------------------------------------*
+                                  helpers
+ *--------------------------------------------------------------------------*/
+
+int Sign(int x)
+{
+    return (x > 0) - (x < 0);
+}
+
+int Compare(const std::string& a, const std::string& b)
+{
+    return Sign(ParsedVersion(a).Compare(ParsedVersion(b)));
+}
+
+// Generates random version strings. They are mostly similar to real versions,
+// so that they often share prefixes, but include degenerate ones too.
+class VersionGenerator
+{
+public:
+    explicit VersionGenerator(unsigned seed) : m_rng(seed) {}
+
+    std::string operator()()
+    {
+        static const char *const fragments[] =
+        {
+            "0", "1", "2", "10", "007", "123456789",
+            ".", ".", ".", "..",
+            "a", "b", "beta", "rc", "RC", "-", "+", " ", "dev", "_"
+        };
+        const size_t fragmentsCount = sizeof(fragments) / sizeof(fragments[0]);
+
+        std::string s;
+        const int count = Random(0, 12);
+        for ( int i = 0; i < count; i++ )
+        {
+            const char *f = fragments[Random(0, fragmentsCount - 1)];
+            // don't create numbers that overflow int, as atoi() does
+            if ( isdigit(f[0]) && !s.empty() && isdigit(s.back()) )
+                s += '.';
+            s += f;
+        }
+        return s;
+    }
+
+    int Random(int from, int to)
+    {
+        return std::uniform_int_distribution<int>(from, to)(m_rng);
+    }
+
+private:
+    std::mt19937 m_rng;
+};
+
+
+/*--------------------------------------------------------------------------*
+                                   tests
+ *--------------------------------------------------------------------------*/
+
+void TestKnownOrder()
+{
+    // each version is smaller than the next one
+    static const char *const versions[] =
+    {
+        "", "0", "1.0a1", "1.0b1", "1.0rc1", "1.0", "1.0.1", "1.1",
+        "1.2rc1", "1.2.0", "1.5b3", "1.5", "1.5.1", "1.10", "2", "10.0"
+    };
+    const size_t count = sizeof(versions) / sizeof(versions[0]);
+
+    for ( size_t i = 0; i < count; i++ )
+    {
+        for ( size_t j = 0; j < count; j++ )
+        {
+            const int expected = Sign(int(i) - int(j));
+            if ( Compare(versions[i], versions[j]) != expected )
+            {
+                winsparkle::test::ReportFailure(__FILE__, __LINE__,
+                    std::string("order of \"") + versions[i] + "\" and \"" + versions[j] + "\"");
+            }
+        }
+    }
+
+    CHECK_EQUAL(Compare("1.0", "1.00"), 0);
+    CHECK_EQUAL(Compare("1.5", "1.5"), 0);
+}
+
+
+void TestLongVersion()
+{
+    // more components than fit inline
+    std::string a, b;
+    for ( int i = 0; i < 40; i++ )
+    {
+        a += "1.";
+        b += "1.";
+    }
+    a += "2";
+    b += "1beta";
+
+    CHECK_EQUAL(Compare(a, b), 1);
+    CHECK_EQUAL(Compare(b, a), -1);
+    CHECK_EQUAL(Compare(a, a), 0);
+    CHECK_EQUAL(ParsedVersion(a).GetString(), a);
+}
+
+
+// The result must be the same as with the original implementation.
+void TestEquivalence()
+{
+    VersionGenerator gen(1);
+
+    for ( int i = 0; i < 200000; i++ )
+    {
+        const std::string a = gen();
+        const std::string b = (i % 4) ? gen() : a + gen();
+
+        const int expected = Sign(ReferenceCompareVersions(a, b));
+        if ( Compare(a, b) != expected )
+        {
+            winsparkle::test::ReportFailure(__FILE__, __LINE__,
+                "comparison of \"" + a + "\" and \"" + b + "\" differs from reference");
+        }
+    }
+}
+
+
+void TestAntisymmetry()
+{
+    VersionGenerator gen(2);
+
+    for ( int i = 0; i < 200000; i++ )
+    {
+        const std::string a = gen();
+        const std::string b = gen();
+
+        if ( Compare(a, b) != -Compare(b, a) )
+        {
+            winsparkle::test::ReportFailure(__FILE__, __LINE__,
+                "comparison of \"" + a + "\" and \"" + b + "\" isn't antisymmetric");
+        }
+        if ( Compare(a, a) != 0 )
+        {
+            winsparkle::test::ReportFailure(__FILE__, __LINE__,
+                "\"" + a + "\" isn't equal to itself");
+        }
+    }
+}
+
+
+void TestTransitivity()
+{
+    VersionGenerator gen(3);
+
+    // a small pool of versions gives many related triples
+    std::vector<std::string> pool;
+    for ( int i = 0; i < 300; i++ )
+        pool.push_back(gen());
+
+    std::vector<ParsedVersion> parsed(pool.begin(), pool.end());
+
+    for ( size_t a = 0; a < pool.size(); a++ )
+    {
+        for ( size_t b = 0; b < pool.size(); b++ )
+        {
+            const int ab = Sign(parsed[a].Compare(parsed[b]));
+            if ( ab > 0 )
+                continue;
+
+            for ( size_t c = 0; c < pool.size(); c++ )
+            {
+                const int bc = Sign(parsed[b].Compare(parsed[c]));
+                if ( bc > 0 )
+                    continue;
+
+                // a <= b <= c implies a <= c, and a < c if either is strict
+                const int ac = Sign(parsed[a].Compare(parsed[c]));
+                if ( ac > 0 || (ac == 0 && (ab < 0 || bc < 0)) )
+                {
+                    winsparkle::test::ReportFailure(__FILE__, __LINE__,
+                        "order of \"" + pool[a] + "\", \"" + pool[b] + "\" and \"" +
+                        pool[c] + "\" isn't transitive");
+                    return;
+                }
+            }
+        }
+    }
+}
+
+
+
+// Comparing sort keys bytewise must give the same order as Compare().
+void TestSortKeys()
+{
+    // besides usual version parts, the strings include bytes that are used
+    // by the key encoding (0x00 and its escape 0xFF, tags 0x01 to 0x05) and
+    // numbers that don't fit into int
+    static const std::string fragments[] =
+    {
+        "0", "1", "2", "255", "256", "65536", "2147483647", "2147483648", "99999999999",
+        ".", ".", "..",
+        "a", "b", "rc", "-", " ",
+        std::string(1, '\0'), std::string(2, '\0'), std::string("\0\xff", 2),
+        "\x01", "\x02", "\x03", "\x04", "\x05", "\xfe", "\xff", "\xff\xff", "\xc3\xa9"
+    };
+    const size_t fragmentsCount = sizeof(fragments) / sizeof(fragments[0]);
+
+    VersionGenerator gen(4);
+    std::vector<std::string> versions;
+    for ( int i = 0; i < 3000; i++ )
+    {
+        std::string v;
+        const int count = gen.Random(0, 8);
+        for ( int j = 0; j < count; j++ )
+            v += fragments[gen.Random(0, fragmentsCount - 1)];
+        versions.push_back(v);
+    }
+
+    std::vector<ParsedVersion> parsed;
+    std::vector<std::string> keys;
+    for ( size_t i = 0; i < versions.size(); i++ )
+    {
+        parsed.push_back(ParsedVersion(versions[i]));
+        keys.push_back(parsed.back().GetSortKey());
+    }
+
+    int failures = 0;
+    for ( size_t a = 0; a < versions.size() && failures < 10; a++ )
+    {
+        for ( size_t b = 0; b < versions.size(); b++ )
+        {
+            const int expected = Sign(parsed[a].Compare(parsed[b]));
+            if ( Sign(keys[a].compare(keys[b])) != expected )
+            {
+                winsparkle::test::ReportFailure(__FILE__, __LINE__,
+                    "sort keys of \"" + versions[a] + "\" and \"" + versions[b] + "\" are misordered");
+                if ( ++failures == 10 )
+                    break;
+            }
+        }
+    }
+}
+
+
+void TestSortKeyFormat()
+{
+    // numbers are stored in as few bytes as possible
+    CHECK(ParsedVersion("1.22").GetSortKey() == std::string("\x05\x01\x01\x03\x05\x01\x16\x02", 8));
+    CHECK(ParsedVersion("").GetSortKey() == std::string("\x02", 1));
+    CHECK(ParsedVersion("0").GetSortKey() == std::string("\x05\x00\x02", 3));
+    // strings are escaped and terminated
+    CHECK(ParsedVersion(std::string("a\0b", 3)).GetSortKey() == std::string("\x01" "a\0\xff" "b\0\0\x02", 8));
+    CHECK(ParsedVersion("1.22.333").GetSortKey().size() <= 16);
+
+    CHECK(ParsedVersion("1.2rc1").GetSortKey() < ParsedVersion("1.2.0").GetSortKey());
+    CHECK(ParsedVersion("1.5").GetSortKey() > ParsedVersion("1.5b3").GetSortKey());
+    CHECK(ParsedVersion("1.0").GetSortKey() == ParsedVersion("1.00").GetSortKey());
+}
+
+} // anonymous namespace
+
+
+int main()
+{
+    TestKnownOrder();
+    TestLongVersion();
+    TestEquivalence();
+    TestAntisymmetry();
+    TestTransitivity();
+    TestSortKeys();
+    TestSortKeyFormat();
+
+    return TestResult();
+}